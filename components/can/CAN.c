@@ -39,50 +39,141 @@
 #include "esp_intr.h"
 #include "soc/dport_reg.h"
 #include <math.h>
+#include <string.h>
 
 #include "driver/gpio.h"
 
 #include "can_regdef.h"
 #include "CAN_config.h"
 
-static void CAN_read_frame();
+#include "freertos/semphr.h"
+
+#include "esp_attr.h"
+
+// Software filter, an open addressing hash set of message IDs, with the
+// frame format in bit 31
+#define CAN_SW_FILTER_BITS	6
+#define CAN_SW_FILTER_SIZE	(1 << CAN_SW_FILTER_BITS)
+#define CAN_SW_FILTER_MAX	((CAN_SW_FILTER_SIZE * 3) / 4)
+#define CAN_SW_FILTER_EMPTY	0xffffffff
+
+static DRAM_ATTR uint32_t sw_filter[CAN_SW_FILTER_SIZE];
+static volatile uint32_t sw_filter_count = 0;
+
+// TX state, 1 while a frame is in the controller's transmit buffer
+static volatile uint8_t tx_busy = 0;
+static SemaphoreHandle_t tx_idle = NULL;
+
+// Number of times the transmission was restarted after reset mode, so the
+// ISR can ignore a TX interrupt of the frame that was restarted
+static volatile uint32_t tx_restarts = 0;
+
+// Time to wait for the frame in the transmit buffer to be sent, before the
+// controller is put in reset mode, in milliseconds
+#define CAN_RESET_TX_TIMEOUT	100
+
+static portMUX_TYPE can_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static void CAN_read_frame(BaseType_t *woken);
 static void CAN_isr(void *arg_p);
 
+static inline uint32_t IRAM_ATTR CAN_sw_filter_key(uint32_t id, CAN_frame_format_t ff) {
+	return (id & 0x1fffffff) | ((uint32_t)ff << 31);
+}
+
+static inline uint32_t IRAM_ATTR CAN_sw_filter_slot(uint32_t key) {
+	return (key * 2654435761u) >> (32 - CAN_SW_FILTER_BITS);
+}
 
-static void CAN_isr(void *arg_p){
+static int IRAM_ATTR CAN_sw_filter_find(uint32_t key) {
+	uint32_t slot = CAN_sw_filter_slot(key);
+
+	while (sw_filter[slot] != CAN_SW_FILTER_EMPTY) {
+		if (sw_filter[slot] == key) {
+			return slot;
+		}
+
+		slot = (slot + 1) & (CAN_SW_FILTER_SIZE - 1);
+	}
 
+	return -1;
+}
+
+static void IRAM_ATTR CAN_isr(void *arg_p){
+
+	BaseType_t woken = pdFALSE;
+	CAN_frame_t __frame;
     uint8_t interrupt;
+    uint32_t restarts = tx_restarts;
 
     // Read interrupt status and clears flags
     interrupt = MODULE_CAN->IR.U;
 
-    // Handle TX complete interrupt
+    // Handle TX complete interrupt, write the next queued frame
     if ((interrupt & __CAN_IRQ_TX) != 0) {
-
+    	portENTER_CRITICAL_ISR(&can_spinlock);
+
+    	if (restarts == tx_restarts) {
+    		if (tx_busy) {
+    			CAN_cfg.stats.tx++;
+    		}
+
+    		if (CAN_cfg.tx_queue && (xQueueReceiveFromISR(CAN_cfg.tx_queue, &__frame, &woken) == pdTRUE)) {
+    			CAN_write_frame(&__frame);
+    		} else {
+    			tx_busy = 0;
+    			if (tx_idle) {
+    				xSemaphoreGiveFromISR(tx_idle, &woken);
+    			}
+    		}
+    	}
+
+    	portEXIT_CRITICAL_ISR(&can_spinlock);
     }
 
-    // Handle RX frame available interrupt
+    // Handle RX frame available interrupt, drain all the frames in the FIFO
     if ((interrupt & __CAN_IRQ_RX) != 0) {
-        if (CAN_cfg.rx_queue == NULL)
-            return;
+    	while (MODULE_CAN->SR.B.RBS) {
+    		CAN_read_frame(&woken);
+    	}
+    }
 
-    	CAN_read_frame();
+    // Handle data overrun, frames have been lost in the FIFO
+    if ((interrupt & __CAN_IRQ_DATA_OVERRUN) != 0) {
+    	CAN_cfg.stats.rx_overrun++;
+    	MODULE_CAN->CMR.B.CDO = 1;
+    }
+
+    if ((interrupt & __CAN_IRQ_BUS_ERR) != 0) {
+    	CAN_cfg.stats.bus_errors++;
     }
 
     // Handle error interrupts.
     if ((interrupt & (__CAN_IRQ_ERR						//0x4
-                      | __CAN_IRQ_DATA_OVERRUN			//0x8
                       | __CAN_IRQ_WAKEUP				//0x10
                       | __CAN_IRQ_ERR_PASSIVE			//0x20
                       | __CAN_IRQ_ARB_LOST				//0x40
-                      | __CAN_IRQ_BUS_ERR				//0x80
 	)) != 0) {
 
+    	// On bus off the controller is in reset mode, and the frame in the
+    	// transmit buffer won't be sent, so don't let writers wait for it
+    	if (MODULE_CAN->SR.B.BS) {
+        	portENTER_CRITICAL_ISR(&can_spinlock);
+    		tx_busy = 0;
+    		if (tx_idle) {
+    			xSemaphoreGiveFromISR(tx_idle, &woken);
+    		}
+        	portEXIT_CRITICAL_ISR(&can_spinlock);
+    	}
+    }
+
+    if (woken == pdTRUE) {
+    	portYIELD_FROM_ISR();
     }
 }
 
 
-static void CAN_read_frame(){
+static void IRAM_ATTR CAN_read_frame(BaseType_t *woken){
 
 	//byte iterator
 	uint8_t __byte_i;
@@ -90,46 +181,92 @@ static void CAN_read_frame(){
 	//frame read buffer
 	CAN_frame_t __frame;
 
-    //only handle standard frames, for extended format frames, FF is 0.
-    if(MODULE_CAN->MBX_CTRL.FCTRL.FIR.B.FF==1){
-        // Let the hardware know the frame has been read.
-        MODULE_CAN->CMR.B.RRB=1;
-    	return;
-    }
+	//pass the frame if software filter is empty or has the message ID
+	int __pass;
 
-    //Get Message ID
-    __frame.MsgID = (((uint32_t)MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[0] << 3) | (MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[1]>>5));
+	//get FIR
+	__frame.FIR.U = MODULE_CAN->MBX_CTRL.FCTRL.FIR.U;
 
-    //get DLC
-    __frame.DLC = MODULE_CAN->MBX_CTRL.FCTRL.FIR.B.DLC;
+	//DLC above 8 means 8 data bytes
+	if (__frame.FIR.B.DLC > 8) {
+		__frame.FIR.B.DLC = 8;
+	}
 
-    //deep copy data bytes
-    for(__byte_i=0;__byte_i<__frame.DLC;__byte_i++)
-    	__frame.data.u8[__byte_i]=MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.data[__byte_i];
+    if (__frame.FIR.B.FF == CAN_frame_std) {
+        //Get Message ID
+        __frame.MsgID = (((uint32_t)MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[0] << 3) | (MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[1]>>5));
+
+        //deep copy data bytes
+        if (__frame.FIR.B.RTR == CAN_no_RTR) {
+			for(__byte_i=0;__byte_i<__frame.FIR.B.DLC;__byte_i++)
+				__frame.data.u8[__byte_i]=MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.data[__byte_i];
+        }
+    } else {
+        //Get Message ID
+        __frame.MsgID = (((uint32_t)MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[0] << 21) |
+        		         ((uint32_t)MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[1] << 13) |
+        		         ((uint32_t)MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[2] << 5) |
+        		         (MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[3] >> 3));
+
+        //deep copy data bytes
+        if (__frame.FIR.B.RTR == CAN_no_RTR) {
+			for(__byte_i=0;__byte_i<__frame.FIR.B.DLC;__byte_i++)
+				__frame.data.u8[__byte_i]=MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.data[__byte_i];
+        }
+    }
 
     // Let the hardware know the frame has been read.
     MODULE_CAN->CMR.B.RRB=1;
 
+    if (CAN_cfg.rx_queue == NULL)
+        return;
+
+    //apply software filter
+    portENTER_CRITICAL_ISR(&can_spinlock);
+    __pass = (sw_filter_count == 0) || (CAN_sw_filter_find(CAN_sw_filter_key(__frame.MsgID, __frame.FIR.B.FF)) >= 0);
+    portEXIT_CRITICAL_ISR(&can_spinlock);
+
+    if (!__pass) {
+    	CAN_cfg.stats.rx_filtered++;
+    	return;
+    }
+
     //send frame to input queue
-    xQueueSendFromISR(CAN_cfg.rx_queue,&__frame,0);
+    if (xQueueSendFromISR(CAN_cfg.rx_queue,&__frame,woken) == pdTRUE) {
+    	CAN_cfg.stats.rx++;
+    } else {
+    	CAN_cfg.stats.rx_dropped++;
+    }
 }
 
 
-int CAN_write_frame(const CAN_frame_t* p_frame){
+int IRAM_ATTR CAN_write_frame(const CAN_frame_t* p_frame){
 
 	//byte iterator
 	uint8_t __byte_i;
 
-	//set frame format to standard and no RTR (needs to be done in a single write)
-	MODULE_CAN->MBX_CTRL.FCTRL.FIR.U=p_frame->DLC;
-
-	//Write message ID
-	MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[0] = ((p_frame->MsgID) >> 3);
-	MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[1] = ((p_frame->MsgID) << 5);
-
-    // Copy the frame data to the hardware
-    for(__byte_i=0;__byte_i<p_frame->DLC;__byte_i++)
-    	MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.data[__byte_i]=p_frame->data.u8[__byte_i];
+	//set frame format, RTR and DLC (needs to be done in a single write)
+	MODULE_CAN->MBX_CTRL.FCTRL.FIR.U=p_frame->FIR.U;
+
+	if (p_frame->FIR.B.FF == CAN_frame_std) {
+		//Write message ID
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[0] = ((p_frame->MsgID) >> 3);
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.ID[1] = ((p_frame->MsgID) << 5);
+
+	    // Copy the frame data to the hardware
+	    for(__byte_i=0;__byte_i<p_frame->FIR.B.DLC;__byte_i++)
+	    	MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.STD.data[__byte_i]=p_frame->data.u8[__byte_i];
+	} else {
+		//Write message ID
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[0] = ((p_frame->MsgID) >> 21);
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[1] = ((p_frame->MsgID) >> 13);
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[2] = ((p_frame->MsgID) >> 5);
+		MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.ID[3] = ((p_frame->MsgID) << 3);
+
+	    // Copy the frame data to the hardware
+	    for(__byte_i=0;__byte_i<p_frame->FIR.B.DLC;__byte_i++)
+	    	MODULE_CAN->MBX_CTRL.FCTRL.TX_RX.EXT.data[__byte_i]=p_frame->data.u8[__byte_i];
+	}
 
     // Transmit frame
     MODULE_CAN->CMR.B.TR=1;
@@ -137,7 +274,184 @@ int CAN_write_frame(const CAN_frame_t* p_frame){
     return 0;
 }
 
+int CAN_send_frame(const CAN_frame_t* p_frame, TickType_t timeout){
+
+	CAN_frame_t __frame;
+
+	// Controller is idle, write the frame now
+	portENTER_CRITICAL(&can_spinlock);
+	if (!tx_busy) {
+		tx_busy = 1;
+		CAN_write_frame(p_frame);
+		portEXIT_CRITICAL(&can_spinlock);
+
+		return 0;
+	}
+	portEXIT_CRITICAL(&can_spinlock);
+
+	// Controller is busy, queue the frame for the TX interrupt
+	if (xQueueSend(CAN_cfg.tx_queue, p_frame, timeout) != pdTRUE) {
+		return -1;
+	}
+
+	// The last TX interrupt can happen before the frame is queued, in this
+	// case the controller is idle, and nobody will take the frame
+	portENTER_CRITICAL(&can_spinlock);
+	if (!tx_busy && (xQueueReceive(CAN_cfg.tx_queue, &__frame, 0) == pdTRUE)) {
+		tx_busy = 1;
+		CAN_write_frame(&__frame);
+	}
+	portEXIT_CRITICAL(&can_spinlock);
+
+	return 0;
+}
+
+int CAN_wait_tx(TickType_t timeout){
 
+	TickType_t start = xTaskGetTickCount();
+	TickType_t elapsed;
+
+	while (tx_busy) {
+		elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= timeout) {
+			return -1;
+		}
+
+		xSemaphoreTake(tx_idle, timeout - elapsed);
+	}
+
+	return 0;
+}
+
+int CAN_config_filter(const CAN_filter_t* p_filter){
+
+	//byte iterator
+	uint8_t __byte_i;
+
+	uint32_t __rm;
+	uint8_t __aborted;
+	CAN_frame_t __frame;
+
+	//reset mode aborts the transmission, so let the current frame be sent
+	//first. It can't be sent if there is no other node to acknowledge it,
+	//so don't wait forever.
+	CAN_wait_tx(CAN_RESET_TX_TIMEOUT / portTICK_PERIOD_MS);
+
+	portENTER_CRITICAL(&can_spinlock);
+
+	//filter can only be changed in reset mode
+	__rm = MODULE_CAN->MOD.B.RM;
+	__aborted = tx_busy && !__rm;
+
+	if (__aborted) {
+		//the frame can be sent, and its TX interrupt pending, but it's
+		//handled here
+		if (MODULE_CAN->SR.B.TCS) {
+			CAN_cfg.stats.tx++;
+		}
+
+		tx_restarts++;
+	}
+
+	MODULE_CAN->MOD.B.RM = 1;
+
+	MODULE_CAN->MOD.B.AFM = p_filter->FM;
+
+	for(__byte_i=0;__byte_i<4;__byte_i++) {
+		MODULE_CAN->MBX_CTRL.ACC.CODE[__byte_i] = p_filter->ACR[__byte_i];
+		MODULE_CAN->MBX_CTRL.ACC.MASK[__byte_i] = p_filter->AMR[__byte_i];
+	}
+
+	MODULE_CAN->MOD.B.RM = __rm;
+
+	//no TX interrupt will come for the frame that was in the transmit
+	//buffer, so restart from the TX queue
+	if (__aborted) {
+		if (CAN_cfg.tx_queue && (xQueueReceive(CAN_cfg.tx_queue, &__frame, 0) == pdTRUE)) {
+			CAN_write_frame(&__frame);
+		} else {
+			tx_busy = 0;
+			if (tx_idle) {
+				xSemaphoreGive(tx_idle);
+			}
+		}
+	}
+
+	portEXIT_CRITICAL(&can_spinlock);
+
+	return 0;
+}
+
+int CAN_add_sw_filter(uint32_t id, CAN_frame_format_t ff){
+
+	uint32_t key = CAN_sw_filter_key(id, ff);
+	uint32_t slot;
+	int ret = 0;
+
+	portENTER_CRITICAL(&can_spinlock);
+
+	if (sw_filter_count == 0) {
+		memset(sw_filter, 0xff, sizeof(sw_filter));
+	}
+
+	if (CAN_sw_filter_find(key) < 0) {
+		if (sw_filter_count < CAN_SW_FILTER_MAX) {
+			slot = CAN_sw_filter_slot(key);
+			while (sw_filter[slot] != CAN_SW_FILTER_EMPTY) {
+				slot = (slot + 1) & (CAN_SW_FILTER_SIZE - 1);
+			}
+
+			sw_filter[slot] = key;
+			sw_filter_count++;
+		} else {
+			ret = -1;
+		}
+	}
+
+	portEXIT_CRITICAL(&can_spinlock);
+
+	return ret;
+}
+
+int CAN_remove_sw_filter(uint32_t id, CAN_frame_format_t ff){
+
+	int hole, slot;
+	uint32_t home;
+
+	portENTER_CRITICAL(&can_spinlock);
+
+	if ((sw_filter_count == 0) || ((hole = CAN_sw_filter_find(CAN_sw_filter_key(id, ff))) < 0)) {
+		portEXIT_CRITICAL(&can_spinlock);
+		return -1;
+	}
+
+	// Backward shift deletion, so lookups don't need tombstones
+	slot = hole;
+	for(;;) {
+		sw_filter[hole] = CAN_SW_FILTER_EMPTY;
+
+		do {
+			slot = (slot + 1) & (CAN_SW_FILTER_SIZE - 1);
+			if (sw_filter[slot] == CAN_SW_FILTER_EMPTY) {
+				sw_filter_count--;
+				portEXIT_CRITICAL(&can_spinlock);
+				return 0;
+			}
+
+			home = CAN_sw_filter_slot(sw_filter[slot]);
+		} while (((slot - home) & (CAN_SW_FILTER_SIZE - 1)) < ((slot - hole) & (CAN_SW_FILTER_SIZE - 1)));
+
+		sw_filter[hole] = sw_filter[slot];
+		hole = slot;
+	}
+}
+
+void CAN_clear_sw_filter(void){
+
+	portENTER_CRITICAL(&can_spinlock);
+	sw_filter_count = 0;
+	portEXIT_CRITICAL(&can_spinlock);
+}
 
 int CAN_init(){
 
@@ -147,6 +461,12 @@ int CAN_init(){
 	//Bit timing
 	float __bt = 1000/CAN_cfg.speed;
 
+    //TX state
+    tx_busy = 0;
+    if (!tx_idle) {
+    	tx_idle = xSemaphoreCreateBinary();
+    }
+
     //enable module
     DPORT_SET_PERI_REG_MASK(DPORT_PERIP_CLK_EN_REG, DPORT_CAN_CLK_EN);
     DPORT_CLEAR_PERI_REG_MASK(DPORT_PERIP_RST_EN_REG, DPORT_CAN_RST);
@@ -32,16 +32,57 @@
 #include <stdint.h>
 #include "CAN_config.h"
 
+/** \brief Frame format */
+typedef enum {
+	CAN_frame_std=0,						/**< \brief Standard frame, 11 bit ID */
+	CAN_frame_ext=1							/**< \brief Extended frame, 29 bit ID */
+}CAN_frame_format_t;
+
+/** \brief Remote transmission request */
+typedef enum {
+	CAN_no_RTR=0,							/**< \brief Data frame */
+	CAN_RTR=1								/**< \brief Remote frame */
+}CAN_RTR_t;
+
+/** \brief Frame information record, same layout as the controller's FIR */
+typedef union {
+	uint32_t U;								/**< \brief Unsigned access */
+	struct {
+		unsigned int DLC:4;             		/**< \brief [3:0] DLC, Data length container */
+		unsigned int unknown_2:2;       	/**< \brief \internal unknown */
+		CAN_RTR_t RTR:1;                	/**< \brief [6:6] RTR, Remote Transmission Request */
+		CAN_frame_format_t FF:1;        	/**< \brief [7:7] Frame Format, see #CAN_frame_format_t */
+		unsigned int reserved_24:24;    	/**< \brief \internal Reserved */
+	} B;
+}CAN_FIR_t;
+
 /** \brief CAN Frame structure */
 typedef struct {
+	CAN_FIR_t			FIR;			/**< \brief Frame information record */
     uint32_t 			MsgID;     		/**< \brief Message ID */
-    uint32_t 			DLC;			/**< \brief Length */
     union {
         uint8_t u8[8];					/**< \brief Payload byte access*/
         uint32_t u32[2];				/**< \brief Payload u32 access*/
     } data;
 }CAN_frame_t;
 
+/** \brief Acceptance filter mode */
+typedef enum {
+	CAN_filter_dual=0,						/**< \brief Two short filters */
+	CAN_filter_single=1						/**< \brief One long filter */
+}CAN_filter_mode_t;
+
+/**
+ * \brief Hardware acceptance filter
+ *
+ * ACR and AMR are written as is to the controller's acceptance code and
+ * mask registers. A bit set in AMR means "don't care" for that bit.
+ */
+typedef struct {
+	CAN_filter_mode_t 	FM;				/**< \brief Filter mode */
+	uint8_t 			ACR[4];			/**< \brief Acceptance code */
+	uint8_t 			AMR[4];			/**< \brief Acceptance mask */
+}CAN_filter_t;
 
 /**
  * \brief Initialize the CAN Module
@@ -51,13 +92,65 @@ typedef struct {
 int CAN_init(void);
 
 /**
- * \brief Send a can frame
+ * \brief Write a can frame to the controller's transmit buffer
+ *
+ * The transmit buffer must be free, use CAN_send_frame instead.
  *
  * \param	p_frame	Pointer to the frame to be send, see #CAN_frame_t
  * \return  0 Frame has been written to the module
  */
 int CAN_write_frame(const CAN_frame_t* p_frame);
 
+/**
+ * \brief Send a can frame
+ *
+ * The frame is written to the controller if it's idle, or queued in the TX
+ * queue and written from the TX interrupt when the previous frames are out.
+ *
+ * \param	p_frame	Pointer to the frame to be send, see #CAN_frame_t
+ * \param	timeout	Ticks to wait for room in the TX queue
+ * \return  0 Frame has been sent or queued, -1 TX queue is full
+ */
+int CAN_send_frame(const CAN_frame_t* p_frame, TickType_t timeout);
+
+/**
+ * \brief Wait until all the queued frames have been transmitted
+ *
+ * \param	timeout	Ticks to wait
+ * \return  0 All frames transmitted, -1 timeout
+ */
+int CAN_wait_tx(TickType_t timeout);
+
+/**
+ * \brief Set the hardware acceptance filter
+ *
+ * \param	p_filter	Pointer to the filter, see #CAN_filter_t
+ * \return  0 Filter has been set
+ */
+int CAN_config_filter(const CAN_filter_t* p_filter);
+
+/**
+ * \brief Add a message ID to the software filter
+ *
+ * When the software filter has IDs, frames with other IDs are discarded in
+ * the ISR, so they don't take room in the RX queue.
+ *
+ * \return  0 ID added, -1 filter is full
+ */
+int CAN_add_sw_filter(uint32_t id, CAN_frame_format_t ff);
+
+/**
+ * \brief Remove a message ID from the software filter
+ *
+ * \return  0 ID removed, -1 ID not found
+ */
+int CAN_remove_sw_filter(uint32_t id, CAN_frame_format_t ff);
+
+/**
+ * \brief Remove all the IDs from the software filter, so all frames pass
+ */
+void CAN_clear_sw_filter(void);
+
 /**
  * \brief Stops the CAN Module
  *
@@ -45,11 +45,23 @@ typedef enum  {
 }CAN_speed_t;
 
 /** \brief CAN configuration structure */
+/** \brief CAN Node counters */
+typedef struct {
+	uint32_t 			rx;				/**< \brief Frames received and queued. */
+	uint32_t 			tx;				/**< \brief Frames transmitted. */
+	uint32_t 			rx_filtered;	/**< \brief Frames discarded by the software filter. */
+	uint32_t 			rx_dropped;		/**< \brief Frames lost because the RX queue was full. */
+	uint32_t 			rx_overrun;		/**< \brief Data overruns, frames lost in the controller's FIFO. */
+	uint32_t 			bus_errors;		/**< \brief Bus errors. */
+}CAN_stats_t;
+
 typedef struct  {
 	CAN_speed_t			speed;			/**< \brief CAN speed. */
     gpio_num_t 			tx_pin_id;		/**< \brief TX pin. */
     gpio_num_t 			rx_pin_id;		/**< \brief RX pin. */
     QueueHandle_t 		rx_queue;		/**< \brief Handler to FreeRTOS RX queue. */
+    QueueHandle_t 		tx_queue;		/**< \brief Handler to FreeRTOS TX queue. */
+    CAN_stats_t			stats;			/**< \brief Counters, updated from the ISR. */
 }CAN_device_t;
 
 /** \brief CAN configuration reference */
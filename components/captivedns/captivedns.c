@@ -50,30 +50,7 @@
 
 #define PORT           53
 
-#include "lua.h"
-#include "lualib.h"
-#include "lauxlib.h"
-
-#define DNS_QR_QUERY 0
-#define DNS_QR_RESPONSE 1
-#define DNS_OPCODE_QUERY 0
-
-struct DNSHeader
-{
-  uint16_t ID;               // identification number
-  unsigned char RD : 1;      // recursion desired
-  unsigned char TC : 1;      // truncated message
-  unsigned char AA : 1;      // authoritive answer
-  unsigned char OPCode : 4;  // message_type
-  unsigned char QR : 1;      // query/response flag
-  unsigned char RCode : 4;   // response code
-  unsigned char Z : 3;       // its z! reserved
-  unsigned char RA : 1;      // recursion available
-  uint16_t QDCount;          // number of question entries
-  uint16_t ANCount;          // number of answer entries
-  uint16_t NSCount;          // number of authority entries
-  uint16_t ARCount;          // number of resource entries
-};
+#include "captivedns.h"
 
 static tcpip_adapter_ip_info_t esp_info;
 static struct udp_pcb *captivedns_pcb;
@@ -81,6 +58,14 @@ static u8_t captivedns_pcb_refcount;
 static void captivedns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
 driver_error_t *wifi_check_error(esp_err_t error);
 
+/*
+ * Replies are built in place in a pbuf that is reused while no one else
+ * has a reference to it. lwip prepends the UDP / IP headers to the payload
+ * when sending, so the payload is restored before each reply.
+ */
+static struct pbuf *captivedns_reply_pbuf;
+static void *captivedns_reply_payload;
+
 /** Ensure captivedns PCB is allocated and bound */
 static err_t
 captivedns_inc_pcb_refcount(void)
@@ -115,58 +100,54 @@ captivedns_dec_pcb_refcount(void)
   if(captivedns_pcb_refcount == 0) {
     udp_remove(captivedns_pcb);
     captivedns_pcb = NULL;
+
+    if (captivedns_reply_pbuf) {
+      pbuf_free(captivedns_reply_pbuf);
+      captivedns_reply_pbuf = NULL;
+    }
   }
 }
 
 /**
- * In case of an incoming dns message, trigger the state machine
+ * In case of an incoming dns message, reply from the zone
  */
 static void
 captivedns_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
 {
   struct netif *netif = ip_current_input_netif();
-  struct DNSHeader* dnsHeader = (struct DNSHeader*)p->payload;
-
-  if (dnsHeader->QR == DNS_QR_QUERY && dnsHeader->OPCode == DNS_OPCODE_QUERY &&
-      /* request only contains one question */
-      ntohs(dnsHeader->QDCount) == 1 && dnsHeader->ANCount == 0 &&
-      dnsHeader->NSCount == 0 && dnsHeader->ARCount == 0
-      /* request only contains one question */
-     ) {
+  struct pbuf *p_out = captivedns_reply_pbuf;
+  int len;
 
-      dnsHeader->QR = DNS_QR_RESPONSE;
-      dnsHeader->ANCount = dnsHeader->QDCount;
-
-      struct pbuf *p_out;
-      p_out = pbuf_alloc(PBUF_TRANSPORT, p->len + 16, PBUF_RAM);
-      pbuf_take(p_out, p->payload, p->len); //cannot use tot_len here
-
-      u16_t position = p->len - 1;
-      pbuf_put_at(p_out, ++position, (uint8_t)192); // answer name is a pointer
-      pbuf_put_at(p_out, ++position, (uint8_t)12);  // pointer to offset at 0x00c
+  /* queries received in more than one pbuf are not expected */
+  if (p->len != p->tot_len) {
+    pbuf_free(p);
+    return;
+  }
 
-      pbuf_put_at(p_out, ++position, (uint8_t)0);   // 0x0001  answer is type A query (host address)
-      pbuf_put_at(p_out, ++position, (uint8_t)1);
+  if (p_out == NULL) {
+    p_out = pbuf_alloc(PBUF_TRANSPORT, CAPTIVEDNS_MSG_SIZE, PBUF_RAM);
+    if (p_out == NULL) {
+      pbuf_free(p);
+      return;
+    }
 
-      pbuf_put_at(p_out, ++position, (uint8_t)0);   // 0x0001 answer is class IN (internet address)
-      pbuf_put_at(p_out, ++position, (uint8_t)1);
+    captivedns_reply_pbuf = p_out;
+    captivedns_reply_payload = p_out->payload;
+  }
 
-      pbuf_put_at(p_out, ++position, (uint8_t)0);   // fixed TTL of zero
-      pbuf_put_at(p_out, ++position, (uint8_t)0);
-      pbuf_put_at(p_out, ++position, (uint8_t)0);
-      pbuf_put_at(p_out, ++position, (uint8_t)0);
+  p_out->payload = captivedns_reply_payload;
 
-      pbuf_put_at(p_out, ++position, (uint8_t)0);   // length of RData is 4 bytes (because, in this case, RData is IPv4)
-      pbuf_put_at(p_out, ++position, (uint8_t)4);
+  len = captivedns_reply(p->payload, p->len, p_out->payload, CAPTIVEDNS_MSG_SIZE);
+  if (len > 0) {
+    p_out->len = p_out->tot_len = len;
 
-      //esp32 ip addr
-      pbuf_put_at(p_out, ++position, (uint8_t)ip4_addr1(&esp_info.ip));
-      pbuf_put_at(p_out, ++position, (uint8_t)ip4_addr2(&esp_info.ip));
-      pbuf_put_at(p_out, ++position, (uint8_t)ip4_addr3(&esp_info.ip));
-      pbuf_put_at(p_out, ++position, (uint8_t)ip4_addr4(&esp_info.ip));
+    udp_sendto_if(captivedns_pcb, p_out, addr, port, netif);
 
-      udp_sendto_if(captivedns_pcb, p_out, addr, port, netif);
+    /* still queued somewhere, get a new one for the next reply */
+    if (p_out->ref > 1) {
       pbuf_free(p_out);
+      captivedns_reply_pbuf = NULL;
+    }
   }
 
   pbuf_free(p);
@@ -185,6 +166,9 @@ void captivedns_start() {
 	// Get WIFI IF info
 	if ((error = wifi_check_error(tcpip_adapter_get_ip_info(ESP_IF_WIFI_AP, &esp_info)))) return; //FIXME
 
+	// Names that are not in the zone are resolved to the access point
+	captivedns_zone_default((const uint8_t *)&esp_info.ip.addr);
+
 	captivedns_inc_pcb_refcount();
 }
 
@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright (c) 2017
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/*
+ * Captive DNS responder.
+ *
+ * The responder is authoritative for a zone of names, each one with an IPv4
+ * and / or an IPv6 address. A name can be a wildcard: "*.example.com"
+ * matches any name ending in ".example.com", and "*" matches any name.
+ * Exact names are matched first, and then the most specific wildcard.
+ *
+ * When the zone is empty, any name is resolved to the default address (the
+ * address of the access point), as a captive portal does.
+ */
+
+#ifndef CAPTIVEDNS_H
+#define CAPTIVEDNS_H
+
+#include <stdint.h>
+
+#define CAPTIVEDNS_MAX_ENTRIES   32   // entries in the zone
+#define CAPTIVEDNS_MAX_QUESTIONS 8    // questions in a query
+#define CAPTIVEDNS_MSG_SIZE      512  // maximum size of a message over UDP
+
+#define CAPTIVEDNS_HAS_A    (1 << 0)
+#define CAPTIVEDNS_HAS_AAAA (1 << 1)
+
+typedef struct {
+	uint32_t queries;   // received queries
+	uint32_t answered;  // replies with at least one answer
+	uint32_t nxdomain;  // replies with a NXDOMAIN
+	uint32_t cached;    // replies taken from the cache
+} captivedns_stats_t;
+
+/**
+ * @brief Add a name to the zone, or replace its addresses if the name is
+ *        already in the zone.
+ *
+ * @param name Name, case insensitive, and with an optional trailing dot. It
+ *             can start with a "*" label, to add a wildcard.
+ * @param flags CAPTIVEDNS_HAS_A and / or CAPTIVEDNS_HAS_AAAA.
+ * @param a IPv4 address, in network order, if flags has CAPTIVEDNS_HAS_A.
+ * @param aaaa IPv6 address, in network order, if flags has CAPTIVEDNS_HAS_AAAA.
+ * @param ttl Time to live of the answers, in seconds.
+ *
+ * @return 0 on success, EINVAL if the name is not valid, or there is no
+ *         address, ENOSPC if the zone is full, ENOMEM if there is not
+ *         enough memory.
+ */
+int captivedns_zone_add(const char *name, uint8_t flags, const uint8_t *a, const uint8_t *aaaa, uint32_t ttl);
+
+/**
+ * @brief Remove a name from the zone.
+ *
+ * @return 0 on success, ENOENT if the name is not in the zone.
+ */
+int captivedns_zone_remove(const char *name);
+
+/**
+ * @brief Remove all the names from the zone.
+ */
+void captivedns_zone_clear();
+
+/**
+ * @brief Set the IPv4 address that is returned for any name when the zone
+ *        is empty.
+ */
+void captivedns_zone_default(const uint8_t *a);
+
+/**
+ * @brief Build the reply of a query.
+ *
+ * @param query The query message.
+ * @param len Length of the query.
+ * @param reply Buffer for the reply, that can't be the query buffer.
+ * @param size Size of the reply buffer. If the answers don't fit, the
+ *             reply is truncated and has the TC flag set.
+ *
+ * @return Length of the reply, or 0 if the message must be ignored (it's
+ *         not a query, or it's too short).
+ */
+int captivedns_reply(const uint8_t *query, int len, uint8_t *reply, int size);
+
+void captivedns_stats(captivedns_stats_t *stats);
+
+void captivedns_start();
+void captivedns_stop();
+
+#endif /* CAPTIVEDNS_H */
@@ -0,0 +1,553 @@
+/*******************************************************************************
+ * Copyright (c) 2017
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/*
+ * Zone table and reply construction of the captive DNS responder. This part
+ * doesn't depend on lwip, it only works with DNS messages.
+ *
+ * The reply is built in the caller's buffer: the header and the questions
+ * are copied from the query, and the answers are appended, with the name
+ * of each answer compressed as a pointer to the name of its question.
+ *
+ * Captive portal clients repeat the same queries, so the last replies are
+ * kept in a small cache, indexed by the query without its id. The cache is
+ * flushed when the zone changes.
+ */
+
+#include "captivedns.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread/pthread.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_NAME_SIZE   256
+
+#define DNS_FLAG_QR     0x80
+#define DNS_FLAG_AA     0x04
+#define DNS_FLAG_TC     0x02
+#define DNS_FLAG_RD     0x01
+
+#define DNS_OPCODE(flags) (((flags) >> 3) & 0x0f)
+
+#define DNS_RCODE_NOERROR  0
+#define DNS_RCODE_FORMERR  1
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_NOTIMP   4
+
+#define DNS_TYPE_A    1
+#define DNS_TYPE_AAAA 28
+#define DNS_TYPE_ANY  255
+
+#define DNS_CLASS_IN  1
+#define DNS_CLASS_ANY 255
+
+#define CACHE_ENTRIES 4
+#define CACHE_SIZE    192  // query without id, and reply without id
+
+// The name of a wildcard entry is stored without the "*." prefix
+#define ENTRY_WILDCARD (1 << 7)
+
+typedef struct {
+	char *name;
+	uint32_t hash;
+	uint16_t len;
+	uint8_t flags;
+	uint32_t ttl;
+	uint8_t a[4];
+	uint8_t aaaa[16];
+} zone_entry_t;
+
+typedef struct {
+	uint32_t hash;
+	uint16_t klen;
+	uint16_t rlen;
+	uint8_t answered;
+	uint8_t data[CACHE_SIZE];
+} cache_entry_t;
+
+static pthread_mutex_t zone_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static zone_entry_t zone[CAPTIVEDNS_MAX_ENTRIES];
+static int zone_count = 0;
+
+// Entry used when the zone is empty
+static zone_entry_t zone_default = {.name = "", .flags = 0};
+
+static cache_entry_t cache[CACHE_ENTRIES];
+static int cache_next = 0;
+
+static captivedns_stats_t stats;
+
+// Decoded name of the question in progress, protected by zone_mtx
+static char qname[DNS_NAME_SIZE];
+
+static uint32_t hash(const void *data, int len) {
+	const uint8_t *p = (const uint8_t *)data;
+	uint32_t h = 2166136261U;
+
+	while (len--) {
+		h = (h ^ *p++) * 16777619U;
+	}
+
+	return h;
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void cache_flush() {
+	int i;
+
+	for(i = 0; i < CACHE_ENTRIES; i++) {
+		cache[i].klen = 0;
+	}
+}
+
+/*
+ * Zone
+ */
+
+// Normalize a name of the zone to lowercase, without the trailing dot, and
+// without the "*." prefix of a wildcard. Return the length, or -1 if the
+// name is not valid.
+static int zone_name(const char *name, char *out, uint8_t *wildcard) {
+	int label = 0;
+	int len = 0;
+	char c;
+
+	*wildcard = 0;
+
+	if (!strcmp(name, "*") || !strcmp(name, "*.")) {
+		*wildcard = 1;
+		*out = 0;
+		return 0;
+	}
+
+	if (!strncmp(name, "*.", 2)) {
+		*wildcard = 1;
+		name += 2;
+	}
+
+	for(; *name; name++) {
+		c = *name;
+		if (c == '.') {
+			// Empty label, or trailing dot
+			if (label == 0) return -1;
+			if (!name[1]) break;
+			label = 0;
+		} else {
+			if ((c == '*') || (c == ' ')) return -1;
+			if (++label > 63) return -1;
+			if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+		}
+
+		if (len >= DNS_NAME_SIZE - 3) return -1;
+		out[len++] = c;
+	}
+
+	if (len == 0) return -1;
+
+	out[len] = 0;
+
+	return len;
+}
+
+static zone_entry_t *zone_find(const char *name, int len, uint8_t flags) {
+	uint32_t h = hash(name, len);
+	int i;
+
+	for(i = 0; i < zone_count; i++) {
+		if ((zone[i].hash == h) && (zone[i].len == len) &&
+			((zone[i].flags & ENTRY_WILDCARD) == (flags & ENTRY_WILDCARD)) && !memcmp(zone[i].name, name, len)) {
+			return &zone[i];
+		}
+	}
+
+	return NULL;
+}
+
+// Find the entry of a name: the exact name, or else the most specific
+// wildcard
+static zone_entry_t *zone_lookup(const char *name, int len) {
+	zone_entry_t *entry;
+	int i;
+
+	if (zone_count == 0) {
+		return zone_default.flags ? &zone_default : NULL;
+	}
+
+	if ((entry = zone_find(name, len, 0))) {
+		return entry;
+	}
+
+	for(i = 0; i < len; i++) {
+		if (name[i] == '.') {
+			if ((entry = zone_find(name + i + 1, len - i - 1, ENTRY_WILDCARD))) {
+				return entry;
+			}
+		}
+	}
+
+	return zone_find("", 0, ENTRY_WILDCARD);
+}
+
+int captivedns_zone_add(const char *name, uint8_t flags, const uint8_t *a, const uint8_t *aaaa, uint32_t ttl) {
+	char norm[DNS_NAME_SIZE];
+	zone_entry_t *entry;
+	uint8_t wildcard;
+	int len;
+
+	len = zone_name(name, norm, &wildcard);
+	if ((len < 0) || !(flags & (CAPTIVEDNS_HAS_A | CAPTIVEDNS_HAS_AAAA))) {
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&zone_mtx);
+
+	entry = zone_find(norm, len, wildcard ? ENTRY_WILDCARD : 0);
+	if (!entry) {
+		if (zone_count == CAPTIVEDNS_MAX_ENTRIES) {
+			pthread_mutex_unlock(&zone_mtx);
+			return ENOSPC;
+		}
+
+		entry = &zone[zone_count];
+		entry->name = strdup(norm);
+		if (!entry->name) {
+			pthread_mutex_unlock(&zone_mtx);
+			return ENOMEM;
+		}
+
+		entry->len = len;
+		entry->hash = hash(norm, len);
+		zone_count++;
+	}
+
+	entry->flags = (flags & (CAPTIVEDNS_HAS_A | CAPTIVEDNS_HAS_AAAA)) | (wildcard ? ENTRY_WILDCARD : 0);
+	entry->ttl = ttl;
+
+	if (flags & CAPTIVEDNS_HAS_A) memcpy(entry->a, a, sizeof(entry->a));
+	if (flags & CAPTIVEDNS_HAS_AAAA) memcpy(entry->aaaa, aaaa, sizeof(entry->aaaa));
+
+	cache_flush();
+
+	pthread_mutex_unlock(&zone_mtx);
+
+	return 0;
+}
+
+int captivedns_zone_remove(const char *name) {
+	char norm[DNS_NAME_SIZE];
+	zone_entry_t *entry;
+	uint8_t wildcard;
+	int len;
+
+	len = zone_name(name, norm, &wildcard);
+	if (len < 0) {
+		return ENOENT;
+	}
+
+	pthread_mutex_lock(&zone_mtx);
+
+	entry = zone_find(norm, len, wildcard ? ENTRY_WILDCARD : 0);
+	if (!entry) {
+		pthread_mutex_unlock(&zone_mtx);
+		return ENOENT;
+	}
+
+	free(entry->name);
+	*entry = zone[--zone_count];
+
+	cache_flush();
+
+	pthread_mutex_unlock(&zone_mtx);
+
+	return 0;
+}
+
+void captivedns_zone_clear() {
+	pthread_mutex_lock(&zone_mtx);
+
+	while (zone_count > 0) {
+		free(zone[--zone_count].name);
+	}
+
+	cache_flush();
+
+	pthread_mutex_unlock(&zone_mtx);
+}
+
+void captivedns_zone_default(const uint8_t *a) {
+	pthread_mutex_lock(&zone_mtx);
+
+	memcpy(zone_default.a, a, sizeof(zone_default.a));
+	zone_default.flags = CAPTIVEDNS_HAS_A;
+	zone_default.ttl = 0;
+
+	cache_flush();
+
+	pthread_mutex_unlock(&zone_mtx);
+}
+
+void captivedns_stats(captivedns_stats_t *s) {
+	pthread_mutex_lock(&zone_mtx);
+	*s = stats;
+	pthread_mutex_unlock(&zone_mtx);
+}
+
+/*
+ * Messages
+ */
+
+// Skip the name of a question, that starts at pos, checking that it's not
+// compressed, and that it fits in the message. Return the position after
+// the name, or -1 if it's not valid.
+static int skip_name(const uint8_t *msg, int len, int pos) {
+	int total = 0;
+	uint8_t label;
+
+	for(;;) {
+		if (pos >= len) return -1;
+
+		label = msg[pos++];
+		if (label == 0) return pos;
+
+		// Compression is not expected in questions
+		if (label & 0xc0) return -1;
+
+		total += label + 1;
+		if ((total >= DNS_NAME_SIZE) || (pos + label > len)) return -1;
+
+		pos += label;
+	}
+}
+
+// Decode the name of a question, that was checked by skip_name, into
+// qname, in lowercase and without trailing dot. Return the length, or -1
+// if a label has a dot.
+static int decode_name(const uint8_t *msg, int pos) {
+	int len = 0;
+	uint8_t label;
+	char c;
+
+	while ((label = msg[pos++])) {
+		if (len > 0) qname[len++] = '.';
+
+		while (label--) {
+			c = msg[pos++];
+			if (c == '.') return -1;
+			if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+			qname[len++] = c;
+		}
+	}
+
+	qname[len] = 0;
+
+	return len;
+}
+
+static int put_answer(uint8_t *reply, int pos, int size, uint16_t name, uint16_t type, uint32_t ttl, const uint8_t *data, int dlen) {
+	if (pos + 12 + dlen > size) {
+		return -1;
+	}
+
+	put16(reply + pos, 0xc000 | name);
+	put16(reply + pos + 2, type);
+	put16(reply + pos + 4, DNS_CLASS_IN);
+	put16(reply + pos + 6, ttl >> 16);
+	put16(reply + pos + 8, ttl & 0xffff);
+	put16(reply + pos + 10, dlen);
+	memcpy(reply + pos + 12, data, dlen);
+
+	return pos + 12 + dlen;
+}
+
+static int reply_header(const uint8_t *query, uint8_t *reply, uint8_t rcode) {
+	memset(reply, 0, DNS_HEADER_SIZE);
+
+	reply[0] = query[0];
+	reply[1] = query[1];
+	reply[2] = DNS_FLAG_QR | (query[2] & 0x78) | (query[2] & DNS_FLAG_RD);
+	reply[3] = rcode;
+
+	return DNS_HEADER_SIZE;
+}
+
+int captivedns_reply(const uint8_t *query, int len, uint8_t *reply, int size) {
+	uint16_t offset[CAPTIVEDNS_MAX_QUESTIONS];
+	zone_entry_t *entry;
+	int qdcount, found, answers;
+	int i, pos, qend, rpos, res;
+	uint16_t type, class;
+	cache_entry_t *c;
+	uint8_t tc = 0;
+	uint32_t h;
+
+	if ((len < DNS_HEADER_SIZE) || (size < DNS_HEADER_SIZE) || (query[2] & DNS_FLAG_QR)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&zone_mtx);
+
+	stats.queries++;
+
+	if (DNS_OPCODE(query[2]) != 0) {
+		res = reply_header(query, reply, DNS_RCODE_NOTIMP);
+		goto exit;
+	}
+
+	// Only questions are expected, additional records (such as the EDNS
+	// ones) are ignored
+	qdcount = get16(query + 4);
+	if ((qdcount == 0) || (qdcount > CAPTIVEDNS_MAX_QUESTIONS) || get16(query + 6) || get16(query + 8)) {
+		res = reply_header(query, reply, DNS_RCODE_FORMERR);
+		goto exit;
+	}
+
+	pos = DNS_HEADER_SIZE;
+	for(i = 0; i < qdcount; i++) {
+		offset[i] = pos;
+
+		pos = skip_name(query, len, pos);
+		if ((pos < 0) || (pos + 4 > len)) {
+			res = reply_header(query, reply, DNS_RCODE_FORMERR);
+			goto exit;
+		}
+
+		pos += 4;
+	}
+
+	qend = pos;
+
+	// Cached reply
+	h = hash(query + 2, qend - 2);
+	for(i = 0; i < CACHE_ENTRIES; i++) {
+		c = &cache[i];
+		if ((c->klen == qend - 2) && (c->hash == h) && (c->rlen <= size) && !memcmp(c->data, query + 2, c->klen)) {
+			reply[0] = query[0];
+			reply[1] = query[1];
+			memcpy(reply + 2, c->data + c->klen, c->rlen - 2);
+
+			stats.cached++;
+			stats.answered += c->answered;
+			stats.nxdomain += (reply[3] == DNS_RCODE_NXDOMAIN);
+
+			res = c->rlen;
+			goto exit;
+		}
+	}
+
+	// The questions don't fit
+	if (qend > size) {
+		res = reply_header(query, reply, DNS_RCODE_NOERROR);
+		reply[2] |= DNS_FLAG_TC;
+		goto exit;
+	}
+
+	memcpy(reply, query, qend);
+	rpos = qend;
+
+	found = 0;
+	answers = 0;
+
+	for(i = 0; (i < qdcount) && !tc; i++) {
+		pos = skip_name(query, len, offset[i]);
+		type = get16(query + pos);
+		class = get16(query + pos + 2);
+
+		res = decode_name(query, offset[i]);
+		entry = (res < 0) ? NULL : zone_lookup(qname, res);
+		if (!entry) {
+			continue;
+		}
+
+		found++;
+
+		if ((class != DNS_CLASS_IN) && (class != DNS_CLASS_ANY)) {
+			continue;
+		}
+
+		if ((entry->flags & CAPTIVEDNS_HAS_A) && ((type == DNS_TYPE_A) || (type == DNS_TYPE_ANY))) {
+			res = put_answer(reply, rpos, size, offset[i], DNS_TYPE_A, entry->ttl, entry->a, 4);
+			if (res < 0) {
+				tc = 1;
+				break;
+			}
+
+			rpos = res;
+			answers++;
+		}
+
+		if ((entry->flags & CAPTIVEDNS_HAS_AAAA) && ((type == DNS_TYPE_AAAA) || (type == DNS_TYPE_ANY))) {
+			res = put_answer(reply, rpos, size, offset[i], DNS_TYPE_AAAA, entry->ttl, entry->aaaa, 16);
+			if (res < 0) {
+				tc = 1;
+				break;
+			}
+
+			rpos = res;
+			answers++;
+		}
+	}
+
+	reply[2] = DNS_FLAG_QR | DNS_FLAG_AA | (tc ? DNS_FLAG_TC : 0) | (query[2] & DNS_FLAG_RD);
+	reply[3] = found ? DNS_RCODE_NOERROR : DNS_RCODE_NXDOMAIN;
+	put16(reply + 6, answers);
+	put16(reply + 8, 0);
+	put16(reply + 10, 0);
+
+	stats.answered += (answers > 0);
+	stats.nxdomain += !found;
+
+	// Cache the reply
+	if (!tc && ((qend - 2) + (rpos - 2) <= CACHE_SIZE)) {
+		c = &cache[cache_next];
+		cache_next = (cache_next + 1) % CACHE_ENTRIES;
+
+		c->hash = h;
+		c->klen = qend - 2;
+		c->rlen = rpos;
+		c->answered = (answers > 0);
+		memcpy(c->data, query + 2, c->klen);
+		memcpy(c->data + c->klen, reply + 2, rpos - 2);
+	}
+
+	res = rpos;
+
+exit:
+	pthread_mutex_unlock(&zone_mtx);
+
+	return res;
+}
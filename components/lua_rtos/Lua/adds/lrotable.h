@@ -82,6 +82,10 @@ int luaR_isrotable(const void *p);
 LUA_API void lua_pushrotable (lua_State *L, void *p);
 const TValue *luaL_rometatable(const void *data);
 int luaH_getn_ro (void *t);
+const TValue *luaH_get_ro (const void *t, const TValue *key);
+const TValue *luaH_getint_ro (const void *t, lua_Integer key);
+const TValue *luaH_getstr_ro (const void *t, TString *key);
+const TValue *luaH_getshortstr_ro (const void *t, TString *key);
 void luaR_next(lua_State *L, void *data, TValue *key, TValue *val);
 int luaH_next_ro (lua_State *L, void *t, StkId key);
 
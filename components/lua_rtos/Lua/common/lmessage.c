@@ -0,0 +1,291 @@
+/*
+ * Lua RTOS, Lua values as messages
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lmessage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Value tags
+#define LMESSAGE_TNIL     0
+#define LMESSAGE_TFALSE   1
+#define LMESSAGE_TTRUE    2
+#define LMESSAGE_TINTEGER 3
+#define LMESSAGE_TNUMBER  4
+#define LMESSAGE_TSTRING  5
+#define LMESSAGE_TTABLE   6
+#define LMESSAGE_TEND     7
+#define LMESSAGE_TREF     8
+
+// Message being encoded
+typedef struct {
+	lmessage_t *msg;
+	size_t size;
+	const lmessage_ref_t *ref;
+	const char *bad;
+} encoder_t;
+
+static int put_bytes(encoder_t *enc, const void *data, size_t len) {
+	lmessage_t *msg;
+	size_t size;
+
+	if (enc->msg->len + len > enc->size) {
+		size = enc->size * 2;
+		while (enc->msg->len + len > size) {
+			size *= 2;
+		}
+
+		msg = realloc(enc->msg, sizeof(lmessage_t) + size);
+		if (!msg) {
+			return LMESSAGE_ERR_NOT_ENOUGH_MEMORY;
+		}
+
+		enc->msg = msg;
+		enc->size = size;
+	}
+
+	memcpy(&enc->msg->data[enc->msg->len], data, len);
+	enc->msg->len += len;
+
+	return 0;
+}
+
+static int put_tag(encoder_t *enc, uint8_t tag) {
+	return put_bytes(enc, &tag, 1);
+}
+
+static int encode(lua_State *L, int idx, encoder_t *enc, int depth) {
+	lua_Integer integer;
+	lua_Number number;
+	const char *str;
+	void **ud;
+	size_t len;
+	int res;
+
+	switch (lua_type(L, idx)) {
+		case LUA_TNIL:
+			return put_tag(enc, LMESSAGE_TNIL);
+
+		case LUA_TBOOLEAN:
+			return put_tag(enc, lua_toboolean(L, idx)?LMESSAGE_TTRUE:LMESSAGE_TFALSE);
+
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, idx)) {
+				integer = lua_tointeger(L, idx);
+				if ((res = put_tag(enc, LMESSAGE_TINTEGER))) return res;
+				return put_bytes(enc, &integer, sizeof(integer));
+			}
+
+			number = lua_tonumber(L, idx);
+			if ((res = put_tag(enc, LMESSAGE_TNUMBER))) return res;
+			return put_bytes(enc, &number, sizeof(number));
+
+		case LUA_TSTRING:
+			str = lua_tolstring(L, idx, &len);
+			if ((res = put_tag(enc, LMESSAGE_TSTRING))) return res;
+			if ((res = put_bytes(enc, &len, sizeof(len)))) return res;
+			return put_bytes(enc, str, len);
+
+		case LUA_TTABLE:
+			if ((depth >= LMESSAGE_MAX_DEPTH) || !lua_checkstack(L, 3)) {
+				enc->bad = "nested table";
+				return LMESSAGE_ERR_INVALID_VALUE;
+			}
+
+			if ((res = put_tag(enc, LMESSAGE_TTABLE))) return res;
+
+			idx = lua_absindex(L, idx);
+			lua_pushnil(L);
+			while (lua_next(L, idx)) {
+				if ((res = encode(L, -2, enc, depth + 1)) || (res = encode(L, -1, enc, depth + 1))) {
+					lua_pop(L, 2);
+					return res;
+				}
+
+				lua_pop(L, 1);
+			}
+
+			return put_tag(enc, LMESSAGE_TEND);
+
+		case LUA_TUSERDATA:
+			ud = enc->ref?(void **)luaL_testudata(L, idx, enc->ref->tname):NULL;
+			if (ud && *ud) {
+				if ((res = put_tag(enc, LMESSAGE_TREF))) return res;
+				if ((res = put_bytes(enc, ud, sizeof(*ud)))) return res;
+
+				// The message holds a reference
+				enc->ref->retain(*ud);
+				return 0;
+			}
+			break;
+	}
+
+	enc->bad = luaL_typename(L, idx);
+
+	return LMESSAGE_ERR_INVALID_VALUE;
+}
+
+int lmessage_pack(lua_State *L, int first, int n, const lmessage_ref_t *ref, lmessage_t **msg, const char **bad) {
+	encoder_t enc;
+	int res = 0;
+	int i;
+
+	enc.size = 64;
+	enc.ref = ref;
+	enc.bad = NULL;
+	enc.msg = malloc(sizeof(lmessage_t) + enc.size);
+	if (!enc.msg) {
+		return LMESSAGE_ERR_NOT_ENOUGH_MEMORY;
+	}
+
+	enc.msg->len = 0;
+
+	for(i = 0; (i < n) && !res; i++) {
+		res = encode(L, first + i, &enc, 0);
+	}
+
+	if (res) {
+		lmessage_free(enc.msg, ref);
+
+		if (bad) {
+			*bad = enc.bad;
+		}
+
+		return res;
+	}
+
+	*msg = enc.msg;
+
+	return 0;
+}
+
+static const uint8_t *decode(lua_State *L, const uint8_t *p, const lmessage_ref_t *ref) {
+	lua_Integer integer;
+	lua_Number number;
+	void *ptr;
+	size_t len;
+
+	luaL_checkstack(L, 3, "too many nested tables");
+
+	switch (*p++) {
+		case LMESSAGE_TNIL:   lua_pushnil(L); break;
+		case LMESSAGE_TFALSE: lua_pushboolean(L, 0); break;
+		case LMESSAGE_TTRUE:  lua_pushboolean(L, 1); break;
+
+		case LMESSAGE_TINTEGER:
+			memcpy(&integer, p, sizeof(integer));
+			lua_pushinteger(L, integer);
+			p += sizeof(integer);
+			break;
+
+		case LMESSAGE_TNUMBER:
+			memcpy(&number, p, sizeof(number));
+			lua_pushnumber(L, number);
+			p += sizeof(number);
+			break;
+
+		case LMESSAGE_TSTRING:
+			memcpy(&len, p, sizeof(len));
+			p += sizeof(len);
+			lua_pushlstring(L, (const char *)p, len);
+			p += len;
+			break;
+
+		case LMESSAGE_TTABLE:
+			lua_newtable(L);
+			while (*p != LMESSAGE_TEND) {
+				p = decode(L, p, ref);
+				p = decode(L, p, ref);
+				lua_rawset(L, -3);
+			}
+			p++;
+			break;
+
+		case LMESSAGE_TREF:
+			// The reference of the message goes to the new userdata
+			memcpy(&ptr, p, sizeof(ptr));
+			ref->push(L, ptr);
+			p += sizeof(ptr);
+			break;
+	}
+
+	return p;
+}
+
+static int push(lua_State *L, const uint8_t *data, size_t len, const lmessage_ref_t *ref) {
+	const uint8_t *p = data;
+	int n = 0;
+
+	while (p < data + len) {
+		p = decode(L, p, ref);
+		n++;
+	}
+
+	return n;
+}
+
+int lmessage_unpack(lua_State *L, lmessage_t *msg, const lmessage_ref_t *ref) {
+	int n = push(L, msg->data, msg->len, ref);
+
+	free(msg);
+
+	return n;
+}
+
+int lmessage_push(lua_State *L, const uint8_t *data, size_t len) {
+	return push(L, data, len, NULL);
+}
+
+void lmessage_free(lmessage_t *msg, const lmessage_ref_t *ref) {
+	size_t pos = 0;
+	void *ptr;
+	size_t len;
+
+	while (pos < msg->len) {
+		switch (msg->data[pos++]) {
+			case LMESSAGE_TINTEGER: pos += sizeof(lua_Integer); break;
+			case LMESSAGE_TNUMBER:  pos += sizeof(lua_Number); break;
+
+			case LMESSAGE_TSTRING:
+				memcpy(&len, &msg->data[pos], sizeof(len));
+				pos += sizeof(len) + len;
+				break;
+
+			case LMESSAGE_TREF:
+				memcpy(&ptr, &msg->data[pos], sizeof(ptr));
+				pos += sizeof(ptr);
+				ref->release(ptr);
+				break;
+		}
+	}
+
+	free(msg);
+}
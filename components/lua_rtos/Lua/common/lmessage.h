@@ -0,0 +1,88 @@
+/*
+ * Lua RTOS, Lua values as messages
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef _LUA_RTOS_LMESSAGE_H_
+#define _LUA_RTOS_LMESSAGE_H_
+
+#include "lua.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A message is a sequence of Lua values, serialized in a buffer that
+ * doesn't belong to any Lua state, so it can be passed to another thread,
+ * and pushed into another state. The receiver gets a deep copy.
+ *
+ * Nil, booleans, numbers, strings and tables of them can be serialized.
+ * Optionally, a userdata type can be passed by reference (see
+ * lmessage_ref_t), with a reference that is held by the message until the
+ * message is unpacked or freed.
+ */
+
+// Errors
+#define LMESSAGE_ERR_NOT_ENOUGH_MEMORY 1
+#define LMESSAGE_ERR_INVALID_VALUE     2
+
+// Max nesting of tables in a message (this also stops cycles)
+#define LMESSAGE_MAX_DEPTH 32
+
+typedef struct {
+	size_t len;
+	uint8_t data[];
+} lmessage_t;
+
+// Userdata type passed by reference. The userdata holds a pointer, that is
+// stored in the message.
+typedef struct {
+	const char *tname;                     // metatable name
+	void (*retain)(void *ref);             // take a reference
+	void (*release)(void *ref);            // release a reference
+	void (*push)(lua_State *L, void *ref); // push a userdata, that takes the reference
+} lmessage_ref_t;
+
+/*
+ * Serialize n values of the stack, starting at first. Returns 0 and the
+ * new message, or an error. In the case of LMESSAGE_ERR_INVALID_VALUE, bad
+ * is the type name of the value that can't be serialized.
+ */
+int lmessage_pack(lua_State *L, int first, int n, const lmessage_ref_t *ref, lmessage_t **msg, const char **bad);
+
+// Push the values of a message, and free it. Returns the number of values.
+int lmessage_unpack(lua_State *L, lmessage_t *msg, const lmessage_ref_t *ref);
+
+// Push the values of a serialized buffer, that is kept. Returns the number
+// of values. Only for messages without references, as each push would take
+// the same reference.
+int lmessage_push(lua_State *L, const uint8_t *data, size_t len);
+
+// Free a message that was not unpacked
+void lmessage_free(lmessage_t *msg, const lmessage_ref_t *ref);
+
+#endif /* _LUA_RTOS_LMESSAGE_H_ */
@@ -13,6 +13,7 @@
 #include "lrotable.h"
 #include "cache.h"
 #include "lstring.h"
+#include "lvm.h"
 #include "lua.h"
 #include <string.h>
 
@@ -59,6 +60,20 @@ void luaA_pushobject(lua_State *L, const TValue *o) {
 	api_incr_top(L);
 }
 
+/* Find a string key of known length in a rotable, and return the entry */
+static const IRAM_ATTR luaR_entry *luaR_findstr(const luaR_entry *pentry, const char *k, int kl) {
+	const luaR_entry *entry = pentry;
+
+	while (entry->key.id.strkey) {
+		if ((entry->key.type == LUA_TSTRING) && (entry->key.len == kl) && (!memcmp(entry->key.id.strkey, k, kl))) {
+			return entry;
+		}
+		entry++;
+	}
+
+	return NULL;
+}
+
 /* Find an entry in a rotable and return it */
 static const IRAM_ATTR TValue *luaR_auxfind(const luaR_entry *pentry, const char *k, luaR_numkey nk, unsigned *ppos) {
 	const TValue *res = luaO_nilobject;
@@ -74,20 +89,17 @@ static const IRAM_ATTR TValue *luaR_auxfind(const luaR_entry *pentry, const char
 		}
 		#endif
 
-		int kl = strlen(k);
-
-		while (entry->key.id.strkey) {
-			if ((entry->key.type == LUA_TSTRING) && (entry->key.len == kl) && (!strncmp(entry->key.id.strkey, k, kl))) {
-				#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
-				// Put in cache
-				rotable_cache_put(pentry, entry);
-				#endif
+		entry = luaR_findstr(pentry, k, strlen(k));
+		if (entry) {
+			#if CONFIG_LUA_RTOS_LUA_USE_ROTABLE_CACHE
+			// Put in cache
+			rotable_cache_put(pentry, entry);
+			#endif
 
-				res = &entry->value;
-				break;
-			}
-			entry++;
-			i++;
+			res = &entry->value;
+			i = entry - pentry;
+		} else {
+			i = luaH_getn_ro((void *)pentry);
 		}
 	} else {
 		while (entry->key.id.strkey) {
@@ -168,6 +180,45 @@ const TValue *luaR_findentry(const void *pentry, const char *strkey,
 		return luaR_auxfind(lua_rotable, strkey, numkey, ppos);
 	}
 }
+/*
+ * Raw access functions, with the same semantics as their luaH_xxx
+ * counterparts in ltable.c. The VM calls them when the value being
+ * indexed is tagged as LUA_TROTABLE, so ordinary tables never pay for
+ * rotable support.
+ */
+const TValue *IRAM_ATTR luaH_getshortstr_ro(const void *t, TString *key) {
+	const luaR_entry *entry = luaR_findstr((const luaR_entry *)t, getstr(key), key->shrlen);
+
+	return entry ? &entry->value : luaO_nilobject;
+}
+
+const TValue *IRAM_ATTR luaH_getstr_ro(const void *t, TString *key) {
+	const luaR_entry *entry = luaR_findstr((const luaR_entry *)t, getstr(key), tsslen(key));
+
+	return entry ? &entry->value : luaO_nilobject;
+}
+
+const TValue *luaH_getint_ro(const void *t, lua_Integer key) {
+	return luaR_auxfind((const luaR_entry *)t, NULL, key, NULL);
+}
+
+const TValue *luaH_get_ro(const void *t, const TValue *key) {
+	lua_Integer k;
+
+	switch (ttype(key)) {
+		case LUA_TSHRSTR: return luaH_getshortstr_ro(t, tsvalue(key));
+		case LUA_TLNGSTR: return luaH_getstr_ro(t, tsvalue(key));
+		case LUA_TNUMINT: return luaH_getint_ro(t, ivalue(key));
+		case LUA_TNUMFLT:
+			if (luaV_tointeger(key, &k, 0)) {
+				return luaH_getint_ro(t, k);
+			}
+			return luaO_nilobject;
+		default:
+			return luaO_nilobject;
+	}
+}
+
 extern uint32_t _rodata_start;
 extern uint32_t _lit4_end;
 extern uint32_t _lua_rtos_rodata_start;
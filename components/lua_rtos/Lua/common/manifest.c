@@ -0,0 +1,226 @@
+/*
+ * Lua RTOS, precompiled bytecode manifest
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+
+#include "manifest.h"
+
+#include "lua.h"
+#include "lobject.h"
+#include "lundump.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <sys/mount.h>
+#include <sys/syslog.h>
+
+#define MANIFEST_UNCHECKED 0
+#define MANIFEST_VALID     1
+#define MANIFEST_INVALID   2
+
+typedef struct {
+	char *source;    // source path
+	char *bytecode;  // bytecode path (source path + "c")
+	uint32_t size;   // source size
+	uint8_t state;   // MANIFEST_UNCHECKED / MANIFEST_VALID / MANIFEST_INVALID
+} manifest_entry_t;
+
+static manifest_entry_t *entries = NULL;
+static int count = 0;
+static int manifest_checked = 0;
+
+/*
+ * Read the manifest, if any. Returns 0 if there is a manifest for bytecode
+ * that can be loaded by this build.
+ */
+int manifest_init() {
+	char line[PATH_MAX + 32];
+	unsigned int version, format, sint, ssize_t_, sinstr, sinteger, snumber;
+	char endian[3];
+	unsigned int size;
+	manifest_entry_t *tmp;
+	char *path;
+	size_t len;
+	int pos;
+	FILE *fp;
+
+	if (manifest_checked) {
+		return (entries ? 0 : -1);
+	}
+
+	manifest_checked = 1;
+
+	fp = fopen(MANIFEST_FILE, "r");
+	if (!fp) {
+		return -1;
+	}
+
+	// Bytecode format must match the one of this build
+	if (!fgets(line, sizeof(line), fp) ||
+		(sscanf(line, "luac %x %u %u %u %u %u %u %2s", &version, &format, &sint,
+			&ssize_t_, &sinstr, &sinteger, &snumber, endian) != 8) ||
+		(version != LUAC_VERSION) || (format != LUAC_FORMAT) ||
+		(sint != sizeof(int)) || (ssize_t_ != sizeof(size_t)) ||
+		(sinstr != sizeof(Instruction)) || (sinteger != sizeof(lua_Integer)) ||
+		(snumber != sizeof(lua_Number)) || (strcmp(endian, "le") != 0)) {
+		syslog(LOG_ERR, "manifest: bytecode in %s is not compatible, using sources", MANIFEST_FILE);
+		fclose(fp);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		len = strlen(line);
+		if ((len == 0) || (line[len - 1] != '\n')) {
+			// Too long, skip the rest of the line
+			while (fgets(line, sizeof(line), fp) && (line[strlen(line) - 1] != '\n'));
+			continue;
+		}
+
+		line[len - 1] = 0;
+
+		if ((sscanf(line, "%u %n", &size, &pos) != 1) || (line[pos] == 0)) {
+			continue;
+		}
+
+		path = line + pos;
+
+		tmp = realloc(entries, sizeof(manifest_entry_t) * (count + 1));
+		if (!tmp) {
+			break;
+		}
+		entries = tmp;
+
+		entries[count].source = strdup(path);
+		entries[count].bytecode = malloc(strlen(path) + 2);
+		if (!entries[count].source || !entries[count].bytecode) {
+			free(entries[count].source);
+			free(entries[count].bytecode);
+			break;
+		}
+
+		strcpy(entries[count].bytecode, path);
+		strcat(entries[count].bytecode, "c");
+
+		entries[count].size = size;
+		entries[count].state = MANIFEST_UNCHECKED;
+
+		count++;
+	}
+
+	fclose(fp);
+
+	if (count > 0) {
+		syslog(LOG_INFO, "manifest: %d precompiled files", count);
+	}
+
+	return 0;
+}
+
+static manifest_entry_t *manifest_find(const char *filename) {
+	manifest_entry_t *entry = NULL;
+	char *path;
+	int i;
+
+	path = mount_normalize_path(filename);
+	if (!path) {
+		return NULL;
+	}
+
+	for(i = 0; i < count; i++) {
+		if (strcmp(entries[i].source, path) == 0) {
+			entry = &entries[i];
+			break;
+		}
+	}
+
+	free(path);
+
+	return entry;
+}
+
+/*
+ * Get the bytecode file to load instead of source file 'filename'. Returns
+ * NULL if there is no bytecode for it, or the source has been changed after
+ * the bytecode was built.
+ */
+const char *manifest_bytecode(const char *filename) {
+	manifest_entry_t *entry;
+	struct stat sb;
+
+	if (count == 0) {
+		return NULL;
+	}
+
+	entry = manifest_find(filename);
+	if (!entry) {
+		return NULL;
+	}
+
+	// Checked once, later changes are reported by manifest_invalidate
+	if (entry->state == MANIFEST_UNCHECKED) {
+		if ((stat(entry->source, &sb) == 0) && (sb.st_size == entry->size) &&
+			(stat(entry->bytecode, &sb) == 0)) {
+			entry->state = MANIFEST_VALID;
+		} else {
+			entry->state = MANIFEST_INVALID;
+		}
+	}
+
+	return ((entry->state == MANIFEST_VALID) ? entry->bytecode : NULL);
+}
+
+/*
+ * Called when file 'filename' is written, renamed or removed. If it's a
+ * source with bytecode, the bytecode is removed, so it's not used after a
+ * reboot either.
+ */
+void manifest_invalidate(const char *filename) {
+	manifest_entry_t *entry;
+
+	if (count == 0) {
+		return;
+	}
+
+	entry = manifest_find(filename);
+	if (entry && (entry->state != MANIFEST_INVALID)) {
+		entry->state = MANIFEST_INVALID;
+		unlink(entry->bytecode);
+	}
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Lua RTOS, precompiled bytecode manifest
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef _LUA_RTOS_MANIFEST_H_
+#define _LUA_RTOS_MANIFEST_H_
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+
+/*
+ * When mkspiffs builds the SPIFFS image with -x, each .lua file is also
+ * written precompiled as .luac, and a manifest is written to MANIFEST_FILE.
+ *
+ * The manifest is a text file. The first line describes the bytecode
+ * format:
+ *
+ *   luac <LUAC_VERSION> <LUAC_FORMAT> <int> <size_t> <Instruction> <lua_Integer> <lua_Number> <le | be>
+ *
+ * and each following line describes a source file that has bytecode:
+ *
+ *   <source size> <source path>
+ *
+ * The path is the rest of the line, so it can have spaces.
+ *
+ * The bytecode of a source is used if the source has the size recorded in
+ * the manifest the first time it's loaded. SPIFFS keeps no modification
+ * time, so sources that are written, renamed or removed after that are
+ * reported with manifest_invalidate, that removes their bytecode.
+ */
+
+#define MANIFEST_FILE "/.manifest"
+
+int manifest_init();
+const char *manifest_bytecode(const char *filename);
+void manifest_invalidate(const char *filename);
+
+#endif
+
+#endif /* _LUA_RTOS_MANIFEST_H_ */
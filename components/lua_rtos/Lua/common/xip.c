@@ -0,0 +1,128 @@
+/*
+ * Lua RTOS, execute in place bytecode image
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+
+#include "xip.h"
+
+#include "esp_spi_flash.h"
+
+#include "lua.h"
+#include "lundump.h"
+
+#include <string.h>
+
+#include <sys/syslog.h>
+
+static const XIPHeader *image = NULL;
+static spi_flash_mmap_handle_t image_handle;
+static int image_checked = 0;
+
+/*
+ * Map the bytecode image, if any. Returns 0 if there is a valid image.
+ */
+int xip_init() {
+	const XIPHeader *header;
+	const void *ptr;
+
+	if (image_checked) {
+		return (image ? 0 : -1);
+	}
+
+	image_checked = 1;
+
+	if (spi_flash_mmap(CONFIG_LUA_RTOS_LUA_XIP_BASE_ADDR, CONFIG_LUA_RTOS_LUA_XIP_SIZE,
+			SPI_FLASH_MMAP_DATA, &ptr, &image_handle) != ESP_OK) {
+		syslog(LOG_ERR, "xip: can't map bytecode image at 0x%x", CONFIG_LUA_RTOS_LUA_XIP_BASE_ADDR);
+		return -1;
+	}
+
+	header = (const XIPHeader *)ptr;
+
+	// Flash is erased, or image is not for this Lua version
+	if ((header->magic != LUAC_XIP_MAGIC) || (header->version != LUAC_VERSION) ||
+		(header->size > CONFIG_LUA_RTOS_LUA_XIP_SIZE) ||
+		(sizeof(XIPHeader) + header->count * sizeof(XIPEntry) > header->size)) {
+		spi_flash_munmap(image_handle);
+		return -1;
+	}
+
+	image = header;
+
+	syslog(LOG_INFO, "xip: bytecode image with %d modules, %d bytes", image->count, image->size);
+
+	return 0;
+}
+
+/*
+ * Find the chunk of module 'name' in the bytecode image. Returns a pointer to
+ * the chunk in mapped flash, or NULL if there is no such module.
+ */
+const char *xip_find(const char *name, size_t *size) {
+	const XIPEntry *entry;
+	int i;
+
+	if (!image) {
+		return NULL;
+	}
+
+	entry = (const XIPEntry *)(image + 1);
+	for(i = 0; i < image->count; i++, entry++) {
+		if (strncmp(entry->name, name, LUAC_XIP_NAME) == 0) {
+			if (entry->offset + entry->size > image->size) {
+				return NULL;
+			}
+
+			*size = entry->size;
+
+			return ((const char *)image) + entry->offset;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns 1 if the 'size' bytes at 'ptr' are inside the mapped bytecode
+ * image, so they can be used for as long as the image is mapped.
+ */
+int xip_contains(const void *ptr, size_t size) {
+	const char *p = (const char *)ptr;
+	const char *start = (const char *)image;
+
+	if (!image) {
+		return 0;
+	}
+
+	return (p >= start) && (size <= image->size) && ((size_t)(p - start) <= image->size - size);
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Lua RTOS, execute in place bytecode image
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef _LUA_RTOS_XIP_H_
+#define _LUA_RTOS_XIP_H_
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+
+#include <stddef.h>
+
+/*
+ * A bytecode image is built on the host with luac -x (see lundump.h for
+ * the format), and written to flash at CONFIG_LUA_RTOS_LUA_XIP_BASE_ADDR.
+ * The image is mapped in the data address space, so the code of the
+ * modules loaded from it is executed from flash, and not copied to RAM.
+ */
+
+int xip_init();
+const char *xip_find(const char *name, size_t *size);
+int xip_contains(const void *ptr, size_t size);
+
+#endif
+
+#endif /* _LUA_RTOS_XIP_H_ */
@@ -40,6 +40,7 @@
 #include "modules.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <drivers/adc.h>
@@ -88,6 +89,102 @@ static int ladc_read( lua_State* L ) {
     }
 }
 
+static int ladc_stream( lua_State* L ) {
+	driver_error_t *error;
+    adc_userdata *adc = NULL;
+
+    adc = (adc_userdata *)luaL_checkudata(L, 1, "adc.chan");
+    luaL_argcheck(L, adc, 1, "adc expected");
+
+    uint32_t rate = luaL_checkinteger( L, 2 );
+    int decimation = luaL_optinteger( L, 3, 1 );
+    int size = luaL_optinteger( L, 4, 1024 );
+
+    luaL_argcheck(L, (decimation > 0) && (decimation <= 0xffff), 3, "invalid decimation");
+    luaL_argcheck(L, size > 0, 4, "invalid size");
+
+    adc_stream_userdata *udata = (adc_stream_userdata *)lua_newuserdata(L, sizeof(adc_stream_userdata));
+
+    udata->stream = NULL;
+
+    if ((error = adc_stream_start(adc->adc, adc->chan, rate, decimation, size, &udata->stream))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    luaL_getmetatable(L, "adc.stream");
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+// Read a block of samples, as a string of 16-bit little endian values, or as
+// an array if third argument is true
+static int ladc_stream_read( lua_State* L ) {
+	adc_stream_userdata *udata;
+	uint32_t count, i;
+	uint16_t *buffer;
+
+    udata = (adc_stream_userdata *)luaL_checkudata(L, 1, "adc.stream");
+    luaL_argcheck(L, udata && udata->stream, 1, "adc stream expected");
+
+    count = luaL_checkinteger( L, 2 );
+    uint32_t timeout = luaL_optinteger( L, 3, 1000 );
+    int table = lua_toboolean( L, 4 );
+
+    if (count > udata->stream->size) {
+    	count = udata->stream->size;
+    }
+
+    if (!(buffer = (uint16_t *)malloc(count * sizeof(uint16_t)))) {
+    	return luaL_exception(L, ADC_ERR_NOT_ENOUGH_MEMORY);
+    }
+
+    count = adc_stream_read(udata->stream, buffer, count, timeout);
+
+    if (table) {
+    	lua_createtable(L, count, 0);
+    	for(i = 0;i < count;i++) {
+    		lua_pushinteger(L, buffer[i]);
+    		lua_rawseti(L, -2, i + 1);
+    	}
+    } else {
+    	lua_pushlstring(L, (const char *)buffer, count * sizeof(uint16_t));
+    }
+
+    free(buffer);
+
+    return 1;
+}
+
+static int ladc_stream_stats( lua_State* L ) {
+	adc_stream_userdata *udata;
+	uint32_t samples, dropped;
+	double rate;
+
+    udata = (adc_stream_userdata *)luaL_checkudata(L, 1, "adc.stream");
+    luaL_argcheck(L, udata && udata->stream, 1, "adc stream expected");
+
+    adc_stream_stats(udata->stream, &rate, &samples, &dropped);
+
+    lua_pushnumber(L, rate);
+    lua_pushinteger(L, samples);
+    lua_pushinteger(L, dropped);
+
+    return 3;
+}
+
+static int ladc_stream_stop( lua_State* L ) {
+	adc_stream_userdata *udata;
+
+    udata = (adc_stream_userdata *)luaL_checkudata(L, 1, "adc.stream");
+    if (udata && udata->stream) {
+    	adc_stream_stop(udata->stream);
+    	udata->stream = NULL;
+    }
+
+    return 0;
+}
+
 static const LUA_REG_TYPE ladc_map[] = {
     { LSTRKEY( "setup" ),		  LFUNCVAL( ladc_setup   ) },
     { LSTRKEY( "attach" ),		  LFUNCVAL( ladc_setup   ) },
@@ -109,13 +206,25 @@ static const LUA_REG_TYPE ladc_map[] = {
 
 static const LUA_REG_TYPE ladc_chan_map[] = {
   	{ LSTRKEY( "read"        ),	  LFUNCVAL( ladc_read          ) },
+  	{ LSTRKEY( "stream"      ),	  LFUNCVAL( ladc_stream        ) },
     { LSTRKEY( "__metatable" ),	  LROVAL  ( ladc_chan_map      ) },
 	{ LSTRKEY( "__index"     ),   LROVAL  ( ladc_chan_map      ) },
 	{ LNILKEY, LNILVAL }
 };
 
+static const LUA_REG_TYPE ladc_stream_map[] = {
+  	{ LSTRKEY( "read"        ),	  LFUNCVAL( ladc_stream_read   ) },
+  	{ LSTRKEY( "stats"       ),	  LFUNCVAL( ladc_stream_stats  ) },
+  	{ LSTRKEY( "stop"        ),	  LFUNCVAL( ladc_stream_stop   ) },
+    { LSTRKEY( "__metatable" ),	  LROVAL  ( ladc_stream_map    ) },
+	{ LSTRKEY( "__index"     ),   LROVAL  ( ladc_stream_map    ) },
+	{ LSTRKEY( "__gc"        ),   LROVAL  ( ladc_stream_stop   ) },
+	{ LNILKEY, LNILVAL }
+};
+
 LUALIB_API int luaopen_adc( lua_State *L ) {
     luaL_newmetarotable(L,"adc.chan", (void *)ladc_chan_map);
+    luaL_newmetarotable(L,"adc.stream", (void *)ladc_stream_map);
     return 0;
 }
 
@@ -38,6 +38,10 @@ typedef struct {
     unsigned int chan;
 } adc_userdata;
 
+typedef struct {
+	adc_stream_t *stream;
+} adc_stream_userdata;
+
 #ifdef CPU_ADC0
 #define ADC_ADC0 {LSTRKEY(CPU_ADC0_NAME), LINTVAL(CPU_ADC0)},
 #else
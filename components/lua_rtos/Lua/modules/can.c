@@ -40,10 +40,14 @@
 #include "modules.h"
 
 #include <signal.h>
+#include <string.h>
 
 #include <drivers/can.h>
 #include <drivers/cpu.h>
 
+// Size of a frame record returned by can.recvmany
+#define LCAN_RECORD_SIZE 14
+
 extern LUA_REG_TYPE can_error_map[];
 
 static int dump_stop = 0;
@@ -68,7 +72,10 @@ static int lcan_send(lua_State* L) {
 	int msg_id = luaL_checkinteger(L, 2);
 	int msg_id_type = luaL_checkinteger(L, 3);
 	int len = luaL_checkinteger(L, 4);
-	const char *data = luaL_checkstring(L, 5);
+	size_t size;
+	const char *data = luaL_checklstring(L, 5, &size);
+
+	luaL_argcheck(L, (len >= 0) && (len <= size), 4, "invalid length");
 
     if ((error = can_tx(id, msg_id, msg_id_type, (uint8_t *)data, len))) {
     	return luaL_driver_error(L, error);
@@ -135,38 +142,162 @@ static int lcan_dump(lua_State* L) {
 	return 0;
 }
 
-#if 0
+/*
+ * Receive up to n frames, waiting up to timeout msecs for the first one, and
+ * taking the next ones only if they are already queued. Returns the frames
+ * packed in a string, with a record per frame, and the number of frames.
+ *
+ * Record format is "<I4BBc8", as in string.unpack: message id, frame type,
+ * length and data (zero padded).
+ */
+static int lcan_recvmany(lua_State* L) {
+	driver_error_t *error;
+	CAN_frame_t frames[CAN_RX_QUEUE_SIZE];
+	char record[LCAN_RECORD_SIZE];
+	luaL_Buffer b;
+	int count, i;
+
+	int id = luaL_checkinteger(L, 1);
+	int n = luaL_checkinteger(L, 2);
+	uint32_t timeout = luaL_optinteger(L, 3, 0xffffffff);
+
+	luaL_argcheck(L, n > 0, 2, "must be greater than 0");
+
+	// More frames than the queue can hold are never available at once
+	if (n > CAN_RX_QUEUE_SIZE) {
+		n = CAN_RX_QUEUE_SIZE;
+	}
+
+    if ((error = can_rx_frames(id, frames, n, timeout, &count))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    luaL_buffinit(L, &b);
+
+    for(i = 0;i < count;i++) {
+    	memset(record, 0, sizeof(record));
+
+    	record[0] = frames[i].MsgID & 0xff;
+    	record[1] = (frames[i].MsgID >> 8) & 0xff;
+    	record[2] = (frames[i].MsgID >> 16) & 0xff;
+    	record[3] = (frames[i].MsgID >> 24) & 0xff;
+    	record[4] = frames[i].FIR.B.FF;
+    	record[5] = frames[i].FIR.B.DLC;
+
+    	if (frames[i].FIR.B.RTR == CAN_no_RTR) {
+    		memcpy(&record[6], frames[i].data.u8, frames[i].FIR.B.DLC);
+    	}
+
+    	luaL_addlstring(&b, record, sizeof(record));
+    }
+
+    luaL_pushresult(&b);
+	lua_pushinteger(L, count);
+
+	return 2;
+}
+
+// Wait until all the queued frames are transmitted
+static int lcan_flush(lua_State* L) {
+	driver_error_t *error;
+
+	int id = luaL_checkinteger(L, 1);
+	uint32_t timeout = luaL_optinteger(L, 2, 0xffffffff);
+
+    if ((error = can_flush(id, timeout))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+// Hardware filter, without arguments all frames are accepted
+static int lcan_filter(lua_State* L) {
+	driver_error_t *error;
+
+	int id = luaL_checkinteger(L, 1);
+	uint32_t msg_id = luaL_optinteger(L, 2, 0);
+	uint32_t mask = luaL_optinteger(L, 3, 0);
+	uint8_t msg_type = luaL_optinteger(L, 4, CAN_FRAME_STD);
+
+    if ((error = can_hw_filter(id, msg_id, mask, msg_type))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+// Software filter, once it has an id only frames with the filter ids are received
+static int lcan_addfilter(lua_State* L) {
+	driver_error_t *error;
+
+	int id = luaL_checkinteger(L, 1);
+	uint32_t msg_id = luaL_checkinteger(L, 2);
+	uint8_t msg_type = luaL_optinteger(L, 3, CAN_FRAME_STD);
+
+    if ((error = can_add_filter(id, msg_id, msg_type))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+// Without id all the software filter ids are removed
+static int lcan_removefilter(lua_State* L) {
+	driver_error_t *error;
+
+	int id = luaL_checkinteger(L, 1);
+
+	if (lua_isnoneornil(L, 2)) {
+		error = can_clear_filters(id);
+	} else {
+		error = can_remove_filter(id, luaL_checkinteger(L, 2), luaL_optinteger(L, 3, CAN_FRAME_STD));
+	}
+
+    if (error) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
 static int lcan_stats(lua_State* L) {
-	u8 len;
-	int id;
-	struct can_stats stats;
-
-	id = luaL_checkinteger(L, 1);
-	MOD_CHECK_ID(can, id);
-
-	if (platform_can_stats(id, &stats)) {
-		lua_pushinteger(L, stats.rx);
-		lua_pushinteger(L, stats.tx);
-		lua_pushinteger(L, stats.rxqueued);
-		lua_pushinteger(L, stats.rxunqueued);
-
-		return 4;
-	} else
-		return 0;
+	driver_error_t *error;
+	CAN_stats_t stats;
+
+	int id = luaL_checkinteger(L, 1);
+
+    if ((error = can_stats(id, &stats))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	lua_pushinteger(L, stats.rx);
+	lua_pushinteger(L, stats.tx);
+	lua_pushinteger(L, stats.rx_filtered);
+	lua_pushinteger(L, stats.rx_dropped);
+	lua_pushinteger(L, stats.rx_overrun);
+	lua_pushinteger(L, stats.bus_errors);
+
+	return 6;
 }
-#endif
 
 static const LUA_REG_TYPE lcan_map[] = {
     { LSTRKEY( "setup"   ),		  LFUNCVAL( lcan_setup   ) },
     { LSTRKEY( "send"    ),		  LFUNCVAL( lcan_send    ) },
     { LSTRKEY( "receive" ),		  LFUNCVAL( lcan_recv    ) },
+    { LSTRKEY( "recvmany"     ),  LFUNCVAL( lcan_recvmany     ) },
+    { LSTRKEY( "flush"        ),  LFUNCVAL( lcan_flush        ) },
+    { LSTRKEY( "filter"       ),  LFUNCVAL( lcan_filter       ) },
+    { LSTRKEY( "addfilter"    ),  LFUNCVAL( lcan_addfilter    ) },
+    { LSTRKEY( "removefilter" ),  LFUNCVAL( lcan_removefilter ) },
+    { LSTRKEY( "stats"        ),  LFUNCVAL( lcan_stats        ) },
     { LSTRKEY( "dump"    ),		  LFUNCVAL( lcan_dump    ) },
 	CAN_CAN0
 	CAN_CAN1
 	{LSTRKEY("error"), 			  LROVAL( can_error_map    )},
 
-	{LSTRKEY("STD"), LINTVAL(0)},
-	{LSTRKEY("EXT"), LINTVAL(1)},
+	{LSTRKEY("STD"), LINTVAL(CAN_FRAME_STD)},
+	{LSTRKEY("EXT"), LINTVAL(CAN_FRAME_EXT)},
 
 	{ LNILKEY, LNILVAL }
 };
@@ -197,4 +328,16 @@ end
 can.setup(can.CAN0, 1000)
 can.dump(can.CAN0)
 
+can.setup(can.CAN0, 1000)
+can.addfilter(can.CAN0, 100)
+can.addfilter(can.CAN0, 0x18fef100, can.EXT)
+while true do
+	frames, n = can.recvmany(can.CAN0, 16, 100)
+	pos = 1
+	for i = 1, n do
+		msg_id, msg_type, len, data, pos = string.unpack("<I4BBc8", frames, pos)
+		print(msg_id, msg_type, data:sub(1, len):byte(1, -1))
+	end
+end
+
  */
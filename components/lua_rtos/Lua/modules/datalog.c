@@ -0,0 +1,388 @@
+/*
+ * Lua RTOS, Lua data logger module
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_DATALOG
+
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#include "auxmods.h"
+#include "error.h"
+#include "datalog.h"
+#include "adc.h"
+#include "modules.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+#include "sensor.h"
+#endif
+
+#include <string.h>
+
+#include <drivers/datalog.h>
+
+// This variables are defined at linker time
+extern LUA_REG_TYPE datalog_error_map[];
+
+// State for datalog.read query callback
+typedef struct {
+	lua_State *L;
+	int source;
+	int n;
+	int error;
+	datalog_file_header_t *header;
+	datalog_record_t *record;
+} ldatalog_query_t;
+
+// Add the record of a query to the result table, that is the first argument
+static int ldatalog_push_record(lua_State *L) {
+	ldatalog_query_t *query = (ldatalog_query_t *)lua_touserdata(L, 2);
+	datalog_file_header_t *header = query->header;
+	datalog_record_t *record = query->record;
+
+	lua_createtable(L, 0, 3);
+
+	lua_pushnumber(L, (double)record->sec + ((double)record->msec / 1000.0));
+	lua_setfield(L, -2, "time");
+
+	if (record->source < header->sources) {
+		lua_pushlstring(L, header->name[record->source], strnlen(header->name[record->source], DATALOG_NAME_SIZE));
+		lua_setfield(L, -2, "source");
+	}
+
+	if (!record->error) {
+		lua_pushnumber(L, record->value);
+		lua_setfield(L, -2, "value");
+	}
+
+	lua_rawseti(L, 1, ++query->n);
+
+	return 0;
+}
+
+static int ldatalog_query_record(void *arg, datalog_file_header_t *header, datalog_record_t *record) {
+	ldatalog_query_t *query = (ldatalog_query_t *)arg;
+	lua_State *L = query->L;
+
+	if ((query->source >= 0) && (record->source != query->source)) {
+		return 0;
+	}
+
+	// In protected mode, so the query can close the file if there is not
+	// enough memory. The error is raised after the query.
+	query->header = header;
+	query->record = record;
+
+	lua_pushcfunction(L, ldatalog_push_record);
+	lua_pushvalue(L, -2);
+	lua_pushlightuserdata(L, query);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+		query->error = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int ldatalog_attach( lua_State* L ) {
+	driver_error_t *error;
+	datalog_t *instance;
+	int i;
+
+    const char *path = luaL_checkstring( L, 1 );
+    int period = luaL_checkinteger( L, 2 );
+    int size = luaL_optinteger( L, 3, DATALOG_RING_RECORDS );
+
+    luaL_argcheck(L, period > 0, 2, "invalid period");
+    luaL_argcheck(L, size > 0, 3, "invalid size");
+
+    if ((error = datalog_setup(path, period, size, &instance))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	// Create user data
+    datalog_userdata *udata = (datalog_userdata *)lua_newuserdata(L, sizeof(datalog_userdata));
+    if (!udata) {
+    	datalog_unsetup(instance);
+    	return luaL_exception(L, DATALOG_ERR_NOT_ENOUGH_MEMORY);
+    }
+
+    udata->instance = instance;
+    for(i = 0;i < DATALOG_MAX_SOURCES;i++) {
+    	udata->ref[i] = LUA_NOREF;
+    }
+
+    luaL_getmetatable(L, "datalog.ins");
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+static int ldatalog_sensor( lua_State* L ) {
+	datalog_userdata *udata;
+	sensor_userdata *sdata;
+	driver_error_t *error;
+	int data;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+	sdata = (sensor_userdata *)luaL_checkudata(L, 2, "sensor.ins");
+	luaL_argcheck(L, sdata, 2, "sensor expected");
+
+    const char *id = luaL_checkstring( L, 3 );
+    const char *name = luaL_optstring( L, 4, id );
+
+    // Get data index
+    for(data = 0;data < SENSOR_MAX_DATA;data++) {
+    	if (sdata->instance->sensor->data[data].id && (strcmp(sdata->instance->sensor->data[data].id, id) == 0)) {
+    		break;
+    	}
+    }
+
+    if (data == SENSOR_MAX_DATA) {
+    	return luaL_exception(L, SENSOR_ERR_NOT_FOUND);
+    }
+
+    if ((error = datalog_add_sensor(udata->instance, name, sdata->instance, data))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    // Keep a reference to sensor
+    lua_pushvalue(L, 2);
+    udata->ref[udata->instance->header.sources - 1] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	return 0;
+}
+#endif
+
+static int ldatalog_adc( lua_State* L ) {
+	datalog_userdata *udata;
+	adc_userdata *adata;
+	driver_error_t *error;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+	adata = (adc_userdata *)luaL_checkudata(L, 2, "adc.chan");
+	luaL_argcheck(L, adata, 2, "adc expected");
+
+	const char *name = luaL_optstring( L, 3, "adc" );
+
+    if ((error = datalog_add_adc(udata->instance, name, adata->adc, adata->chan))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+static int ldatalog_start( lua_State* L ) {
+	datalog_userdata *udata;
+	driver_error_t *error;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+    if ((error = datalog_start(udata->instance))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+static int ldatalog_flush( lua_State* L ) {
+	datalog_userdata *udata;
+	driver_error_t *error;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+    if ((error = datalog_flush(udata->instance))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+static int ldatalog_stop( lua_State* L ) {
+	datalog_userdata *udata;
+	driver_error_t *error;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+    if ((error = datalog_stop(udata->instance))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+static int ldatalog_stats( lua_State* L ) {
+	datalog_userdata *udata;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	luaL_argcheck(L, udata, 1, "datalog expected");
+
+	lua_pushinteger(L, udata->instance->records);
+	lua_pushinteger(L, udata->instance->dropped);
+	lua_pushinteger(L, udata->instance->blocks);
+
+	return 3;
+}
+
+// Read records in a time range from a log file, without loading the whole file
+static int ldatalog_read( lua_State* L ) {
+	datalog_file_header_t header;
+	ldatalog_query_t query;
+	driver_error_t *error;
+	FILE *fp;
+	int i;
+
+    const char *path = luaL_checkstring( L, 1 );
+    uint32_t from = luaL_optinteger( L, 2, 0 );
+    uint32_t to = luaL_optinteger( L, 3, 0xffffffff );
+    const char *source = luaL_optstring( L, 4, NULL );
+
+    query.L = L;
+    query.source = -1;
+    query.n = 0;
+    query.error = 0;
+
+    // Get source index from name
+    if (source) {
+    	if (!(fp = fopen(path, "r"))) {
+        	return luaL_exception(L, DATALOG_ERR_CANT_OPEN);
+    	}
+
+    	if (fread(&header, 1, sizeof(header), fp) != sizeof(header)) {
+    		fclose(fp);
+        	return luaL_exception(L, DATALOG_ERR_INVALID_FILE);
+    	}
+
+    	fclose(fp);
+
+    	for(i = 0;(i < header.sources) && (i < DATALOG_MAX_SOURCES);i++) {
+    		if (strncmp(header.name[i], source, DATALOG_NAME_SIZE) == 0) {
+    			query.source = i;
+    			break;
+    		}
+    	}
+
+    	if (query.source < 0) {
+    		lua_createtable(L, 0, 0);
+    		return 1;
+    	}
+    }
+
+    lua_createtable(L, 0, 0);
+
+    if ((error = datalog_query(path, from, to, ldatalog_query_record, &query))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    if (query.error) {
+    	return lua_error(L);
+    }
+
+	return 1;
+}
+
+// Destructor
+static int ldatalog_ins_gc (lua_State *L) {
+	datalog_userdata *udata = NULL;
+	int i;
+
+	udata = (datalog_userdata *)luaL_checkudata(L, 1, "datalog.ins");
+	if (udata && udata->instance) {
+		datalog_unsetup(udata->instance);
+		udata->instance = NULL;
+
+		for(i = 0;i < DATALOG_MAX_SOURCES;i++) {
+			luaL_unref(L, LUA_REGISTRYINDEX, udata->ref[i]);
+		}
+	}
+
+	return 0;
+}
+
+static const LUA_REG_TYPE ldatalog_map[] = {
+    { LSTRKEY( "attach"      ),	LFUNCVAL( ldatalog_attach   ) },
+    { LSTRKEY( "read"        ),	LFUNCVAL( ldatalog_read     ) },
+	{ LSTRKEY( "error"       ), LROVAL  ( datalog_error_map ) },
+    { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE ldatalog_ins_map[] = {
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+    { LSTRKEY( "sensor"      ),	LFUNCVAL( ldatalog_sensor   ) },
+#endif
+    { LSTRKEY( "adc"         ),	LFUNCVAL( ldatalog_adc      ) },
+    { LSTRKEY( "start"       ),	LFUNCVAL( ldatalog_start    ) },
+    { LSTRKEY( "flush"       ),	LFUNCVAL( ldatalog_flush    ) },
+    { LSTRKEY( "stop"        ),	LFUNCVAL( ldatalog_stop     ) },
+    { LSTRKEY( "stats"       ),	LFUNCVAL( ldatalog_stats    ) },
+	{ LSTRKEY( "__metatable" ), LROVAL  ( ldatalog_ins_map  ) },
+	{ LSTRKEY( "__index"     ), LROVAL  ( ldatalog_ins_map  ) },
+	{ LSTRKEY( "__gc"        ), LROVAL  ( ldatalog_ins_gc   ) },
+    { LNILKEY, LNILVAL }
+};
+
+LUALIB_API int luaopen_datalog( lua_State *L ) {
+    luaL_newmetarotable(L,"datalog.ins", (void *)ldatalog_ins_map);
+    return 0;
+}
+
+MODULE_REGISTER_MAPPED(DATALOG, datalog, ldatalog_map, luaopen_datalog);
+
+#endif
+
+/*
+
+s = sensor.attach("DS1820", pio.GPIO4, 1)
+s:sample(1000)
+
+a = adc.attach(adc.ADC1, adc.ADC_CH6, 12)
+
+log = datalog.attach("/sd/log.dat", 1000)
+log:sensor(s, "temperature", "temp")
+log:adc(a, "battery")
+log:start()
+
+...
+
+log:stop()
+
+for k,v in ipairs(datalog.read("/sd/log.dat", os.time() - 3600, os.time(), "temp")) do
+	print(v.time, v.value)
+end
+
+*/
@@ -0,0 +1,47 @@
+/*
+ * Lua RTOS, data logger wrapper
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef LDATALOG_H
+#define	LDATALOG_H
+
+#include <drivers/datalog.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_DATALOG
+
+typedef struct {
+	datalog_t *instance;
+
+	// References to source objects, so they are not collected while
+	// the logger uses them
+	int ref[DATALOG_MAX_SOURCES];
+} datalog_userdata;
+
+#endif
+
+#endif	/* LDATALOG_H */
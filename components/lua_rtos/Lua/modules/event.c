@@ -41,7 +41,9 @@
 #include "error.h"
 #include "event.h"
 #include "modules.h"
+#include "lmessage.h"
 
+#include <errno.h>
 #include <string.h>
 
 #include <sys/driver.h>
@@ -53,9 +55,20 @@ extern LUA_REG_TYPE event_error_map[];
 
 // Module errors
 
-#define EVENT_ERR_NOT_ENOUGH_MEMORY (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  0)
+#define EVENT_ERR_NOT_ENOUGH_MEMORY    (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  0)
+#define EVENT_ERR_INVALID_TOPIC        (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  1)
+#define EVENT_ERR_INVALID_QUEUE_SIZE   (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  2)
+#define EVENT_ERR_INVALID_OVERFLOW     (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  3)
+#define EVENT_ERR_CANNOT_PUBLISH       (DRIVER_EXCEPTION_BASE(EVENT_DRIVER_ID) |  4)
 
 DRIVER_REGISTER_ERROR(EVENT, event, NotEnoughtMemory, "not enough memory", EVENT_ERR_NOT_ENOUGH_MEMORY);
+DRIVER_REGISTER_ERROR(EVENT, event, InvalidTopic, "invalid topic", EVENT_ERR_INVALID_TOPIC);
+DRIVER_REGISTER_ERROR(EVENT, event, InvalidQueueSize, "invalid queue size", EVENT_ERR_INVALID_QUEUE_SIZE);
+DRIVER_REGISTER_ERROR(EVENT, event, InvalidOverflow, "invalid overflow policy", EVENT_ERR_INVALID_OVERFLOW);
+DRIVER_REGISTER_ERROR(EVENT, event, CannotPublish, "value can't be published", EVENT_ERR_CANNOT_PUBLISH);
+
+// Default size of the queue of a subscriber
+#define EVENT_DEFAULT_QUEUE_SIZE 16
 
 /*
  * Get the listener that corresponds to the current thread. If current thread has not
@@ -312,8 +325,191 @@ static int levent_ins_gc (lua_State *L) {
 	return 0;
 }
 
+/*
+ * Publish / subscribe bus
+ */
+
+// event.subscribe(filter [, queue size [, overflow]])
+static int levent_subscribe( lua_State* L ) {
+	event_sub_userdata_t *udata;
+	const char *filter;
+	int size, overflow, res;
+
+	filter = luaL_checkstring(L, 1);
+	size = luaL_optinteger(L, 2, EVENT_DEFAULT_QUEUE_SIZE);
+	overflow = luaL_optinteger(L, 3, PubSubDropOldest);
+
+	if ((size < 1) || (size > PUBSUB_MAX_QUEUE)) {
+		return luaL_exception(L, EVENT_ERR_INVALID_QUEUE_SIZE);
+	}
+
+	if ((overflow < PubSubDropOldest) || (overflow > PubSubBlock)) {
+		return luaL_exception(L, EVENT_ERR_INVALID_OVERFLOW);
+	}
+
+	udata = (event_sub_userdata_t *)lua_newuserdata(L, sizeof(event_sub_userdata_t));
+	udata->sub = NULL;
+
+	luaL_getmetatable(L, "event.sub");
+	lua_setmetatable(L, -2);
+
+	res = pubsub_subscribe(filter, size, overflow, &udata->sub);
+	if (res == EINVAL) {
+		return luaL_exception_extended(L, EVENT_ERR_INVALID_TOPIC, filter);
+	} else if (res) {
+		return luaL_exception(L, EVENT_ERR_NOT_ENOUGH_MEMORY);
+	}
+
+	return 1;
+}
+
+// event.publish(topic, ...), returns the number of subscribers that got
+// the message
+static int levent_publish( lua_State* L ) {
+	const char *topic, *bad;
+	uint32_t delivered;
+	lmessage_t *msg;
+	int res;
+
+	topic = luaL_checkstring(L, 1);
+
+	res = lmessage_pack(L, 2, lua_gettop(L) - 1, NULL, &msg, &bad);
+	if (res == LMESSAGE_ERR_NOT_ENOUGH_MEMORY) {
+		return luaL_exception(L, EVENT_ERR_NOT_ENOUGH_MEMORY);
+	} else if (res) {
+		return luaL_exception_extended(L, EVENT_ERR_CANNOT_PUBLISH, bad);
+	}
+
+	res = pubsub_publish(topic, msg->data, msg->len, &delivered);
+	lmessage_free(msg, NULL);
+
+	if (res == EINVAL) {
+		return luaL_exception_extended(L, EVENT_ERR_INVALID_TOPIC, topic);
+	} else if (res) {
+		return luaL_exception(L, EVENT_ERR_NOT_ENOUGH_MEMORY);
+	}
+
+	lua_pushinteger(L, delivered);
+
+	return 1;
+}
+
+static int levent_stats( lua_State* L ) {
+	pubsub_stats_t stats;
+
+	pubsub_stats(&stats);
+
+	lua_pushinteger(L, stats.published);
+	lua_pushinteger(L, stats.delivered);
+	lua_pushinteger(L, stats.dropped);
+
+	return 3;
+}
+
+static pubsub_sub_t *event_sub_check(lua_State *L) {
+	event_sub_userdata_t *udata;
+
+	udata = (event_sub_userdata_t *)luaL_checkudata(L, 1, "event.sub");
+	luaL_argcheck(L, udata && udata->sub, 1, "subscription expected");
+
+	return udata->sub;
+}
+
+// Push the topic and the values of a message, that is a light userdata
+static int event_msg_push( lua_State* L ) {
+	pubsub_msg_t *msg = (pubsub_msg_t *)lua_touserdata(L, 1);
+
+	lua_pushstring(L, msg->topic);
+
+	return lmessage_push(L, msg->data, msg->len) + 1;
+}
+
+// subscription:receive([timeout]), timeout in milliseconds. Returns the
+// topic and the published values, or nil on timeout.
+static int levent_sub_receive( lua_State* L ) {
+	pubsub_sub_t *sub = event_sub_check(L);
+	TickType_t ticks = portMAX_DELAY;
+	pubsub_msg_t *msg;
+	int top, status;
+
+	if (lua_gettop(L) > 1) {
+		ticks = luaL_checkinteger(L, 2) / portTICK_PERIOD_MS;
+	}
+
+	msg = pubsub_receive(sub, ticks);
+	if (!msg) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	// The values are pushed in protected mode, so the message is released
+	// if there is not enough memory
+	top = lua_gettop(L);
+
+	lua_pushcfunction(L, event_msg_push);
+	lua_pushlightuserdata(L, msg);
+	status = lua_pcall(L, 1, LUA_MULTRET, 0);
+
+	pubsub_msg_release(msg);
+
+	if (status != LUA_OK) {
+		return lua_error(L);
+	}
+
+	return lua_gettop(L) - top;
+}
+
+static int levent_sub_count( lua_State* L ) {
+	uint32_t queued;
+
+	pubsub_sub_stats(event_sub_check(L), &queued, NULL, NULL);
+
+	lua_pushinteger(L, queued);
+
+	return 1;
+}
+
+static int levent_sub_stats( lua_State* L ) {
+	uint32_t delivered, dropped;
+
+	pubsub_sub_stats(event_sub_check(L), NULL, &delivered, &dropped);
+
+	lua_pushinteger(L, delivered);
+	lua_pushinteger(L, dropped);
+
+	return 2;
+}
+
+static int levent_sub_unsubscribe( lua_State* L ) {
+	pubsub_unsubscribe(event_sub_check(L));
+
+	return 0;
+}
+
+static int levent_sub_gc (lua_State *L) {
+	event_sub_userdata_t *udata;
+
+	udata = (event_sub_userdata_t *)luaL_checkudata(L, 1, "event.sub");
+	if (udata && udata->sub) {
+		pubsub_unsubscribe(udata->sub);
+		pubsub_sub_release(udata->sub);
+		udata->sub = NULL;
+	}
+
+	return 0;
+}
+
 static const LUA_REG_TYPE levent_map[] = {
     { LSTRKEY( "create"  ),			LFUNCVAL( levent_create   ) },
+    { LSTRKEY( "subscribe" ),		LFUNCVAL( levent_subscribe ) },
+    { LSTRKEY( "publish" ),			LFUNCVAL( levent_publish  ) },
+    { LSTRKEY( "stats"   ),			LFUNCVAL( levent_stats    ) },
+
+	// Overflow policies
+    { LSTRKEY( "DROP_OLDEST" ),		LINTVAL ( PubSubDropOldest ) },
+    { LSTRKEY( "DROP_NEWEST" ),		LINTVAL ( PubSubDropNewest ) },
+    { LSTRKEY( "BLOCK"       ),		LINTVAL ( PubSubBlock      ) },
+
 	{ LSTRKEY( "error"   ), 		LROVAL  ( event_error_map )},
     { LNILKEY, LNILVAL }
 };
@@ -329,8 +525,20 @@ static const LUA_REG_TYPE levent_ins_map[] = {
     { LNILKEY, LNILVAL }
 };
 
+static const LUA_REG_TYPE levent_sub_map[] = {
+	{ LSTRKEY( "receive"     ),		LFUNCVAL( levent_sub_receive     ) },
+	{ LSTRKEY( "count"       ),		LFUNCVAL( levent_sub_count       ) },
+	{ LSTRKEY( "stats"       ),		LFUNCVAL( levent_sub_stats       ) },
+	{ LSTRKEY( "unsubscribe" ),		LFUNCVAL( levent_sub_unsubscribe ) },
+	{ LSTRKEY( "__metatable" ),    	LROVAL  ( levent_sub_map         ) },
+	{ LSTRKEY( "__index"     ),   	LROVAL  ( levent_sub_map         ) },
+	{ LSTRKEY( "__gc"        ),   	LFUNCVAL( levent_sub_gc          ) },
+    { LNILKEY, LNILVAL }
+};
+
 LUALIB_API int luaopen_event( lua_State *L ) {
     luaL_newmetarotable(L,"event.ins", (void*)levent_ins_map);
+    luaL_newmetarotable(L,"event.sub", (void*)levent_sub_map);
     return 0;
 }
 
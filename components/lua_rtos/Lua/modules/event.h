@@ -28,7 +28,8 @@
  */
 
 /*
- * This module implements basic event driven mechanism for sync threads.
+ * This module implements basic event driven mechanism for sync threads,
+ * and a publish / subscribe bus with named topics (see sys/pubsub.h).
  */
 
 #ifndef LEVENT_H
@@ -42,6 +43,8 @@
 #include <sys/mutex.h>
 #include <sys/list.h>
 
+#include <sys/pubsub.h>
+
 #include <pthread/pthread.h>
 
 typedef struct {
@@ -58,4 +61,8 @@ typedef struct {
 	xQueueHandle q;        // This is used by the listener for inform the caller that event is processed
 } event_userdata_t;
 
+typedef struct {
+	pubsub_sub_t *sub;     // Subscription to the bus
+} event_sub_userdata_t;
+
 #endif	/* LEVENT_H */
@@ -133,13 +133,21 @@ static int li2c_address( lua_State* L ) {
 static int li2c_read( lua_State* L ) {
 	driver_error_t *error;
 	i2c_user_data_t *user_data;
-	char data;
+	luaL_Buffer b;
+	char *data;
 
 	// Get user data
 	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
     luaL_argcheck(L, user_data, 1, "i2c transaction expected");
 
-    if ((error = i2c_read(user_data->unit, &user_data->transaction, &data, 1))) {
+    // Without length read one byte, and return it as an integer. With length
+    // read length bytes in one command, and return them as a string.
+    int len = luaL_optinteger(L, 2, 1);
+    luaL_argcheck(L, len > 0, 2, "must be greater than 0");
+
+    data = luaL_buffinitsize(L, &b, len);
+
+    if ((error = i2c_read(user_data->unit, &user_data->transaction, data, len))) {
     	return luaL_driver_error(L, error);
     }
 
@@ -148,24 +156,109 @@ static int li2c_read( lua_State* L ) {
     	return luaL_driver_error(L, error);
     }
 
-    lua_pushinteger(L, (int)data);
+    if (lua_isnoneornil(L, 2)) {
+    	lua_pushinteger(L, (uint8_t)data[0]);
+    } else {
+    	luaL_pushresultsize(&b, len);
+    }
 
     return 1;
 }
 
+// Get the bytes to write from the arguments, starting at index. Each
+// argument can be an integer (one byte) or a string.
+static char *li2c_checkdata(lua_State* L, int index, luaL_Buffer *b, size_t *len) {
+	int top = lua_gettop(L);
+	int i;
+
+	luaL_buffinit(L, b);
+
+	for(i = index; i <= top; i++) {
+		if (lua_type(L, i) == LUA_TSTRING) {
+			size_t l;
+			const char *s = lua_tolstring(L, i, &l);
+
+			luaL_addlstring(b, s, l);
+		} else {
+			luaL_addchar(b, (char)(luaL_checkinteger(L, i) & 0xff));
+		}
+	}
+
+	luaL_pushresult(b);
+
+	return (char *)lua_tolstring(L, -1, len);
+}
+
 static int li2c_write(lua_State* L) {
 	driver_error_t *error;
 	i2c_user_data_t *user_data;
+	luaL_Buffer b;
+	size_t len;
+	char *data;
 
 	// Get user data
 	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
     luaL_argcheck(L, user_data, 1, "i2c transaction expected");
+    luaL_checkany(L, 2);
 
-    char data = (char)(luaL_checkinteger(L, 2) & 0xff);
-    
-    esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
+    data = li2c_checkdata(L, 2, &b, &len);
+
+    if ((error = i2c_write(user_data->unit, &user_data->transaction, data, len))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int li2c_readreg(lua_State* L) {
+	driver_error_t *error;
+	i2c_user_data_t *user_data;
+	luaL_Buffer b;
+	char *data;
+
+	// Get user data
+	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
+    luaL_argcheck(L, user_data, 1, "i2c transaction expected");
+
+    int address = luaL_checkinteger(L, 2);
+    int reg = luaL_checkinteger(L, 3);
+
+    // Same as read, without length return an integer
+    int len = luaL_optinteger(L, 4, 1);
+    luaL_argcheck(L, len > 0, 4, "must be greater than 0");
+
+    data = luaL_buffinitsize(L, &b, len);
+
+    if ((error = i2c_read_reg(user_data->unit, address, reg, data, len))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    if (lua_isnoneornil(L, 4)) {
+    	lua_pushinteger(L, (uint8_t)data[0]);
+    } else {
+    	luaL_pushresultsize(&b, len);
+    }
+
+    return 1;
+}
+
+static int li2c_writereg(lua_State* L) {
+	driver_error_t *error;
+	i2c_user_data_t *user_data;
+	luaL_Buffer b;
+	size_t len;
+	char *data;
+
+	// Get user data
+	user_data = (i2c_user_data_t *)luaL_checkudata(L, 1, "i2c.trans");
+    luaL_argcheck(L, user_data, 1, "i2c transaction expected");
+
+    int address = luaL_checkinteger(L, 2);
+    int reg = luaL_checkinteger(L, 3);
+
+    data = li2c_checkdata(L, 4, &b, &len);
 
-    if ((error = i2c_write(user_data->unit, &user_data->transaction, &data, sizeof(data)))) {
+    if ((error = i2c_write_reg(user_data->unit, address, reg, data, len))) {
     	return luaL_driver_error(L, error);
     }
 
@@ -177,7 +270,9 @@ static int li2c_trans_gc (lua_State *L) {
 	i2c_user_data_t *user_data = NULL;
 
     user_data = (i2c_user_data_t *)luaL_testudata(L, 1, "i2c.trans");
-    if (user_data) {
+    if (user_data && (user_data->transaction != I2C_TRANSACTION_INITIALIZER)) {
+    	// Return the transaction to the pool
+    	i2c_release(user_data->unit, &user_data->transaction);
     }
 
     return 0;
@@ -200,6 +295,8 @@ static const LUA_REG_TYPE li2c_trans_map[] = {
     { LSTRKEY( "address"     ),		LFUNCVAL( li2c_address   ) },
     { LSTRKEY( "read"        ),		LFUNCVAL( li2c_read      ) },
     { LSTRKEY( "write"       ),		LFUNCVAL( li2c_write     ) },
+    { LSTRKEY( "readreg"     ),		LFUNCVAL( li2c_readreg   ) },
+    { LSTRKEY( "writereg"    ),		LFUNCVAL( li2c_writereg  ) },
     { LSTRKEY( "stop"        ),		LFUNCVAL( li2c_stop      ) },
     { LSTRKEY( "__metatable" ),  	LROVAL  ( li2c_trans_map ) },
 	{ LSTRKEY( "__index"     ),   	LROVAL  ( li2c_trans_map ) },
@@ -120,18 +120,14 @@ static void val_to_hex_string(char *hbuff, char *vbuff, int len) {
     }    
 }
 
-// Gets the length of an hex string coded in hbuff argument
-static int hex_string_len(char *hbuff) {
-    char c1;
-    char c2;
+// Gets the length of an hex string coded in hbuff argument, that ends at
+// the "00" terminator, or at end if the terminator is missing
+static int hex_string_len(char *hbuff, char *end) {
     int len = 0;
     
-    c1 = *hbuff++;
-    c2 = *hbuff++;
-    while ((c1 != '0') && (c2 != '0')) {
+    while ((end - hbuff >= 2) && ((hbuff[0] != '0') || (hbuff[1] != '0'))) {
         len++;
-        c1 = *hbuff++;
-        c2 = *hbuff++;        
+        hbuff += 2;
     }
     
     return len;
@@ -282,6 +278,7 @@ static int l_unpack(lua_State *L) {
     int total;                   // Number of packet values
     int i;                       // Current packet value
     char *pack;         // Packed string
+    size_t pack_len;             // Packed string length
     int data_idx;                // Current data index on pack string
     char *header;       // Header buffer
     char *cheader;      // Current position of header buffer
@@ -302,7 +299,7 @@ static int l_unpack(lua_State *L) {
     }
     
     // Get the packet string
-    pack = (char *)luaL_checkstring(L, 1);
+    pack = (char *)luaL_checklstring(L, 1, &pack_len);
 
     // Check for an optional second argument, a boolean that tell if we want
     // to unpack only first value
@@ -357,7 +354,7 @@ static int l_unpack(lua_State *L) {
                 break;
             case PACK_STRING:
                 // Get the string length
-                slen = hex_string_len(pack + data_idx);
+                slen = hex_string_len(pack + data_idx, pack + pack_len);
                 
                 // Allocate space for the string
                 luaStringVal = (char *)malloc(slen + 1);
@@ -399,10 +396,457 @@ static int l_unpack(lua_State *L) {
 
 }
 
+/*
+ * Binary codec
+ *
+ * pack.encode(fmt, v1, v2, ...) encodes the values into a binary string, as
+ * described by a format string, and pack.decode(fmt, data [, pos]) decodes
+ * them, returning the values and the position of the first unread byte.
+ * Unlike pack.pack / pack.unpack, the values are stored as raw bytes, so the
+ * encoded data has half of the size, and there is no conversion per nibble.
+ *
+ * Format options:
+ *
+ *   <  little endian          >  big endian          =  native endian
+ *   b  / B  signed / unsigned 8-bit integer
+ *   h  / H  signed / unsigned 16-bit integer
+ *   i[n] / I[n]  signed / unsigned integer of n bytes (1 to 8, default 4)
+ *   l  / L  signed / unsigned 64-bit integer
+ *   j  / J  signed / unsigned lua_Integer
+ *   f  float                  d  double              n  lua_Number
+ *   s[n]  string preceded by its length, as an unsigned integer of n bytes
+ *         (1 to 8, default 4)
+ *   z  zero-terminated string
+ *   v  / V  signed (zig-zag) / unsigned variable-length integer, 7 bits
+ *           per byte, least significant group first
+ *   x  one zero byte of padding
+ *
+ * Spaces are ignored. Encoding is done in two passes over the format: the
+ * first one checks the arguments and computes the encoded length, and the
+ * second one writes the values directly into a buffer of this length.
+ */
+#define PACK_MAX_INT_SIZE 8
+#define PACK_INT_BITS     ((int)(sizeof(lua_Integer) * 8))
+
+typedef enum {
+	PackOptInt,
+	PackOptUint,
+	PackOptFloat,
+	PackOptDouble,
+	PackOptNumber,
+	PackOptString,
+	PackOptZString,
+	PackOptVarint,
+	PackOptUvarint,
+	PackOptPadding,
+	PackOptNone
+} pack_opt_t;
+
+typedef struct {
+	lua_State *L;
+	const char *fmt;
+	int little;
+} pack_fmt_t;
+
+static int pack_native_little(void) {
+	const union {int i; char c;} u = {1};
+
+	return u.c;
+}
+
+static int pack_fmt_size(pack_fmt_t *f, int def) {
+	int size = 0;
+
+	if ((*f->fmt < '0') || (*f->fmt > '9')) {
+		return def;
+	}
+
+	while ((*f->fmt >= '0') && (*f->fmt <= '9')) {
+		size = size * 10 + (*f->fmt++ - '0');
+		if (size > PACK_MAX_INT_SIZE) break;
+	}
+
+	if ((size < 1) || (size > PACK_MAX_INT_SIZE)) {
+		luaL_error(f->L, "integral size (%d) out of limits [1,%d]", size, PACK_MAX_INT_SIZE);
+	}
+
+	return size;
+}
+
+// Get the next option of the format, and its size in bytes
+static pack_opt_t pack_fmt_next(pack_fmt_t *f, int *size) {
+	char c = *f->fmt++;
+
+	*size = 0;
+
+	switch (c) {
+		case 'b': *size = 1; return PackOptInt;
+		case 'B': *size = 1; return PackOptUint;
+		case 'h': *size = 2; return PackOptInt;
+		case 'H': *size = 2; return PackOptUint;
+		case 'i': *size = pack_fmt_size(f, 4); return PackOptInt;
+		case 'I': *size = pack_fmt_size(f, 4); return PackOptUint;
+		case 'l': *size = 8; return PackOptInt;
+		case 'L': *size = 8; return PackOptUint;
+		case 'j': *size = sizeof(lua_Integer); return PackOptInt;
+		case 'J': *size = sizeof(lua_Integer); return PackOptUint;
+		case 'f': *size = sizeof(float); return PackOptFloat;
+		case 'd': *size = sizeof(double); return PackOptDouble;
+		case 'n': *size = sizeof(lua_Number); return PackOptNumber;
+		case 's': *size = pack_fmt_size(f, 4); return PackOptString;
+		case 'z': return PackOptZString;
+		case 'v': return PackOptVarint;
+		case 'V': return PackOptUvarint;
+		case 'x': *size = 1; return PackOptPadding;
+		case '<': f->little = 1; return PackOptNone;
+		case '>': f->little = 0; return PackOptNone;
+		case '=': f->little = pack_native_little(); return PackOptNone;
+		case ' ': return PackOptNone;
+		default:
+			luaL_error(f->L, "invalid format option '%c'", c);
+			return PackOptNone;
+	}
+}
+
+static int pack_varint_len(lua_Unsigned v) {
+	int len = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		len++;
+	}
+
+	return len;
+}
+
+static lua_Unsigned pack_zigzag(lua_Integer v) {
+	return ((lua_Unsigned)v << 1) ^ (lua_Unsigned)(v < 0 ? -1 : 0);
+}
+
+// Store an integer of size bytes, extending the sign if size is greater
+// than the size of a lua_Integer
+static void pack_put_int(char *out, lua_Unsigned v, int size, int little, int neg) {
+	int i;
+
+	for(i = 0; i < size; i++) {
+		out[little ? i : size - 1 - i] = (i < (int)sizeof(lua_Unsigned)) ? (char)(v & 0xff) : (neg ? 0xff : 0);
+		if (i < (int)sizeof(lua_Unsigned) - 1) v >>= 8;
+	}
+}
+
+// Store a float / double in the requested byte order
+static void pack_put_raw(char *out, const void *v, int size, int little) {
+	int i;
+
+	if (little == pack_native_little()) {
+		memcpy(out, v, size);
+	} else {
+		for(i = 0; i < size; i++) {
+			out[i] = ((const char *)v)[size - 1 - i];
+		}
+	}
+}
+
+static void pack_check_int(lua_State *L, int arg, lua_Integer v, int size, pack_opt_t opt) {
+	lua_Integer lim;
+
+	// All the values fit
+	if (size >= (int)sizeof(lua_Integer)) {
+		return;
+	}
+
+	lim = (lua_Integer)1 << ((size * 8) - 1);
+	if (opt == PackOptInt) {
+		luaL_argcheck(L, (-lim <= v) && (v < lim), arg, "integer overflow");
+	} else {
+		luaL_argcheck(L, (lua_Unsigned)v < (lua_Unsigned)lim * 2, arg, "unsigned overflow");
+	}
+}
+
+// Encode the argument arg as described by opt, and return the encoded
+// length. If out is NULL only the length is computed, and the argument
+// is checked.
+static size_t pack_encode_arg(lua_State *L, pack_opt_t opt, int size, int little, int arg, char *out) {
+	const char *s;
+	lua_Integer i;
+	lua_Number n;
+	lua_Unsigned u;
+	size_t len;
+	float fv;
+	double dv;
+
+	switch (opt) {
+		case PackOptInt:
+		case PackOptUint:
+			i = luaL_checkinteger(L, arg);
+			if (out) {
+				pack_put_int(out, (lua_Unsigned)i, size, little, (opt == PackOptInt) && (i < 0));
+			} else {
+				pack_check_int(L, arg, i, size, opt);
+			}
+			return size;
+
+		case PackOptFloat:
+			fv = (float)luaL_checknumber(L, arg);
+			if (out) pack_put_raw(out, &fv, size, little);
+			return size;
+
+		case PackOptDouble:
+			dv = (double)luaL_checknumber(L, arg);
+			if (out) pack_put_raw(out, &dv, size, little);
+			return size;
+
+		case PackOptNumber:
+			n = luaL_checknumber(L, arg);
+			if (out) pack_put_raw(out, &n, size, little);
+			return size;
+
+		case PackOptString:
+			s = luaL_checklstring(L, arg, &len);
+			if (out) {
+				pack_put_int(out, (lua_Unsigned)len, size, little, 0);
+				memcpy(out + size, s, len);
+			} else if (size < (int)sizeof(size_t)) {
+				luaL_argcheck(L, len < ((size_t)1 << (size * 8)), arg, "string length does not fit in given size");
+			}
+			return size + len;
+
+		case PackOptZString:
+			s = luaL_checklstring(L, arg, &len);
+			if (out) {
+				memcpy(out, s, len + 1);
+			} else {
+				luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
+			}
+			return len + 1;
+
+		case PackOptVarint:
+		case PackOptUvarint:
+			i = luaL_checkinteger(L, arg);
+			if (opt == PackOptVarint) {
+				u = pack_zigzag(i);
+			} else {
+				luaL_argcheck(L, i >= 0, arg, "unsigned overflow");
+				u = (lua_Unsigned)i;
+			}
+
+			len = pack_varint_len(u);
+			if (out) {
+				while (u >= 0x80) {
+					*out++ = (char)((u & 0x7f) | 0x80);
+					u >>= 7;
+				}
+				*out = (char)u;
+			}
+			return len;
+
+		default:
+			return 0;
+	}
+}
+
+static int l_encode(lua_State *L) {
+	pack_fmt_t f;
+	luaL_Buffer b;
+	pack_opt_t opt;
+	size_t total = 0;
+	size_t len;
+	char *out;
+	int size;
+	int arg;
+
+	// First pass: check the arguments, and compute the encoded length
+	f.L = L;
+	f.fmt = luaL_checkstring(L, 1);
+	f.little = pack_native_little();
+	arg = 1;
+
+	while (*f.fmt) {
+		opt = pack_fmt_next(&f, &size);
+		if (opt == PackOptPadding) {
+			total += size;
+		} else if (opt != PackOptNone) {
+			len = pack_encode_arg(L, opt, size, f.little, ++arg, NULL);
+			luaL_argcheck(L, total + len >= total, arg, "result too large");
+			total += len;
+		}
+	}
+
+	luaL_argcheck(L, arg >= lua_gettop(L), arg + 1, "too many arguments");
+
+	// Second pass: encode into the buffer
+	out = luaL_buffinitsize(L, &b, total);
+
+	f.fmt = lua_tostring(L, 1);
+	f.little = pack_native_little();
+	arg = 1;
+
+	while (*f.fmt) {
+		opt = pack_fmt_next(&f, &size);
+		if (opt == PackOptPadding) {
+			*out++ = 0;
+		} else if (opt != PackOptNone) {
+			out += pack_encode_arg(L, opt, size, f.little, ++arg, out);
+		}
+	}
+
+	luaL_pushresultsize(&b, total);
+
+	return 1;
+}
+
+// Read an integer of size bytes
+static lua_Integer pack_get_int(lua_State *L, const char *p, int size, int little, int issigned) {
+	lua_Unsigned v = 0;
+	lua_Unsigned mask;
+	int limit;
+	int i;
+
+	limit = (size <= (int)sizeof(lua_Integer)) ? size : (int)sizeof(lua_Integer);
+	for(i = limit - 1; i >= 0; i--) {
+		v = (v << 8) | (unsigned char)p[little ? i : size - 1 - i];
+	}
+
+	if (size < (int)sizeof(lua_Integer)) {
+		if (issigned) {
+			mask = (lua_Unsigned)1 << (size * 8 - 1);
+			v = (v ^ mask) - mask;
+		}
+	} else if (size > (int)sizeof(lua_Integer)) {
+		// The bytes that don't fit must be the sign extension
+		mask = (!issigned || ((lua_Integer)v >= 0)) ? 0 : 0xff;
+		for(i = limit; i < size; i++) {
+			if ((unsigned char)p[little ? i : size - 1 - i] != mask) {
+				luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
+			}
+		}
+	}
+
+	return (lua_Integer)v;
+}
+
+static void pack_get_raw(void *v, const char *p, int size, int little) {
+	int i;
+
+	if (little == pack_native_little()) {
+		memcpy(v, p, size);
+	} else {
+		for(i = 0; i < size; i++) {
+			((char *)v)[i] = p[size - 1 - i];
+		}
+	}
+}
+
+static int l_decode(lua_State *L) {
+	const char *data;
+	lua_Integer pos;
+	lua_Unsigned u;
+	pack_opt_t opt;
+	pack_fmt_t f;
+	size_t len;
+	size_t slen;
+	int size;
+	int shift;
+	int n = 0;
+	float fv;
+	double dv;
+	lua_Number nv;
+
+	f.L = L;
+	f.fmt = luaL_checkstring(L, 1);
+	f.little = pack_native_little();
+
+	data = luaL_checklstring(L, 2, &len);
+	pos = luaL_optinteger(L, 3, 1) - 1;
+	luaL_argcheck(L, (pos >= 0) && ((size_t)pos <= len), 3, "initial position out of string");
+
+	while (*f.fmt) {
+		opt = pack_fmt_next(&f, &size);
+		if (opt == PackOptNone) {
+			continue;
+		}
+
+		luaL_argcheck(L, (size_t)size <= len - pos, 2, "data string too short");
+		luaL_checkstack(L, 2, "too many results");
+
+		switch (opt) {
+			case PackOptInt:
+			case PackOptUint:
+				lua_pushinteger(L, pack_get_int(L, data + pos, size, f.little, opt == PackOptInt));
+				break;
+
+			case PackOptFloat:
+				pack_get_raw(&fv, data + pos, size, f.little);
+				lua_pushnumber(L, (lua_Number)fv);
+				break;
+
+			case PackOptDouble:
+				pack_get_raw(&dv, data + pos, size, f.little);
+				lua_pushnumber(L, (lua_Number)dv);
+				break;
+
+			case PackOptNumber:
+				pack_get_raw(&nv, data + pos, size, f.little);
+				lua_pushnumber(L, nv);
+				break;
+
+			case PackOptString:
+				slen = (size_t)pack_get_int(L, data + pos, size, f.little, 0);
+				luaL_argcheck(L, slen <= len - pos - size, 2, "data string too short");
+				lua_pushlstring(L, data + pos + size, slen);
+				pos += slen;
+				break;
+
+			case PackOptZString:
+				slen = strnlen(data + pos, len - pos);
+				luaL_argcheck(L, slen < len - pos, 2, "unfinished string for format 'z'");
+				lua_pushlstring(L, data + pos, slen);
+				pos += slen + 1;
+				break;
+
+			case PackOptVarint:
+			case PackOptUvarint:
+				u = 0;
+				shift = 0;
+				for(;;) {
+					luaL_argcheck(L, (size_t)pos < len, 2, "data string too short");
+					// Bits that don't fit
+					if ((shift >= PACK_INT_BITS) || ((shift > PACK_INT_BITS - 7) && ((data[pos] & 0x7f) >> (PACK_INT_BITS - shift)))) {
+						luaL_error(L, "variable-length integer does not fit into Lua Integer");
+					}
+
+					u |= (lua_Unsigned)(data[pos] & 0x7f) << shift;
+					shift += 7;
+
+					if (!(data[pos++] & 0x80)) break;
+				}
+
+				if (opt == PackOptVarint) {
+					lua_pushinteger(L, (lua_Integer)(u >> 1) ^ -(lua_Integer)(u & 1));
+				} else {
+					lua_pushinteger(L, (lua_Integer)u);
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		pos += size;
+		if (opt != PackOptPadding) n++;
+	}
+
+	lua_pushinteger(L, pos + 1);
+
+	return n + 1;
+}
+
 static const LUA_REG_TYPE pack_map[] = 
 {
   { LSTRKEY( "pack" ),      LFUNCVAL( l_pack ) },
   { LSTRKEY( "unpack" ),    LFUNCVAL( l_unpack ) },
+  { LSTRKEY( "encode" ),    LFUNCVAL( l_encode ) },
+  { LSTRKEY( "decode" ),    LFUNCVAL( l_decode ) },
   { LNILKEY, LNILVAL }
 };
 
@@ -42,9 +42,12 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <sys/list.h>
+
 #include <drivers/neopixel.h>
 
 extern LUA_REG_TYPE neopixel_error_map[];
+extern struct list neopixel_list;
 
 static int lneopixel_setup( lua_State* L ) {
     int type, gpio, pixels;
@@ -101,6 +104,207 @@ static int lneopixel_set_pixel( lua_State* L ) {
     return 0;
 }
 
+// Check the r, g, b components at index, and store them in rgb
+static void lneopixel_check_rgb(lua_State* L, int index, uint8_t *rgb) {
+	const char *name = "rgb";
+	lua_Integer val;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		val = luaL_checkinteger( L, index + i );
+	    if ((val < 0) || (val > 255)) {
+	    	char component[2] = {name[i], 0};
+
+	    	luaL_exception_extended(L, NEOPIXEL_ERR_INVALID_RGB_COMPONENT, component);
+	    }
+
+	    rgb[i] = (uint8_t)val;
+	}
+}
+
+// Get the range of pixels at index (first, count), count defaults to all
+// pixels from first to the end of the strip
+static void lneopixel_check_range(lua_State* L, neopixel_userdata *neopixel, int index, uint32_t *first, uint32_t *count) {
+	neopixel_instance_t *instance;
+	lua_Integer val;
+
+    if (list_get(&neopixel_list, (int)neopixel->unit, (void **)&instance)) {
+    	luaL_exception(L, NEOPIXEL_ERR_INVALID_UNIT);
+    }
+
+	val = luaL_optinteger( L, index, 0 );
+	if ((val < 0) || (val > instance->npixels)) {
+		luaL_exception(L, NEOPIXEL_ERR_INVALID_PIXEL);
+	}
+
+	*first = (uint32_t)val;
+
+	val = luaL_optinteger( L, index + 1, instance->npixels - *first );
+	if ((val < 0) || (val > instance->npixels - *first)) {
+		luaL_exception(L, NEOPIXEL_ERR_INVALID_PIXEL);
+	}
+
+	*count = (uint32_t)val;
+}
+
+static int lneopixel_set_pixels( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+	const uint8_t *rgb;
+	size_t len;
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    int first = luaL_checkinteger( L, 2 );
+    if (first < 0) {
+    	return luaL_exception(L, NEOPIXEL_ERR_INVALID_PIXEL);
+    }
+
+    if (lua_type(L, 3) == LUA_TSTRING) {
+    	// Packed r, g, b bytes
+    	rgb = (const uint8_t *)lua_tolstring(L, 3, &len);
+    	luaL_argcheck(L, (len % 3) == 0, 3, "length must be a multiple of 3");
+    } else {
+    	// Array of 0xrrggbb colors, packed to r, g, b bytes
+    	luaL_Buffer b;
+    	lua_Integer color;
+    	size_t i, n;
+    	char *dst;
+
+    	luaL_checktype(L, 3, LUA_TTABLE);
+
+    	n = lua_rawlen(L, 3);
+    	dst = luaL_buffinitsize(L, &b, n * 3);
+
+    	for(i = 1; i <= n; i++) {
+    		lua_rawgeti(L, 3, i);
+    		color = luaL_checkinteger(L, -1);
+    		lua_pop(L, 1);
+
+    		*dst++ = (color >> 16) & 0xff;
+    		*dst++ = (color >> 8) & 0xff;
+    		*dst++ = color & 0xff;
+    	}
+
+    	luaL_pushresultsize(&b, n * 3);
+    	rgb = (const uint8_t *)lua_tolstring(L, -1, &len);
+    }
+
+    if ((error = neopixel_set_pixels(neopixel->unit, first, rgb, len / 3))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_fill( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+	uint32_t first, count;
+	uint8_t rgb[3];
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    lneopixel_check_rgb(L, 2, rgb);
+    lneopixel_check_range(L, neopixel, 5, &first, &count);
+
+    if ((error = neopixel_fill(neopixel->unit, first, count, rgb[0], rgb[1], rgb[2]))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_gradient( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+	uint32_t first, count;
+	uint8_t from[3], to[3];
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    lneopixel_check_rgb(L, 2, from);
+    lneopixel_check_rgb(L, 5, to);
+    lneopixel_check_range(L, neopixel, 8, &first, &count);
+
+    if ((error = neopixel_gradient(neopixel->unit, first, count, from, to))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_shift( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    int n = luaL_checkinteger( L, 2 );
+    int rotate = lua_toboolean( L, 3 );
+
+    if ((error = neopixel_shift(neopixel->unit, n, rotate))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_brightness( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    int brightness = luaL_checkinteger( L, 2 );
+    luaL_argcheck(L, (brightness >= 0) && (brightness <= 255), 2, "must be between 0 and 255");
+
+    if ((error = neopixel_brightness(neopixel->unit, brightness))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_gamma( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    float gamma = luaL_checknumber( L, 2 );
+
+    if ((error = neopixel_gamma(neopixel->unit, gamma))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    return 0;
+}
+
+static int lneopixel_stats( lua_State* L ) {
+	driver_error_t *error;
+	neopixel_userdata *neopixel = NULL;
+	uint32_t frames, skipped;
+
+	neopixel = (neopixel_userdata *)luaL_checkudata(L, 1, "neopixel.inst");
+    luaL_argcheck(L, neopixel, 1, "neopixel expected");
+
+    if ((error = neopixel_stats(neopixel->unit, &frames, &skipped))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    lua_pushinteger(L, frames);
+    lua_pushinteger(L, skipped);
+
+    return 2;
+}
+
 static int lneopixel_update( lua_State* L ) {
 	driver_error_t *error;
 	neopixel_userdata *neopixel = NULL;
@@ -119,12 +323,22 @@ static const LUA_REG_TYPE lneopixel_map[] = {
     { LSTRKEY( "setup"   ),	     LFUNCVAL ( lneopixel_setup    ) },
 	{ LSTRKEY( "error"   ),      LROVAL   ( neopixel_error_map ) },
 	{ LSTRKEY( "WS2812B" ),      LINTVAL  ( NeopixelWS2812B    ) },
+	{ LSTRKEY( "WS2812"  ),      LINTVAL  ( NeopixelWS2812     ) },
+	{ LSTRKEY( "SK6812"  ),      LINTVAL  ( NeopixelSK6812     ) },
+	{ LSTRKEY( "WS2811"  ),      LINTVAL  ( NeopixelWS2811     ) },
 	{ LNILKEY, LNILVAL }
 };
 
 static const LUA_REG_TYPE lneopixel_inst_map[] = {
 	{ LSTRKEY( "setPixel"    ),	  LFUNCVAL( lneopixel_set_pixel     ) },
+	{ LSTRKEY( "setPixels"   ),	  LFUNCVAL( lneopixel_set_pixels    ) },
+	{ LSTRKEY( "fill"        ),	  LFUNCVAL( lneopixel_fill          ) },
+	{ LSTRKEY( "gradient"    ),	  LFUNCVAL( lneopixel_gradient      ) },
+	{ LSTRKEY( "shift"       ),	  LFUNCVAL( lneopixel_shift         ) },
+	{ LSTRKEY( "brightness"  ),	  LFUNCVAL( lneopixel_brightness    ) },
+	{ LSTRKEY( "gamma"       ),	  LFUNCVAL( lneopixel_gamma         ) },
 	{ LSTRKEY( "update"      ),	  LFUNCVAL( lneopixel_update        ) },
+	{ LSTRKEY( "stats"       ),	  LFUNCVAL( lneopixel_stats         ) },
     { LSTRKEY( "__metatable" ),	  LROVAL  ( lneopixel_inst_map      ) },
 	{ LSTRKEY( "__index"     ),   LROVAL  ( lneopixel_inst_map      ) },
 	{ LNILKEY, LNILVAL }
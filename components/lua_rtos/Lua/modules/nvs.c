@@ -27,6 +27,7 @@
  * this software.
  */
 
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "modules.h"
@@ -43,16 +44,55 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 
+#include <sys/nvs_cache.h>
+
+#include <pthread/pthread.h>
+
+/*
+ * Values are accessed through a cache for each namespace (see
+ * sys/nvs_cache.h), that is opened on first use, and is kept open.
+ *
+ * Integers, numbers, booleans and strings are stored as NVS integers,
+ * unsigned integers (the bits of a double), unsigned bytes and strings.
+ * Strings with zeros are stored as blobs. Values written by previous
+ * versions of this module, as blobs with a type byte, can still be read.
+ */
+
+// Type of the values stored as blobs
 #define LNVS_TYPE_INT     1
 #define LNVS_TYPE_NUMBER  2
 #define LNVS_TYPE_BOOLEAN 3
 #define LNVS_TYPE_NIL     4
 #define LNVS_TYPE_STRING  5
+#define LNVS_TYPE_BINARY  6
+
+// How a value is stored
+#define LNVS_STORED_NONE  0
+#define LNVS_STORED_I32   1
+#define LNVS_STORED_I64   2
+#define LNVS_STORED_U64   3
+#define LNVS_STORED_U8    4
+#define LNVS_STORED_STR   5
+#define LNVS_STORED_BLOB  6
+
+typedef struct lnvs_nspace {
+	struct lnvs_nspace *next;
+	nvs_cache_t *cache;
+} lnvs_nspace_t;
+
+typedef struct {
+	nvs_cache_t *cache;
+	nvs_cache_batch_t *batch;  // the batch started with this handle, if any
+} lnvs_userdata_t;
+
+// Open namespaces
+static pthread_mutex_t nspace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static lnvs_nspace_t *nspaces = NULL;
 
 static void nvs_error(lua_State* L, int code) {
     switch (code){
         case ESP_FAIL:
-            luaL_error(L, "%:dfail", ESP_FAIL);break;
+            luaL_error(L, "%d:fail", ESP_FAIL);break;
         case ESP_ERR_INVALID_ARG:
             luaL_error(L, "%d:fail", ESP_ERR_INVALID_ARG);break;
         case ESP_ERR_NO_MEM:
@@ -63,18 +103,370 @@ static void nvs_error(lua_State* L, int code) {
             luaL_error(L, "%d:invalid size", ESP_ERR_INVALID_SIZE);break;
         case ESP_ERR_NVS_NOT_FOUND:
             luaL_error(L, "%d:key not found", ESP_ERR_NOT_FOUND);break;
+        default:
+            luaL_error(L, "%d:fail", code);break;
     }
 }
 
+/*
+ * ESP-IDF NVS backend
+ */
+
+static int lnvs_backend_open(const char *nspace, void **handle) {
+	nvs_handle h;
+	esp_err_t err;
+
+	if ((err = nvs_open(nspace, NVS_READWRITE, &h)) == ESP_OK) {
+		*handle = (void *)(uintptr_t)h;
+	}
+
+	return err;
+}
+
+static void lnvs_backend_close(void *handle) {
+	nvs_close((nvs_handle)(uintptr_t)handle);
+}
+
+static int lnvs_backend_commit(void *handle) {
+	return nvs_commit((nvs_handle)(uintptr_t)handle);
+}
+
+// Decode a blob, that has a type byte and the value
+static int lnvs_blob_decode(char *data, size_t len, nvs_cache_value_t *value) {
+	switch (data[0]) {
+		case LNVS_TYPE_INT:
+			value->type = NvsCacheInteger;
+			if (len - 1 == sizeof(int64_t)) {
+				memcpy(&value->integer, data + 1, sizeof(int64_t));
+			} else {
+				int32_t i32;
+
+				memcpy(&i32, data + 1, sizeof(int32_t));
+				value->integer = i32;
+			}
+			break;
+
+		case LNVS_TYPE_NUMBER:
+			value->type = NvsCacheNumber;
+			if (len - 1 == sizeof(double)) {
+				memcpy(&value->number, data + 1, sizeof(double));
+			} else {
+				float f;
+
+				memcpy(&f, data + 1, sizeof(float));
+				value->number = f;
+			}
+			break;
+
+		case LNVS_TYPE_BOOLEAN:
+			value->type = NvsCacheBoolean;
+			memcpy(&value->boolean, data + 1, sizeof(int));
+			break;
+
+		case LNVS_TYPE_STRING:
+		case LNVS_TYPE_BINARY:
+			value->type = NvsCacheString;
+			value->string.len = (data[0] == LNVS_TYPE_STRING) ? strlen(data + 1) : len - 1;
+			value->string.data = data;
+			memmove(data, data + 1, value->string.len);
+			data[value->string.len] = 0;
+
+			// The value owns the data now
+			return ESP_OK;
+
+		default:
+			value->type = NvsCacheNone;
+	}
+
+	free(data);
+
+	return ESP_OK;
+}
+
+static int lnvs_backend_get(void *handle, const char *key, nvs_cache_value_t *value, uint8_t *stored) {
+	nvs_handle h = (nvs_handle)(uintptr_t)handle;
+	esp_err_t err;
+	int32_t i32;
+	int64_t i64;
+	uint64_t u64;
+	uint8_t u8;
+	size_t len;
+	char *data;
+
+	value->type = NvsCacheNone;
+	*stored = LNVS_STORED_NONE;
+
+	// The type of a key is not known, so each type is tried, from the most
+	// used one
+	if ((err = nvs_get_i32(h, key, &i32)) == ESP_OK) {
+		value->type = NvsCacheInteger;
+		value->integer = i32;
+		*stored = LNVS_STORED_I32;
+		return ESP_OK;
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	if ((err = nvs_get_str(h, key, NULL, &len)) == ESP_OK) {
+		data = malloc(len);
+		if (!data) {
+			return ESP_ERR_NO_MEM;
+		}
+
+		if ((err = nvs_get_str(h, key, data, &len)) != ESP_OK) {
+			free(data);
+			return err;
+		}
+
+		value->type = NvsCacheString;
+		value->string.data = data;
+		value->string.len = len - 1;
+		*stored = LNVS_STORED_STR;
+		return ESP_OK;
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	if ((err = nvs_get_u8(h, key, &u8)) == ESP_OK) {
+		value->type = NvsCacheBoolean;
+		value->boolean = u8;
+		*stored = LNVS_STORED_U8;
+		return ESP_OK;
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	if ((err = nvs_get_u64(h, key, &u64)) == ESP_OK) {
+		value->type = NvsCacheNumber;
+		memcpy(&value->number, &u64, sizeof(double));
+		*stored = LNVS_STORED_U64;
+		return ESP_OK;
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	if ((err = nvs_get_i64(h, key, &i64)) == ESP_OK) {
+		value->type = NvsCacheInteger;
+		value->integer = i64;
+		*stored = LNVS_STORED_I64;
+		return ESP_OK;
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	if ((err = nvs_get_blob(h, key, NULL, &len)) == ESP_OK) {
+		if (len == 0) {
+			*stored = LNVS_STORED_BLOB;
+			return ESP_OK;
+		}
+
+		data = malloc(len + 1);
+		if (!data) {
+			return ESP_ERR_NO_MEM;
+		}
+
+		if ((err = nvs_get_blob(h, key, data, &len)) != ESP_OK) {
+			free(data);
+			return err;
+		}
+
+		data[len] = 0;
+		*stored = LNVS_STORED_BLOB;
+
+		return lnvs_blob_decode(data, len, value);
+	} else if (err != ESP_ERR_NVS_NOT_FOUND) {
+		return err;
+	}
+
+	return ESP_OK;
+}
+
+static int lnvs_backend_set(void *handle, const char *key, const nvs_cache_value_t *value, uint8_t *stored) {
+	nvs_handle h = (nvs_handle)(uintptr_t)handle;
+	uint8_t type = LNVS_STORED_NONE;
+	esp_err_t err = ESP_OK;
+	uint64_t u64;
+	char *data;
+
+	switch (value->type) {
+		case NvsCacheInteger:
+			type = ((value->integer >= INT32_MIN) && (value->integer <= INT32_MAX)) ? LNVS_STORED_I32 : LNVS_STORED_I64;
+			break;
+		case NvsCacheNumber:
+			type = LNVS_STORED_U64;
+			break;
+		case NvsCacheBoolean:
+			type = LNVS_STORED_U8;
+			break;
+		case NvsCacheString:
+			type = memchr(value->string.data, 0, value->string.len) ? LNVS_STORED_BLOB : LNVS_STORED_STR;
+			break;
+		case NvsCacheNone:
+			break;
+	}
+
+	// A key can have a value of each type, so the value of the other type
+	// must be erased
+	if ((*stored != LNVS_STORED_NONE) && (*stored != type)) {
+		err = nvs_erase_key(h, key);
+		if ((err != ESP_OK) && (err != ESP_ERR_NVS_NOT_FOUND)) {
+			return err;
+		}
+
+		*stored = LNVS_STORED_NONE;
+	}
+
+	switch (type) {
+		case LNVS_STORED_I32:
+			err = nvs_set_i32(h, key, (int32_t)value->integer);
+			break;
+		case LNVS_STORED_I64:
+			err = nvs_set_i64(h, key, value->integer);
+			break;
+		case LNVS_STORED_U64:
+			memcpy(&u64, &value->number, sizeof(double));
+			err = nvs_set_u64(h, key, u64);
+			break;
+		case LNVS_STORED_U8:
+			err = nvs_set_u8(h, key, value->boolean ? 1 : 0);
+			break;
+		case LNVS_STORED_STR:
+			err = nvs_set_str(h, key, value->string.data);
+			break;
+		case LNVS_STORED_BLOB:
+			data = malloc(value->string.len + 1);
+			if (!data) {
+				return ESP_ERR_NO_MEM;
+			}
+
+			data[0] = LNVS_TYPE_BINARY;
+			memcpy(data + 1, value->string.data, value->string.len);
+
+			err = nvs_set_blob(h, key, data, value->string.len + 1);
+			free(data);
+			break;
+	}
+
+	if (err == ESP_OK) {
+		*stored = type;
+	}
+
+	return err;
+}
+
+static const nvs_cache_backend_t lnvs_backend = {
+	.open = lnvs_backend_open,
+	.close = lnvs_backend_close,
+	.get = lnvs_backend_get,
+	.set = lnvs_backend_set,
+	.commit = lnvs_backend_commit,
+};
+
+/*
+ * Helpers
+ */
+
+// Get the cache of a namespace, opening it the first time
+static nvs_cache_t *lnvs_nspace(lua_State *L, const char *nspace) {
+	lnvs_nspace_t *ns;
+	int err;
+
+	pthread_mutex_lock(&nspace_mtx);
+
+	for(ns = nspaces; ns; ns = ns->next) {
+		if (strcmp(ns->cache->nspace, nspace) == 0) {
+			pthread_mutex_unlock(&nspace_mtx);
+			return ns->cache;
+		}
+	}
+
+	ns = (lnvs_nspace_t *)calloc(1, sizeof(lnvs_nspace_t));
+	if (!ns) {
+		pthread_mutex_unlock(&nspace_mtx);
+		nvs_error(L, ESP_ERR_NO_MEM);
+	}
+
+	if ((err = nvs_cache_open(&lnvs_backend, nspace, &ns->cache))) {
+		free(ns);
+		pthread_mutex_unlock(&nspace_mtx);
+		nvs_error(L, err);
+	}
+
+	ns->next = nspaces;
+	nspaces = ns;
+
+	pthread_mutex_unlock(&nspace_mtx);
+
+	return ns->cache;
+}
+
+static void lnvs_check_value(lua_State *L, int idx, nvs_cache_value_t *value) {
+	switch(lua_type(L, idx)) {
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, idx)) {
+				value->type = NvsCacheInteger;
+				value->integer = lua_tointeger(L, idx);
+			} else {
+				value->type = NvsCacheNumber;
+				value->number = lua_tonumber(L, idx);
+			}
+			break;
+
+		case LUA_TBOOLEAN:
+			value->type = NvsCacheBoolean;
+			value->boolean = lua_toboolean(L, idx);
+			break;
+
+		case LUA_TNIL:
+			value->type = NvsCacheNone;
+			break;
+
+		case LUA_TSTRING:
+			value->type = NvsCacheString;
+			value->string.data = (char *)lua_tolstring(L, idx, &value->string.len);
+			break;
+
+		default:
+			luaL_argerror(L, idx, "value can't be stored");
+	}
+}
+
+// Push a value, and free it
+static int lnvs_push_value(lua_State *L, nvs_cache_value_t *value) {
+	switch (value->type) {
+		case NvsCacheInteger:
+			lua_pushinteger(L, value->integer);
+			break;
+		case NvsCacheNumber:
+			lua_pushnumber(L, value->number);
+			break;
+		case NvsCacheBoolean:
+			lua_pushboolean(L, value->boolean);
+			break;
+		case NvsCacheString:
+			lua_pushlstring(L, value->string.data, value->string.len);
+			break;
+		case NvsCacheNone:
+			lua_pushnil(L);
+			break;
+	}
+
+	nvs_cache_value_free(value);
+
+	return 1;
+}
+
+/*
+ * Module functions
+ */
+
 static int l_nvs_write(lua_State *L) {
     int total = lua_gettop(L); // Get number of arguments
-    nvs_handle handle_to_settings;
-    esp_err_t err;
+    nvs_cache_value_t value;
+    nvs_cache_t *cache;
     const char *key = NULL;
     const char *nspace = NULL;
-    const char *str_val = NULL;
-    size_t val_size = 0;
-    void *val_val = NULL;
+    int err;
 
     // Sanity checks, and check arguments
     if (total != 3 ) {
@@ -82,101 +474,27 @@ static int l_nvs_write(lua_State *L) {
     }
 
     nspace = luaL_checkstring(L, 1);
-    if (!nspace) {
-    	return luaL_error(L, "namespace missing");
-    }
-
     key = luaL_checkstring(L, 2);
-    if (!key) {
-    	return luaL_error(L, "key missing");
-    }
-
-    switch(lua_type(L, 3)) {
-        case LUA_TNUMBER:
-            if (lua_isinteger(L,3)) {
-            	val_size = sizeof(lua_Integer) + 1;
-            	val_val = (void *)malloc(val_size);
-            	if (val_val) {
-            		*((char*)val_val) = (char)LNVS_TYPE_INT;
-            		*((lua_Integer *)(val_val + 1)) = luaL_checkinteger(L, 3);
-            	}
-            } else {
-            	val_size = sizeof(lua_Number) + 1;
-            	val_val = (void *)malloc(val_size);
-            	if (val_val) {
-            		*((char*)val_val) = (char)LNVS_TYPE_NUMBER;
-            		*((lua_Number *)(val_val + 1)) = luaL_checknumber(L, 3);
-            	}
-            }
-
-            break;
-
-        case LUA_TBOOLEAN:
-        	val_size = sizeof(int) + 1;
-        	val_val = (void *)malloc(val_size);
-        	if (val_val) {
-        		*((char*)val_val) = (char)LNVS_TYPE_BOOLEAN;
-        		*((int *)(val_val + 1)) = (char)lua_toboolean(L, 3);
-        	}
-            break;
-
-        case LUA_TNIL:
-        	val_size = sizeof(char) * 2;
-        	val_val = (void *)malloc(val_size);
-        	if (val_val) {
-        		*((char*)val_val) = (char)LNVS_TYPE_NIL;
-        		*((char *)(val_val + 1)) = 0;
-        	}
-            break;
-
-        case LUA_TSTRING:
-        	str_val = (char *)lua_tostring(L, 3);
-
-        	val_size = strlen(str_val) + 2;
-        	val_val = (void *)malloc(val_size);
-        	if (val_val) {
-        		*((char*)val_val) = (char)LNVS_TYPE_STRING;
-        		memcpy((char *)(val_val + 1), str_val, val_size - 1);
-        	}
-            break;
-    }
-
-    // Open
-    err = nvs_open(nspace, NVS_READWRITE, &handle_to_settings);
-    if (err != ESP_OK) {
-    	free(val_val);
-    	nvs_error(L, err);
-    }
-
-    // Save
-    err = nvs_set_blob(handle_to_settings, key, val_val, val_size);
-    if (err != ESP_OK) {
-    	free(val_val);
-    	nvs_error(L, err);
-    }
+    lnvs_check_value(L, 3, &value);
 
-    free(val_val);
+    cache = lnvs_nspace(L, nspace);
 
-    // Commit changes
-    err = nvs_commit(handle_to_settings);
-    if (err != ESP_OK) {
+    // Written and committed at once, also if a handle of the namespace is
+    // in a batch
+    if ((err = nvs_cache_set(cache, key, &value))) {
     	nvs_error(L, err);
     }
 
-    // Close
-    nvs_close(handle_to_settings);
-
     return 0;
 }
 
 static int l_nvs_read(lua_State *L) {
     int total = lua_gettop(L); // Get number of arguments
-    nvs_handle handle_to_settings;
-    esp_err_t err;
+    nvs_cache_value_t value;
+    nvs_cache_t *cache;
     const char *key = NULL;
     const char *nspace = NULL;
-    int8_t val_type = 0;
-    void *val_val = NULL;
+    int err;
 
     // Sanity checks, and check arguments
     if (total != 2 ) {
@@ -184,75 +502,225 @@ static int l_nvs_read(lua_State *L) {
     }
 
     nspace = luaL_checkstring(L, 1);
-    if (!nspace) {
-    	return luaL_error(L, "namespace missing");
-    }
-
     key = luaL_checkstring(L, 2);
-    if (!key) {
-    	return luaL_error(L, "key missing");
-    }
 
-    // Open
-    err = nvs_open(nspace, NVS_READWRITE, &handle_to_settings);
-    if (err != ESP_OK) {
+    cache = lnvs_nspace(L, nspace);
+
+    if ((err = nvs_cache_get(cache, key, &value))) {
     	nvs_error(L, err);
     }
 
-    // Read key size
-    size_t key_size = 0;
-    err = nvs_get_blob(handle_to_settings, key,NULL, &key_size);
-	if (err != ESP_OK) {
+    if (value.type == NvsCacheNone) {
+    	nvs_error(L, ESP_ERR_NVS_NOT_FOUND);
+    }
+
+    return lnvs_push_value(L, &value);
+}
+
+// nvs.open(namespace)
+static int l_nvs_open(lua_State *L) {
+	const char *nspace = luaL_checkstring(L, 1);
+	lnvs_userdata_t *udata;
+
+	udata = (lnvs_userdata_t *)lua_newuserdata(L, sizeof(lnvs_userdata_t));
+	udata->cache = NULL;
+	udata->batch = NULL;
+	luaL_setmetatable(L, "nvs.handle");
+
+	udata->cache = lnvs_nspace(L, nspace);
+
+	return 1;
+}
+
+/*
+ * Handle functions
+ */
+
+static lnvs_userdata_t *lnvs_check(lua_State *L) {
+	lnvs_userdata_t *udata = (lnvs_userdata_t *)luaL_checkudata(L, 1, "nvs.handle");
+
+	luaL_argcheck(L, udata->cache != NULL, 1, "handle is closed");
+
+	return udata;
+}
+
+// handle:read(key [, default])
+static int l_nvs_handle_read(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	const char *key = luaL_checkstring(L, 2);
+	nvs_cache_value_t value;
+	int err;
+
+	// A batch reads its own writes
+	if (udata->batch) {
+		err = nvs_cache_batch_get(udata->batch, key, &value);
+	} else {
+		err = nvs_cache_get(udata->cache, key, &value);
+	}
+
+	if (err) {
 		nvs_error(L, err);
 	}
 
-	// Alloc space for retrieve key value
-	val_val = malloc(key_size);
-	if (!val_val) {
-		// TO DO
+	if (value.type == NvsCacheNone) {
+		if (lua_gettop(L) < 3) {
+			nvs_error(L, ESP_ERR_NVS_NOT_FOUND);
+		}
+
+		lua_pushvalue(L, 3);
+		return 1;
+	}
+
+	return lnvs_push_value(L, &value);
+}
+
+// handle:write(key, value), a nil value erases the key
+static int l_nvs_handle_write(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	const char *key = luaL_checkstring(L, 2);
+	nvs_cache_value_t value;
+	int err;
+
+	luaL_checkany(L, 3);
+	lnvs_check_value(L, 3, &value);
+
+	if (udata->batch) {
+		err = nvs_cache_batch_set(udata->batch, key, &value);
+	} else {
+		err = nvs_cache_set(udata->cache, key, &value);
 	}
 
-    // Read key value
-    err = nvs_get_blob(handle_to_settings, key,val_val, &key_size);
-	if (err != ESP_OK) {
+	if (err) {
 		nvs_error(L, err);
 	}
 
-	val_type = *((char*)val_val);
-	switch (val_type) {
-		case LNVS_TYPE_INT:
-			lua_pushinteger(L, *((lua_Integer *)(val_val + 1)));
-			break;
-		case LNVS_TYPE_NUMBER:
-			lua_pushnumber(L, *((lua_Number *)(val_val + 1)));
-			break;
-		case LNVS_TYPE_BOOLEAN:
-			lua_pushboolean(L, *((int *)(val_val + 1)));
-			break;
-		case LNVS_TYPE_NIL:
-			lua_pushnil(L);
-			break;
-		case LNVS_TYPE_STRING:
-			lua_pushstring(L, ((const char *)(val_val + 1)));
-			break;
+	return 0;
+}
+
+static int l_nvs_handle_begin(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	int err;
+
+	if (udata->batch) {
+		nvs_error(L, ESP_ERR_INVALID_STATE);
+	}
+
+	if ((err = nvs_cache_begin(udata->cache, &udata->batch))) {
+		nvs_error(L, err);
+	}
+
+	return 0;
+}
+
+static int l_nvs_handle_commit(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	nvs_cache_batch_t *batch = udata->batch;
+	int err;
+
+	if (!batch) {
+		nvs_error(L, ESP_ERR_INVALID_STATE);
+	}
+
+	udata->batch = NULL;
+
+	if ((err = nvs_cache_commit(batch))) {
+		nvs_error(L, err);
 	}
 
-	free(val_val);
+	return 0;
+}
 
-    // Close
-    nvs_close(handle_to_settings);
+static int l_nvs_handle_rollback(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
 
-    return 1;
+	if (udata->batch) {
+		nvs_cache_rollback(udata->batch);
+		udata->batch = NULL;
+	}
+
+	return 0;
+}
+
+// Returns an array with the keys
+static int l_nvs_handle_keys(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+	uint32_t i, nkeys;
+	int err;
+
+	if ((err = nvs_cache_keys(udata->cache, &keys, &nkeys))) {
+		nvs_error(L, err);
+	}
+
+	lua_createtable(L, nkeys, 0);
+	for(i = 0; i < nkeys; i++) {
+		lua_pushstring(L, keys[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	free(keys);
+
+	return 1;
+}
+
+static int l_nvs_handle_stats(lua_State *L) {
+	lnvs_userdata_t *udata = lnvs_check(L);
+	nvs_cache_stats_t stats;
+
+	nvs_cache_stats(udata->cache, &stats);
+
+	lua_pushinteger(L, stats.reads);
+	lua_pushinteger(L, stats.hits);
+	lua_pushinteger(L, stats.writes);
+	lua_pushinteger(L, stats.commits);
+
+	return 4;
+}
+
+// The cache of the namespace is kept open, for other handles, and for
+// nvs.read / nvs.write
+static int l_nvs_handle_close(lua_State *L) {
+	lnvs_userdata_t *udata = (lnvs_userdata_t *)luaL_checkudata(L, 1, "nvs.handle");
+
+	if (udata->cache) {
+		if (udata->batch) {
+			nvs_cache_rollback(udata->batch);
+		}
+
+		udata->cache = NULL;
+		udata->batch = NULL;
+	}
+
+	return 0;
 }
 
 static const LUA_REG_TYPE nvs_map[] =
 {
   { LSTRKEY( "write" ),      LFUNCVAL( l_nvs_write ) },
   { LSTRKEY( "read" ),       LFUNCVAL( l_nvs_read ) },
+  { LSTRKEY( "open" ),       LFUNCVAL( l_nvs_open ) },
+  { LNILKEY, LNILVAL }
+};
+
+static const LUA_REG_TYPE nvs_handle_map[] =
+{
+  { LSTRKEY( "read" ),        LFUNCVAL( l_nvs_handle_read ) },
+  { LSTRKEY( "write" ),       LFUNCVAL( l_nvs_handle_write ) },
+  { LSTRKEY( "begin" ),       LFUNCVAL( l_nvs_handle_begin ) },
+  { LSTRKEY( "commit" ),      LFUNCVAL( l_nvs_handle_commit ) },
+  { LSTRKEY( "rollback" ),    LFUNCVAL( l_nvs_handle_rollback ) },
+  { LSTRKEY( "keys" ),        LFUNCVAL( l_nvs_handle_keys ) },
+  { LSTRKEY( "stats" ),       LFUNCVAL( l_nvs_handle_stats ) },
+  { LSTRKEY( "close" ),       LFUNCVAL( l_nvs_handle_close ) },
+  { LSTRKEY( "__metatable" ), LROVAL  ( nvs_handle_map ) },
+  { LSTRKEY( "__index" ),     LROVAL  ( nvs_handle_map ) },
+  { LSTRKEY( "__gc" ),        LFUNCVAL( l_nvs_handle_close ) },
   { LNILKEY, LNILVAL }
 };
 
 int luaopen_nvs(lua_State *L) {
+	luaL_newmetarotable(L,"nvs.handle", (void*)nvs_handle_map);
+
 	#if !LUA_USE_ROTABLE
 	luaL_newlib(L, nvs_map);
 	return 1;
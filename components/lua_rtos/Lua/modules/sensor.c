@@ -242,6 +242,70 @@ static int lsensor_acquire( lua_State* L ) {
 	return 0;
 }
 
+static int lsensor_sample( lua_State* L ) {
+    sensor_userdata *udata = NULL;
+	driver_error_t *error;
+
+	udata = (sensor_userdata *)luaL_checkudata(L, 1, "sensor.ins");
+    luaL_argcheck(L, udata, 1, "sensor expected");
+
+    // Sampling period in msecs, 0 = stop sampling
+    int period = luaL_checkinteger( L, 2 );
+    luaL_argcheck(L, period >= 0, 2, "invalid period");
+
+    if ((error = sensor_sample(udata->instance, period))) {
+    	return luaL_driver_error(L, error);
+    }
+
+	return 0;
+}
+
+// Read data from the last sample taken by the sampling service. The sample's age in
+// msecs is returned after the data.
+static int lsensor_read_sample( lua_State* L, sensor_userdata *udata, const char *id ) {
+	sensor_value_t sample[SENSOR_MAX_DATA];
+	driver_error_t *error;
+	uint32_t age;
+	int idx, numread = 0;
+
+	if ((error = sensor_get_sample(udata->instance, sample, &age))) {
+    	return luaL_driver_error(L, error);
+	}
+
+	for(idx=0;idx <  SENSOR_MAX_DATA;idx++) {
+		if (!udata->instance->sensor->data[idx].id) continue;
+
+		if ((strcmp(id, "all") != 0) && (strcmp(id, "ALL") != 0) && (strcmp(udata->instance->sensor->data[idx].id, id) != 0)) {
+			continue;
+		}
+
+		switch (sample[idx].type) {
+			case SENSOR_NO_DATA:
+				lua_pushnil(L);
+				break;
+			case SENSOR_DATA_INT:
+				lua_pushinteger(L, sample[idx].integerd.value);
+				break;
+			case SENSOR_DATA_FLOAT:
+				lua_pushnumber(L, sample[idx].floatd.value);
+				break;
+			case SENSOR_DATA_DOUBLE:
+				lua_pushnumber(L, sample[idx].doubled.value);
+				break;
+			default:
+				return luaL_driver_error(L, driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_FOUND, NULL));
+		}
+
+		numread++;
+	}
+
+	if (numread == 0) return luaL_driver_error(L, driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_FOUND, NULL));
+
+	lua_pushinteger(L, age);
+
+	return numread + 1;
+}
+
 static int lsensor_read( lua_State* L ) {
     sensor_userdata *udata = NULL;
 	driver_error_t *error;
@@ -252,6 +316,11 @@ static int lsensor_read( lua_State* L ) {
 
     const char *id = luaL_checkstring( L, 2 );
 
+    // If sensor is sampled read from last sample, without waiting for the sensor
+    if (udata->instance->period) {
+    	return lsensor_read_sample(L, udata, id);
+    }
+
     // If data is not acquired acquire data
     if (!udata->adquired) {
         if ((error = sensor_acquire(udata->instance))) {
@@ -466,23 +535,15 @@ static int lsensor_list( lua_State* L ) {
 	return table;
 }
 
-static int lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin) {
+static void lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin, int *count) {
 	const sensor_t *csensor = sensors;
 	const sensor_t *sensor;
 	sensor_instance_t *instance = NULL;
 	sensor_setup_t setup;
-	uint16_t count = 0;
 	int wh, wl;
 
-	if (!table) {
-		printf("SENSOR      DEVICE   ADDRESS             MODEL         \r\n");
-		printf("-------------------------------------------------------\r\n");
-	} else {
-		lua_createtable(L, count, 0);
-	}
-
 	// Search for 1-WIRE sensors in build
-	while (csensor->id) {
+	for(; csensor->id; csensor++) {
 		if (csensor->interface == OWIRE_INTERFACE) {
 			// Get sensor definition
 			sensor = get_sensor(csensor->id);
@@ -490,6 +551,7 @@ static int lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin) {
 				// Setup this sensor for init bus
 				setup.owire.gpio = pin;
 				setup.owire.owsensor = 1;
+				instance = NULL;
 				sensor_setup(sensor, &setup, &instance);
 				if (instance) {
 					sensor_value_t *type;
@@ -498,6 +560,7 @@ static int lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin) {
 					uint8_t owdev = instance->setup.owire.owdevice;
 					sensor_get(instance, "type", &type);
 					if (!type) {
+						sensor_unsetup(instance);
 						continue;
 					}
 
@@ -507,15 +570,18 @@ static int lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin) {
 						}
 
 						if (!table) {
-							printf("%-10s  %02d       %s    %s\r\n",csensor->id, i+1, rombuf, type->stringd.value);
+							printf("%-10s  %02d    %02d       %s    %s\r\n",csensor->id, pin, i+1, rombuf, type->stringd.value);
 						} else {
-							lua_pushinteger(L, i);
+							lua_pushinteger(L, *count);
 
-							lua_createtable(L, 0, 5);
+							lua_createtable(L, 0, 6);
 
 					        lua_pushstring(L, (char *)csensor->id);
 					        lua_setfield (L, -2, "id");
 
+					        lua_pushinteger(L, pin);
+					        lua_setfield (L, -2, "gpio");
+
 					        lua_pushinteger(L, i+1);
 					        lua_setfield (L, -2, "device");
 
@@ -531,30 +597,41 @@ static int lsensor_enumerate_owire( lua_State* L, uint8_t table, int pin) {
 
 					        lua_settable(L,-3);
 						}
+
+						(*count)++;
 					}
 
-					free(instance);
+					sensor_unsetup(instance);
 				}
 			}
 		}
-
-		csensor++;
-	}
-
-	if (!table) {
-		printf("\r\n");
 	}
-
-	return table;
 }
 
 static int lsensor_enumerate( lua_State* L ) {
+	driver_error_t *error;
 	uint8_t table = 0;
+	int pins[MAX_ONEWIRE_PINS];
+	int npins, i, dev, count;
+	uint32_t mask;
 
 	int e_type = luaL_checkinteger(L, 1);
 
 	if (e_type == OWIRE_INTERFACE) {
-		int pin = luaL_checkinteger(L, 2);
+		// A pin, or a table of pins
+		if (lua_istable(L, 2)) {
+			npins = lua_rawlen(L, 2);
+			luaL_argcheck(L, (npins > 0) && (npins <= MAX_ONEWIRE_PINS), 2, "invalid number of pins");
+
+			for(i = 0; i < npins; i++) {
+				lua_rawgeti(L, 2, i + 1);
+				pins[i] = luaL_checkinteger(L, -1);
+				lua_pop(L, 1);
+			}
+		} else {
+			pins[0] = luaL_checkinteger(L, 2);
+			npins = 1;
+		}
 
 		// Check if user wants result as a table, or wants result
 		// on the console
@@ -565,7 +642,40 @@ static int lsensor_enumerate( lua_State* L ) {
 			}
 		}
 
-		return lsensor_enumerate_owire(L, table, pin);
+		// Setup the buses, and search all of them at the same time. Then, the
+		// sensors setup below use the ROMs found.
+		mask = 0;
+		for(i = 0; i < npins; i++) {
+			if ((error = owire_setup_pin(pins[i]))) {
+				return luaL_driver_error(L, error);
+			}
+
+			if ((dev = owire_checkpin(pins[i])) >= 0) {
+				mask |= (1 << dev);
+			}
+		}
+
+		if ((error = owire_search(mask))) {
+			return luaL_driver_error(L, error);
+		}
+
+		if (!table) {
+			printf("SENSOR      GPIO  DEVICE   ADDRESS             MODEL         \r\n");
+			printf("-------------------------------------------------------------\r\n");
+		} else {
+			lua_createtable(L, 0, 0);
+		}
+
+		count = 0;
+		for(i = 0; i < npins; i++) {
+			lsensor_enumerate_owire(L, table, pins[i], &count);
+		}
+
+		if (!table) {
+			printf("\r\n");
+		}
+
+		return table;
 	} else {
 		return luaL_exception(L, SENSOR_ERR_INTERFACE_NOT_SUPPORTED);
 	}
@@ -579,7 +689,7 @@ static int lsensor_ins_gc (lua_State *L) {
 
     udata = (sensor_userdata *)luaL_checkudata(L, 1, "sensor.ins");
 	if (udata) {
-		free(udata->instance);
+		sensor_unsetup(udata->instance);
 	}
 
 	return 0;
@@ -598,6 +708,7 @@ static const LUA_REG_TYPE lsensor_map[] = {
 static const LUA_REG_TYPE lsensor_ins_map[] = {
 	{ LSTRKEY( "acquire"     ),	LFUNCVAL( lsensor_acquire   ) },
   	{ LSTRKEY( "read"        ),	LFUNCVAL( lsensor_read 	    ) },
+  	{ LSTRKEY( "sample"      ),	LFUNCVAL( lsensor_sample    ) },
   	{ LSTRKEY( "set"         ),	LFUNCVAL( lsensor_set 	    ) },
   	{ LSTRKEY( "get"         ),	LFUNCVAL( lsensor_get 	    ) },
     { LSTRKEY( "__metatable" ),	LROVAL  ( lsensor_ins_map   ) },
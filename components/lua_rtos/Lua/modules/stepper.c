@@ -38,6 +38,8 @@
 #include "error.h"
 #include "modules.h"
 
+#include "driver/timer.h"
+
 #include <drivers/gpio.h>
 #include <drivers/stepper.h>
 
@@ -83,16 +85,13 @@ static int lstepper_attach( lua_State* L ){
     return 1;
 }
 
-static int lstepper_move( lua_State* L ){
-    stepper_userdata *lstepper = NULL;
-
-    lstepper = (stepper_userdata *)luaL_checkudata(L, 1, "stepper.inst");
-    luaL_argcheck(L, lstepper, 1, "stepper expected");
-
-    double units  = luaL_checknumber(L, 2);
-    double speed  = luaL_optnumber(L, 3, lstepper->max_spd); // Speed in units / min (800 rpm by default)
-    double accel  = luaL_optnumber(L, 4, lstepper->accel);   // Acceleration in units/secs^2 (2)
-
+/*
+ * Compute steps, ramp steps, and initial / end frequencies, for moving a
+ * stepper the given units at the given speed (units / min), with the given
+ * acceleration (units / secs^2).
+ */
+static void lstepper_plan(stepper_userdata *lstepper, double units, double speed, double accel,
+		                  uint8_t *dir, uint32_t *steps, uint32_t *ramp, double *ifreq, double *efreq) {
     double ispd = lstepper->min_spd;
     double stpu = lstepper->stpu;
 
@@ -101,11 +100,11 @@ static int lstepper_move( lua_State* L ){
     }
 
     // Calculate direction
-    uint8_t dir = (units >= 0.0);
+    *dir = (units >= 0.0);
 
 	// Calculate steps needed for move the axis
     double absUnits = fabs(units);
-    double steps = absUnits * stpu;
+    double nsteps = absUnits * stpu;
 
 	// Remembrer:
 	//
@@ -133,18 +132,96 @@ static int lstepper_move( lua_State* L ){
 	// desired accelerarion
     double acc_steps = acc_dist * stpu;
 
-	if ((steps - 2 * acc_steps) < 0) {
-		acc_steps = floor(steps / 2.0);
+	if ((nsteps - 2 * acc_steps) < 0) {
+		acc_steps = floor(nsteps / 2.0);
 	}
 
 	// Calculate initial and end frequency
-	double ifreq = (ispd * stpu) / 60.0;
-	double efreq = (speed * stpu) / 60.0;
+	*ifreq = floor((ispd * stpu) / 60.0);
+	*efreq = floor((speed * stpu) / 60.0);
+
+	*steps = (uint32_t)floor(nsteps);
+	*ramp = (uint32_t)floor(acc_steps);
+}
+
+static int lstepper_move( lua_State* L ){
+	driver_error_t *error;
+    stepper_userdata *lstepper = NULL;
+    uint32_t steps, ramp;
+    double ifreq, efreq;
+    uint8_t dir;
+
+    lstepper = (stepper_userdata *)luaL_checkudata(L, 1, "stepper.inst");
+    luaL_argcheck(L, lstepper, 1, "stepper expected");
+
+    double units  = luaL_checknumber(L, 2);
+    double speed  = luaL_optnumber(L, 3, lstepper->max_spd); // Speed in units / min (800 rpm by default)
+    double accel  = luaL_optnumber(L, 4, lstepper->accel);   // Acceleration in units/secs^2 (2)
+    int profile   = luaL_optinteger(L, 5, STEPPER_PROFILE_TRAPEZOIDAL);
+
+    lstepper_plan(lstepper, units, speed, accel, &dir, &steps, &ramp, &ifreq, &efreq);
+
+    if ((error = stepper_move(lstepper->unit, dir, steps, ramp, ifreq, efreq, profile))) {
+    	return luaL_driver_error(L, error);
+    }
 
-    stepper_move(
-    		lstepper->unit, dir, (uint32_t)floor(steps), (uint32_t)floor(acc_steps),
-			(uint32_t)floor(ifreq), (uint32_t)floor(efreq)
-	);
+    return 0;
+}
+
+/*
+ * Coordinated move: stepper.line(s1, units1, s2, units2, ... [, speed [, accel [, profile]]])
+ *
+ * Speed and acceleration are for the stepper with the most steps, the other
+ * steppers follow it, so all steppers start and end at the same time. Start
+ * the movement with stepper.start.
+ */
+static int lstepper_line( lua_State* L ){
+	driver_error_t *error;
+    stepper_userdata *lstepper[NSTEP];
+    double units[NSTEP];
+    uint32_t steps[NSTEP], ramp;
+    double ifreq, efreq;
+    uint8_t dir[NSTEP];
+    int n = 0, master = 0;
+    int arg = 1;
+    int i;
+
+    while (lua_isuserdata(L, arg)) {
+    	luaL_argcheck(L, n < NSTEP, arg, "too many steppers");
+
+    	lstepper[n] = (stepper_userdata *)luaL_checkudata(L, arg, "stepper.inst");
+    	units[n] = luaL_checknumber(L, arg + 1);
+
+    	dir[n] = (units[n] >= 0.0);
+    	steps[n] = (uint32_t)floor(fabs(units[n]) * lstepper[n]->stpu);
+
+    	if (steps[n] > steps[master]) {
+    		master = n;
+    	}
+
+    	n++;
+    	arg += 2;
+    }
+
+    luaL_argcheck(L, n > 0, 1, "stepper expected");
+
+    double speed  = luaL_optnumber(L, arg, lstepper[master]->max_spd);
+    double accel  = luaL_optnumber(L, arg + 1, lstepper[master]->accel);
+    int profile   = luaL_optinteger(L, arg + 2, STEPPER_PROFILE_TRAPEZOIDAL);
+
+    lstepper_plan(lstepper[master], units[master], speed, accel, &dir[master], &steps[master], &ramp, &ifreq, &efreq);
+
+    if ((error = stepper_move(lstepper[master]->unit, dir[master], steps[master], ramp, ifreq, efreq, profile))) {
+    	return luaL_driver_error(L, error);
+    }
+
+    for(i = 0; i < n; i++) {
+    	if (i != master) {
+    	    if ((error = stepper_follow(lstepper[i]->unit, lstepper[master]->unit, dir[i], steps[i]))) {
+    	    	return luaL_driver_error(L, error);
+    	    }
+    	}
+    }
 
     return 0;
 }
@@ -170,10 +247,35 @@ static int lstepper_start( lua_State* L ){
     return 0;
 }
 
+/*
+ * Interrupt handler measures: max step rate achieved by a unit (Hz, from the
+ * shortest time between two steps, 0 if no unit has done two steps), max and
+ * average time in the interrupt handler (usecs), and clock jitter (usecs,
+ * difference between max and min interrupt latency).
+ */
+static int lstepper_stats( lua_State* L ){
+	stepper_stats_t stats;
+
+	int reset = lua_toboolean(L, 1);
+
+	stepper_stats(&stats, reset);
+
+	lua_pushnumber(L, (stats.step_min != 0xffffffff)?(double)CPU_HZ / (double)stats.step_min:0.0);
+	lua_pushnumber(L, (double)stats.isr_max / (CPU_HZ / 1000000.0));
+	lua_pushnumber(L, stats.isr?((double)stats.isr_total / (double)stats.isr) / (CPU_HZ / 1000000.0):0.0);
+	lua_pushnumber(L, stats.isr?((double)(stats.latency_max - stats.latency_min) * 1000000.0) / (double)STEPPER_TIMER_HZ:0.0);
+
+	return 4;
+}
+
 static const LUA_REG_TYPE lstepper_map[] = {
     { LSTRKEY( "attach" ),		  LFUNCVAL( lstepper_attach    ) },
 	{ LSTRKEY( "error"  ), 		  LROVAL  ( stepper_error_map  ) },
 	{ LSTRKEY( "start"  ),		  LFUNCVAL( lstepper_start     ) },
+	{ LSTRKEY( "line"   ),		  LFUNCVAL( lstepper_line      ) },
+	{ LSTRKEY( "stats"  ),		  LFUNCVAL( lstepper_stats     ) },
+	{ LSTRKEY( "TRAPEZOIDAL" ),	  LINTVAL ( STEPPER_PROFILE_TRAPEZOIDAL ) },
+	{ LSTRKEY( "SCURVE"      ),	  LINTVAL ( STEPPER_PROFILE_SCURVE      ) },
 	{ LNILKEY, LNILVAL }
 };
 
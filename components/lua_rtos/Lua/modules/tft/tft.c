@@ -13,9 +13,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "tft/tftspi.h"
 #include "time.h"
@@ -1014,10 +1017,160 @@ static uint8_t getMaxWidth(void) {
   return w;
 }
 
+// ================ Glyph index & cache ========================================
+// Proportional fonts are indexed once when selected, so glyph lookup does not
+// walk the font table. Non rotated glyphs drawn on an opaque background are
+// rasterised once per (font, char, fg, bg) into a cell of RGB565 words that is
+// sent to the display in a single address window / SPI burst.
+
+typedef struct {
+	const uint8_t *font;	// font the glyph was rasterised from (NULL = free slot)
+	uint16_t      *pixels;	// w * h words, in the byte order the display expects
+	uint16_t      fg;
+	uint16_t      bg;
+	uint8_t       code;
+	uint8_t       fixed;	// _forceFixed when rasterised
+	uint8_t       w;
+	uint8_t       h;
+} glyph_t;
+
+static uint16_t glyph_index[256];	// char code -> offset of glyph header, 0 = not in font
+static glyph_t  glyph_cache[TFT_GLYPH_CACHE_SIZE];
+
+// Words sent by TFT_pushColorRep / drawPixel for a given color
+#define glyph_fill_word(color)	(color)
+#define glyph_pixel_word(color)	((uint16_t)(((color) >> 8) | ((color) << 8)))
+
+//------------------------------
+static void glyph_cache_flush() {
+	int i;
+
+	for(i=0;i < TFT_GLYPH_CACHE_SIZE;i++) {
+		if (glyph_cache[i].pixels) {
+			free(glyph_cache[i].pixels);
+		}
+	}
+
+	memset(glyph_cache, 0, sizeof(glyph_cache));
+}
+
+// build the char code -> glyph offset table of the current proportional font
+//--------------------------------
+static void glyph_index_build() {
+  uint16_t tempPtr = 4; // point at first char data
+  uint8_t cc, cw, ch;
+
+  memset(glyph_index, 0, sizeof(glyph_index));
+  if ((cfont.font == NULL) || (cfont.x_size != 0)) return;
+
+  do {
+    cc = cfont.font[tempPtr];
+    cw = cfont.font[tempPtr + 2];
+    ch = cfont.font[tempPtr + 3];
+
+    if (cc != 0xFF) {
+      glyph_index[cc] = tempPtr;
+      tempPtr += 6;
+      // packed bits
+      if (cw != 0) tempPtr += (((cw * ch)-1) / 8) + 1;
+    }
+  } while (cc != 0xFF);
+}
+
+// Get the cache slot for (current font, c, _fg, _bg). On a miss (*hit = 0) the
+// slot is returned filled with the background color, and the caller must
+// draw the glyph foreground into it. Returns NULL if the cell can't be cached.
+//------------------------------------------------------------------
+static glyph_t *glyph_cache_get(uint8_t c, int w, int h, int *hit) {
+	glyph_t *g;
+
+	*hit = 0;
+	if ((w <= 0) || (h <= 0) || ((w * h) > TFT_GLYPH_MAX_PIXELS)) return NULL;
+
+	g = &glyph_cache[(c ^ ((uint32_t)cfont.font >> 4)) & (TFT_GLYPH_CACHE_SIZE - 1)];
+	if ((g->font == cfont.font) && (g->code == c) && (g->fg == _fg) && (g->bg == _bg) &&
+		(g->fixed == _forceFixed) && (g->w == w) && (g->h == h)) {
+		*hit = 1;
+		return g;
+	}
+
+	// Evict
+	if (g->pixels) {
+		free(g->pixels);
+	}
+
+	memset(g, 0, sizeof(glyph_t));
+
+	g->pixels = (uint16_t *)malloc(sizeof(uint16_t) * w * h);
+	if (!g->pixels) return NULL;
+
+	g->font = cfont.font;
+	g->code = c;
+	g->fg = _fg;
+	g->bg = _bg;
+	g->fixed = _forceFixed;
+	g->w = w;
+	g->h = h;
+
+	// Fill background, caller draws the foreground
+	uint16_t bg = glyph_fill_word(_bg);
+	for(int i=0;i < w * h;i++) {
+		g->pixels[i] = bg;
+	}
+
+	return g;
+}
+
+// returns 1 if the cell (x,y,w,h) is entirely inside the clip window
+//---------------------------------------------------------
+static int glyph_cell_visible(int x, int y, int w, int h) {
+	return ((x >= dispWin.x1) && (y >= dispWin.y1) && ((x + w - 1) <= dispWin.x2) && ((y + h - 1) <= dispWin.y2));
+}
+
+// draw the foreground runs of a glyph row in transparent mode
+// bits are read from cfont.font starting at *ptr / *mask
+//----------------------------------------------------------------------------------------
+static void glyph_draw_row_runs(int x, int y, int width, uint16_t *ptr, uint8_t *mask, uint8_t *ch) {
+	int i, start = -1;
+	uint16_t color = glyph_pixel_word(_fg);
+
+	// If row is clipped only advance the bit pointer
+	int visible = ((y >= dispWin.y1) && (y <= dispWin.y2));
+
+	for (i=0; i <= width; i++) {
+		int set = 0;
+
+		if (i < width) {
+			if (*mask == 0) {
+				*mask = 0x80;
+				*ch = cfont.font[(*ptr)++];
+			}
+			set = ((*ch & *mask) != 0);
+			*mask >>= 1;
+		}
+
+		if (set && (start < 0)) start = i;
+		else if (!set && (start >= 0)) {
+			int x1 = x + start;
+			int x2 = x + i - 1;
+
+			if (x1 < dispWin.x1) x1 = dispWin.x1;
+			if (x2 > dispWin.x2) x2 = dispWin.x2;
+			if (visible && (x1 <= x2)) {
+				for (int k=0; k <= (x2 - x1); k++) tft_line[k] = color;
+				send_data(x1, y, x2, y, x2 - x1 + 1, tft_line);
+			}
+			start = -1;
+		}
+	}
+}
+
 //--------------------------------------------------------
 static int load_file_font(const char * fontfile, int info)
 {
 	if (userfont != NULL) {
+		// Cached glyphs may point to the font we are going to release
+		glyph_cache_flush();
 		free(userfont);
 		userfont = NULL;
 	}
@@ -1164,41 +1317,38 @@ static void TFT_setFont(uint8_t font, const char *font_file)
 	  if (cfont.x_size != 0) cfont.numchars = cfont.font[3];
 	  else cfont.numchars = getMaxWidth();
   }
+
+  glyph_index_build();
 }
 
 // private method to return the Glyph data for an individual character in the proportional font
 //--------------------------------
 static int getCharPtr(uint8_t c) {
-  uint16_t tempPtr = 4; // point at first char data
+  uint16_t tempPtr = glyph_index[c];
 
-  do {
-    fontChar.charCode = cfont.font[tempPtr++];
-    fontChar.adjYOffset = cfont.font[tempPtr++];
-    fontChar.width = cfont.font[tempPtr++];
-    fontChar.height = cfont.font[tempPtr++];
-    fontChar.xOffset = cfont.font[tempPtr++];
-    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : (0x100 - fontChar.xOffset);
-    fontChar.xDelta = cfont.font[tempPtr++];
-
-    if (c != fontChar.charCode && fontChar.charCode != 0xFF) {
-      if (fontChar.width != 0) {
-        // packed bits
-        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
-      }
-    }
-  } while (c != fontChar.charCode && fontChar.charCode != 0xFF);
+  if (tempPtr == 0) {
+    // not in font
+    memset(&fontChar, 0, sizeof(fontChar));
+    fontChar.charCode = 0xFF;
+    return 0;
+  }
 
+  fontChar.charCode = cfont.font[tempPtr++];
+  fontChar.adjYOffset = cfont.font[tempPtr++];
+  fontChar.width = cfont.font[tempPtr++];
+  fontChar.height = cfont.font[tempPtr++];
+  fontChar.xOffset = cfont.font[tempPtr++];
+  fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : (0x100 - fontChar.xOffset);
+  fontChar.xDelta = cfont.font[tempPtr++];
   fontChar.dataPtr = tempPtr;
-  if (c == fontChar.charCode) {
-    if (_forceFixed > 0) {
-      // fix width & offset for forced fixed width
-      fontChar.xDelta = cfont.numchars;
-      fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
-    }
+
+  if (_forceFixed > 0) {
+    // fix width & offset for forced fixed width
+    fontChar.xDelta = cfont.numchars;
+    fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
   }
 
-  if (fontChar.charCode != 0xFF) return 1;
-  else return 0;
+  return 1;
 }
 
 // print rotated proportional character
@@ -1239,12 +1389,59 @@ static int rotatePropChar(int x, int y, int offset) {
 static int printProportionalChar(int x, int y) {
   uint8_t i,j,ch=0;
   uint16_t cx,cy;
+  glyph_t *g = NULL;
+  int hit;
+  int w = fontChar.xDelta+1;
+  int h = cfont.y_size;
+
+  if (_transparent) {
+    // draw Glyph foreground as horizontal runs
+    uint16_t ptr = fontChar.dataPtr;
+    uint8_t mask = 0;
+
+    for (j=0; j < fontChar.height; j++) {
+      glyph_draw_row_runs(x+fontChar.xOffset, y+j+fontChar.adjYOffset, fontChar.width, &ptr, &mask, &ch);
+    }
+
+    return fontChar.xDelta;
+  }
 
-  // fill background if not transparent background
-  if (!_transparent) {
-    TFT_fillRect(x, y, fontChar.xDelta+1, cfont.y_size, _bg);
+  if (glyph_cell_visible(x, y, w, h) &&
+      ((fontChar.xOffset + fontChar.width) <= w) && ((fontChar.adjYOffset + fontChar.height) <= h)) {
+    g = glyph_cache_get(fontChar.charCode, w, h, &hit);
   }
 
+  if (g) {
+    if (!hit) {
+      // rasterise Glyph into the cell
+      uint16_t fg = glyph_pixel_word(_fg);
+      uint8_t mask = 0x80;
+      uint16_t ptr = fontChar.dataPtr;
+
+      for (j=0; j < fontChar.height; j++) {
+        for (i=0; i < fontChar.width; i++) {
+          if (((i + (j*fontChar.width)) % 8) == 0) {
+            mask = 0x80;
+            ch = cfont.font[ptr++];
+          }
+
+          if ((ch & mask) != 0) {
+            g->pixels[((j+fontChar.adjYOffset) * w) + fontChar.xOffset + i] = fg;
+          }
+          mask >>= 1;
+        }
+      }
+    }
+
+    // whole cell (background + Glyph) in one burst
+    send_data(x, y, x+w-1, y+h-1, w*h, g->pixels);
+
+    return fontChar.xDelta;
+  }
+
+  // fill background
+  TFT_fillRect(x, y, fontChar.xDelta+1, cfont.y_size, _bg);
+
   // draw Glyph
   uint8_t mask = 0x80;
   spi_ll_select(disp_spi);
@@ -1281,11 +1478,52 @@ static void printChar(uint8_t c, int x, int y) {
   // get char address
   temp = ((c-cfont.offset)*((fz)*cfont.y_size))+4;
 
-  // fill background if not transparent background
-  if (!_transparent) {
-    TFT_fillRect(x, y, cfont.x_size, cfont.y_size, _bg);
+  if (_transparent) {
+    // draw Glyph foreground as horizontal runs, rows are byte aligned
+    for (j=0; j<cfont.y_size; j++) {
+      mask = 0;
+      glyph_draw_row_runs(x, y+j, fz * 8, &temp, &mask, &ch);
+    }
+
+    return;
+  }
+
+  glyph_t *g = NULL;
+  int hit;
+
+  if (glyph_cell_visible(x, y, cfont.x_size, cfont.y_size)) {
+    g = glyph_cache_get(c, cfont.x_size, cfont.y_size, &hit);
   }
 
+  if (g) {
+    if (!hit) {
+      // rasterise Glyph into the cell
+      uint16_t fg = glyph_pixel_word(_fg);
+
+      for (j=0; j<cfont.y_size; j++) {
+        for (k=0; k < fz; k++) {
+          ch = cfont.font[temp+k];
+          mask=0x80;
+          for (i=0; i<8; i++) {
+            if (((ch & mask) != 0) && ((i+(k*8)) < cfont.x_size)) {
+              g->pixels[(j * cfont.x_size) + i + (k*8)] = fg;
+            }
+            mask >>= 1;
+          }
+        }
+        temp += (fz);
+      }
+    }
+
+    // whole cell (background + Glyph) in one burst
+    send_data(x, y, x+cfont.x_size-1, y+cfont.y_size-1, cfont.x_size * cfont.y_size, g->pixels);
+
+    return;
+  }
+
+  // fill background
+  TFT_fillRect(x, y, cfont.x_size, cfont.y_size, _bg);
+
   spi_ll_select(disp_spi);
   for (j=0; j<cfont.y_size; j++) {
     for (k=0; k < fz; k++) {
@@ -1957,6 +2195,29 @@ static void _initvar(void) {
 
 
 // ================ JPG SUPPORT ================================================
+// Decoded MCUs are collected into row bands (one MCU row, image width). While a
+// band is sent to the display by the jpg sender task, the next one is decoded
+// into the other band buffer.
+
+// Band of decoded pixels
+typedef struct {
+	uint16_t *buf;		// pixels, in display byte order
+	uint16_t x1;		// band window
+	uint16_t y1;
+	uint16_t x2;
+	uint16_t y2;
+} jpg_band_t;
+
+// Time spent in each stage of the last decoded image, in usecs
+typedef struct {
+	uint32_t read;		// reading the input stream
+	uint32_t decode;	// decoding (excluding read and wait)
+	uint32_t transfer;	// sending bands to the display
+	uint32_t wait;		// decoder waiting for a free band
+	uint32_t total;
+	uint32_t bands;		// number of bands sent
+} jpg_stats_t;
+
 // User defined device identifier
 typedef struct {
 	FILE *fhndl;		// File handler for input function
@@ -1965,8 +2226,102 @@ typedef struct {
     uint8_t *membuff;	// memory buffer containing the image
     uint32_t bufsize;	// size of the memory buffer
     uint32_t bufptr;	// memory buffer current possition
+    uint8_t *rdbuf;		// file read buffer (NULL = unbuffered)
+    uint32_t rdlen;		// bytes in read buffer
+    uint32_t rdpos;		// read buffer current possition
+    jpg_band_t band[2];	// band buffers (band[0].buf == NULL = no bands)
+    jpg_band_t *cur;	// band being filled
+    uint16_t bw;		// band width
 } JPGIODEV;
 
+static jpg_stats_t jpg_stats;
+static xQueueHandle jpg_band_q = NULL;		// bands to send
+static xQueueHandle jpg_free_q = NULL;		// bands already sent
+static xSemaphoreHandle jpg_mtx = NULL;		// one decoding at a time
+
+//--------------------------------
+static uint32_t jpg_time_us(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint32_t)((tv.tv_sec * 1000000) + tv.tv_usec);
+}
+
+// Send decoded bands to the display
+//-------------------------------------------
+static void jpg_sender_task(void *arg) {
+	jpg_band_t *band;
+	uint32_t t0;
+
+	for(;;) {
+		xQueueReceive(jpg_band_q, &band, portMAX_DELAY);
+
+		t0 = jpg_time_us();
+		send_data(band->x1, band->y1, band->x2, band->y2, (band->x2 - band->x1 + 1) * (band->y2 - band->y1 + 1), band->buf);
+		jpg_stats.transfer += jpg_time_us() - t0;
+		jpg_stats.bands++;
+
+		xQueueSend(jpg_free_q, &band, portMAX_DELAY);
+	}
+}
+
+// Create the sender task and it's queues, if not created.
+// jpg_mtx is only set when the queues and the task exist.
+//----------------------------
+static int jpg_sender_init() {
+	xSemaphoreHandle mtx;
+	BaseType_t res;
+	int core;
+
+	if (jpg_mtx) return 1;
+
+	mtx = xSemaphoreCreateMutex();
+	jpg_band_q = xQueueCreate(2, sizeof(jpg_band_t *));
+	jpg_free_q = xQueueCreate(2, sizeof(jpg_band_t *));
+
+	if (!mtx || !jpg_band_q || !jpg_free_q) {
+		syslog(LOG_ERR, "tft can't create jpg sender queues");
+		goto fail;
+	}
+
+	// Send on the other core, if any
+	#if CONFIG_FREERTOS_UNICORE
+	core = 0;
+	#else
+	core = xPortGetCoreID() ^ 1;
+	#endif
+
+	res = xTaskCreatePinnedToCore(jpg_sender_task, "tftjpg", 2048, NULL, CONFIG_LUA_RTOS_LUA_TASK_PRIORITY, NULL, core);
+	if (res != pdPASS) {
+		syslog(LOG_ERR, "tft can't create jpg sender task");
+		goto fail;
+	}
+
+	jpg_mtx = mtx;
+
+	return 1;
+
+fail:
+	if (mtx) vSemaphoreDelete(mtx);
+	if (jpg_band_q) vQueueDelete(jpg_band_q);
+	if (jpg_free_q) vQueueDelete(jpg_free_q);
+
+	jpg_band_q = NULL;
+	jpg_free_q = NULL;
+
+	return 0;
+}
+
+// Queue current band to the sender task
+//-----------------------------------------
+static void jpg_band_flush(JPGIODEV *dev) {
+	if (dev->cur) {
+		xQueueSend(jpg_band_q, &dev->cur, portMAX_DELAY);
+		dev->cur = NULL;
+	}
+}
+
 
 // User defined call-back function to input JPEG data from file
 //---------------------
@@ -1977,17 +2332,40 @@ static UINT tjd_input (
 )
 {
 	int rb = 0;
+	uint32_t t0 = jpg_time_us();
 	// Device identifier for the session (5th argument of jd_prepare function)
 	JPGIODEV *dev = (JPGIODEV*)jd->device;
 
-	if (buff) {	// Read nd bytes from the input strem
+	if (dev->rdbuf) {
+		// Serve from the read buffer, which is refilled in TFT_JPG_READ_BUF_SIZE chunks
+		UINT n;
+
+		while (rb < nd) {
+			if (dev->rdpos >= dev->rdlen) {
+				dev->rdlen = fread(dev->rdbuf, 1, TFT_JPG_READ_BUF_SIZE, dev->fhndl);
+				dev->rdpos = 0;
+				if (dev->rdlen == 0) break;
+			}
+
+			n = dev->rdlen - dev->rdpos;
+			if (n > (nd - rb)) n = nd - rb;
+
+			if (buff) memcpy(buff + rb, dev->rdbuf + dev->rdpos, n);
+
+			dev->rdpos += n;
+			rb += n;
+		}
+	}
+	else if (buff) {	// Read nd bytes from the input strem
 		rb = fread(buff, 1, nd, dev->fhndl);
-		return rb;	// Returns actual number of bytes read
 	}
 	else {	// Remove nd bytes from the input stream
-		if (fseek(dev->fhndl, nd, SEEK_CUR) >= 0) return nd;
-		else return 0;
+		if (fseek(dev->fhndl, nd, SEEK_CUR) >= 0) rb = nd;
 	}
+
+	jpg_stats.read += jpg_time_us() - t0;
+
+	return rb;	// Returns actual number of bytes read
 }
 
 // User defined call-back function to input JPEG data from memory buffer
@@ -2057,7 +2435,11 @@ static UINT tjd_output (
 	    }
 	    if (right > _width) right = _width-1;
 	    if (bottom > _height) bottom = _height-1;
+
+	    uint32_t t0 = jpg_time_us();
 	    send_data(left, top, right, bottom, bufidx, tft_line);
+	    jpg_stats.transfer += jpg_time_us() - t0;
+	    jpg_stats.bands++;
 	}
 	else {
 		syslog(LOG_ERR, "max data size exceded: %d (%d,%d,%d,%d)", len, left,top,right,bottom);
@@ -2067,6 +2449,63 @@ static UINT tjd_output (
 	return 1;	// Continue to decompression
 }
 
+// User defined call-back function to output RGB bitmap into the row bands
+//---------------------------
+static UINT tjd_band_output (
+	JDEC* jd,		// Decompression object of current session
+	void* bitmap,	// Bitmap data to be output
+	JRECT* rect		// Rectangular region to output
+)
+{
+	// Device identifier for the session (5th argument of jd_prepare function)
+	JPGIODEV *dev = (JPGIODEV*)jd->device;
+
+	uint16_t x;
+	uint16_t y;
+	BYTE *src = (BYTE*)bitmap;
+	uint16_t left = rect->left + dev->x;
+	uint16_t top = rect->top + dev->y;
+	uint16_t right = rect->right + dev->x;
+	uint16_t bottom = rect->bottom + dev->y;
+	uint16_t *dst;
+
+	if ((left >= _width) || (top >= _height)) return 1;	// out of screen area, return
+
+	if (bottom >= _height) bottom = _height - 1;
+
+	// A new MCU row starts a new band
+	if (dev->cur && (dev->cur->y1 != top)) {
+		jpg_band_flush(dev);
+	}
+
+	if (!dev->cur) {
+		uint32_t t0 = jpg_time_us();
+
+		xQueueReceive(jpg_free_q, &dev->cur, portMAX_DELAY);
+		jpg_stats.wait += jpg_time_us() - t0;
+
+		dev->cur->x1 = dev->x;
+		dev->cur->x2 = dev->x + dev->bw - 1;
+		dev->cur->y1 = top;
+		dev->cur->y2 = top;
+	}
+
+	if (bottom > dev->cur->y2) dev->cur->y2 = bottom;
+
+	for (y = top; y <= rect->bottom + dev->y; y++) {
+		dst = dev->cur->buf + ((y - top) * dev->bw) + (left - dev->x);
+		for (x = left; x <= right; x++) {
+			// Clip to display area
+			if ((x <= dev->cur->x2) && (y <= bottom)) {
+				*dst++ = (uint16_t)src[0] | ((uint16_t)src[1] << 8);
+			}
+			src += 2;
+		}
+	}
+
+	return 1;	// Continue to decompression
+}
+
 #if CONFIG_LUA_RTOS_LUA_USE_CAM
 extern uint8_t *cam_get_image(FILE *fhndl, int *err, uint32_t *bytes_read, uint8_t capture);
 #endif
@@ -2100,6 +2539,8 @@ static int ltft_jpg_image( lua_State* L )
         return luaL_error(L, "Line buffer not allocated");
     }
 
+    memset(&dev, 0, sizeof(dev));
+
 	#if CONFIG_LUA_RTOS_LUA_USE_CAM
     if ((strcmp(fname, "CAM") == 0) || (strcmp(fname, "cam") == 0)) {
     	// image from camera
@@ -2148,12 +2589,25 @@ static int ltft_jpg_image( lua_State* L )
 	BYTE scale = 0;
 	uint8_t radj = 0;
 	uint8_t badj = 0;
+	uint8_t banded = 0;
+	uint32_t t_start;
+	jpg_band_t *band;
 
 	if ((x < 0) && (x != CENTER) && (x != RIGHT)) x = 0;
 	if ((y < 0) && (y != CENTER) && (y != BOTTOM)) y = 0;
 	if (x > (_width-5)) x = _width - 5;
 	if (y > (_height-5)) y = _height - 5;
 
+	// Sender task is also used to serialize decodings, as stats are global
+	if (jpg_sender_init()) {
+		xSemaphoreTake(jpg_mtx, portMAX_DELAY);
+	}
+
+	memset(&jpg_stats, 0, sizeof(jpg_stats));
+	t_start = jpg_time_us();
+
+	if (dev.fhndl) dev.rdbuf = malloc(TFT_JPG_READ_BUF_SIZE);
+
 	work = malloc(sz_work);
 	if (work) {
 		if (dev.membuff) rc = jd_prepare(&jd, tjd_buf_input, (void *)work, sz_work, &dev);
@@ -2220,8 +2674,44 @@ static int ltft_jpg_image( lua_State* L )
 			}
 			dev.x = x;
 			dev.y = y;
+
+			// Band buffers are one MCU row high, and image width clipped to the display
+			dev.bw = jd.width >> scale;
+			if ((dev.x + dev.bw) > _width) dev.bw = _width - dev.x;
+
+			if (jpg_mtx && (dev.bw > 0)) {
+				int bh = (jd.msy * 8) >> scale;
+
+				dev.band[0].buf = malloc(sizeof(uint16_t) * dev.bw * bh);
+				dev.band[1].buf = malloc(sizeof(uint16_t) * dev.bw * bh);
+
+				banded = (dev.band[0].buf && dev.band[1].buf);
+			}
+
 			// Start to decompress the JPEG file
-			rc = jd_decomp(&jd, tjd_output, scale);
+			if (banded) {
+				band = &dev.band[0];
+				xQueueSend(jpg_free_q, &band, portMAX_DELAY);
+				band = &dev.band[1];
+				xQueueSend(jpg_free_q, &band, portMAX_DELAY);
+
+				rc = jd_decomp(&jd, tjd_band_output, scale);
+
+				// Send last band, and wait until all bands are sent
+				jpg_band_flush(&dev);
+
+				uint32_t t0 = jpg_time_us();
+				xQueueReceive(jpg_free_q, &band, portMAX_DELAY);
+				xQueueReceive(jpg_free_q, &band, portMAX_DELAY);
+				jpg_stats.wait += jpg_time_us() - t0;
+			} else {
+				// Not enough memory for bands, output MCU by MCU
+				rc = jd_decomp(&jd, tjd_output, scale);
+			}
+
+			if (dev.band[0].buf) free(dev.band[0].buf);
+			if (dev.band[1].buf) free(dev.band[1].buf);
+
 			if (rc != JDR_OK) {
 				if (dbg) printf("jpg decompression error %d\r\n", rc);
 			}
@@ -2236,12 +2726,55 @@ static int ltft_jpg_image( lua_State* L )
 		if (dbg) printf("work buffer allocation error\r\n");
 	}
 
+	jpg_stats.total = jpg_time_us() - t_start;
+	jpg_stats.decode = jpg_stats.total - jpg_stats.read - jpg_stats.wait;
+	if (!banded) {
+		// Transfers are done by the decoder
+		jpg_stats.decode -= jpg_stats.transfer;
+	}
+
+	if (jpg_mtx) {
+		xSemaphoreGive(jpg_mtx);
+	}
+
+	if (dbg) printf("Image timing (usecs): read %u, decode %u, transfer %u, wait %u, total %u, bands %u\r\n",
+			jpg_stats.read, jpg_stats.decode, jpg_stats.transfer, jpg_stats.wait, jpg_stats.total, jpg_stats.bands);
+
     if (dev.fhndl) fclose(dev.fhndl);  // close input file
     if (dev.membuff) free(dev.membuff);
+    if (dev.rdbuf) free(dev.rdbuf);
 
     return 0;
 }
 
+// Timing breakdown of the last tft.jpgimage call, in usecs
+// tft.jpgstats()
+//=======================================
+static int ltft_jpg_stats( lua_State* L )
+{
+	lua_createtable(L, 0, 6);
+
+	lua_pushinteger(L, jpg_stats.read);
+	lua_setfield(L, -2, "read");
+
+	lua_pushinteger(L, jpg_stats.decode);
+	lua_setfield(L, -2, "decode");
+
+	lua_pushinteger(L, jpg_stats.transfer);
+	lua_setfield(L, -2, "transfer");
+
+	lua_pushinteger(L, jpg_stats.wait);
+	lua_setfield(L, -2, "wait");
+
+	lua_pushinteger(L, jpg_stats.total);
+	lua_setfield(L, -2, "total");
+
+	lua_pushinteger(L, jpg_stats.bands);
+	lua_setfield(L, -2, "bands");
+
+	return 1;
+}
+
 //==================================
 static int tft_image( lua_State* L )
 {
@@ -3411,6 +3944,7 @@ static const LUA_REG_TYPE tft_map[] = {
 	{ LSTRKEY( "stringpos" ),		LFUNCVAL( tft_writepos )},
 	{ LSTRKEY( "image" ),			LFUNCVAL( tft_image )},
 	{ LSTRKEY( "jpgimage" ),		LFUNCVAL( ltft_jpg_image )},
+	{ LSTRKEY( "jpgstats" ),		LFUNCVAL( ltft_jpg_stats )},
 	{ LSTRKEY( "bmpimage" ),		LFUNCVAL( tft_bmpimage )},
 	{ LSTRKEY( "hsb2rgb" ),			LFUNCVAL( tft_HSBtoRGB )},
 	{ LSTRKEY( "setbrightness" ),	LFUNCVAL( tft_set_brightness )},
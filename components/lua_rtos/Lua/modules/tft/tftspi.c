@@ -107,13 +107,15 @@ void IRAM_ATTR disp_spi_set_pixel(int deviceid, uint16_t x, uint16_t y, uint16_t
 // address window must be already set
 //---------------------------------------------------------------------------------------------------------------
 void IRAM_ATTR disp_spi_transfer_color_rep(int deviceid, uint8_t *color, uint32_t len, uint8_t rep) {
-	int i;
+	int i, blen;
 	uint16_t *buffer;
 
 	if (rep) {
-		buffer = (uint16_t *)malloc(sizeof(uint16_t) * 1024);
+		// Short runs (font glyph rows, lines) don't need the whole 1024 words buffer
+		blen = (len > 1024?1024:len);
+		buffer = (uint16_t *)malloc(sizeof(uint16_t) * blen);
 
-		for(i=0;i < 1024;i++) {
+		for(i=0;i < blen;i++) {
 			buffer[i] = *((uint16_t *)color);
 		}
 	} else {
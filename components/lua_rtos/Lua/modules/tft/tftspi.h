@@ -31,6 +31,11 @@
 #define TFT_MAX_DISP_SIZE		480					// maximum display dimension in pixel
 #define TFT_LINEBUF_MAX_SIZE	TFT_MAX_DISP_SIZE	// line buffer maximum size in words (uint16_t)
 
+#define TFT_GLYPH_CACHE_SIZE	32					// number of rasterised glyphs kept (power of 2)
+#define TFT_GLYPH_MAX_PIXELS	1024				// bigger glyph cells are not cached
+
+#define TFT_JPG_READ_BUF_SIZE	2048				// jpg file read chunk size in bytes
+
 //#define tft_color(color) ( (uint16_t)((color >> 8) | (color << 8)) )
 #define swap(a, b) { int16_t t = a; a = b; b = t; }
 
@@ -34,6 +34,7 @@
 #include "lua.h"
 #include "lapi.h"
 #include "lauxlib.h"
+#include "lualib.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "ldo.h"
@@ -61,6 +62,9 @@
 #define LUA_THREAD_ERR_INVALID_PRIORITY     (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) |  5)
 #define LUA_THREAD_ERR_INVALID_CPU_AFFINITY (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) |  6)
 #define LUA_THREAD_ERR_CANNOT_MONITOR_AS_TABLE (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) |  7)
+#define LUA_THREAD_ERR_INVALID_CAPACITY     (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) |  8)
+#define LUA_THREAD_ERR_CANNOT_SEND          (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) |  9)
+#define LUA_THREAD_ERR_CANNOT_LOAD          (DRIVER_EXCEPTION_BASE(THREAD_DRIVER_ID) | 10)
 
 DRIVER_REGISTER_ERROR(THREAD, thread, NotEnoughtMemory, "not enough memory", LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
 DRIVER_REGISTER_ERROR(THREAD, thread, NotAllowed, "not allowed", LUA_THREAD_ERR_NOT_ALLOWED);
@@ -70,10 +74,15 @@ DRIVER_REGISTER_ERROR(THREAD, thread, InvalidStackSize, "invalid stack size", LU
 DRIVER_REGISTER_ERROR(THREAD, thread, InvalidPriority, "invalid priority", LUA_THREAD_ERR_INVALID_PRIORITY);
 DRIVER_REGISTER_ERROR(THREAD, thread, InvalidCPUAffinity, "invalid CPU affinity", LUA_THREAD_ERR_INVALID_CPU_AFFINITY);
 DRIVER_REGISTER_ERROR(THREAD, thread, CannotMonitorAsTable, "you can't monitor thread as table", LUA_THREAD_ERR_CANNOT_MONITOR_AS_TABLE);
+DRIVER_REGISTER_ERROR(THREAD, thread, InvalidCapacity, "invalid channel capacity", LUA_THREAD_ERR_INVALID_CAPACITY);
+DRIVER_REGISTER_ERROR(THREAD, thread, CannotSend, "value can't be sent through a channel", LUA_THREAD_ERR_CANNOT_SEND);
+DRIVER_REGISTER_ERROR(THREAD, thread, CannotLoad, "cannot load thread code", LUA_THREAD_ERR_CANNOT_LOAD);
 
 #define thread_status_RUNNING   1
 #define thread_status_SUSPENDED 2
 
+#include "thread_channel.inc"
+
 // List of Lua threads (this threads are created from Lua)
 static struct list lua_threads;
 
@@ -86,8 +95,12 @@ void thread_terminated(void *args) {
     int *thid = (void *)args;
     int res = list_get(&lua_threads, *thid, (void **)&thread);
     if (!res) {  
-        luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->function_ref);
-        luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->thread_ref);
+        if (thread->isolated) {
+            lua_close(thread->L);
+        } else {
+            luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->function_ref);
+            luaL_unref(thread->PL, LUA_REGISTRYINDEX, thread->thread_ref);
+        }
             
         list_remove(&lua_threads, *thid, 1);
     }
@@ -108,7 +121,8 @@ void *lthread_start_task(void *arg) {
     *thid = thread->thid;
     pthread_cleanup_push(thread_terminated, thid);
 
-    int status = lua_pcall(thread->L, 0, 0, 0);
+    // Arguments are after the function (only isolated threads have them)
+    int status = lua_pcall(thread->L, lua_gettop(thread->L) - 1, 0, 0);
     if (status != LUA_OK) {
         int *tmp;
         
@@ -210,8 +224,12 @@ static int lthread_stop_pthreads(lua_State *L, int thid) {
             _pthread_stop(thread->thread);
             _pthread_free(thread->thread);
 
-            luaL_unref(L, LUA_REGISTRYINDEX, thread->function_ref);
-            luaL_unref(L, LUA_REGISTRYINDEX, thread->thread_ref);
+            if (thread->isolated) {
+                lua_close(thread->L);
+            } else {
+                luaL_unref(L, LUA_REGISTRYINDEX, thread->function_ref);
+                luaL_unref(L, LUA_REGISTRYINDEX, thread->thread_ref);
+            }
 
             list_remove(&lua_threads, idx, 1);
         }
@@ -456,6 +474,7 @@ static int new_thread(lua_State* L, int run) {
     thread->L = lua_newthread(L);
     thread->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
     thread->status = thread_status_SUSPENDED;
+    thread->isolated = 0;
     
     lua_rawgeti(L, LUA_REGISTRYINDEX, thread->function_ref);                
     lua_xmove(L, thread->L, 1);
@@ -527,7 +546,180 @@ static int lthread_start(lua_State* L) {
 // Create a new thread in suspended mode
 static int lthread_create(lua_State* L) {
     return new_thread(L, 0);
-}    
+}
+
+/*
+ * Isolated threads
+ *
+ * An isolated thread runs in its own Lua state, created with lua_newstate,
+ * so it doesn't share a heap, a garbage collector, or a global table with
+ * other threads, and can run Lua code in parallel on the other core. It
+ * only has the base, coroutine, table, string, math and utf8 libraries:
+ * driver modules are not available. Values are exchanged with other threads
+ * through channels.
+ */
+struct isolated_code {
+    const char *code;
+    size_t len;
+    const char *mode;
+    lmessage_t *args;
+};
+
+static const luaL_Reg isolated_libs[] = {
+    {"_G",        luaopen_base},
+    {"coroutine", luaopen_coroutine},
+    {"table",     luaopen_table},
+    {"string",    luaopen_string},
+    {"math",      luaopen_math},
+    {"utf8",      luaopen_utf8},
+    {NULL, NULL}
+};
+
+static int dump_writer(lua_State *L, const void *b, size_t size, void *B) {
+    luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+    return 0;
+}
+
+// Open the libraries of an isolated state, load the code, and push the
+// function and its arguments
+static int isolated_open(lua_State *L) {
+    struct isolated_code *code = (struct isolated_code *)lua_touserdata(L, 1);
+    lmessage_t *args;
+    const luaL_Reg *lib;
+    int n = 0;
+
+    lua_pop(L, 1);
+
+    for(lib = isolated_libs; lib->func; lib++) {
+        luaL_requiref(L, lib->name, lib->func, 1);
+        lua_pop(L, 1);
+    }
+
+    luaL_newmetarotable(L, "thread.channel", (void *)channel_inst_map);
+    lua_pop(L, 1);
+
+    if (luaL_loadbufferx(L, code->code, code->len, "=thread", code->mode) != LUA_OK) {
+        return lua_error(L);
+    }
+
+    if (code->args) {
+        args = code->args;
+        code->args = NULL;
+        n = channel_unpack(L, args);
+    }
+
+    return n + 1;
+}
+
+// thread.spawn_isolated(code [, cpu [, ...]]), where code is a string with
+// Lua code, or a Lua function without upvalues
+static int lthread_spawn_isolated(lua_State* L) {
+    struct isolated_code code;
+    struct lthread *thread;
+    pthread_attr_t attr;
+	struct sched_param sched;
+    int res, idx, nargs;
+    lua_State *IL;
+    luaL_Buffer b;
+
+    int affinity = luaL_optinteger(L, 2, CONFIG_LUA_RTOS_LUA_THREAD_CPU);
+
+    if ((affinity < 0) || (affinity > 1)) {
+    	return luaL_exception(L, LUA_THREAD_ERR_INVALID_CPU_AFFINITY);
+    }
+
+    nargs = lua_gettop(L) - 2;
+
+    // Get the code, functions are moved as bytecode
+    if (lua_type(L, 1) == LUA_TFUNCTION) {
+        lua_pushvalue(L, 1);
+        luaL_buffinit(L, &b);
+        if (lua_dump(L, dump_writer, &b, 0) != 0) {
+            return luaL_exception_extended(L, LUA_THREAD_ERR_CANNOT_LOAD, "not a Lua function");
+        }
+        luaL_pushresult(&b);
+
+        code.mode = "b";
+    } else {
+        luaL_checktype(L, 1, LUA_TSTRING);
+        lua_pushvalue(L, 1);
+
+        code.mode = "t";
+    }
+
+    code.code = lua_tolstring(L, -1, &code.len);
+    code.args = NULL;
+
+    if (nargs > 0) {
+        code.args = channel_pack(L, 3, nargs);
+    }
+
+    IL = luaL_newstate();
+    if (!IL) {
+        if (code.args) channel_msg_free(code.args);
+    	return luaL_exception(L, LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
+    }
+
+    lua_pushcfunction(IL, isolated_open);
+    lua_pushlightuserdata(IL, &code);
+    if (lua_pcall(IL, 1, LUA_MULTRET, 0) != LUA_OK) {
+        lua_pushstring(L, lua_tostring(IL, -1));
+        lua_close(IL);
+
+        if (code.args) channel_msg_free(code.args);
+
+        return luaL_exception_extended(L, LUA_THREAD_ERR_CANNOT_LOAD, lua_tostring(L, -1));
+    }
+
+    thread = (struct lthread *)malloc(sizeof(struct lthread));
+    if (!thread) {
+        lua_close(IL);
+    	return luaL_exception(L, LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
+    }
+
+    thread->PL = NULL;
+    thread->L = IL;
+    thread->function_ref = LUA_NOREF;
+    thread->thread_ref = LUA_NOREF;
+    thread->status = thread_status_SUSPENDED;
+    thread->isolated = 1;
+
+    res = list_add(&lua_threads, thread, &idx);
+    if (res) {
+        lua_close(IL);
+        free(thread);
+    	return luaL_exception(L, LUA_THREAD_ERR_NOT_ENOUGH_MEMORY);
+    }
+
+    thread->thid = idx;
+
+	pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE);
+
+    sched.sched_priority = CONFIG_LUA_RTOS_LUA_THREAD_PRIORITY;
+    pthread_attr_setschedparam(&attr, &sched);
+
+    cpu_set_t cpu_set = affinity;
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpu_set);
+
+    pthread_attr_setinitialstate(&attr, PTHREAD_INITIAL_STATE_RUN);
+
+    // A short script can end, and free the thread, before pthread_create
+    // returns, so the thread is updated before it runs. The id is stored
+    // by pthread_create before the thread is started.
+    thread->status = thread_status_RUNNING;
+
+    res = pthread_create(&thread->thread, &attr, lthread_start_task, thread);
+    if (res) {
+        lua_close(IL);
+        list_remove(&lua_threads, idx, 1);
+
+        return luaL_exception_extended(L, LUA_THREAD_ERR_CANNOT_START, strerror(errno));
+    }
+
+    lua_pushinteger(L, idx);
+    return 1;
+}
 
 static int lthread_sleep(lua_State* L) {
     int seconds;
@@ -614,6 +806,8 @@ static const LUA_REG_TYPE thread[] = {
     { LSTRKEY( "sleepms" ),			LFUNCVAL( lthread_sleepms ) },
     { LSTRKEY( "sleepus" ),			LFUNCVAL( lthread_sleepus ) },
     { LSTRKEY( "usleep"  ),			LFUNCVAL( lthread_sleepus ) },
+    { LSTRKEY( "spawn_isolated" ),	LFUNCVAL( lthread_spawn_isolated ) },
+    { LSTRKEY( "channel" ),			LFUNCVAL( lthread_channel ) },
 
 	// Error definitions
 	{LSTRKEY("error"),  			LROVAL( thread_error_map )},
@@ -623,6 +817,9 @@ static const LUA_REG_TYPE thread[] = {
 
 int luaopen_thread(lua_State* L) {
 	list_init(&lua_threads, 1);
+
+	luaL_newmetarotable(L, "thread.channel", (void *)channel_inst_map);
+	lua_pop(L, 1);
 	
 #if !LUA_USE_ROTABLE
     luaL_newlib(L, thread);
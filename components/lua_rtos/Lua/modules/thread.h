@@ -41,6 +41,7 @@ struct lthread {
     int thread_ref;
     int status;
     int thid;
+    int isolated; // L is an independent state, owned by the thread
     pthread_t thread;
 };
 
@@ -31,12 +31,61 @@
 
 #if CONFIG_LUA_RTOS_LUA_USE_TMR
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
 #include "lua.h"
 #include "lauxlib.h"
+#include "error.h"
 #include "modules.h"
 
 #include <unistd.h>
 #include <sys/delay.h>
+#include <sys/driver.h>
+#include <sys/swtimer.h>
+
+/*
+ * Timers
+ *
+ * Timers are served by the software timer service (see sys/swtimer.h). When
+ * a timer expires, the service queues it, and a Lua thread, the timer
+ * dispatcher, takes it from the queue and calls its callback, so callbacks
+ * run one after the other in the same Lua thread, and never in the service
+ * task. The dispatcher is started by the first tmr.attach.
+ *
+ * Callbacks are not run in the thread that attached the timer: a Lua thread
+ * runs in its own task, and it can only take a callback between two Lua
+ * instructions, so a thread that is blocked in C (in tmr.sleep, or reading a
+ * socket) would delay its callbacks for as long as it's blocked, and the
+ * timers of a thread that ends would have nobody to run them. A callback
+ * that must run with the state of a thread can send a message to it (see
+ * thread channels).
+ */
+
+// Module errors
+#define TMR_ERR_NOT_ENOUGH_MEMORY   (DRIVER_EXCEPTION_BASE(TMR_DRIVER_ID) |  0)
+#define TMR_ERR_INVALID_PERIOD      (DRIVER_EXCEPTION_BASE(TMR_DRIVER_ID) |  1)
+
+DRIVER_REGISTER_ERROR(TMR, tmr, NotEnoughtMemory, "not enough memory", TMR_ERR_NOT_ENOUGH_MEMORY);
+DRIVER_REGISTER_ERROR(TMR, tmr, InvalidPeriod, "invalid period", TMR_ERR_INVALID_PERIOD);
+
+// This variables are defined at linker time
+extern LUA_REG_TYPE tmr_error_map[];
+
+// Expired timers that are waiting for the dispatcher
+#define TMR_QUEUE_SIZE     64
+
+// Minimum period of a high resolution timer, in microseconds
+#define TMR_MIN_PERIOD_US  (portTICK_PERIOD_MS * 1000)
+
+typedef struct {
+	swtimer_t timer;
+	volatile uint32_t refs;    // handle, attached, and queued expirations
+	volatile uint32_t dropped; // expirations lost because the queue was full
+	int callback;              // registry reference, LUA_NOREF if detached
+} tmr_timer_t;
+
+static xQueueHandle queue = NULL;
 
 static int tmr_delay( lua_State* L ) {
     unsigned long long period;
@@ -92,6 +141,201 @@ static int tmr_sleep_us( lua_State* L ) {
     return 0;
 }
 
+#if CONFIG_LUA_RTOS_LUA_USE_THREAD
+static void tmr_release(tmr_timer_t *t) {
+	if (__atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(t);
+	}
+}
+
+static void tmr_detach(lua_State *L, tmr_timer_t *t) {
+	if (t->callback == LUA_NOREF) {
+		return;
+	}
+
+	// When swtimer_stop returns the timer can't be queued anymore, but it
+	// can be in the queue, that's why the timer has references
+	swtimer_stop(&t->timer);
+
+	luaL_unref(L, LUA_REGISTRYINDEX, t->callback);
+	t->callback = LUA_NOREF;
+
+	tmr_release(t);
+}
+
+// Called from the timer service
+static void tmr_expired(void *arg) {
+	tmr_timer_t *t = (tmr_timer_t *)arg;
+
+	__atomic_add_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+
+	if (xQueueSend(queue, &t, 0) != pdTRUE) {
+		// The attached reference is still held, so this is not the last one
+		__atomic_sub_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+		t->dropped++;
+	}
+}
+
+// Timer dispatcher, runs in its own Lua thread
+static int tmr_dispatcher( lua_State* L ) {
+	tmr_timer_t *t;
+
+	for(;;) {
+		xQueueReceive(queue, &t, portMAX_DELAY);
+
+		// Expirations that were queued before a detach are discarded
+		if (t->callback != LUA_NOREF) {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, t->callback);
+			if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+				lua_writestringerror("tmr: %s\n", lua_tostring(L, -1));
+				lua_pop(L, 1);
+			}
+
+			if (t->timer.flags & SWTIMER_ONESHOT) {
+				tmr_detach(L, t);
+			}
+		}
+
+		tmr_release(t);
+	}
+
+	return 0;
+}
+
+static void tmr_dispatcher_start( lua_State* L ) {
+	if (queue) {
+		return;
+	}
+
+	// The dispatcher is a regular Lua thread, so it is listed, and can be
+	// monitored, as any other
+	lua_getglobal(L, "thread");
+	lua_getfield(L, -1, "start");
+	lua_pushcfunction(L, tmr_dispatcher);
+
+	queue = xQueueCreate(TMR_QUEUE_SIZE, sizeof(tmr_timer_t *));
+	if (!queue) {
+		luaL_exception(L, TMR_ERR_NOT_ENOUGH_MEMORY);
+	}
+
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		// Without a dispatcher, so the next attach starts it again
+		vQueueDelete(queue);
+		queue = NULL;
+
+		lua_error(L);
+	}
+
+	lua_pop(L, 2);
+}
+
+static int tmr_attach_timer( lua_State* L, uint64_t period, uint32_t flags ) {
+	tmr_timer_t **ud;
+	tmr_timer_t *t;
+	int res;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (lua_toboolean(L, 3)) {
+		flags |= SWTIMER_ONESHOT;
+	}
+
+	tmr_dispatcher_start(L);
+
+	ud = (tmr_timer_t **)lua_newuserdata(L, sizeof(tmr_timer_t *));
+	*ud = NULL;
+	luaL_setmetatable(L, "tmr.timer");
+
+	t = (tmr_timer_t *)calloc(1, sizeof(tmr_timer_t));
+	if (!t) {
+		return luaL_exception(L, TMR_ERR_NOT_ENOUGH_MEMORY);
+	}
+
+	lua_pushvalue(L, 2);
+	t->callback = luaL_ref(L, LUA_REGISTRYINDEX);
+	t->refs = 2;
+
+	*ud = t;
+
+	if ((res = swtimer_start(&t->timer, period, flags, tmr_expired, t))) {
+		tmr_detach(L, t);
+		return luaL_exception(L, TMR_ERR_NOT_ENOUGH_MEMORY);
+	}
+
+	return 1;
+}
+
+// tmr.attach(period, callback [, oneshot]), period in milliseconds
+static int tmr_attach( lua_State* L ) {
+	lua_Integer period = luaL_checkinteger(L, 1);
+
+	if (period < 1) {
+		return luaL_exception(L, TMR_ERR_INVALID_PERIOD);
+	}
+
+	return tmr_attach_timer(L, (uint64_t)period * 1000, 0);
+}
+
+// tmr.attachus(period, callback [, oneshot]), period in microseconds
+static int tmr_attach_us( lua_State* L ) {
+	lua_Integer period = luaL_checkinteger(L, 1);
+
+	if (period < TMR_MIN_PERIOD_US) {
+		return luaL_exception(L, TMR_ERR_INVALID_PERIOD);
+	}
+
+	return tmr_attach_timer(L, (uint64_t)period, SWTIMER_HIRES);
+}
+
+static tmr_timer_t *tmr_check( lua_State* L ) {
+	tmr_timer_t **ud = (tmr_timer_t **)luaL_checkudata(L, 1, "tmr.timer");
+
+	luaL_argcheck(L, *ud != NULL, 1, "invalid timer");
+
+	return *ud;
+}
+
+static int tmr_timer_detach( lua_State* L ) {
+	tmr_detach(L, tmr_check(L));
+
+	return 0;
+}
+
+// Returns the number of callbacks queued, and the number of missed
+// expirations, because the service or the dispatcher was late
+static int tmr_timer_stats( lua_State* L ) {
+	tmr_timer_t *t = tmr_check(L);
+	uint32_t fired, missed;
+
+	swtimer_stats(&t->timer, &fired, &missed);
+
+	lua_pushinteger(L, fired - t->dropped);
+	lua_pushinteger(L, missed + t->dropped);
+
+	return 2;
+}
+
+// An attached timer keeps running when its handle is collected
+static int tmr_timer_gc( lua_State* L ) {
+	tmr_timer_t **ud = (tmr_timer_t **)luaL_checkudata(L, 1, "tmr.timer");
+
+	if (*ud) {
+		tmr_release(*ud);
+		*ud = NULL;
+	}
+
+	return 0;
+}
+
+static const LUA_REG_TYPE tmr_timer_map[] = {
+    { LSTRKEY( "detach" ),			LFUNCVAL( tmr_timer_detach ) },
+    { LSTRKEY( "stats" ),			LFUNCVAL( tmr_timer_stats ) },
+    { LSTRKEY( "__metatable" ),		LROVAL  ( tmr_timer_map ) },
+    { LSTRKEY( "__index" ),			LROVAL  ( tmr_timer_map ) },
+    { LSTRKEY( "__gc" ),			LFUNCVAL( tmr_timer_gc ) },
+    { LNILKEY, LNILVAL }
+};
+#endif
+
 static const LUA_REG_TYPE tmr_map[] = {
     { LSTRKEY( "delay" ),			LFUNCVAL( tmr_delay ) },
     { LSTRKEY( "delayms" ),			LFUNCVAL( tmr_delay_ms ) },
@@ -99,10 +343,19 @@ static const LUA_REG_TYPE tmr_map[] = {
     { LSTRKEY( "sleep" ),			LFUNCVAL( tmr_sleep ) },
     { LSTRKEY( "sleepms" ),			LFUNCVAL( tmr_sleep_ms ) },
     { LSTRKEY( "sleepus" ),			LFUNCVAL( tmr_sleep_us ) },
+#if CONFIG_LUA_RTOS_LUA_USE_THREAD
+    { LSTRKEY( "attach" ),			LFUNCVAL( tmr_attach ) },
+    { LSTRKEY( "attachus" ),		LFUNCVAL( tmr_attach_us ) },
+#endif
+    { LSTRKEY( "error" ),			LROVAL  ( tmr_error_map ) },
     { LNILKEY, LNILVAL }
 };
 
 LUALIB_API int luaopen_tmr( lua_State *L ) {
+#if CONFIG_LUA_RTOS_LUA_USE_THREAD
+    luaL_newmetarotable(L,"tmr.timer", (void*)tmr_timer_map);
+#endif
+
 #if !LUA_USE_ROTABLE
     luaL_newlib(L, tmr_map);
 
@@ -113,5 +366,6 @@ LUALIB_API int luaopen_tmr( lua_State *L ) {
 }
 
 MODULE_REGISTER_MAPPED(TMR, tmr, tmr_map, luaopen_tmr);
+DRIVER_REGISTER(TMR,tmr,NULL,NULL,NULL);
 
 #endif
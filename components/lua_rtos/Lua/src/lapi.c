@@ -656,8 +656,14 @@ LUA_API int lua_rawget (lua_State *L, int idx) {
   StkId t;
   lua_lock(L);
   t = index2addr(L, idx);
+#if !LUA_USE_ROTABLE
   api_check(L, ttistable(t), "table expected");
   setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1));
+#else
+  api_check(L, ttistable(t) || ttisrotable(t), "table or rotable expected");
+  setobj2s(L, L->top - 1, ttistable(t) ? luaH_get(hvalue(t), L->top - 1)
+                                       : luaH_get_ro(rvalue(t), L->top - 1));
+#endif
   lua_unlock(L);
   return ttnov(L->top - 1);
 }
@@ -667,8 +673,14 @@ LUA_API int lua_rawgeti (lua_State *L, int idx, lua_Integer n) {
   StkId t;
   lua_lock(L);
   t = index2addr(L, idx);
+#if !LUA_USE_ROTABLE
   api_check(L, ttistable(t), "table expected");
   setobj2s(L, L->top, luaH_getint(hvalue(t), n));
+#else
+  api_check(L, ttistable(t) || ttisrotable(t), "table or rotable expected");
+  setobj2s(L, L->top, ttistable(t) ? luaH_getint(hvalue(t), n)
+                                   : luaH_getint_ro(rvalue(t), n));
+#endif
   api_incr_top(L);
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -680,9 +692,15 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
   TValue k;
   lua_lock(L);
   t = index2addr(L, idx);
-  api_check(L, ttistable(t), "table expected");
   setpvalue(&k, cast(void *, p));
+#if !LUA_USE_ROTABLE
+  api_check(L, ttistable(t), "table expected");
   setobj2s(L, L->top, luaH_get(hvalue(t), &k));
+#else
+  api_check(L, ttistable(t) || ttisrotable(t), "table or rotable expected");
+  setobj2s(L, L->top, ttistable(t) ? luaH_get(hvalue(t), &k)
+                                   : luaH_get_ro(rvalue(t), &k));
+#endif
   api_incr_top(L);
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -1061,7 +1079,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, getproto(o), writer, data, strip);
+    status = luaU_dump(L, getproto(o), writer, data, strip, 0);
   else
     status = 1;
   lua_unlock(L);
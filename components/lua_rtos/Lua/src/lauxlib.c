@@ -30,6 +30,10 @@
 #include "lrotable.h"
 #endif
 
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+#include "manifest.h"
+#endif
+
 /*
 ** {======================================================
 ** Traceback
@@ -709,6 +713,17 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   int status, readstatus;
   int c;
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+  /* Lua RTOS: prefer the precompiled bytecode of the file, if any */
+  if (filename != NULL && (mode == NULL || strchr(mode, 'b') != NULL)) {
+    const char *bytecode = manifest_bytecode(filename);
+    if (bytecode != NULL) {
+      if (luaL_loadfilex(L, bytecode, "b") == LUA_OK)
+        return LUA_OK;
+      lua_pop(L, 1);  /* remove error message, and load the source */
+    }
+  }
+#endif
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
@@ -769,7 +769,11 @@ static void f_parser (lua_State *L, void *ud) {
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    /* Lua RTOS: mode 'x' means that the chunk can be used in place, if it
+       is in the bytecode image mapped from flash. Only 'searcher_xip' uses
+       it, 'load' and 'loadfile' reject it */
+    cl = luaU_undump(L, p->z, p->name,
+                     p->mode != NULL && strchr(p->mode, 'x') != NULL);
   }
   else {
     checkmode(L, p->mode, "text");
@@ -24,6 +24,8 @@ typedef struct {
   lua_Writer writer;
   void *data;
   int strip;
+  int align;  /* pad code and line info for execution in place? */
+  size_t pos;  /* bytes dumped so far */
   int status;
 } DumpState;
 
@@ -42,10 +44,22 @@ static void DumpBlock (const void *b, size_t size, DumpState *D) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+    D->pos += size;
   }
 }
 
 
+/*
+** pad the dump to a LUAC_XIP_ALIGN boundary, so the next vector can be
+** used in place by the loader
+*/
+static void DumpAlign (DumpState *D) {
+  static const char pad[LUAC_XIP_ALIGN] = {0};
+  if (D->align)
+    DumpBlock(pad, (LUAC_XIP_ALIGN - (D->pos % LUAC_XIP_ALIGN)) % LUAC_XIP_ALIGN, D);
+}
+
+
 #define DumpVar(x,D)		DumpVector(&x,1,D)
 
 
@@ -74,7 +88,7 @@ static void DumpString (const TString *s, DumpState *D) {
   if (s == NULL)
     DumpByte(0, D);
   else {
-    size_t size = tsslen(s) + 1;  /* include trailing '\0' */
+    LUAC_SIZE_T size = tsslen(s) + 1;  /* include trailing '\0' */
     const char *str = getstr(s);
     if (size < 0xFF)
       DumpByte(cast_int(size), D);
@@ -89,6 +103,7 @@ static void DumpString (const TString *s, DumpState *D) {
 
 static void DumpCode (const Proto *f, DumpState *D) {
   DumpInt(f->sizecode, D);
+  DumpAlign(D);
   DumpVector(f->code, f->sizecode, D);
 }
 
@@ -148,6 +163,7 @@ static void DumpDebug (const Proto *f, DumpState *D) {
   int i, n;
   n = (D->strip) ? 0 : f->sizelineinfo;
   DumpInt(n, D);
+  DumpAlign(D);
   DumpVector(f->lineinfo, n, D);
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
@@ -184,10 +200,10 @@ static void DumpFunction (const Proto *f, TString *psource, DumpState *D) {
 static void DumpHeader (DumpState *D) {
   DumpLiteral(LUA_SIGNATURE, D);
   DumpByte(LUAC_VERSION, D);
-  DumpByte(LUAC_FORMAT, D);
+  DumpByte(D->align ? LUAC_FORMAT_XIP : LUAC_FORMAT, D);
   DumpLiteral(LUAC_DATA, D);
   DumpByte(sizeof(int), D);
-  DumpByte(sizeof(size_t), D);
+  DumpByte(sizeof(LUAC_SIZE_T), D);
   DumpByte(sizeof(Instruction), D);
   DumpByte(sizeof(lua_Integer), D);
   DumpByte(sizeof(lua_Number), D);
@@ -200,12 +216,14 @@ static void DumpHeader (DumpState *D) {
 ** dump Lua function as precompiled chunk
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+              int strip, int align) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.align = align;
+  D.pos = 0;
   D.status = 0;
   DumpHeader(&D);
   DumpByte(f->sizeupvalues, &D);
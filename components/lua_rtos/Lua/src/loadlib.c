@@ -27,6 +27,14 @@
 #include "lrotable.h"
 #endif
 
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+#include "xip.h"
+#endif
+
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+#include "manifest.h"
+#endif
+
 /*
 ** LUA_IGMARK is a mark to ignore all before it when building the
 ** luaopen_ function name.
@@ -560,6 +568,28 @@ static int searcher_Croot (lua_State *L) {
 }
 
 
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+/*
+** Lua RTOS: look for the module in the bytecode image mapped from flash.
+** Its code is executed in place (see mode 'x' in 'f_parser').
+*/
+static int searcher_xip (lua_State *L) {
+  const char *filename;
+  const char *chunk;
+  size_t size;
+  const char *name = luaL_checkstring(L, 1);
+  chunk = xip_find(name, &size);
+  if (chunk == NULL) {  /* module not found in image? */
+    lua_pushfstring(L, "\n\tno module '%s' in bytecode image", name);
+    return 1;
+  }
+  filename = lua_pushfstring(L, "xip:%s", name);
+  return checkload(L, (luaL_loadbufferx(L, chunk, size, filename, "bx") == LUA_OK),
+                   filename);
+}
+#endif
+
+
 static int searcher_preload (lua_State *L) {
   const char *name = luaL_checkstring(L, 1);
   lua_getfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
@@ -744,8 +774,14 @@ static const luaL_Reg ll_funcs[] = {
 
 
 static void createsearcherstable (lua_State *L) {
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+  static const lua_CFunction searchers[] =
+    {searcher_preload, searcher_xip, searcher_Lua, searcher_C, searcher_Croot,
+     NULL};
+#else
   static const lua_CFunction searchers[] =
     {searcher_preload, searcher_Lua, searcher_C, searcher_Croot, NULL};
+#endif
   int i;
   /* create 'searchers' table */
   lua_createtable(L, sizeof(searchers)/sizeof(searchers[0]) - 1, 0);
@@ -779,6 +815,12 @@ static void createclibstable (lua_State *L) {
 
 LUAMOD_API int luaopen_package (lua_State *L) {
   createclibstable(L);
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+  xip_init();  /* map bytecode image, if any */
+#endif
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+  manifest_init();  /* read precompiled bytecode manifest, if any */
+#endif
   luaL_newlib(L, pk_funcs);  /* create 'package' table */
   createsearcherstable(L);
   /* set paths */
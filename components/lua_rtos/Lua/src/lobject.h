@@ -401,6 +401,23 @@ typedef struct LocVar {
 } LocVar;
 
 
+#if LUA_USE_ROTABLE
+/*
+** Inline cache for rotable accesses with a constant string key. Entries
+** are direct-mapped by instruction index, and remember the rotable seen
+** by the instruction and the value found for its key. Rotables can't
+** change, so an entry is valid while 'pc' and 'rt' match.
+*/
+#define LUAI_ROCACHESIZE	32	/* must be a power of 2 */
+
+typedef struct RoCache {
+  const Instruction *pc;  /* instruction that owns the entry */
+  const void *rt;  /* rotable indexed by the instruction */
+  const TValue *slot;  /* value of the key in 'rt' */
+} RoCache;
+#endif
+
+
 /*
 ** Function Prototypes
 */
@@ -409,6 +426,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte xip;  /* 'code' and 'lineinfo' are used in place (not owned) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -424,6 +442,9 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+#if LUA_USE_ROTABLE
+  RoCache *rocache;  /* inline caches for rotable accesses (or NULL) */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
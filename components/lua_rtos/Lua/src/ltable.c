@@ -192,13 +192,6 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
 
 
 int luaH_next (lua_State *L, Table *t, StkId key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-  	luaR_next(L, t, key, key+1);
-  	return ttisnil(key) ? 0 : 1;
-  }
-#endif
-
   unsigned int i = findindex(L, t, key);  /* find original element */
   for (; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
@@ -510,12 +503,6 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
 ** search function for integers
 */
 const TValue *luaH_getint (Table *t, lua_Integer key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-	  return luaR_findentry((const void *)t, NULL, key, NULL);
-  }
-#endif
-
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
@@ -539,13 +526,6 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-
-	  return luaR_findentry((const void *)t, getstr(key), 0, NULL);
-  }
-#endif
-
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -567,12 +547,6 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
-#if LUA_USE_ROTABLE
-  if (luaR_isrotable((const void *)t)) {
-	  return luaR_findentry((const void *)t, getstr(key), 0, NULL);
-  }
-#endif
-
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key))
@@ -64,24 +64,50 @@ void luaT_init (lua_State *L) {
 }
 
 
+#if LUA_USE_ROTABLE
+/*
+** Metatables are stored as untagged 'Table' pointers, so a metatable can
+** be a rotable. This is the only place where a table pointer still has
+** to be checked against the rotable address range; other accesses are
+** dispatched by the LUA_TROTABLE type tag.
+*/
+static const TValue *getmetafield (Table *mt, TString *key) {
+  if (luaR_isrotable(mt))
+    return luaH_getshortstr_ro(mt, key);
+  return luaH_getshortstr(mt, key);
+}
+#else
+#define getmetafield(mt,key)	luaH_getshortstr(mt, key)
+#endif
+
+
 /*
 ** function to be used with macro "fasttm": optimized for absence of
 ** tag methods
 */
 const TValue *luaT_gettm (Table *events, TMS event, TString *ename) {
+#if !LUA_USE_ROTABLE
   const TValue *tm = luaH_getshortstr(events, ename);
   lua_assert(event <= TM_EQ);
   if (ttisnil(tm)) {  /* no tag method? */
-#if !LUA_USE_ROTABLE
     events->flags |= cast_byte(1u<<event);  /* cache this fact */
+    return NULL;
+  }
+  else return tm;
 #else
-	if (!luaR_isrotable(events)) {
-		events->flags |= cast_byte(1u<<event);  /* cache this fact */
-	}
-#endif
+  const TValue *tm;
+  lua_assert(event <= TM_EQ);
+  if (luaR_isrotable(events)) {
+    tm = luaH_getshortstr_ro(events, ename);
+    return ttisnil(tm) ? NULL : tm;
+  }
+  tm = luaH_getshortstr(events, ename);
+  if (ttisnil(tm)) {  /* no tag method? */
+    events->flags |= cast_byte(1u<<event);  /* cache this fact */
     return NULL;
   }
   else return tm;
+#endif
 }
 
 
@@ -102,7 +128,7 @@ const TValue *luaT_gettmbyobj (lua_State *L, const TValue *o, TMS event) {
     default:
       mt = G(L)->mt[ttnov(o)];
   }
-  return (mt ? luaH_getshortstr(mt, G(L)->tmname[event]) : luaO_nilobject);
+  return (mt ? getmetafield(mt, G(L)->tmname[event]) : luaO_nilobject);
 }
 
 
@@ -114,7 +140,7 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
   Table *mt;
   if ((ttistable(o) && (mt = hvalue(o)->metatable) != NULL) ||
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
-    const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
+    const TValue *name = getmetafield(mt, luaS_new(L, "__name"));
     if (ttisstring(name))  /* is '__name' a string? */
       return getstr(tsvalue(name));  /* use it as type name */
   }
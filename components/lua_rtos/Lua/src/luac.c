@@ -31,6 +31,8 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int aligning=0;			/* align code for execution in place? */
+static int imaging=0;			/* build a bytecode image? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,11 +58,13 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -a       align code for execution in place\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
+  "  -x       build a bytecode image with one module per file\n"
   "  --       stop handling options\n"
   "  -        stop handling options and process stdin\n"
   ,progname,Output);
@@ -86,6 +90,8 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-a"))			/* align code */
+   aligning=1;
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -101,6 +107,8 @@ static int doargs(int argc, char* argv[])
    stripping=1;
   else if (IS("-v"))			/* show version */
    ++version;
+  else if (IS("-x"))			/* build a bytecode image */
+   imaging=aligning=1;
   else					/* unknown option */
    usage(argv[i]);
  }
@@ -162,12 +170,94 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+/*
+** Lua RTOS: module name for file 'filename': without leading "./" and
+** ".lua" extension, and with '.' as directory separator
+*/
+static void modname(char* name, const char* filename)
+{
+ const char* p=filename;
+ size_t n;
+ if (p[0]=='.' && p[1]=='/') p+=2;
+ n=strlen(p);
+ if (n>4 && strcmp(p+n-4,".lua")==0) n-=4;
+ if (n>=LUAC_XIP_NAME)
+ {
+  fprintf(stderr,"%s: module name too long in %s\n",progname,filename);
+  exit(EXIT_FAILURE);
+ }
+ memcpy(name,p,n);
+ name[n]=0;
+ for (; *name; name++) if (*name=='/') *name='.';
+}
+
+/*
+** Lua RTOS: write a bytecode image (see lundump.h), with a chunk for each
+** input file, that the target maps from flash and executes in place.
+** Chunks are written in the host byte order, which must match the
+** target's (little endian).
+*/
+static void image(lua_State* L, int argc, char* argv[])
+{
+ static const char pad[LUAC_XIP_ALIGN]={0};
+ XIPHeader h;
+ XIPEntry* e;
+ FILE* D;
+ long pos;
+ int i,j;
+ if (output==NULL) usage("'-x' needs an output file");
+ e=(XIPEntry*)calloc(argc,sizeof(XIPEntry));
+ if (e==NULL) fatal("not enough memory");
+ D=fopen(output,"wb");
+ if (D==NULL) cannot("open");
+ pos=sizeof(h)+argc*sizeof(XIPEntry);
+ if (fseek(D,pos,SEEK_SET)!=0) cannot("seek");
+ for (i=0; i<argc; i++)
+ {
+  const Proto* f;
+  if (luaL_loadfile(L,argv[i])!=LUA_OK) fatal(lua_tostring(L,-1));
+  f=toproto(L,-1);
+  if (listing) luaU_print(f,listing>1);
+  modname(e[i].name,argv[i]);
+  for (j=0; j<i; j++)
+   if (strcmp(e[i].name,e[j].name)==0) fatal("duplicated module name");
+  e[i].offset=pos;
+  lua_lock(L);
+  luaU_dump(L,f,writer,D,stripping,1);
+  lua_unlock(L);
+  lua_pop(L,1);
+  pos=ftell(D);
+  e[i].size=pos-e[i].offset;
+  if (pos%LUAC_XIP_ALIGN!=0)
+  {
+   fwrite(pad,LUAC_XIP_ALIGN-pos%LUAC_XIP_ALIGN,1,D);
+   pos=ftell(D);
+  }
+  if (ferror(D)) cannot("write");
+ }
+ h.magic=LUAC_XIP_MAGIC;
+ h.version=LUAC_VERSION;
+ h.count=argc;
+ h.size=pos;
+ if (fseek(D,0,SEEK_SET)!=0) cannot("seek");
+ fwrite(&h,sizeof(h),1,D);
+ fwrite(e,sizeof(XIPEntry),argc,D);
+ if (ferror(D)) cannot("write");
+ if (fclose(D)) cannot("close");
+ free(e);
+}
+
 static int pmain(lua_State* L)
 {
  int argc=(int)lua_tointeger(L,1);
  char** argv=(char**)lua_touserdata(L,2);
  const Proto* f;
  int i;
+ if (imaging)
+ {
+  image(L,argc,argv);
+  return 0;
+ }
  if (!lua_checkstack(L,argc)) fatal("too many input files");
  for (i=0; i<argc; i++)
  {
@@ -181,7 +271,7 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  luaU_dump(L,f,writer,D,stripping,aligning);
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -23,6 +23,10 @@
 #include "lundump.h"
 #include "lzio.h"
 
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+#include "xip.h"
+#endif
+
 
 #if !defined(luai_verifycode)
 #define luai_verifycode(L,b,f)  /* empty */
@@ -33,6 +37,9 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  size_t pos;  /* bytes loaded so far */
+  int aligned;  /* chunk is in LUAC_FORMAT_XIP format? */
+  int xip;  /* chunk can be used in place? */
 } LoadState;
 
 
@@ -51,6 +58,41 @@ static l_noret error(LoadState *S, const char *why) {
 static void LoadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated");
+  S->pos += size;
+}
+
+
+/*
+** skip the padding before an aligned vector
+*/
+static void LoadAlign (LoadState *S) {
+  char pad[LUAC_XIP_ALIGN];
+  if (S->aligned)
+    LoadBlock(S, pad, (LUAC_XIP_ALIGN - (S->pos % LUAC_XIP_ALIGN)) % LUAC_XIP_ALIGN);
+}
+
+
+/*
+** Return a pointer to the next 'size' bytes of the chunk, to be used in
+** place, or NULL if they can't be used in place (chunk not loaded with
+** mode 'x', not contiguous in the reader's buffer, not aligned, or not
+** in the mapped bytecode image, as any other buffer can be freed while
+** the Proto is alive).
+*/
+static const void *MapBlock (LoadState *S, size_t size) {
+#if CONFIG_LUA_RTOS_LUA_USE_XIP
+  const char *b = S->Z->p;
+  if (!S->xip || size == 0 || S->Z->n < size ||
+      ((size_t)b % LUAC_XIP_ALIGN) != 0 || !xip_contains(b, size))
+    return NULL;
+  S->Z->p += size;
+  S->Z->n -= size;
+  S->pos += size;
+  return b;
+#else
+  (void)S; (void)size;
+  return NULL;
+#endif
 }
 
 
@@ -87,8 +129,11 @@ static lua_Integer LoadInteger (LoadState *S) {
 
 static TString *LoadString (LoadState *S) {
   size_t size = LoadByte(S);
-  if (size == 0xFF)
-    LoadVar(S, size);
+  if (size == 0xFF) {
+    LUAC_SIZE_T lsize;  /* target's size_t */
+    LoadVar(S, lsize);
+    size = lsize;
+  }
   if (size == 0)
     return NULL;
   else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
@@ -106,6 +151,13 @@ static TString *LoadString (LoadState *S) {
 
 static void LoadCode (LoadState *S, Proto *f) {
   int n = LoadInt(S);
+  LoadAlign(S);
+  f->code = cast(Instruction *, MapBlock(S, n * sizeof(Instruction)));
+  if (f->code != NULL) {  /* code used in place? */
+    f->xip = 1;
+    f->sizecode = n;
+    return;
+  }
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
@@ -180,9 +232,17 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 static void LoadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
+  LoadAlign(S);
+  if (f->xip) {  /* line info is used in place, as the code */
+    f->lineinfo = cast(int *, MapBlock(S, n * sizeof(int)));
+    if (f->lineinfo == NULL && n > 0)
+      error(S, "misaligned");
+  }
+  else {
+    f->lineinfo = luaM_newvector(S->L, n, int);
+    LoadVector(S, f->lineinfo, n);
+  }
   f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
   n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
@@ -237,11 +297,14 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, LUA_SIGNATURE + 1, "not a");  /* 1st char already checked */
   if (LoadByte(S) != LUAC_VERSION)
     error(S, "version mismatch in");
-  if (LoadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch in");
+  switch (LoadByte(S)) {
+    case LUAC_FORMAT: S->aligned = 0; break;
+    case LUAC_FORMAT_XIP: S->aligned = 1; break;
+    default: error(S, "format mismatch in");
+  }
   checkliteral(S, LUAC_DATA, "corrupted");
   checksize(S, int);
-  checksize(S, size_t);
+  checksize(S, LUAC_SIZE_T);
   checksize(S, Instruction);
   checksize(S, lua_Integer);
   checksize(S, lua_Number);
@@ -255,7 +318,7 @@ static void checkHeader (LoadState *S) {
 /*
 ** load precompiled chunk
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int xip) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -266,7 +329,11 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.pos = 1;  /* 1st char already read */
+  S.aligned = 0;
+  S.xip = xip;
   checkHeader(&S);
+  S.xip = xip && S.aligned;
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
   luaD_inctop(L);
@@ -22,11 +22,52 @@
 #define LUAC_VERSION	(MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR))
 #define LUAC_FORMAT	0	/* this is the official format */
 
+/*
+** Lua RTOS: format of chunks that can be executed in place. It's the
+** official format, but the code and line info vectors are padded to
+** start at a LUAC_XIP_ALIGN boundary from the beginning of the chunk.
+*/
+#define LUAC_FORMAT_XIP	1
+#define LUAC_XIP_ALIGN	4
+
+/*
+** size_t as seen by the target. luac runs on the host when building
+** images for the ESP32, so it must use the target's 32 bit size_t.
+*/
+#if defined(LUAC_CROSS_COMPILER)
+#define LUAC_SIZE_T	unsigned int
+#else
+#define LUAC_SIZE_T	size_t
+#endif
+
+/*
+** Lua RTOS: bytecode image, built with 'luac -x', and mapped from flash.
+** The image is a header, followed by a directory of 'count' entries and
+** by the chunks, in LUAC_FORMAT_XIP format. Chunks start at a
+** LUAC_XIP_ALIGN boundary. All fields are little endian.
+*/
+#define LUAC_XIP_MAGIC	0x5049584c	/* "LXIP" */
+#define LUAC_XIP_NAME	32	/* max module name length, including '\0' */
+
+typedef struct XIPHeader {
+  unsigned int magic;
+  unsigned int version;  /* LUAC_VERSION */
+  unsigned int count;  /* number of modules */
+  unsigned int size;  /* image size, in bytes */
+} XIPHeader;
+
+typedef struct XIPEntry {
+  char name[LUAC_XIP_NAME];  /* module name */
+  unsigned int offset;  /* offset of chunk from start of image */
+  unsigned int size;  /* chunk size, in bytes */
+} XIPEntry;
+
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name,
+                                 int xip);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
-                         void* data, int strip);
+                         void* data, int strip, int align);
 
 #endif
@@ -874,6 +874,51 @@ void luaV_finishOp (lua_State *L) {
   else Protect(luaV_finishget(L,t,k,v,slot)); }
 
 
+#if LUA_USE_ROTABLE
+/*
+** Get 't[key]' for rotable 't' and constant string 'key', for the
+** instruction being executed, through the inline cache of the running
+** function. Only found keys are cached.
+*/
+static const TValue *rocacheget (lua_State *L, CallInfo *ci, const void *t,
+                                 TString *key) {
+  Proto *p = clLvalue(ci->func)->p;
+  const Instruction *pc = ci->u.l.savedpc - 1;
+  RoCache *rc;
+  const TValue *slot;
+  if (p->rocache == NULL) {  /* first rotable access in this function? */
+    p->rocache = luaM_newvector(L, LUAI_ROCACHESIZE, RoCache);
+    memset(p->rocache, 0, LUAI_ROCACHESIZE * sizeof(RoCache));
+  }
+  rc = &p->rocache[(pc - p->code) & (LUAI_ROCACHESIZE - 1)];
+  if (rc->pc == pc && rc->rt == t)  /* hit? */
+    return rc->slot;
+  slot = luaH_getstr_ro(t, key);
+  if (!ttisnil(slot)) {
+    rc->pc = pc;
+    rc->rt = t;
+    rc->slot = slot;
+  }
+  return slot;
+}
+
+
+/*
+** 'gettableProtected' for instructions whose key is 'RK(c)': rotables
+** indexed by a constant string go through the inline cache. (Allocating
+** the cache doesn't move the stack, so 'v' is still valid.)
+*/
+#define gettableKProtected(L,t,k,v,c) { \
+  if (ttisrotable(t) && ISK(c) && ttisstring(k)) { \
+    const TValue *slot = rocacheget(L, ci, rvalue(t), tsvalue(k)); \
+    if (!ttisnil(slot)) { setobj2s(L, v, slot); } \
+    else Protect(luaV_finishget(L,t,k,v,slot)); } \
+  else gettableProtected(L,t,k,v); }
+#else
+#define gettableKProtected(L,t,k,v,c)	gettableProtected(L,t,k,v)
+#endif
+
+
 /* same for 'luaV_settable' */
 #define settableProtected(L,t,k,v) { const TValue *slot; \
   if (!luaV_fastset(L,t,k,slot,luaH_get,v)) \
@@ -934,13 +979,13 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        gettableKProtected(L, upval, rc, ra, GETARG_C(i));
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        gettableKProtected(L, rb, rc, ra, GETARG_C(i));
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -978,6 +1023,16 @@ void luaV_execute (lua_State *L) {
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
+#if LUA_USE_ROTABLE
+        if (ttisrotable(rb) && ISK(GETARG_C(i))) {
+          aux = rocacheget(L, ci, rvalue(rb), key);
+          if (!ttisnil(aux)) {
+            setobj2s(L, ra, aux);
+          }
+          else Protect(luaV_finishget(L, rb, rc, ra, aux));
+        }
+        else
+#endif
         if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
         }
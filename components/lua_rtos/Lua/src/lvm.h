@@ -62,11 +62,18 @@
    : (slot = f(hvalue(t), k),  /* else, do raw access */  \
       !ttisnil(slot)))  /* result not nil? */
 #else
+/*
+** rotables are dispatched by their type tag to 'f_ro' (see lrotable.h),
+** so the raw access functions for tables don't need to check for them
+*/
 #define luaV_fastget(L,t,k,slot,f) \
-  (!(ttistable(t) || ttisrotable(t))  \
-   ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
-   : (slot = f(hvalue(t), k),  /* else, do raw access */  \
-      !ttisnil(slot)))  /* result not nil? */
+  (ttistable(t)  \
+   ? (slot = f(hvalue(t), k),  /* raw access to a table */  \
+      !ttisnil(slot))  /* result not nil? */  \
+   : ttisrotable(t)  \
+   ? (slot = f##_ro(rvalue(t), k),  /* raw access to a rotable */  \
+      !ttisnil(slot))  \
+   : (slot = NULL, 0))  /* not a table; 'slot' is NULL and result is 0 */
 #endif
 
 /*
@@ -30,8 +30,15 @@
 #include "luartos.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "soc/timer_group_struct.h"
+#include "driver/timer.h"
 
 #include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
 
 #include <sys/driver.h>
 #include <sys/syslog.h>
@@ -45,15 +52,141 @@
 
 static adc_unit_t adc_unit[CPU_LAST_ADC + 1];
 
+// Current stream, only one stream can run, as it uses a hardware timer
+static adc_stream_t *adc_stream = NULL;
+static intr_handle_t adc_stream_intr = NULL;
+
 // Driver message errors
 DRIVER_REGISTER_ERROR(ADC, adc, InvalidUnit, "invalid unit", ADC_ERR_INVALID_UNIT);
 DRIVER_REGISTER_ERROR(ADC, adc, InvalidChannel, "invalid channel", ADC_ERR_INVALID_CHANNEL);
 DRIVER_REGISTER_ERROR(ADC, adc, InvalidResolution, "invalid resolution", ADC_ERR_INVALID_RESOLUTION);
 DRIVER_REGISTER_ERROR(ADC, adc, NotEnoughtMemory, "not enough memory", ADC_ERR_NOT_ENOUGH_MEMORY);
+DRIVER_REGISTER_ERROR(ADC, adc, InvalidRate, "invalid sample rate", ADC_ERR_INVALID_RATE);
+DRIVER_REGISTER_ERROR(ADC, adc, StreamBusy, "another stream is running", ADC_ERR_STREAM_BUSY);
+DRIVER_REGISTER_ERROR(ADC, adc, NotSetup, "channel is not setup", ADC_ERR_NOT_SETUP);
+DRIVER_REGISTER_ERROR(ADC, adc, CantStartStream, "can't start stream", ADC_ERR_CANT_START_STREAM);
 
 /*
  * Helper functions
  */
+static uint64_t adc_time_us() {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((uint64_t)now.tv_sec * 1000000) + now.tv_usec;
+}
+
+// Timer interrupt, wakes up stream task for take a sample
+static void IRAM_ATTR adc_stream_isr(void *arg) {
+	timg_dev_t *timerg = (ADC_STREAM_TIMER_GROUP == TIMER_GROUP_0)?&TIMERG0:&TIMERG1;
+	BaseType_t high_priority_task_awoken = pdFALSE;
+
+	if (timerg->int_st_timers.val & BIT(ADC_STREAM_TIMER)) {
+		timerg->int_clr_timers.val = BIT(ADC_STREAM_TIMER);
+		timerg->hw_timer[ADC_STREAM_TIMER].config.alarm_en = 1;
+
+		if (adc_stream) {
+			vTaskNotifyGiveFromISR(adc_stream->task, &high_priority_task_awoken);
+		}
+	}
+
+	if (high_priority_task_awoken == pdTRUE) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+static esp_err_t adc_stream_timer(uint32_t rate) {
+	timer_config_t config;
+	esp_err_t err;
+
+	// Timer counts at 1 Mhz
+	config.alarm_en = 1;
+	config.auto_reload = 1;
+	config.counter_dir = TIMER_COUNT_UP;
+	config.divider = TIMER_BASE_CLK / 1000000;
+	config.intr_type = TIMER_INTR_LEVEL;
+	config.counter_en = TIMER_PAUSE;
+
+	timer_init(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER, &config);
+	timer_pause(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+	timer_set_counter_value(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER, 0x00000000ULL);
+	timer_set_alarm_value(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER, 1000000 / rate);
+	timer_enable_intr(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+
+	if ((err = timer_isr_register(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER, adc_stream_isr, NULL, ESP_INTR_FLAG_IRAM, &adc_stream_intr)) != ESP_OK) {
+		timer_disable_intr(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+		adc_stream_intr = NULL;
+
+		return err;
+	}
+
+	timer_start(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+
+	return ESP_OK;
+}
+
+// Take a raw sample from the stream's channel
+static inline int adc_stream_raw(adc_stream_t *stream) {
+	int raw = 0;
+
+	switch (stream->unit) {
+		case 1:
+			adc_internal_read(stream->unit, stream->channel, &raw);
+			break;
+
+		case 2:
+			adc_mcp3008_read(stream->unit, stream->channel, &raw);
+			break;
+
+		case 3:
+			adc_mcp3208_read(stream->unit, stream->channel, &raw);
+			break;
+	}
+
+	return raw;
+}
+
+// Stream task, takes a sample each time it's notified by the timer interrupt
+static void adc_stream_task(void *arg) {
+	adc_stream_t *stream = (adc_stream_t *)arg;
+	uint32_t pending;
+
+	while (stream->running) {
+		pending = ulTaskNotifyTake(pdTRUE, 100 / portTICK_PERIOD_MS);
+		if (!pending) {
+			continue;
+		}
+
+		// More than one notification means that we lost samples
+		stream->dropped += pending - 1;
+		stream->samples++;
+
+		stream->acc += adc_stream_raw(stream);
+		if (++stream->nacc < stream->decimation) {
+			continue;
+		}
+
+		if (stream->head - stream->tail < stream->size) {
+			stream->ring[stream->head % stream->size] = (stream->acc / stream->nacc) >> stream->shift;
+			stream->head++;
+		} else {
+			// Ring is full, reader can't keep up
+			stream->dropped += stream->nacc;
+		}
+
+		stream->acc = 0;
+		stream->nacc = 0;
+
+		if (stream->wanted && (stream->head - stream->tail >= stream->wanted)) {
+			stream->wanted = 0;
+			xSemaphoreGive(stream->data);
+		}
+	}
+
+	xSemaphoreGive(stream->done);
+	vTaskDelete(NULL);
+}
 
 /*
  * Operation functions
@@ -180,6 +313,153 @@ driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, double *mvols)
 	return NULL;
 }
 
+// Start streaming samples from a channel at rate hertz, into a ring of size samples, averaging
+// decimation raw samples for each ring sample
+driver_error_t *adc_stream_start(uint8_t unit, uint8_t channel, uint32_t rate, uint16_t decimation, uint32_t size, adc_stream_t **stream) {
+	adc_stream_t *instance;
+
+	if ((unit < CPU_FIRST_ADC) || (unit > CPU_LAST_ADC)) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_INVALID_UNIT, NULL);
+	}
+
+	if (channel > CPU_LAST_ADC_CH) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_INVALID_CHANNEL, NULL);
+	}
+
+	if (!adc_unit[unit].channel || !adc_unit[unit].channel[channel].setup) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_NOT_SETUP, NULL);
+	}
+
+	if ((rate == 0) || (rate > ADC_STREAM_MAX_RATE)) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_INVALID_RATE, NULL);
+	}
+
+	if (adc_stream) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_STREAM_BUSY, NULL);
+	}
+
+	if (!(instance = calloc(1, sizeof(adc_stream_t)))) {
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	instance->ring = calloc(size, sizeof(uint16_t));
+	instance->data = xSemaphoreCreateBinary();
+	instance->done = xSemaphoreCreateBinary();
+
+	if (!instance->ring || !instance->data || !instance->done) {
+		if (instance->data) vSemaphoreDelete(instance->data);
+		if (instance->done) vSemaphoreDelete(instance->done);
+		free(instance->ring);
+		free(instance);
+
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	instance->unit = unit;
+	instance->channel = channel;
+	instance->shift = adc_unit[unit].channel[channel].max_resolution - adc_unit[unit].channel[channel].resolution;
+	instance->rate = rate;
+	instance->decimation = (decimation?decimation:1);
+	instance->size = size;
+	instance->running = 1;
+	instance->start = adc_time_us();
+
+	// Stream task runs on the other core, if any, so sampling is not delayed by Lua
+	#if CONFIG_FREERTOS_UNICORE
+	if (xTaskCreatePinnedToCore(adc_stream_task, "adcs", 2048, instance, ADC_STREAM_TASK_PRIORITY, &instance->task, 0) != pdPASS) {
+	#else
+	if (xTaskCreatePinnedToCore(adc_stream_task, "adcs", 2048, instance, ADC_STREAM_TASK_PRIORITY, &instance->task, xPortGetCoreID() ^ 1) != pdPASS) {
+	#endif
+		vSemaphoreDelete(instance->data);
+		vSemaphoreDelete(instance->done);
+		free(instance->ring);
+		free(instance);
+
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	adc_stream = instance;
+
+	if (adc_stream_timer(rate) != ESP_OK) {
+		adc_stream = NULL;
+
+		// Stop the stream task
+		instance->running = 0;
+		xSemaphoreTake(instance->done, portMAX_DELAY);
+
+		vSemaphoreDelete(instance->data);
+		vSemaphoreDelete(instance->done);
+		free(instance->ring);
+		free(instance);
+
+		return driver_operation_error(ADC_DRIVER, ADC_ERR_CANT_START_STREAM, NULL);
+	}
+
+	*stream = instance;
+
+	return NULL;
+}
+
+// Read up to count samples from stream, waiting up to timeout msecs for count samples
+uint32_t adc_stream_read(adc_stream_t *stream, uint16_t *buffer, uint32_t count, uint32_t timeout) {
+	uint32_t available, i;
+
+	if (count > stream->size) {
+		count = stream->size;
+	}
+
+	if (stream->head - stream->tail < count) {
+		xSemaphoreTake(stream->data, 0);
+		stream->wanted = count;
+
+		// Samples can arrive before wanted is set
+		if (stream->head - stream->tail < count) {
+			xSemaphoreTake(stream->data, timeout / portTICK_PERIOD_MS);
+		}
+
+		stream->wanted = 0;
+	}
+
+	available = stream->head - stream->tail;
+	if (available > count) {
+		available = count;
+	}
+
+	for(i = 0;i < available;i++) {
+		buffer[i] = stream->ring[(stream->tail + i) % stream->size];
+	}
+
+	stream->tail += available;
+
+	return available;
+}
+
+// Get the achieved raw sample rate, and sample counters
+void adc_stream_stats(adc_stream_t *stream, double *rate, uint32_t *samples, uint32_t *dropped) {
+	uint64_t elapsed = adc_time_us() - stream->start;
+
+	*rate = (elapsed?((double)stream->samples * 1000000.0) / (double)elapsed:0);
+	*samples = stream->samples;
+	*dropped = stream->dropped;
+}
+
+void adc_stream_stop(adc_stream_t *stream) {
+	timer_pause(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+	timer_disable_intr(ADC_STREAM_TIMER_GROUP, ADC_STREAM_TIMER);
+	esp_intr_free(adc_stream_intr);
+	adc_stream_intr = NULL;
+
+	stream->running = 0;
+	xSemaphoreTake(stream->done, portMAX_DELAY);
+
+	adc_stream = NULL;
+
+	vSemaphoreDelete(stream->data);
+	vSemaphoreDelete(stream->done);
+	free(stream->ring);
+	free(stream);
+}
+
 DRIVER_REGISTER(ADC,adc,NULL,NULL,NULL);
 
 /*
@@ -197,4 +477,11 @@ while true do
 	print("raw: "..raw..", mvolts: "..mvolts..", temp: "..temp)
 	tmr.delay(1)
 end
+
+-- Stream at 8 Khz, averaging 4 samples, and get blocks of 512 samples
+ch = adc.setup(adc.ADC1, 6, 12)
+s = ch:stream(8000, 4)
+block = s:read(512)
+print(s:stats())
+s:stop()
 */
@@ -32,7 +32,12 @@
 
 #include <stdint.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
 #include "driver/adc.h"
+#include "driver/timer.h"
 
 #include <drivers/cpu.h>
 #include <sys/driver.h>
@@ -54,6 +59,44 @@ typedef struct {
 	driver_unit_lock_t *lock;
 } adc_lock_t;
 
+// Streaming mode
+#define ADC_STREAM_TIMER_GROUP   TIMER_GROUP_1
+#define ADC_STREAM_TIMER         TIMER_0
+#define ADC_STREAM_MAX_RATE      20000                      // max sample rate in hertz
+#define ADC_STREAM_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+
+// ADC stream. Raw samples are taken at a fixed rate by the stream task, paced by a
+// hardware timer, optionally averaged (decimation), and put into a ring.
+typedef struct {
+	uint8_t unit;
+	uint8_t channel;
+	uint8_t shift;                // shift for convert a sample to the channel's resolution
+	uint32_t rate;                // sample rate in hertz
+	uint16_t decimation;          // number of samples averaged for each ring sample
+
+	// Ring, head is only written by the stream task, and tail is only written
+	// by the reader
+	uint16_t *ring;
+	uint32_t size;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+
+	uint32_t acc;                 // decimation accumulator
+	uint16_t nacc;                // number of samples in accumulator
+
+	volatile uint32_t wanted;     // number of samples that reader is waiting for
+	SemaphoreHandle_t data;       // given when wanted samples are available
+	SemaphoreHandle_t done;       // given by stream task on exit
+
+	// Statistics
+	volatile uint32_t samples;    // raw samples taken
+	volatile uint32_t dropped;    // raw samples lost, or ring samples discarded
+	uint64_t start;               // start time in usecs
+
+	TaskHandle_t task;
+	volatile uint8_t running;
+} adc_stream_t;
+
 // Resources used by ADC
 typedef struct {
 	uint8_t pin;
@@ -64,9 +107,17 @@ typedef struct {
 #define ADC_ERR_INVALID_CHANNEL          (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  1)
 #define ADC_ERR_INVALID_RESOLUTION       (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  2)
 #define ADC_ERR_NOT_ENOUGH_MEMORY	 	 (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  3)
+#define ADC_ERR_INVALID_RATE	 	     (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  4)
+#define ADC_ERR_STREAM_BUSY	 	         (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  5)
+#define ADC_ERR_NOT_SETUP	 	         (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  6)
+#define ADC_ERR_CANT_START_STREAM        (DRIVER_EXCEPTION_BASE(ADC_DRIVER_ID) |  7)
 
 driver_error_t *adc_device(int8_t unit, int8_t channel, uint8_t *device);
 driver_error_t *adc_setup(int8_t unit, int8_t channel, uint16_t vref, uint8_t resolution);
 driver_error_t *adc_read(uint8_t unit, uint8_t channel, int *raw, double *mvols);
+driver_error_t *adc_stream_start(uint8_t unit, uint8_t channel, uint32_t rate, uint16_t decimation, uint32_t size, adc_stream_t **stream);
+uint32_t adc_stream_read(adc_stream_t *stream, uint16_t *buffer, uint32_t count, uint32_t timeout);
+void adc_stream_stats(adc_stream_t *stream, double *rate, uint32_t *samples, uint32_t *dropped);
+void adc_stream_stop(adc_stream_t *stream);
 
 #endif	/* ADC_H */
@@ -52,17 +52,18 @@ driver_error_t *adc_mcp3008_setup(int8_t unit, int8_t channel, uint8_t spi, uint
 }
 
 driver_error_t *adc_mcp3008_read(int8_t unit, int8_t channel, int *raw) {
-    uint8_t msb, lsb;
+    uint8_t buffer[3];
 
-    spi_ll_select(spi_device);
-
-    spi_ll_transfer(spi_device, ((0x18 | channel) & 0xf0) >> 4, &msb);
-    spi_ll_transfer(spi_device, ((0x18 | channel) & 0x0f) << 4, &msb);
-    spi_ll_transfer(spi_device, 0, &lsb);
+    // Send start bit, mode and channel, and get the conversion, in a single transfer
+    buffer[0] = ((0x18 | channel) & 0xf0) >> 4;
+    buffer[1] = ((0x18 | channel) & 0x0f) << 4;
+    buffer[2] = 0;
 
+    spi_ll_select(spi_device);
+    spi_ll_bulk_rw(spi_device, 3, buffer);
     spi_ll_deselect(spi_device);
 
-    *raw = ((msb & 0x03) << 8 | lsb);
+    *raw = ((buffer[1] & 0x03) << 8 | buffer[2]);
 
     return NULL;
 }
@@ -48,11 +48,50 @@ CAN_device_t CAN_cfg;
 // Driver message errors
 DRIVER_REGISTER_ERROR(CAN, can, NotEnoughtMemory, "not enough memory", CAN_ERR_NOT_ENOUGH_MEMORY);
 DRIVER_REGISTER_ERROR(CAN, can, InvalidFrameLength, "invalid frame length", CAN_ERR_INVALID_FRAME_LENGTH);
+DRIVER_REGISTER_ERROR(CAN, can, InvalidFrameType, "invalid frame type", CAN_ERR_INVALID_FRAME_TYPE);
+DRIVER_REGISTER_ERROR(CAN, can, InvalidId, "invalid message id", CAN_ERR_INVALID_ID);
+DRIVER_REGISTER_ERROR(CAN, can, NotSetup, "is not setup", CAN_ERR_NOT_SETUP);
+DRIVER_REGISTER_ERROR(CAN, can, TxQueueFull, "transmit queue is full", CAN_ERR_TX_QUEUE_FULL);
+DRIVER_REGISTER_ERROR(CAN, can, Timeout, "timeout", CAN_ERR_TIMEOUT);
+DRIVER_REGISTER_ERROR(CAN, can, NoMoreFilters, "no more filters available", CAN_ERR_NO_MORE_FILTERS);
+DRIVER_REGISTER_ERROR(CAN, can, FilterNotFound, "filter not found", CAN_ERR_FILTER_NOT_FOUND);
 
 /*
  * Helper functions
  */
 
+static driver_error_t *can_check_id(uint32_t msg_id, uint8_t msg_type) {
+	if (msg_type == CAN_FRAME_STD) {
+		if (msg_id > 0x7ff) {
+			return driver_operation_error(CAN_DRIVER, CAN_ERR_INVALID_ID, NULL);
+		}
+	} else if (msg_type == CAN_FRAME_EXT) {
+		if (msg_id > 0x1fffffff) {
+			return driver_operation_error(CAN_DRIVER, CAN_ERR_INVALID_ID, NULL);
+		}
+	} else {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_INVALID_FRAME_TYPE, NULL);
+	}
+
+	return NULL;
+}
+
+static driver_error_t *can_check_setup() {
+	if (!CAN_cfg.rx_queue) {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_NOT_SETUP, NULL);
+	}
+
+	return NULL;
+}
+
+static TickType_t can_ticks(uint32_t timeout) {
+	if (timeout == 0xffffffff) {
+		return portMAX_DELAY;
+	}
+
+	return timeout / portTICK_PERIOD_MS;
+}
+
 /*
  * Operation functions
  */
@@ -76,12 +115,23 @@ driver_error_t *can_setup(uint32_t unit, uint16_t speed) {
 	CAN_cfg.speed = speed;
 	CAN_cfg.tx_pin_id = CONFIG_LUA_RTOS_CAN_TX;
 	CAN_cfg.rx_pin_id = CONFIG_LUA_RTOS_CAN_RX;
-	CAN_cfg.rx_queue = xQueueCreate(10,sizeof(CAN_frame_t));;
 
 	if (!CAN_cfg.rx_queue) {
-		return driver_operation_error(CAN_DRIVER, CAN_ERR_NOT_ENOUGH_MEMORY, NULL);
+		CAN_cfg.rx_queue = xQueueCreate(CAN_RX_QUEUE_SIZE, sizeof(CAN_frame_t));
+		if (!CAN_cfg.rx_queue) {
+			return driver_operation_error(CAN_DRIVER, CAN_ERR_NOT_ENOUGH_MEMORY, NULL);
+		}
 	}
 
+	if (!CAN_cfg.tx_queue) {
+		CAN_cfg.tx_queue = xQueueCreate(CAN_TX_QUEUE_SIZE, sizeof(CAN_frame_t));
+		if (!CAN_cfg.tx_queue) {
+			return driver_operation_error(CAN_DRIVER, CAN_ERR_NOT_ENOUGH_MEMORY, NULL);
+		}
+	}
+
+	memset(&CAN_cfg.stats, 0, sizeof(CAN_stats_t));
+
 	// Start CAN module
 	CAN_init();
 
@@ -94,34 +144,189 @@ driver_error_t *can_setup(uint32_t unit, uint16_t speed) {
 }
 
 driver_error_t *can_tx(uint32_t unit, uint32_t msg_id, uint8_t msg_type, uint8_t *data, uint8_t len) {
+	driver_error_t *error;
 	CAN_frame_t frame;
 
 	// Sanity checks
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
+	if ((error = can_check_id(msg_id, msg_type))) {
+		return error;
+	}
+
 	if (len > 8) {
 		return driver_operation_error(CAN_DRIVER, CAN_ERR_INVALID_FRAME_LENGTH, NULL);
 	}
 
 	// Populate frame
+	frame.FIR.U = 0;
+	frame.FIR.B.DLC = len;
+	frame.FIR.B.FF = msg_type;
 	frame.MsgID = msg_id;
-	frame.DLC = len;
 	memcpy(&frame.data, data, len);
 
-	// TX
-	CAN_write_frame(&frame);
+	// TX, or queue if there is a frame on the way
+	if (CAN_send_frame(&frame, CAN_TX_TIMEOUT / portTICK_PERIOD_MS) < 0) {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_TX_QUEUE_FULL, NULL);
+	}
 
 	return NULL;
 }
 
 driver_error_t *can_rx(uint32_t unit, uint32_t *msg_id, uint8_t *msg_type, uint8_t *data, uint8_t *len) {
+	driver_error_t *error;
 	CAN_frame_t frame;
 
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
 	// Read next frame
 	xQueueReceive(CAN_cfg.rx_queue, &frame, portMAX_DELAY);
 
 	*msg_id = frame.MsgID;
-	*msg_type = 0;
-	*len = frame.DLC;
-	memcpy(data, &frame.data, frame.DLC);
+	*msg_type = frame.FIR.B.FF;
+	*len = frame.FIR.B.DLC;
+	memcpy(data, &frame.data, frame.FIR.B.DLC);
+
+	return NULL;
+}
+
+driver_error_t *can_rx_frames(uint32_t unit, CAN_frame_t *frames, int n, uint32_t timeout, int *count) {
+	driver_error_t *error;
+
+	*count = 0;
+
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
+	// Wait for the first frame, then take the available ones without waiting
+	if (n > 0) {
+		if (xQueueReceive(CAN_cfg.rx_queue, &frames[0], can_ticks(timeout)) != pdTRUE) {
+			return NULL;
+		}
+
+		*count = 1;
+	}
+
+	while ((*count < n) && (xQueueReceive(CAN_cfg.rx_queue, &frames[*count], 0) == pdTRUE)) {
+		(*count)++;
+	}
+
+	return NULL;
+}
+
+driver_error_t *can_flush(uint32_t unit, uint32_t timeout) {
+	driver_error_t *error;
+
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
+	if (CAN_wait_tx(can_ticks(timeout)) < 0) {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_TIMEOUT, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * Set the hardware acceptance filter, in single filter mode. Bits set in mask
+ * must match in msg_id, other bits are don't care. The controller applies the
+ * filter to both frame formats, so use the software filter for exact matches.
+ */
+driver_error_t *can_hw_filter(uint32_t unit, uint32_t msg_id, uint32_t mask, uint8_t msg_type) {
+	driver_error_t *error;
+	CAN_filter_t filter;
+
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
+	if ((error = can_check_id(msg_id, msg_type))) {
+		return error;
+	}
+
+	filter.FM = CAN_filter_single;
+
+	if (msg_type == CAN_FRAME_STD) {
+		mask &= 0x7ff;
+
+		filter.ACR[0] = msg_id >> 3;
+		filter.ACR[1] = (msg_id << 5) & 0xe0;
+		filter.ACR[2] = 0;
+		filter.ACR[3] = 0;
+
+		// RTR and data bytes are don't care
+		filter.AMR[0] = ~(mask >> 3);
+		filter.AMR[1] = ~((mask << 5) & 0xe0);
+		filter.AMR[2] = 0xff;
+		filter.AMR[3] = 0xff;
+	} else {
+		mask &= 0x1fffffff;
+
+		filter.ACR[0] = msg_id >> 21;
+		filter.ACR[1] = msg_id >> 13;
+		filter.ACR[2] = msg_id >> 5;
+		filter.ACR[3] = (msg_id << 3) & 0xf8;
+
+		// RTR is don't care
+		filter.AMR[0] = ~(mask >> 21);
+		filter.AMR[1] = ~(mask >> 13);
+		filter.AMR[2] = ~(mask >> 5);
+		filter.AMR[3] = ~((mask << 3) & 0xf8);
+	}
+
+	CAN_config_filter(&filter);
+
+	return NULL;
+}
+
+driver_error_t *can_add_filter(uint32_t unit, uint32_t msg_id, uint8_t msg_type) {
+	driver_error_t *error;
+
+	if ((error = can_check_id(msg_id, msg_type))) {
+		return error;
+	}
+
+	if (CAN_add_sw_filter(msg_id, msg_type) < 0) {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_NO_MORE_FILTERS, NULL);
+	}
+
+	return NULL;
+}
+
+driver_error_t *can_remove_filter(uint32_t unit, uint32_t msg_id, uint8_t msg_type) {
+	driver_error_t *error;
+
+	if ((error = can_check_id(msg_id, msg_type))) {
+		return error;
+	}
+
+	if (CAN_remove_sw_filter(msg_id, msg_type) < 0) {
+		return driver_operation_error(CAN_DRIVER, CAN_ERR_FILTER_NOT_FOUND, NULL);
+	}
+
+	return NULL;
+}
+
+driver_error_t *can_clear_filters(uint32_t unit) {
+	CAN_clear_sw_filter();
+
+	return NULL;
+}
+
+driver_error_t *can_stats(uint32_t unit, CAN_stats_t *stats) {
+	driver_error_t *error;
+
+	if ((error = can_check_setup())) {
+		return error;
+	}
+
+	memcpy(stats, &CAN_cfg.stats, sizeof(CAN_stats_t));
 
 	return NULL;
 }
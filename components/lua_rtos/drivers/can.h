@@ -36,6 +36,8 @@
 
 #include <sys/driver.h>
 
+#include <can_bus.h>
+
 // Get the TX GPIO from Kconfig
 #if CONFIG_LUA_RTOS_CAN_TX_GPIO5
 #define CONFIG_LUA_RTOS_CAN_TX 5
@@ -62,12 +64,37 @@
 #define CONFIG_LUA_RTOS_CAN_RX 35
 #endif
 
+// Queue sizes, in frames
+#define CAN_RX_QUEUE_SIZE 32
+#define CAN_TX_QUEUE_SIZE 16
+
+// Max time that can_tx waits for room in the TX queue, in msecs
+#define CAN_TX_TIMEOUT 1000
+
+// Frame types
+#define CAN_FRAME_STD 0
+#define CAN_FRAME_EXT 1
+
 // CAN errors
 #define CAN_ERR_NOT_ENOUGH_MEMORY           (DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  0)
 #define CAN_ERR_INVALID_FRAME_LENGTH		(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  1)
+#define CAN_ERR_INVALID_FRAME_TYPE			(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  2)
+#define CAN_ERR_INVALID_ID					(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  3)
+#define CAN_ERR_NOT_SETUP					(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  4)
+#define CAN_ERR_TX_QUEUE_FULL				(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  5)
+#define CAN_ERR_TIMEOUT						(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  6)
+#define CAN_ERR_NO_MORE_FILTERS				(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  7)
+#define CAN_ERR_FILTER_NOT_FOUND			(DRIVER_EXCEPTION_BASE(CAN_DRIVER_ID) |  8)
 
 driver_error_t *can_setup(uint32_t unit, uint16_t speed);
 driver_error_t *can_tx(uint32_t unit, uint32_t msg_id, uint8_t msg_type, uint8_t *data, uint8_t len);
 driver_error_t *can_rx(uint32_t unit, uint32_t *msg_id, uint8_t *msg_type, uint8_t *data, uint8_t *len);
+driver_error_t *can_rx_frames(uint32_t unit, CAN_frame_t *frames, int n, uint32_t timeout, int *count);
+driver_error_t *can_flush(uint32_t unit, uint32_t timeout);
+driver_error_t *can_hw_filter(uint32_t unit, uint32_t msg_id, uint32_t mask, uint8_t msg_type);
+driver_error_t *can_add_filter(uint32_t unit, uint32_t msg_id, uint8_t msg_type);
+driver_error_t *can_remove_filter(uint32_t unit, uint32_t msg_id, uint8_t msg_type);
+driver_error_t *can_clear_filters(uint32_t unit);
+driver_error_t *can_stats(uint32_t unit, CAN_stats_t *stats);
 
 #endif	/* CAN_H */
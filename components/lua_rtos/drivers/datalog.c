@@ -0,0 +1,588 @@
+/*
+ * Lua RTOS, data logger driver
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_DATALOG
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <sys/driver.h>
+#include <sys/syslog.h>
+
+#include <drivers/adc.h>
+#include <drivers/datalog.h>
+
+// Driver message errors
+DRIVER_REGISTER_ERROR(DATALOG, datalog, NotEnoughtMemory, "not enough memory", DATALOG_ERR_NOT_ENOUGH_MEMORY);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, TooManySources, "too many sources", DATALOG_ERR_TOO_MANY_SOURCES);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, Running, "logger is running", DATALOG_ERR_RUNNING);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, NotRunning, "logger is not running", DATALOG_ERR_NOT_RUNNING);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, CannotOpen, "can't open log file", DATALOG_ERR_CANT_OPEN);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, InvalidFile, "invalid log file", DATALOG_ERR_INVALID_FILE);
+DRIVER_REGISTER_ERROR(DATALOG, datalog, NoSources, "no sources", DATALOG_ERR_NO_SOURCES);
+
+/*
+ * Helper functions
+ */
+static int datalog_header_valid(datalog_file_header_t *header) {
+	return (
+		(header->magic == DATALOG_MAGIC) &&
+		(header->version == DATALOG_VERSION) &&
+		(header->block_size == DATALOG_BLOCK_SIZE) &&
+		(header->record_size == sizeof(datalog_record_t)) &&
+		(header->sources <= DATALOG_MAX_SOURCES)
+	);
+}
+
+// Get number of data blocks in file
+static uint32_t datalog_blocks(FILE *fp) {
+	long size;
+
+	if (fseek(fp, 0, SEEK_END) != 0) {
+		return 0;
+	}
+
+	size = ftell(fp);
+	if (size < DATALOG_BLOCK_SIZE) {
+		return 0;
+	}
+
+	return (size / DATALOG_BLOCK_SIZE) - 1;
+}
+
+static int datalog_read_block(FILE *fp, uint32_t block, uint8_t *buffer, size_t size) {
+	if (fseek(fp, (block + 1) * DATALOG_BLOCK_SIZE, SEEK_SET) != 0) {
+		return -1;
+	}
+
+	if (fread(buffer, 1, size, fp) != size) {
+		return -1;
+	}
+
+	return 0;
+}
+
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+static double datalog_sensor_value(sensor_value_t *value) {
+	switch (value->type) {
+		case SENSOR_DATA_INT:    return value->integerd.value;
+		case SENSOR_DATA_FLOAT:  return value->floatd.value;
+		case SENSOR_DATA_DOUBLE: return value->doubled.value;
+		default:                 return 0;
+	}
+}
+#endif
+
+// Acquire a value from a source into record
+static void datalog_acquire(datalog_source_t *source, datalog_record_t *record) {
+	driver_error_t *error = NULL;
+
+	switch (source->type) {
+		#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+		case DATALOG_SENSOR: {
+			sensor_instance_t *instance = source->sensor.instance;
+
+			if (instance->period) {
+				// Sensor is sampled, so take last sample instead of wait for the sensor
+				sensor_value_t values[SENSOR_MAX_DATA];
+				uint32_t age;
+
+				if (!(error = sensor_get_sample(instance, values, &age))) {
+					record->value = datalog_sensor_value(&values[source->sensor.data]);
+				}
+			} else {
+				if (!(error = sensor_acquire(instance))) {
+					record->value = datalog_sensor_value(&instance->data[source->sensor.data]);
+				}
+			}
+			break;
+		}
+		#endif
+
+		case DATALOG_ADC: {
+			double mvolts;
+			int raw;
+
+			if (!(error = adc_read(source->adc.unit, source->adc.channel, &raw, &mvolts))) {
+				record->value = mvolts;
+			}
+			break;
+		}
+
+		default:
+			record->value = 0;
+			record->error = 1;
+			return;
+	}
+
+	if (error) {
+		free(error);
+		record->value = 0;
+		record->error = 1;
+	}
+}
+
+// Sample all sources, and put records into the ring
+static void datalog_sample(datalog_t *log) {
+	datalog_record_t *record;
+	struct timeval now;
+	int i;
+
+	gettimeofday(&now, NULL);
+
+	for(i = 0;i < log->header.sources;i++) {
+		if (log->head - log->tail >= log->size) {
+			// Ring is full, writer can't keep up
+			log->dropped++;
+			continue;
+		}
+
+		record = &log->ring[log->head % log->size];
+
+		record->sec = now.tv_sec;
+		record->msec = now.tv_usec / 1000;
+		record->source = i;
+		record->error = 0;
+
+		datalog_acquire(&log->source[i], record);
+
+		// Publish record
+		__sync_synchronize();
+		log->head++;
+		log->records++;
+	}
+
+	// Wake up writer when there are enough records for a block
+	if (log->head - log->tail >= DATALOG_BLOCK_RECORDS) {
+		xTaskNotifyGive(log->writer);
+	}
+}
+
+// Write up to count records from the ring as a new data block
+static void datalog_write_block(datalog_t *log, uint32_t count) {
+	datalog_block_header_t *header = (datalog_block_header_t *)log->block;
+	datalog_record_t *records = (datalog_record_t *)(log->block + sizeof(datalog_record_t));
+	int i;
+
+	if (count > DATALOG_BLOCK_RECORDS) {
+		count = DATALOG_BLOCK_RECORDS;
+	}
+
+	memset(log->block, 0, DATALOG_BLOCK_SIZE);
+
+	for(i = 0;i < count;i++) {
+		memcpy(&records[i], &log->ring[(log->tail + i) % log->size], sizeof(datalog_record_t));
+	}
+
+	header->magic = DATALOG_BLOCK_MAGIC;
+	header->sec = records[0].sec;
+	header->msec = records[0].msec;
+	header->count = count;
+	header->seq = log->seq++;
+
+	// Release records
+	__sync_synchronize();
+	log->tail += count;
+
+	if (fwrite(log->block, 1, DATALOG_BLOCK_SIZE, log->fp) != DATALOG_BLOCK_SIZE) {
+		syslog(LOG_ERR, "datalog: can't write to %s", log->path);
+		log->dropped += count;
+		return;
+	}
+
+	log->blocks++;
+}
+
+// Sampler task, acquires all sources each period
+static void datalog_sampler_task(void *arg) {
+	datalog_t *log = (datalog_t *)arg;
+	TickType_t last = xTaskGetTickCount();
+	TickType_t period = log->period / portTICK_PERIOD_MS;
+
+	if (period == 0) {
+		period = 1;
+	}
+
+	while (log->running) {
+		datalog_sample(log);
+		vTaskDelayUntil(&last, period);
+	}
+
+	xSemaphoreGive(log->done);
+	vTaskDelete(NULL);
+}
+
+// Writer task, writes full blocks to the log file as they are available
+static void datalog_writer_task(void *arg) {
+	datalog_t *log = (datalog_t *)arg;
+	uint8_t flush;
+
+	for(;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		while (log->head - log->tail >= DATALOG_BLOCK_RECORDS) {
+			datalog_write_block(log, DATALOG_BLOCK_RECORDS);
+		}
+
+		if ((flush = log->flush)) {
+			// Write remaining records in a partial block
+			if (log->head != log->tail) {
+				datalog_write_block(log, log->head - log->tail);
+			}
+
+			fflush(log->fp);
+			fsync(fileno(log->fp));
+
+			log->flush = 0;
+
+			if (flush == 2) {
+				break;
+			}
+
+			xSemaphoreGive(log->flushed);
+		}
+	}
+
+	fclose(log->fp);
+	log->fp = NULL;
+
+	xSemaphoreGive(log->done);
+	vTaskDelete(NULL);
+}
+
+// Open log file, appending to an existing log with the same sources, or creating
+// a new one
+static driver_error_t *datalog_open(datalog_t *log) {
+	datalog_file_header_t header;
+	datalog_block_header_t block;
+	uint32_t blocks;
+	FILE *fp;
+
+	if ((fp = fopen(log->path, "r+"))) {
+		if ((fread(&header, 1, sizeof(header), fp) != sizeof(header)) || !datalog_header_valid(&header) ||
+			(header.sources != log->header.sources) || memcmp(header.name, log->header.name, sizeof(header.name))) {
+			fclose(fp);
+			return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_INVALID_FILE, log->path);
+		}
+
+		// Continue block sequence, discarding a trailing incomplete block
+		log->seq = 0;
+		blocks = datalog_blocks(fp);
+		if (blocks && !datalog_read_block(fp, blocks - 1, (uint8_t *)&block, sizeof(block)) && (block.magic == DATALOG_BLOCK_MAGIC)) {
+			log->seq = block.seq + 1;
+		}
+
+		fseek(fp, (blocks + 1) * DATALOG_BLOCK_SIZE, SEEK_SET);
+	} else {
+		if (!(fp = fopen(log->path, "w+"))) {
+			return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_CANT_OPEN, log->path);
+		}
+
+		memset(log->block, 0, DATALOG_BLOCK_SIZE);
+		memcpy(log->block, &log->header, sizeof(log->header));
+
+		if (fwrite(log->block, 1, DATALOG_BLOCK_SIZE, fp) != DATALOG_BLOCK_SIZE) {
+			fclose(fp);
+			return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_CANT_OPEN, log->path);
+		}
+
+		log->seq = 0;
+	}
+
+	// Blocks are written in one call, so there is no need for stdio buffering
+	setvbuf(fp, NULL, _IONBF, 0);
+
+	log->fp = fp;
+
+	return NULL;
+}
+
+static driver_error_t *datalog_add_source(datalog_t *log, const char *name, datalog_source_t **source) {
+	if (log->running) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_RUNNING, NULL);
+	}
+
+	if (log->header.sources >= DATALOG_MAX_SOURCES) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_TOO_MANY_SOURCES, NULL);
+	}
+
+	strncpy(log->header.name[log->header.sources], name, DATALOG_NAME_SIZE - 1);
+
+	*source = &log->source[log->header.sources++];
+
+	return NULL;
+}
+
+/*
+ * Operation functions
+ */
+driver_error_t *datalog_setup(const char *path, uint32_t period, uint32_t size, datalog_t **log) {
+	datalog_t *instance;
+
+	if (!(instance = calloc(1, sizeof(datalog_t)))) {
+		return driver_setup_error(DATALOG_DRIVER, DATALOG_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	if (size < DATALOG_BLOCK_RECORDS * 2) {
+		size = DATALOG_BLOCK_RECORDS * 2;
+	}
+
+	instance->path = strdup(path);
+	instance->ring = calloc(size, sizeof(datalog_record_t));
+	instance->block = malloc(DATALOG_BLOCK_SIZE);
+	instance->flushed = xSemaphoreCreateBinary();
+	instance->done = xSemaphoreCreateCounting(2, 0);
+
+	if (!instance->path || !instance->ring || !instance->block || !instance->flushed || !instance->done) {
+		datalog_unsetup(instance);
+		return driver_setup_error(DATALOG_DRIVER, DATALOG_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	instance->size = size;
+	instance->period = period;
+
+	instance->header.magic = DATALOG_MAGIC;
+	instance->header.version = DATALOG_VERSION;
+	instance->header.block_size = DATALOG_BLOCK_SIZE;
+	instance->header.record_size = sizeof(datalog_record_t);
+	instance->header.period = period;
+
+	*log = instance;
+
+	return NULL;
+}
+
+driver_error_t *datalog_add_adc(datalog_t *log, const char *name, uint8_t unit, uint8_t channel) {
+	driver_error_t *error;
+	datalog_source_t *source;
+
+	if ((error = datalog_add_source(log, name, &source))) {
+		return error;
+	}
+
+	source->type = DATALOG_ADC;
+	source->adc.unit = unit;
+	source->adc.channel = channel;
+
+	return NULL;
+}
+
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+driver_error_t *datalog_add_sensor(datalog_t *log, const char *name, sensor_instance_t *instance, uint8_t data) {
+	driver_error_t *error;
+	datalog_source_t *source;
+
+	if ((error = datalog_add_source(log, name, &source))) {
+		return error;
+	}
+
+	source->type = DATALOG_SENSOR;
+	source->sensor.instance = instance;
+	source->sensor.data = data;
+
+	return NULL;
+}
+#endif
+
+driver_error_t *datalog_start(datalog_t *log) {
+	driver_error_t *error;
+
+	if (log->running) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_RUNNING, NULL);
+	}
+
+	if (log->header.sources == 0) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NO_SOURCES, NULL);
+	}
+
+	if ((error = datalog_open(log))) {
+		return error;
+	}
+
+	log->head = 0;
+	log->tail = 0;
+	log->flush = 0;
+	log->running = 1;
+
+	if (xTaskCreatePinnedToCore(datalog_writer_task, "datalogw", CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE, log, CONFIG_LUA_RTOS_LUA_TASK_PRIORITY, &log->writer, xPortGetCoreID()) != pdPASS) {
+		fclose(log->fp);
+		log->fp = NULL;
+		log->running = 0;
+
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	if (xTaskCreatePinnedToCore(datalog_sampler_task, "datalogs", CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE, log, CONFIG_LUA_RTOS_LUA_TASK_PRIORITY, &log->sampler, xPortGetCoreID()) != pdPASS) {
+		log->running = 0;
+
+		// Writer closes the file
+		log->flush = 2;
+		xTaskNotifyGive(log->writer);
+		xSemaphoreTake(log->done, portMAX_DELAY);
+
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	return NULL;
+}
+
+driver_error_t *datalog_flush(datalog_t *log) {
+	if (!log->running) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NOT_RUNNING, NULL);
+	}
+
+	log->flush = 1;
+	xTaskNotifyGive(log->writer);
+	xSemaphoreTake(log->flushed, portMAX_DELAY);
+
+	return NULL;
+}
+
+driver_error_t *datalog_stop(datalog_t *log) {
+	if (!log->running) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NOT_RUNNING, NULL);
+	}
+
+	// Wait for the sampler, so no more records are added
+	log->running = 0;
+	xSemaphoreTake(log->done, portMAX_DELAY);
+
+	// Write remaining records and wait for the writer
+	log->flush = 2;
+	xTaskNotifyGive(log->writer);
+	xSemaphoreTake(log->done, portMAX_DELAY);
+
+	return NULL;
+}
+
+void datalog_unsetup(datalog_t *log) {
+	if (log->running) {
+		datalog_stop(log);
+	}
+
+	if (log->flushed) vSemaphoreDelete(log->flushed);
+	if (log->done) vSemaphoreDelete(log->done);
+
+	free(log->block);
+	free(log->ring);
+	free(log->path);
+	free(log);
+}
+
+driver_error_t *datalog_query(const char *path, uint32_t from, uint32_t to, datalog_query_f_t callback, void *arg) {
+	datalog_file_header_t header;
+	datalog_block_header_t *block_header;
+	datalog_record_t *records;
+	uint32_t blocks, block;
+	int lo, hi, mid, i;
+	uint8_t *buffer;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r"))) {
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_CANT_OPEN, path);
+	}
+
+	if ((fread(&header, 1, sizeof(header), fp) != sizeof(header)) || !datalog_header_valid(&header)) {
+		fclose(fp);
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_INVALID_FILE, path);
+	}
+
+	if (!(buffer = malloc(DATALOG_BLOCK_SIZE))) {
+		fclose(fp);
+		return driver_operation_error(DATALOG_DRIVER, DATALOG_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	block_header = (datalog_block_header_t *)buffer;
+	records = (datalog_record_t *)(buffer + sizeof(datalog_record_t));
+
+	// Find the last block that starts before from, only reading block headers.
+	// Records at from can be at the end of that block, as a block can start
+	// with records at the same second as the end of the previous one.
+	blocks = datalog_blocks(fp);
+	block = 0;
+	lo = 0;
+	hi = blocks - 1;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+
+		if (datalog_read_block(fp, mid, buffer, sizeof(datalog_block_header_t))) {
+			break;
+		}
+
+		if (block_header->sec < from) {
+			block = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	// Scan blocks until the end of range
+	for(;block < blocks;block++) {
+		if (datalog_read_block(fp, block, buffer, DATALOG_BLOCK_SIZE)) {
+			break;
+		}
+
+		if (block_header->magic != DATALOG_BLOCK_MAGIC) {
+			continue;
+		}
+
+		if (block_header->sec > to) {
+			break;
+		}
+
+		for(i = 0;(i < block_header->count) && (i < DATALOG_BLOCK_RECORDS);i++) {
+			if ((records[i].sec >= from) && (records[i].sec <= to)) {
+				if (callback(arg, &header, &records[i])) {
+					goto done;
+				}
+			}
+		}
+	}
+
+done:
+	free(buffer);
+	fclose(fp);
+
+	return NULL;
+}
+
+DRIVER_REGISTER(DATALOG,datalog,NULL,NULL,NULL);
+
+#endif
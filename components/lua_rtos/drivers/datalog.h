@@ -0,0 +1,182 @@
+/*
+ * Lua RTOS, data logger driver
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#ifndef _DATALOG_H_
+#define _DATALOG_H_
+
+#include "luartos.h"
+
+#if CONFIG_LUA_RTOS_LUA_USE_DATALOG
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <sys/driver.h>
+
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+#include <drivers/sensor.h>
+#endif
+
+/*
+ * Log file format
+ *
+ * A log file is a sequence of DATALOG_BLOCK_SIZE blocks. First block is the
+ * file header, and the next blocks are data blocks. Each data block starts
+ * with a block header, that has the same size as a record, followed by up to
+ * DATALOG_BLOCK_RECORDS records. Records are appended in time order, so
+ * blocks can be located by time with a binary search over block headers.
+ */
+#define DATALOG_MAGIC           0x474f4c44 // DLOG
+#define DATALOG_BLOCK_MAGIC     0x4b4c4244 // DBLK
+#define DATALOG_VERSION         1
+
+#define DATALOG_BLOCK_SIZE      512        // multiple of SPIFFS page and SD sector sizes
+#define DATALOG_MAX_SOURCES     16
+#define DATALOG_NAME_SIZE       16
+#define DATALOG_RING_RECORDS    256        // default ring size, in records
+
+// Record
+typedef struct {
+	uint32_t sec;       // timestamp (seconds since epoch)
+	uint16_t msec;      // timestamp (milliseconds)
+	uint8_t  source;    // source index
+	uint8_t  error;     // 1 if value couldn't be acquired
+	double   value;
+} datalog_record_t;
+
+#define DATALOG_BLOCK_RECORDS   ((DATALOG_BLOCK_SIZE / sizeof(datalog_record_t)) - 1)
+
+// Data block header
+typedef struct {
+	uint32_t magic;
+	uint32_t sec;       // timestamp of first record
+	uint16_t msec;
+	uint16_t count;     // number of records in block
+	uint32_t seq;       // block sequence number
+} datalog_block_header_t;
+
+// File header
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t block_size;
+	uint16_t record_size;
+	uint8_t  sources;
+	uint8_t  reserved;
+	uint32_t period;    // sampling period in msecs
+	char     name[DATALOG_MAX_SOURCES][DATALOG_NAME_SIZE];
+} datalog_file_header_t;
+
+typedef enum {
+	DATALOG_SENSOR,
+	DATALOG_ADC
+} datalog_source_type_t;
+
+// Data source
+typedef struct {
+	datalog_source_type_t type;
+	union {
+		#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+		struct {
+			sensor_instance_t *instance;
+			uint8_t data;
+		} sensor;
+		#endif
+
+		struct {
+			uint8_t unit;
+			uint8_t channel;
+		} adc;
+	};
+} datalog_source_t;
+
+// Logger instance
+typedef struct {
+	char *path;
+	uint32_t period;                          // sampling period in msecs
+
+	datalog_file_header_t header;
+	datalog_source_t source[DATALOG_MAX_SOURCES];
+
+	// Record ring, head is only written by the sampler task, and tail
+	// is only written by the writer task
+	datalog_record_t *ring;
+	uint32_t size;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+
+	// Writer state
+	FILE *fp;
+	uint8_t *block;
+	uint32_t seq;
+	volatile uint8_t flush;                   // 1 = flush, 2 = flush and exit
+	SemaphoreHandle_t flushed;                // given by writer when flush is done
+	SemaphoreHandle_t done;                   // given by sampler and writer on exit
+
+	// Statistics
+	volatile uint32_t records;
+	volatile uint32_t dropped;
+	volatile uint32_t blocks;
+
+	TaskHandle_t sampler;
+	TaskHandle_t writer;
+	volatile uint8_t running;
+} datalog_t;
+
+// Callback for datalog_query, called for each record in the queried range.
+// Returns non zero to stop the query.
+typedef int (*datalog_query_f_t)(void *, datalog_file_header_t *, datalog_record_t *);
+
+// DATALOG errors
+#define DATALOG_ERR_NOT_ENOUGH_MEMORY      (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  0)
+#define DATALOG_ERR_TOO_MANY_SOURCES       (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  1)
+#define DATALOG_ERR_RUNNING                (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  2)
+#define DATALOG_ERR_NOT_RUNNING            (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  3)
+#define DATALOG_ERR_CANT_OPEN              (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  4)
+#define DATALOG_ERR_INVALID_FILE           (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  5)
+#define DATALOG_ERR_NO_SOURCES             (DRIVER_EXCEPTION_BASE(DATALOG_DRIVER_ID) |  6)
+
+driver_error_t *datalog_setup(const char *path, uint32_t period, uint32_t size, datalog_t **log);
+driver_error_t *datalog_add_adc(datalog_t *log, const char *name, uint8_t unit, uint8_t channel);
+#if CONFIG_LUA_RTOS_LUA_USE_SENSOR
+driver_error_t *datalog_add_sensor(datalog_t *log, const char *name, sensor_instance_t *instance, uint8_t data);
+#endif
+driver_error_t *datalog_start(datalog_t *log);
+driver_error_t *datalog_flush(datalog_t *log);
+driver_error_t *datalog_stop(datalog_t *log);
+void datalog_unsetup(datalog_t *log);
+driver_error_t *datalog_query(const char *path, uint32_t from, uint32_t to, datalog_query_f_t callback, void *arg);
+
+#endif
+
+#endif /* _DATALOG_H_ */
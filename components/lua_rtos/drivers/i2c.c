@@ -34,8 +34,9 @@
 #include "driver/periph_ctrl.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include <sys/list.h>
 #include <sys/mutex.h>
 #include <sys/driver.h>
 #include <sys/syslog.h>
@@ -61,6 +62,7 @@ DRIVER_REGISTER_ERROR(I2C, i2c, NotEnoughtMemory, "not enough memory", I2C_ERR_N
 DRIVER_REGISTER_ERROR(I2C, i2c, InvalidTransaction, "invalid transaction", I2C_ERR_INVALID_TRANSACTION);
 DRIVER_REGISTER_ERROR(I2C, i2c, AckNotReceived, "not ack received", I2C_ERR_NOT_ACK);
 DRIVER_REGISTER_ERROR(I2C, i2c, Timeout, "timeout", I2C_ERR_TIMEOUT);
+DRIVER_REGISTER_ERROR(I2C, i2c, NoMoreTransactions, "no more transactions", I2C_ERR_NO_MORE_TRANSACTIONS);
 
 // i2c info needed by driver
 static i2c_t i2c[CPU_LAST_I2C + 1] = {
@@ -68,8 +70,9 @@ static i2c_t i2c[CPU_LAST_I2C + 1] = {
 	{0,0, MUTEX_INITIALIZER},
 };
 
-// Transaction list
-static struct list transactions;
+// Transaction pool
+static i2c_transaction_t transactions[I2C_TRANSACTIONS];
+static struct mtx transactions_mtx = MUTEX_INITIALIZER;
 
 /*
  * Helper functions
@@ -100,65 +103,136 @@ static driver_error_t *i2c_check(int unit) {
 		return driver_operation_error(I2C_DRIVER, I2C_ERR_IS_NOT_SETUP, NULL);
 	}
 
+	if (i2c[unit].mode != I2C_MASTER) {
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
+	}
+
 	return NULL;
 }
 
-static driver_error_t *i2c_get_command(int unit, int *transaction, i2c_cmd_handle_t *cmd) {
-    if (list_get(&transactions, *transaction, (void **)cmd)) {
-    	mtx_unlock(&i2c[unit].mtx);
+static driver_error_t *i2c_cmd_error(esp_err_t err) {
+	if (err == ESP_FAIL) {
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ACK, NULL);
+	} else if (err == ESP_ERR_TIMEOUT) {
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_TIMEOUT, NULL);
+	}
+
+	return NULL;
+}
 
+static driver_error_t *i2c_get_transaction(int *transaction, i2c_transaction_t **trans) {
+	if ((*transaction < 0) || (*transaction >= I2C_TRANSACTIONS) || !transactions[*transaction].used) {
 		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_TRANSACTION, NULL);
-    }
+	}
 
-    return NULL;
+	*trans = &transactions[*transaction];
+
+	return NULL;
 }
 
-static driver_error_t *i2c_create_or_get_command(int unit, int *transaction, i2c_cmd_handle_t *cmd) {
+static driver_error_t *i2c_get_command(int *transaction, i2c_cmd_handle_t *cmd) {
 	driver_error_t *error;
+	i2c_transaction_t *trans;
 
-	// If transaction is valid get command, we don't need to create
-	if (*transaction != I2C_TRANSACTION_INITIALIZER) {
-		if ((error = i2c_get_command(unit, transaction, cmd))) {
-			return error;
-		}
-	} else {
-		// Create command
-		*cmd = i2c_cmd_link_create();
-		if (!*cmd) {
-			mtx_unlock(&i2c[unit].mtx);
+	if ((error = i2c_get_transaction(transaction, &trans))) {
+		return error;
+	}
+
+	// Command link is created on first command after a flush
+	if (!trans->cmd) {
+		trans->cmd = i2c_cmd_link_create();
+		if (!trans->cmd) {
 			return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ENOUGH_MEMORY, NULL);
 		}
+	}
 
-		// Add transaction to list
-		if (list_add(&transactions, *cmd, transaction)) {
-			*transaction = I2C_TRANSACTION_INITIALIZER;
+	*cmd = trans->cmd;
 
-			i2c_cmd_link_delete(*cmd);
-			mtx_unlock(&i2c[unit].mtx);
-			return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ENOUGH_MEMORY, NULL);
+	return NULL;
+}
+
+// Free the command link of a transaction, and its write data
+static void i2c_free_command(i2c_transaction_t *trans) {
+	i2c_buffer_t *buffer;
+
+	if (trans->cmd) {
+		i2c_cmd_link_delete(trans->cmd);
+		trans->cmd = NULL;
+	}
+
+	while ((buffer = trans->buffers)) {
+		trans->buffers = buffer->next;
+		free(buffer);
+	}
+}
+
+// Return a transaction to the pool
+static void i2c_release_transaction(int *transaction) {
+	i2c_transaction_t *trans = &transactions[*transaction];
+
+	i2c_free_command(trans);
+
+	mtx_lock(&transactions_mtx);
+	trans->used = 0;
+	mtx_unlock(&transactions_mtx);
+
+	*transaction = I2C_TRANSACTION_INITIALIZER;
+}
+
+static driver_error_t *i2c_create_or_get_command(int *transaction, i2c_cmd_handle_t *cmd) {
+	driver_error_t *error;
+	int i;
+
+	// If transaction is valid get command, we don't need to take one from the pool
+	if (*transaction != I2C_TRANSACTION_INITIALIZER) {
+		return i2c_get_command(transaction, cmd);
+	}
+
+	mtx_lock(&transactions_mtx);
+	for(i = 0; i < I2C_TRANSACTIONS; i++) {
+		if (!transactions[i].used) {
+			transactions[i].used = 1;
+			break;
 		}
 	}
+	mtx_unlock(&transactions_mtx);
+
+	if (i == I2C_TRANSACTIONS) {
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_NO_MORE_TRANSACTIONS, NULL);
+	}
+
+	*transaction = i;
+
+	if ((error = i2c_get_command(transaction, cmd))) {
+		i2c_release_transaction(transaction);
+		return error;
+	}
 
 	return NULL;
 }
 
-static driver_error_t *i2c_flush_internal(int unit, int *transaction, i2c_cmd_handle_t cmd) {
-	// Flush
-	esp_err_t err = i2c_master_cmd_begin(unit, cmd, 1000 / portTICK_RATE_MS);
-	i2c_cmd_link_delete(cmd);
-	list_remove(&transactions, *transaction, 0);
+// Execute the command link of a transaction. If release is 0 the transaction
+// is kept for next commands, if not it's returned to the pool.
+static driver_error_t *i2c_flush_internal(int unit, int *transaction, int release) {
+	driver_error_t *error;
+	i2c_transaction_t *trans;
+	esp_err_t err = ESP_OK;
 
-    *transaction = I2C_TRANSACTION_INITIALIZER;
+	if ((error = i2c_get_transaction(transaction, &trans))) {
+		return error;
+	}
 
-	if (err == ESP_FAIL) {
-    	mtx_unlock(&i2c[unit].mtx);
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ACK, NULL);
-	} else if (err == ESP_ERR_TIMEOUT) {
-    	mtx_unlock(&i2c[unit].mtx);
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_TIMEOUT, NULL);
+	if (trans->cmd) {
+		err = i2c_master_cmd_begin(unit, trans->cmd, 1000 / portTICK_RATE_MS);
 	}
 
-	return NULL;
+	if (release) {
+		i2c_release_transaction(transaction);
+	} else {
+		i2c_free_command(trans);
+	}
+
+	return i2c_cmd_error(err);
 }
 
 /*
@@ -168,38 +242,27 @@ static driver_error_t *i2c_flush_internal(int unit, int *transaction, i2c_cmd_ha
 void i2c_init() {
 	int i;
 
-	// Init transaction list
-    list_init(&transactions, 0);
-
     // Init mutexes
     for(i=0;i < CPU_LAST_I2C;i++) {
         mtx_init(&i2c[i].mtx, NULL, NULL, 0);
     }
+
+    mtx_init(&transactions_mtx, NULL, NULL, 0);
 }
 
 driver_error_t *i2c_flush(int unit, int *transaction, int new_transaction) {
 	driver_error_t *error;
-	i2c_cmd_handle_t cmd = NULL;
 
-	// Get command
-	if ((error = i2c_get_command(unit, transaction, &cmd))) {
-		return error;
-	}
-
-	// Flush
-	if ((error = i2c_flush_internal(unit, transaction, cmd))) {
+	// Sanity checks
+	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	if (new_transaction) {
-		// Create a new command
-		if ((error = i2c_create_or_get_command(unit, transaction, &cmd))) {
-			mtx_unlock(&i2c[unit].mtx);
-			return error;
-		}
-	}
+	mtx_lock(&i2c[unit].mtx);
+	error = i2c_flush_internal(unit, transaction, !new_transaction);
+	mtx_unlock(&i2c[unit].mtx);
 
-	return NULL;
+	return error;
 }
 
 driver_error_t *i2c_setup(int unit, int mode, int speed, int sda, int scl, int addr10_en, int addr) {
@@ -283,152 +346,237 @@ driver_error_t *i2c_start(int unit, int *transaction) {
 		return error;
 	}
 
-	if (i2c[unit].mode != I2C_MASTER) {
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
+	mtx_lock(&i2c[unit].mtx);
+
+	if (!(error = i2c_create_or_get_command(transaction, &cmd))) {
+		i2c_master_start(cmd);
 	}
 
-	mtx_lock(&i2c[unit].mtx);
+	mtx_unlock(&i2c[unit].mtx);
 
-	if ((error = i2c_create_or_get_command(unit, transaction, &cmd))) {
-		mtx_unlock(&i2c[unit].mtx);
+	return error;
+}
+
+driver_error_t *i2c_stop(int unit, int *transaction) {
+	driver_error_t *error;
+	i2c_cmd_handle_t cmd;
+
+	// Sanity checks
+	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	i2c_master_start(cmd);
+	mtx_lock(&i2c[unit].mtx);
+
+	if (!(error = i2c_get_command(transaction, &cmd))) {
+		i2c_master_stop(cmd);
+
+		// Flush
+		error = i2c_flush_internal(unit, transaction, 1);
+	}
 
 	mtx_unlock(&i2c[unit].mtx);
 
-	return NULL;
+	return error;
 }
 
-driver_error_t *i2c_stop(int unit, int *transaction) {
+driver_error_t *i2c_write_address(int unit, int *transaction, char address, int read) {
 	driver_error_t *error;
+	i2c_cmd_handle_t cmd;
 
 	// Sanity checks
 	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	if (i2c[unit].mode != I2C_MASTER) {
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
+	mtx_lock(&i2c[unit].mtx);
+
+	if (!(error = i2c_get_command(transaction, &cmd))) {
+		i2c_master_write_byte(cmd, address << 1 | (read?I2C_MASTER_READ:I2C_MASTER_WRITE), ACK_CHECK_EN);
 	}
 
-	mtx_lock(&i2c[unit].mtx);
+    mtx_unlock(&i2c[unit].mtx);
+
+	return error;
+}
 
-	// Get command
+driver_error_t *i2c_write(int unit, int *transaction, char *data, int len) {
+	driver_error_t *error;
+	i2c_transaction_t *trans;
+	i2c_buffer_t *buffer;
 	i2c_cmd_handle_t cmd;
-    if (list_get(&transactions, *transaction, (void **)&cmd)) {
-    	mtx_unlock(&i2c[unit].mtx);
 
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_TRANSACTION, NULL);
-    }
+	// Sanity checks
+	if ((error = i2c_check(unit))) {
+		return error;
+	}
 
-	i2c_master_stop(cmd);
+	mtx_lock(&i2c[unit].mtx);
 
-	// Flush
-	if ((error = i2c_flush_internal(unit, transaction, cmd))) {
+	if ((error = i2c_get_command(transaction, &cmd))) {
 		mtx_unlock(&i2c[unit].mtx);
 		return error;
 	}
 
+	if (len > 1) {
+		// Command link only has a reference to data, so data is copied, and
+		// kept until the command link is executed
+		buffer = (i2c_buffer_t *)malloc(sizeof(i2c_buffer_t) + len);
+		if (!buffer) {
+			mtx_unlock(&i2c[unit].mtx);
+			return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ENOUGH_MEMORY, NULL);
+		}
+
+		memcpy(buffer->data, data, len);
+
+		i2c_get_transaction(transaction, &trans);
+		buffer->next = trans->buffers;
+		trans->buffers = buffer;
+
+		i2c_master_write(cmd, buffer->data, len, ACK_CHECK_EN);
+	} else if (len == 1) {
+		i2c_master_write_byte(cmd, *data, ACK_CHECK_EN);
+	}
+
 	mtx_unlock(&i2c[unit].mtx);
 
-	return NULL;
+    return NULL;
 }
 
-driver_error_t *i2c_write_address(int unit, int *transaction, char address, int read) {
+driver_error_t *i2c_read(int unit, int *transaction, char *data, int len) {
 	driver_error_t *error;
+	i2c_cmd_handle_t cmd;
 
 	// Sanity checks
 	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	if (i2c[unit].mode != I2C_MASTER) {
+	if (len <= 0) {
 		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
 	}
 
 	mtx_lock(&i2c[unit].mtx);
 
-	// Get command
-	i2c_cmd_handle_t cmd;
-    if (list_get(&transactions, *transaction, (void **)&cmd)) {
-    	mtx_unlock(&i2c[unit].mtx);
-
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_TRANSACTION, NULL);
-    }
+	if (!(error = i2c_get_command(transaction, &cmd))) {
+		if (len > 1) {
+			i2c_master_read(cmd, (uint8_t *)data, len - 1, ACK_VAL);
+		}
 
-    i2c_master_write_byte(cmd, address << 1 | (read?I2C_MASTER_READ:I2C_MASTER_WRITE), ACK_CHECK_EN);
+		i2c_master_read_byte(cmd, (uint8_t *)(data + len - 1), NACK_VAL);
+	}
 
     mtx_unlock(&i2c[unit].mtx);
 
-	return NULL;
+    return error;
 }
 
-driver_error_t *i2c_write(int unit, int *transaction, char *data, int len) {
+driver_error_t *i2c_release(int unit, int *transaction) {
 	driver_error_t *error;
+	i2c_transaction_t *trans;
+
+    // Sanity checks
+	if (!((1 << unit) & CPU_I2C_ALL)) {
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_UNIT, NULL);
+	}
+
+	mtx_lock(&i2c[unit].mtx);
+
+	if (!(error = i2c_get_transaction(transaction, &trans))) {
+		i2c_release_transaction(transaction);
+	}
+
+	mtx_unlock(&i2c[unit].mtx);
+
+	return error;
+}
+
+/*
+ * Read len registers starting at reg, from the device at address, in a
+ * single command link: start, address (write), reg, repeated start,
+ * address (read), data, stop.
+ */
+driver_error_t *i2c_read_reg(int unit, int address, int reg, char *data, int len) {
+	driver_error_t *error;
+	i2c_cmd_handle_t cmd;
+	esp_err_t err;
 
 	// Sanity checks
 	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	if (i2c[unit].mode != I2C_MASTER) {
+	if (len <= 0) {
 		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
 	}
 
 	mtx_lock(&i2c[unit].mtx);
 
-	// Get command
-	i2c_cmd_handle_t cmd;
-    if (list_get(&transactions, *transaction, (void **)&cmd)) {
-    	mtx_unlock(&i2c[unit].mtx);
+	cmd = i2c_cmd_link_create();
+	if (!cmd) {
+		mtx_unlock(&i2c[unit].mtx);
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
 
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_TRANSACTION, NULL);
-    }
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, address << 1 | I2C_MASTER_WRITE, ACK_CHECK_EN);
+	i2c_master_write_byte(cmd, reg, ACK_CHECK_EN);
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, address << 1 | I2C_MASTER_READ, ACK_CHECK_EN);
 
-    if (len > 1) {
-    	i2c_master_write(cmd, (uint8_t *)data, len, ACK_CHECK_EN);
-    } else {
-        i2c_master_write_byte(cmd, *data, ACK_CHECK_EN);
-    }
+	if (len > 1) {
+		i2c_master_read(cmd, (uint8_t *)data, len - 1, ACK_VAL);
+	}
+
+	i2c_master_read_byte(cmd, (uint8_t *)(data + len - 1), NACK_VAL);
+	i2c_master_stop(cmd);
+
+	err = i2c_master_cmd_begin(unit, cmd, 1000 / portTICK_RATE_MS);
+	i2c_cmd_link_delete(cmd);
 
 	mtx_unlock(&i2c[unit].mtx);
 
-    return NULL;
+	return i2c_cmd_error(err);
 }
 
-driver_error_t *i2c_read(int unit, int *transaction, char *data, int len) {
+/*
+ * Write len registers starting at reg, to the device at address, in a
+ * single command link: start, address (write), reg, data, stop.
+ */
+driver_error_t *i2c_write_reg(int unit, int address, int reg, char *data, int len) {
 	driver_error_t *error;
+	i2c_cmd_handle_t cmd;
+	esp_err_t err;
 
 	// Sanity checks
 	if ((error = i2c_check(unit))) {
 		return error;
 	}
 
-	if (i2c[unit].mode != I2C_MASTER) {
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_OPERATION, NULL);
-	}
-
 	mtx_lock(&i2c[unit].mtx);
 
-	// Get command
-	i2c_cmd_handle_t cmd;
-    if (list_get(&transactions, *transaction, (void **)&cmd)) {
-    	mtx_unlock(&i2c[unit].mtx);
+	cmd = i2c_cmd_link_create();
+	if (!cmd) {
+		mtx_unlock(&i2c[unit].mtx);
+		return driver_operation_error(I2C_DRIVER, I2C_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
 
-		return driver_operation_error(I2C_DRIVER, I2C_ERR_INVALID_TRANSACTION, NULL);
-    }
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, address << 1 | I2C_MASTER_WRITE, ACK_CHECK_EN);
+	i2c_master_write_byte(cmd, reg, ACK_CHECK_EN);
 
-    if (len > 1) {
-    	i2c_master_read(cmd, (uint8_t *)data, len - 1, ACK_VAL);
-    }
+	if (len > 0) {
+		i2c_master_write(cmd, (uint8_t *)data, len, ACK_CHECK_EN);
+	}
 
-   	i2c_master_read_byte(cmd, (uint8_t *)(data + len - 1), NACK_VAL);
+	i2c_master_stop(cmd);
 
-    mtx_unlock(&i2c[unit].mtx);
+	err = i2c_master_cmd_begin(unit, cmd, 1000 / portTICK_RATE_MS);
+	i2c_cmd_link_delete(cmd);
 
-    return NULL;
+	mtx_unlock(&i2c[unit].mtx);
+
+	return i2c_cmd_error(err);
 }
 
 DRIVER_REGISTER(I2C,i2c,i2c_locks,i2c_init,NULL);
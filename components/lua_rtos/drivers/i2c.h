@@ -43,6 +43,24 @@
 
 #define I2C_TRANSACTION_INITIALIZER -1
 
+// Number of transactions in the transaction pool
+#define I2C_TRANSACTIONS 16
+
+// Copy of the data of a write, kept until the transaction is flushed
+typedef struct i2c_buffer {
+	struct i2c_buffer *next;
+	uint8_t data[];
+} i2c_buffer_t;
+
+// Transaction. Transactions are taken from a pool, and are kept by its
+// owner until it's stopped, so the command link is the only thing that
+// is created on each flush.
+typedef struct {
+	uint8_t used;
+	i2c_cmd_handle_t cmd;    // command link, created on first command
+	i2c_buffer_t *buffers;   // write data of the command link
+} i2c_transaction_t;
+
 // Internal driver structure
 typedef struct i2c {
 	uint8_t mode;
@@ -68,6 +86,7 @@ typedef struct {
 #define I2C_ERR_INVALID_TRANSACTION		 (DRIVER_EXCEPTION_BASE(I2C_DRIVER_ID) |  5)
 #define I2C_ERR_NOT_ACK					 (DRIVER_EXCEPTION_BASE(I2C_DRIVER_ID) |  6)
 #define I2C_ERR_TIMEOUT					 (DRIVER_EXCEPTION_BASE(I2C_DRIVER_ID) |  7)
+#define I2C_ERR_NO_MORE_TRANSACTIONS	 (DRIVER_EXCEPTION_BASE(I2C_DRIVER_ID) |  8)
 
 void i2c_init();
 
@@ -78,5 +97,8 @@ driver_error_t *i2c_write_address(int unit, int *transaction, char address, int
 driver_error_t *i2c_write(int unit, int *transaction, char *data, int len);
 driver_error_t *i2c_read(int unit, int *transaction, char *data, int len);
 driver_error_t *i2c_flush(int unit, int *transaction, int new_transaction);
+driver_error_t *i2c_release(int unit, int *transaction);
+driver_error_t *i2c_read_reg(int unit, int address, int reg, char *data, int len);
+driver_error_t *i2c_write_reg(int unit, int address, int reg, char *data, int len);
 
 #endif /* I2C_H */
@@ -31,17 +31,22 @@
 
 #include "neopixel.h"
 
+#include <math.h>
+#include <string.h>
+
 #include <sys/list.h>
 #include <sys/driver.h>
-#include <sys/delay.h>
 
 #include <drivers/gpio.h>
 #include <drivers/nzr.h>
 
 #define NEO_CYCLES(n) ((double)n / (double)((double)1000000000L / (double)CPU_HZ))
 
-static nzr_timing_t chipset[1] = {
-	{NEO_CYCLES(350), NEO_CYCLES(900), NEO_CYCLES(900), NEO_CYCLES(350), NEO_CYCLES(50000)}, // WS2812B
+static nzr_timing_t chipset[NeopixelControllers] = {
+	{NEO_CYCLES(350), NEO_CYCLES(900), NEO_CYCLES(900), NEO_CYCLES(350), NEO_CYCLES(50000)},   // WS2812B
+	{NEO_CYCLES(350), NEO_CYCLES(800), NEO_CYCLES(700), NEO_CYCLES(600), NEO_CYCLES(50000)},   // WS2812
+	{NEO_CYCLES(300), NEO_CYCLES(900), NEO_CYCLES(600), NEO_CYCLES(600), NEO_CYCLES(80000)},   // SK6812
+	{NEO_CYCLES(500), NEO_CYCLES(2000), NEO_CYCLES(1200), NEO_CYCLES(1300), NEO_CYCLES(50000)}, // WS2811
 };
 
 // Driver errors
@@ -50,10 +55,55 @@ DRIVER_REGISTER_ERROR(NEOPIXEL, neopixel, InvalidUnit, "invalid unit", NEOPIXEL_
 DRIVER_REGISTER_ERROR(NEOPIXEL, neopixel, InvalidPixel, "invalid pixel", NEOPIXEL_ERR_INVALID_PIXEL);
 DRIVER_REGISTER_ERROR(NEOPIXEL, neopixel, InvalidController, "invalid controller", NEOPIXEL_ERR_INVALID_CONTROLLER);
 DRIVER_REGISTER_ERROR(NEOPIXEL, neopixel, InvalidRGBComponent, "invalid RGB component", NEOPIXEL_ERR_INVALID_RGB_COMPONENT);
+DRIVER_REGISTER_ERROR(NEOPIXEL, neopixel, InvalidGamma, "invalid gamma", NEOPIXEL_ERR_INVALID_GAMMA);
 
 // List of units
 struct list neopixel_list;
 
+/*
+ * Helper functions
+ */
+
+// Reverse pixels [from, to)
+static void reverse(neopixel_pixel_t *pixels, uint32_t from, uint32_t to) {
+	neopixel_pixel_t tmp;
+
+	while ((from + 1) < to) {
+		to--;
+		tmp = pixels[from];
+		pixels[from] = pixels[to];
+		pixels[to] = tmp;
+		from++;
+	}
+}
+
+// Build the correction table for the current gamma and brightness. When
+// there is nothing to correct the table is freed, and pixels are copied
+// as they are.
+static driver_error_t *build_lut(neopixel_instance_t *instance) {
+	uint32_t i;
+
+	if ((instance->gamma == 1.0f) && (instance->brightness == 255)) {
+		free(instance->lut);
+		instance->lut = NULL;
+	} else {
+		if (!instance->lut) {
+			instance->lut = (uint8_t *)malloc(256);
+			if (!instance->lut) {
+				return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_NOT_ENOUGH_MEMORY, NULL);
+			}
+		}
+
+		for(i = 0; i < 256; i++) {
+			instance->lut[i] = (uint8_t)(powf((float)i / 255.0f, instance->gamma) * (float)instance->brightness + 0.5f);
+		}
+	}
+
+	instance->dirty = 1;
+
+	return NULL;
+}
+
 /*
  * Operation functions
  */
@@ -70,22 +120,183 @@ driver_error_t *neopixel_rgb(uint32_t unit, uint32_t pixel, uint8_t r, uint8_t g
 		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
     }
 
-    if (pixel > instance->npixels) {
+    if (pixel >= instance->npixels) {
 		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_PIXEL, NULL);
     }
 
     instance->pixels[pixel].r = r;
     instance->pixels[pixel].g = g;
     instance->pixels[pixel].b = b;
+    instance->dirty = 1;
 
     return NULL;
 }
 
+driver_error_t *neopixel_set_pixels(uint32_t unit, uint32_t first, const uint8_t *rgb, uint32_t count) {
+	neopixel_instance_t *instance;
+	neopixel_pixel_t *pixel;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    if ((first > instance->npixels) || (count > instance->npixels - first)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_PIXEL, NULL);
+    }
+
+    // Data is packed as r, g, b bytes for each pixel
+    for(pixel = &instance->pixels[first]; count > 0; count--, pixel++, rgb += 3) {
+    	pixel->r = rgb[0];
+    	pixel->g = rgb[1];
+    	pixel->b = rgb[2];
+    }
+
+    instance->dirty = 1;
+
+    return NULL;
+}
+
+driver_error_t *neopixel_fill(uint32_t unit, uint32_t first, uint32_t count, uint8_t r, uint8_t g, uint8_t b) {
+	neopixel_instance_t *instance;
+	neopixel_pixel_t *pixel;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    if ((first > instance->npixels) || (count > instance->npixels - first)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_PIXEL, NULL);
+    }
+
+    for(pixel = &instance->pixels[first]; count > 0; count--, pixel++) {
+    	pixel->r = r;
+    	pixel->g = g;
+    	pixel->b = b;
+    }
+
+    instance->dirty = 1;
+
+    return NULL;
+}
+
+driver_error_t *neopixel_gradient(uint32_t unit, uint32_t first, uint32_t count, const uint8_t *from, const uint8_t *to) {
+	neopixel_instance_t *instance;
+	neopixel_pixel_t *pixel;
+	int32_t dr, dg, db;
+	uint32_t i, steps;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    if ((first > instance->npixels) || (count > instance->npixels - first)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_PIXEL, NULL);
+    }
+
+    // Linear interpolation from the first to the last pixel, both colors
+    // (from, to) are included
+    dr = (int32_t)to[0] - (int32_t)from[0];
+    dg = (int32_t)to[1] - (int32_t)from[1];
+    db = (int32_t)to[2] - (int32_t)from[2];
+
+    steps = (count > 1)?(count - 1):1;
+
+    pixel = &instance->pixels[first];
+    for(i = 0; i < count; i++, pixel++) {
+    	pixel->r = from[0] + (dr * (int32_t)i) / (int32_t)steps;
+    	pixel->g = from[1] + (dg * (int32_t)i) / (int32_t)steps;
+    	pixel->b = from[2] + (db * (int32_t)i) / (int32_t)steps;
+    }
+
+    instance->dirty = 1;
+
+    return NULL;
+}
+
+driver_error_t *neopixel_shift(uint32_t unit, int32_t n, int rotate) {
+	neopixel_instance_t *instance;
+	uint32_t shift;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    if ((n == 0) || (instance->npixels == 0)) {
+    	return NULL;
+    }
+
+    // Positive n moves pixels to the end of the strip, negative n moves
+    // them to the start
+    if (rotate) {
+    	// Rotate in place, by reversing both parts and then all the strip
+    	shift = (n > 0)?((uint32_t)n % instance->npixels):(instance->npixels - ((uint32_t)-n % instance->npixels));
+    	if ((shift > 0) && (shift < instance->npixels)) {
+        	reverse(instance->pixels, 0, instance->npixels - shift);
+        	reverse(instance->pixels, instance->npixels - shift, instance->npixels);
+        	reverse(instance->pixels, 0, instance->npixels);
+    	}
+    } else {
+    	// Pixels shifted in are off
+    	shift = (n > 0)?(uint32_t)n:(uint32_t)-n;
+    	if (shift >= instance->npixels) {
+    		shift = instance->npixels;
+    	} else if (n > 0) {
+        	memmove(&instance->pixels[shift], instance->pixels, sizeof(neopixel_pixel_t) * (instance->npixels - shift));
+    	} else {
+        	memmove(instance->pixels, &instance->pixels[shift], sizeof(neopixel_pixel_t) * (instance->npixels - shift));
+    	}
+
+    	if (n > 0) {
+    		memset(instance->pixels, 0, sizeof(neopixel_pixel_t) * shift);
+    	} else {
+    		memset(&instance->pixels[instance->npixels - shift], 0, sizeof(neopixel_pixel_t) * shift);
+    	}
+    }
+
+    instance->dirty = 1;
+
+    return NULL;
+}
+
+driver_error_t *neopixel_brightness(uint32_t unit, uint8_t brightness) {
+	neopixel_instance_t *instance;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    instance->brightness = brightness;
+
+    return build_lut(instance);
+}
+
+driver_error_t *neopixel_gamma(uint32_t unit, float gamma) {
+	neopixel_instance_t *instance;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    if (!(gamma > 0.0f) || (gamma > 10.0f)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_GAMMA, NULL);
+    }
+
+    instance->gamma = gamma;
+
+    return build_lut(instance);
+}
+
 driver_error_t *neopixel_setup(neopixel_controller_t controller, uint8_t gpio, uint32_t pixels, uint32_t *unit) {
 	driver_error_t *error;
 	uint32_t nzr_unit;
 
-	if (controller > 1) {
+	if (controller >= NeopixelControllers) {
 		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_CONTROLLER, NULL);
 	}
 
@@ -103,15 +314,25 @@ driver_error_t *neopixel_setup(neopixel_controller_t controller, uint8_t gpio, u
 	// Populate instance
 	instance->npixels = pixels;
 	instance->nzr_unit = nzr_unit;
+	instance->brightness = 255;
+	instance->gamma = 1.0f;
 	instance->pixels = (neopixel_pixel_t *)calloc(1,sizeof(neopixel_pixel_t) * pixels);
 	if (!instance->pixels) {
 		free(instance);
 		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_NOT_ENOUGH_MEMORY, NULL);
 	}
 
+	instance->tx = (neopixel_pixel_t *)calloc(1,sizeof(neopixel_pixel_t) * pixels);
+	if (!instance->tx) {
+		free(instance->pixels);
+		free(instance);
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
 	// Add instance
 	if (list_add(&neopixel_list, instance, (int *)unit)) {
 		free(instance->pixels);
+		free(instance->tx);
 		free(instance);
 
 		return driver_setup_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_NOT_ENOUGH_MEMORY, NULL);
@@ -129,12 +350,80 @@ driver_error_t *neopixel_update(uint32_t unit) {
 		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
     }
 
-    // Send buffer
-    if ((error = nzr_send(instance->nzr_unit, (uint8_t *)instance->pixels, 24 * instance->npixels))) {
+    // Nothing changed since the last update, the strip is already showing
+    // this frame
+    if (!instance->dirty && instance->sent) {
+    	instance->skipped++;
+    	return NULL;
+    }
+
+    // Wait until the previous frame is sent, so its buffer can be reused
+    if ((error = nzr_wait(instance->nzr_unit))) {
+		return error;
+	}
+
+    // Send a copy of the pixels, so they can be changed while the frame is
+    // sent, without waiting. Frames on different units are sent in parallel.
+    //
+    // The tx buffer holds the last frame sent, so while it's copied, the
+    // new frame is compared with it, and if the pixels were changed back
+    // to the same output, there is no transfer.
+    uint8_t *src = (uint8_t *)instance->pixels;
+    uint8_t *dst = (uint8_t *)instance->tx;
+    uint32_t len = sizeof(neopixel_pixel_t) * instance->npixels;
+    uint8_t changed = 0;
+
+    if (instance->lut) {
+        const uint8_t *lut = instance->lut;
+    	uint8_t val;
+
+    	while (len--) {
+    		val = lut[*src++];
+    		changed |= *dst ^ val;
+    		*dst++ = val;
+    	}
+    } else if (memcmp(dst, src, len)) {
+        memcpy(dst, src, len);
+        changed = 1;
+    }
+
+    instance->dirty = 0;
+
+    if (!changed && instance->sent) {
+    	instance->skipped++;
+    	return NULL;
+    }
+
+    if ((error = nzr_start(instance->nzr_unit, (uint8_t *)instance->tx, 24 * instance->npixels))) {
 		return error;
 	}
 
+    instance->sent = 1;
+    instance->frames++;
+
 	return NULL;
 }
 
+driver_error_t *neopixel_stats(uint32_t unit, uint32_t *frames, uint32_t *skipped) {
+	neopixel_instance_t *instance;
+
+	// Get instance
+    if (list_get(&neopixel_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NEOPIXEL_DRIVER, NEOPIXEL_ERR_INVALID_UNIT, NULL);
+    }
+
+    *frames = instance->frames;
+    *skipped = instance->skipped;
+
+    return NULL;
+}
+
+const nzr_timing_t *neopixel_chipset(neopixel_controller_t controller) {
+	if (controller >= NeopixelControllers) {
+		return NULL;
+	}
+
+	return &chipset[controller];
+}
+
 DRIVER_REGISTER(NEOPIXEL,neopixel,NULL,neopixel_init,NULL);
@@ -32,8 +32,14 @@
 
 #include <sys/driver.h>
 
+#include <drivers/nzr.h>
+
 typedef enum {
 	NeopixelWS2812B,
+	NeopixelWS2812,
+	NeopixelSK6812,
+	NeopixelWS2811,
+	NeopixelControllers
 } neopixel_controller_t;
 
 typedef struct {
@@ -45,7 +51,21 @@ typedef struct {
 typedef struct {
 	uint32_t nzr_unit;
 	neopixel_pixel_t *pixels;
+	neopixel_pixel_t *tx;     // Pixels being sent
 	uint32_t npixels;
+
+	// Output correction, applied to the pixels when they are copied to
+	// the tx buffer. NULL if there is no correction.
+	uint8_t *lut;
+	uint8_t brightness;
+	float gamma;
+
+	uint8_t dirty;            // pixels changed since last update
+	uint8_t sent;             // at least one frame sent
+
+	// Statistics
+	uint32_t frames;          // frames sent
+	uint32_t skipped;         // updates skipped, frame unchanged
 } neopixel_instance_t;
 
 // NEOPIXEL errors
@@ -54,9 +74,18 @@ typedef struct {
 #define NEOPIXEL_ERR_INVALID_PIXEL               (DRIVER_EXCEPTION_BASE(NEOPIXEL_DRIVER_ID) |  2)
 #define NEOPIXEL_ERR_INVALID_CONTROLLER          (DRIVER_EXCEPTION_BASE(NEOPIXEL_DRIVER_ID) |  4)
 #define NEOPIXEL_ERR_INVALID_RGB_COMPONENT       (DRIVER_EXCEPTION_BASE(NEOPIXEL_DRIVER_ID) |  5)
+#define NEOPIXEL_ERR_INVALID_GAMMA               (DRIVER_EXCEPTION_BASE(NEOPIXEL_DRIVER_ID) |  6)
 
 driver_error_t *neopixel_rgb(uint32_t unit, uint32_t pixel, uint8_t r, uint8_t g, uint8_t b);
 driver_error_t *neopixel_setup(neopixel_controller_t controller, uint8_t gpio, uint32_t pixels, uint32_t *unit);
+driver_error_t *neopixel_set_pixels(uint32_t unit, uint32_t first, const uint8_t *rgb, uint32_t count);
+driver_error_t *neopixel_fill(uint32_t unit, uint32_t first, uint32_t count, uint8_t r, uint8_t g, uint8_t b);
+driver_error_t *neopixel_gradient(uint32_t unit, uint32_t first, uint32_t count, const uint8_t *from, const uint8_t *to);
+driver_error_t *neopixel_shift(uint32_t unit, int32_t n, int rotate);
+driver_error_t *neopixel_brightness(uint32_t unit, uint8_t brightness);
+driver_error_t *neopixel_gamma(uint32_t unit, float gamma);
 driver_error_t *neopixel_update(uint32_t unit);
+driver_error_t *neopixel_stats(uint32_t unit, uint32_t *frames, uint32_t *skipped);
+const nzr_timing_t *neopixel_chipset(neopixel_controller_t controller);
 
 #endif /* NEOPIXEL_H_ */
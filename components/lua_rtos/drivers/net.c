@@ -53,6 +53,9 @@
 // Driver message errors
 DRIVER_REGISTER_ERROR(NET, net, NotAvailable, "network is not available", NET_ERR_NOT_AVAILABLE);
 DRIVER_REGISTER_ERROR(NET, net, InvalidIpAddr, "invalid IP adddress", NET_ERR_INVALID_IP);
+DRIVER_REGISTER_ERROR(NET, net, InvalidName, "invalid name", NET_ERR_INVALID_NAME);
+DRIVER_REGISTER_ERROR(NET, net, NotEnoughtMemory, "not enough memory", NET_ERR_NOT_ENOUGH_MEMORY);
+DRIVER_REGISTER_ERROR(NET, net, TooManyNames, "too many names", NET_ERR_TOO_MANY_NAMES);
 
 // FreeRTOS events used by driver
 EventGroupHandle_t netEvent;
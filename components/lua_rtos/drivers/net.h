@@ -58,6 +58,9 @@ typedef struct {
 // NET errors
 #define NET_ERR_NOT_AVAILABLE              (DRIVER_EXCEPTION_BASE(NET_DRIVER_ID) |  0)
 #define NET_ERR_INVALID_IP                 (DRIVER_EXCEPTION_BASE(NET_DRIVER_ID) |  1)
+#define NET_ERR_INVALID_NAME               (DRIVER_EXCEPTION_BASE(NET_DRIVER_ID) |  2)
+#define NET_ERR_NOT_ENOUGH_MEMORY          (DRIVER_EXCEPTION_BASE(NET_DRIVER_ID) |  3)
+#define NET_ERR_TOO_MANY_NAMES             (DRIVER_EXCEPTION_BASE(NET_DRIVER_ID) |  4)
 
 driver_error_t *net_check_connectivity();
 driver_error_t *net_init();
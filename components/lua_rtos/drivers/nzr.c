@@ -28,23 +28,108 @@
  */
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "nzr.h"
 
+#include "esp_attr.h"
+#include "soc/soc.h"
+#include "soc/rmt_struct.h"
+#include "driver/gpio.h"
+
 #include <string.h>
 
 #include <sys/driver.h>
-#include <sys/delay.h>
 #include <sys/list.h>
 
 #include <drivers/gpio.h>
+#include <drivers/rmt.h>
 
 // Driver errors
 DRIVER_REGISTER_ERROR(NZR, nzr, NotEnoughtMemory, "not enough memory", NZR_ERR_NOT_ENOUGH_MEMORY);
 DRIVER_REGISTER_ERROR(NZR, nzr, InvalidUnit, "invalid unit", NRZ_ERR_INVALID_UNIT);
+DRIVER_REGISTER_ERROR(NZR, nzr, NoMoreChannels, "no more RMT channels available", NZR_ERR_NO_MORE_CHANNELS);
 
 // List of units
 struct list nzr_list;
 
+/*
+ * Helper functions
+ */
+
+// Convert CPU cycles to RMT ticks
+static uint32_t nzr_ticks(uint32_t cycles) {
+	uint64_t ticks = (((uint64_t)cycles * NZR_RMT_HZ) + (CPU_HZ / 2)) / CPU_HZ;
+
+	if (ticks > NZR_RMT_MAX_TICKS) {
+		ticks = NZR_RMT_MAX_TICKS;
+	}
+
+	return (uint32_t)ticks;
+}
+
+// Build a RMT item: level0 during duration0, then level1 during duration1
+static inline uint32_t nzr_item(uint32_t level0, uint32_t duration0, uint32_t level1, uint32_t duration1) {
+	return (duration0 & 0x7fff) | (level0 << 15) | ((duration1 & 0x7fff) << 16) | (level1 << 31);
+}
+
+/*
+ * Fill n items of the RMT memory with the next bits of the current transfer,
+ * followed by the reset item and the end item.
+ */
+static void IRAM_ATTR nzr_fill(nzr_instance_t *instance, volatile uint32_t *mem, uint32_t n) {
+	uint32_t i;
+
+	i = nzr_encode(&instance->items, instance->data, &instance->bit, instance->bits, mem, n);
+
+	while ((i < n) && (instance->tail < 2)) {
+		mem[i++] = (instance->tail == 0)?instance->items.res:0;
+		instance->tail++;
+	}
+
+	while (i < n) {
+		mem[i++] = 0;
+	}
+}
+
+static void IRAM_ATTR nzr_isr(void *arg, uint8_t ch, uint32_t status, BaseType_t *woken) {
+	nzr_instance_t *instance = (nzr_instance_t *)arg;
+
+	// A half has been sent, fill it with the next items
+	if (status & RMT_INTR_TX_THR(ch)) {
+		if (instance->tail < 2) {
+			nzr_fill(instance, (volatile uint32_t *)&RMTMEM.chan[ch] + instance->offset, NZR_RMT_HALF);
+			instance->offset ^= NZR_RMT_HALF;
+		}
+	}
+
+	// End item reached
+	if (status & RMT_INTR_TX_END(ch)) {
+		rmt_channel_intr_disable_from_isr(RMT_INTR_TX_END(ch) | RMT_INTR_TX_THR(ch));
+
+		xSemaphoreGiveFromISR(instance->done, woken);
+	}
+}
+
+static void nzr_setup_channel(uint8_t ch, uint8_t gpio) {
+	RMT.apb_conf.mem_tx_wrap_en = 1;
+
+	RMT.conf_ch[ch].conf0.div_cnt = NZR_RMT_CLK_DIV;
+	RMT.conf_ch[ch].conf0.mem_size = NZR_RMT_MEM_BLOCKS;
+	RMT.conf_ch[ch].conf0.carrier_en = 0;
+	RMT.conf_ch[ch].conf0.mem_pd = 0;
+
+	RMT.conf_ch[ch].conf1.rx_en = 0;
+	RMT.conf_ch[ch].conf1.mem_owner = 0;
+	RMT.conf_ch[ch].conf1.tx_conti_mode = 0;
+	RMT.conf_ch[ch].conf1.ref_always_on = 1;
+	RMT.conf_ch[ch].conf1.idle_out_en = 1;
+	RMT.conf_ch[ch].conf1.idle_out_lv = 0;
+
+	RMT.tx_lim_ch[ch].limit = NZR_RMT_HALF;
+
+	gpio_matrix_out(gpio, RMT_SIG_OUT0_IDX + ch, 0, 0);
+}
+
 /*
  * Operation functions
  */
@@ -53,10 +138,39 @@ void nzr_init() {
     list_init(&nzr_list, 0);
 }
 
+// Get the RMT items for a timing
+void nzr_timing_items(const nzr_timing_t *timing, nzr_items_t *items) {
+	uint32_t res = nzr_ticks(timing->res);
+
+	items->bit0 = nzr_item(1, nzr_ticks(timing->t0h), 0, nzr_ticks(timing->t0l));
+	items->bit1 = nzr_item(1, nzr_ticks(timing->t1h), 0, nzr_ticks(timing->t1l));
+	items->res  = nzr_item(0, res / 2, 0, res - (res / 2));
+}
+
+/*
+ * Encode bits from data, starting at *bit, as RMT items. Writes up to n
+ * items into dst, stopping at bits, and returns the number of items written.
+ * *bit is updated to the next bit to encode.
+ */
+uint32_t IRAM_ATTR nzr_encode(const nzr_items_t *items, const uint8_t *data, uint32_t *bit, uint32_t bits, volatile uint32_t *dst, uint32_t n) {
+	uint32_t b = *bit;
+	uint32_t i = 0;
+
+	while ((i < n) && (b < bits)) {
+		dst[i++] = (data[b >> 3] & (0x80 >> (b & 7)))?items->bit1:items->bit0;
+		b++;
+	}
+
+	*bit = b;
+
+	return i;
+}
+
 driver_error_t *nzr_setup(nzr_timing_t *timing, uint8_t gpio, uint32_t *unit) {
 	driver_error_t *error;
 	nzr_instance_t *instance;
     driver_unit_lock_error_t *lock_error = NULL;
+    int ch;
 
 	// Allocate space for instance
 	instance = (nzr_instance_t *)calloc(1, sizeof(nzr_instance_t));
@@ -64,12 +178,32 @@ driver_error_t *nzr_setup(nzr_timing_t *timing, uint8_t gpio, uint32_t *unit) {
 		return driver_operation_error(NZR_DRIVER, NZR_ERR_NOT_ENOUGH_MEMORY, NULL);
 	}
 
+	instance->done = xSemaphoreCreateBinary();
+	if (!instance->done) {
+		free(instance);
+		return driver_operation_error(NZR_DRIVER, NZR_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	xSemaphoreGive(instance->done);
+
 	// Copy values to instance
 	memcpy(&instance->timings, timing, sizeof(nzr_timing_t));
+	nzr_timing_items(timing, &instance->items);
 	instance->gpio = gpio;
 
+	// Get a free RMT channel
+	if ((ch = rmt_channel_alloc(NZR_RMT_MEM_BLOCKS, nzr_isr, instance)) < 0) {
+		vSemaphoreDelete(instance->done);
+		free(instance);
+		return driver_operation_error(NZR_DRIVER, NZR_ERR_NO_MORE_CHANNELS, NULL);
+	}
+
+	instance->channel = ch;
+
 	// Add instance
 	if (list_add(&nzr_list, instance, (int *)unit)) {
+		rmt_channel_free(ch);
+		vSemaphoreDelete(instance->done);
 		free(instance);
 
 		return driver_setup_error(NZR_DRIVER, NZR_ERR_NOT_ENOUGH_MEMORY, NULL);
@@ -78,6 +212,7 @@ driver_error_t *nzr_setup(nzr_timing_t *timing, uint8_t gpio, uint32_t *unit) {
     // Lock the GPIO
     if ((lock_error = driver_lock(NZR_DRIVER, *unit, GPIO_DRIVER, gpio))) {
     	list_remove(&nzr_list, *unit, 1);
+		rmt_channel_free(ch);
     	// Revoked lock on pin
     	return driver_lock_error(NZR_DRIVER, lock_error);
     }
@@ -89,50 +224,72 @@ driver_error_t *nzr_setup(nzr_timing_t *timing, uint8_t gpio, uint32_t *unit) {
 
 	gpio_ll_pin_clr(gpio);
 
+	// Configure RMT
+	nzr_setup_channel(ch, gpio);
+
 	return NULL;
 }
 
-driver_error_t *nzr_send(uint32_t unit, uint8_t *data, uint32_t bits) {
+/*
+ * Start a transfer, without waiting for it. data must be valid until the
+ * transfer ends. If there is a transfer in progress on the unit, waits for it.
+ */
+driver_error_t *nzr_start(uint32_t unit, const uint8_t *data, uint32_t bits) {
 	nzr_instance_t *instance;
-	uint8_t mask;
-	uint32_t pulseH;
-	uint32_t pulseL;
-	uint32_t c, s, bit;
+	uint8_t ch;
 
 	// Get instance
     if (list_get(&nzr_list, (int)unit, (void **)&instance)) {
 		return driver_operation_error(NZR_DRIVER, NRZ_ERR_INVALID_UNIT, NULL);
     }
 
-	portDISABLE_INTERRUPTS();
+    // Wait for the previous transfer
+    xSemaphoreTake(instance->done, portMAX_DELAY);
 
-	mask = 0x80;
-	c = xthal_get_ccount();
-	for(bit = 0;bit < bits; bit++) {
-		s = c;
-		pulseH = ((*data) & mask)?instance->timings.t1h:instance->timings.t0h;
-		pulseL = ((*data) & mask)?instance->timings.t1l:instance->timings.t0l;
+    ch = instance->channel;
 
-		gpio_ll_pin_set(instance->gpio);
-		while (((c = xthal_get_ccount()) - s) < pulseH);
+    instance->data = data;
+    instance->bit = 0;
+    instance->bits = bits;
+    instance->tail = 0;
+    instance->offset = 0;
 
-		s = c;
-		gpio_ll_pin_clr(instance->gpio);
-		while (((c = xthal_get_ccount()) - s) < pulseL);
+    // Fill both halves
+    nzr_fill(instance, (volatile uint32_t *)&RMTMEM.chan[ch], NZR_RMT_ITEMS);
 
-		mask = mask >> 1;
-		if (mask == 0) {
-			mask = 0x80;
-			data++;
-		}
-	}
+	RMT.conf_ch[ch].conf1.mem_rd_rst = 1;
+	RMT.conf_ch[ch].conf1.mem_rd_rst = 0;
 
-	s = c;
-	while (((c = xthal_get_ccount()) - s) < instance->timings.res);
+	rmt_channel_intr_enable(RMT_INTR_TX_END(ch) | RMT_INTR_TX_THR(ch));
 
-	portENABLE_INTERRUPTS();
+	RMT.conf_ch[ch].conf1.tx_start = 1;
 
 	return NULL;
 }
 
+// Wait for the transfer in progress on the unit
+driver_error_t *nzr_wait(uint32_t unit) {
+	nzr_instance_t *instance;
+
+	// Get instance
+    if (list_get(&nzr_list, (int)unit, (void **)&instance)) {
+		return driver_operation_error(NZR_DRIVER, NRZ_ERR_INVALID_UNIT, NULL);
+    }
+
+    xSemaphoreTake(instance->done, portMAX_DELAY);
+    xSemaphoreGive(instance->done);
+
+	return NULL;
+}
+
+driver_error_t *nzr_send(uint32_t unit, uint8_t *data, uint32_t bits) {
+	driver_error_t *error;
+
+	if ((error = nzr_start(unit, data, bits))) {
+		return error;
+	}
+
+	return nzr_wait(unit);
+}
+
 DRIVER_REGISTER(NZR,nzr,NULL,nzr_init,NULL);
@@ -29,13 +29,43 @@
 
 /*
  * This driver implements NZR data transfers over a GPIO.
+ *
+ * Bits are sent by the RMT peripheral. Each unit uses a RMT channel, and
+ * each bit is encoded as a RMT item (high level for T0H / T1H, followed by a
+ * low level for T0L / T1L). Bits are encoded on the fly in the RMT interrupt,
+ * so the RMT memory of the channel is used as a double buffer: while a half
+ * is sent, the other half is filled with the next bits. The transfer ends
+ * with a low level for the reset time, so a new transfer can start as soon
+ * as the previous one ends.
+ *
+ * Units have their own channel, so transfers on different units run in
+ * parallel.
  */
 
 #ifndef NZR_H_
 #define NZR_H_
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <stdint.h>
+
 #include <sys/driver.h>
 
+// RMT clock divider, RMT clock is APB clock (80 Mhz) / NZR_RMT_CLK_DIV
+#define NZR_RMT_CLK_DIV    2
+#define NZR_RMT_HZ         (80000000 / NZR_RMT_CLK_DIV)
+
+// RMT memory blocks (64 items each) used by a unit. Each unit uses
+// NZR_RMT_MEM_BLOCKS channels, that are shared with other drivers that use
+// the RMT. Bigger buffers give more time to the interrupt for refilling.
+#define NZR_RMT_MEM_BLOCKS 2
+#define NZR_RMT_ITEMS      (64 * NZR_RMT_MEM_BLOCKS)
+#define NZR_RMT_HALF       (NZR_RMT_ITEMS / 2)
+
+// Max duration of an item's level, in RMT ticks
+#define NZR_RMT_MAX_TICKS  0x7fff
+
 typedef struct {
 	uint32_t t0h; //T0H in cycles
 	uint32_t t0l; //T0L in cycles
@@ -44,16 +74,39 @@ typedef struct {
 	uint32_t res; //RES in cycles
 } nzr_timing_t;
 
+// RMT items for a timing
+typedef struct {
+	uint32_t bit0;  // 0 bit
+	uint32_t bit1;  // 1 bit
+	uint32_t res;   // reset
+} nzr_items_t;
+
 typedef struct {
 	uint8_t gpio;
+	uint8_t channel;
 	nzr_timing_t timings;
+	nzr_items_t items;
+
+	// Current transfer, updated in the RMT interrupt
+	const uint8_t *data;
+	uint32_t bit;
+	uint32_t bits;
+	uint8_t tail;       // 0 = reset item pending, 1 = end item pending, 2 = all written
+	uint8_t offset;     // Next half of the RMT memory to fill
+	SemaphoreHandle_t done;
 } nzr_instance_t;
 
 // NZR errors
 #define NZR_ERR_NOT_ENOUGH_MEMORY           (DRIVER_EXCEPTION_BASE(NZR_DRIVER_ID) |  0)
 #define NRZ_ERR_INVALID_UNIT                (DRIVER_EXCEPTION_BASE(NZR_DRIVER_ID) |  1)
+#define NZR_ERR_NO_MORE_CHANNELS            (DRIVER_EXCEPTION_BASE(NZR_DRIVER_ID) |  2)
 
 driver_error_t *nzr_setup(nzr_timing_t *timing, uint8_t gpio, uint32_t *unit);
 driver_error_t *nzr_send(uint32_t unit, uint8_t *data, uint32_t bits);
+driver_error_t *nzr_start(uint32_t unit, const uint8_t *data, uint32_t bits);
+driver_error_t *nzr_wait(uint32_t unit);
+
+void nzr_timing_items(const nzr_timing_t *timing, nzr_items_t *items);
+uint32_t nzr_encode(const nzr_items_t *items, const uint8_t *data, uint32_t *bit, uint32_t bits, volatile uint32_t *dst, uint32_t n);
 
 #endif /* NZR_H_ */
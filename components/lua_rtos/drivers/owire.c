@@ -2,6 +2,14 @@
  * ONE WIRE driver for Lua-RTOS-ESP32
  * author: LoBo (loboris@gmail.com)
  * based on TM_ONEWIRE (author  Tilen Majerle)
+ *
+ * Slots are generated by the RMT. Each bus uses a RMT channel to send the
+ * slots, and other RMT channel to receive the bus level on the same GPIO,
+ * that is open drain. A transaction of up to OWIRE_MAX_SLOTS slots is
+ * written to the RMT memory, and the bits are decoded from the duration of
+ * the low levels received, when the bus is idle again. The CPU is free
+ * while a transaction is sent, and transactions on different buses run at
+ * the same time.
  */
 
 #include "luartos.h"
@@ -9,15 +17,51 @@
 #include <sys/syslog.h>
 #include <string.h>
 
+#include "freertos/semphr.h"
+
+#include "esp_attr.h"
+#include "soc/soc.h"
+#include "soc/gpio_struct.h"
+#include "soc/rmt_struct.h"
+
 #include <drivers/cpu.h>
 #include <drivers/owire.h>
 #include <drivers/gpio.h>
+#include <drivers/rmt.h>
 #include <stdio.h>
 
 #define OWIRE_FIRST_PIN	1
 #define OWIRE_LAST_PIN	31
 
-TM_One_Wire_Devices_t ow_devices[MAX_ONEWIRE_PINS];
+// RMT clock divider, 1 tick = 1 usec
+#define OWIRE_RMT_CLK_DIV	80
+
+// Slot timings, in usecs
+#define OWIRE_T_RSTL		480		// reset, low
+#define OWIRE_T_RSTH		480		// reset, high (presence detect)
+#define OWIRE_T_LOW0		60		// write 0, low
+#define OWIRE_T_REC0		10		// write 0, recovery
+#define OWIRE_T_LOW1		6		// write 1 / read, low
+#define OWIRE_T_REC1		64		// write 1 / read, high until end of slot
+#define OWIRE_T_SAMPLE		12		// a low level shorter than this is read as 1
+#define OWIRE_T_IDLE		100		// bus high for more than this ends the reception
+
+// Glitches shorter than this number of APB clock cycles are ignored
+#define OWIRE_RMT_FILTER	80
+
+// Transaction timeout, in ticks
+#define OWIRE_TIMEOUT		(20 / portTICK_PERIOD_MS + 1)
+
+// RMT state of a bus
+typedef struct {
+	int8_t tx;                 // channel that sends the slots
+	int8_t rx;                 // channel that receives the bus level
+	uint8_t slots;             // slots in current transaction
+	volatile uint8_t pending;  // 1 = tx end pending, 2 = rx end pending
+	SemaphoreHandle_t done;    // taken while a transaction is running
+} owire_rmt_t;
+
+static owire_rmt_t rmt_bus[MAX_ONEWIRE_PINS];
 
 // Convert address to device
 int8_t owire_addess_to_dev(uint8_t sensor, uint64_t address) {
@@ -45,21 +89,227 @@ TM_One_Wire_Devices_t *ow_getdevice(uint8_t dev) {
 	else return &ow_devices[dev];
 }
 
-void ow_devices_init(uint8_t dev) {
-	ow_devices[dev].device.LastDeviceFlag = 0;
-	ow_devices[dev].device.LastDiscrepancy = 0;
-	ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-	memset(ow_devices[dev].device.ROM_NO, 0, sizeof(ow_devices[dev].device.ROM_NO));
-	ow_devices[dev].numdev = 0;
-	memset(ow_devices[dev].roms, 0, sizeof(ow_devices[dev].roms));
-}
-
 // Driver locks
 driver_unit_lock_t owire_locks[CPU_LAST_GPIO];
 
 // Driver message errors
 DRIVER_REGISTER_ERROR(OWIRE, owire, CannotSetup, "can't setup", OWIRE_ERR_CANT_INIT);
 DRIVER_REGISTER_ERROR(OWIRE, owire, InvalidChannel, "invalid channel", OWIRE_ERR_INVALID_CHANNEL);
+DRIVER_REGISTER_ERROR(OWIRE, owire, NoMoreChannels, "no more RMT channels available", OWIRE_ERR_NO_MORE_CHANNELS);
+DRIVER_REGISTER_ERROR(OWIRE, owire, Timeout, "timeout", OWIRE_ERR_TIMEOUT);
+DRIVER_REGISTER_ERROR(OWIRE, owire, Bus, "unexpected bus level", OWIRE_ERR_BUS);
+
+/*
+ * RMT slot engine
+ */
+
+// Build a RMT item: level0 during duration0, then level1 during duration1
+static inline uint32_t owire_item(uint32_t level0, uint32_t duration0, uint32_t level1, uint32_t duration1) {
+	return (duration0 & 0x7fff) | (level0 << 15) | ((duration1 & 0x7fff) << 16) | (level1 << 31);
+}
+
+static void IRAM_ATTR owire_rmt_isr(void *arg, uint8_t ch, uint32_t status, BaseType_t *woken) {
+	owire_rmt_t *bus = (owire_rmt_t *)arg;
+	uint8_t pending = bus->pending;
+
+	// The handler is called for both channels of the bus, with the same status
+	if ((pending & 1) && (status & RMT_INTR_TX_END(bus->tx))) {
+		rmt_channel_intr_disable_from_isr(RMT_INTR_TX_END(bus->tx));
+		pending &= ~1;
+	}
+
+	if ((pending & 2) && (status & RMT_INTR_RX_END(bus->rx))) {
+		RMT.conf_ch[bus->rx].conf1.rx_en = 0;
+		rmt_channel_intr_disable_from_isr(RMT_INTR_RX_END(bus->rx));
+		pending &= ~2;
+	}
+
+	if (pending != bus->pending) {
+		bus->pending = pending;
+
+		if (!pending) {
+			xSemaphoreGiveFromISR(bus->done, woken);
+		}
+	}
+}
+
+static driver_error_t *owire_rmt_start(void *arg, uint8_t dev, const uint8_t *tx, uint32_t slots) {
+	owire_rmt_t *bus = &rmt_bus[dev];
+	volatile uint32_t *mem;
+	uint32_t i;
+
+	// Wait for the previous transaction
+	if (!xSemaphoreTake(bus->done, OWIRE_TIMEOUT)) {
+		return driver_operation_error(OWIRE_DRIVER, OWIRE_ERR_TIMEOUT, NULL);
+	}
+
+	mem = (volatile uint32_t *)&RMTMEM.chan[bus->tx];
+
+	if (slots == 0) {
+		mem[0] = owire_item(0, OWIRE_T_RSTL, 1, OWIRE_T_RSTH);
+		i = 1;
+	} else {
+		for(i = 0; i < slots; i++) {
+			if (tx[i >> 3] & (1 << (i & 7))) {
+				mem[i] = owire_item(0, OWIRE_T_LOW1, 1, OWIRE_T_REC1);
+			} else {
+				mem[i] = owire_item(0, OWIRE_T_LOW0, 1, OWIRE_T_REC0);
+			}
+		}
+	}
+
+	// End item
+	mem[i] = 0;
+
+	bus->slots = slots;
+	bus->pending = 3;
+
+	RMT.conf_ch[bus->rx].conf1.mem_wr_rst = 1;
+	RMT.conf_ch[bus->rx].conf1.mem_wr_rst = 0;
+	RMT.conf_ch[bus->tx].conf1.mem_rd_rst = 1;
+	RMT.conf_ch[bus->tx].conf1.mem_rd_rst = 0;
+
+	rmt_channel_intr_enable(RMT_INTR_TX_END(bus->tx) | RMT_INTR_RX_END(bus->rx));
+
+	// Start receiving before sending, so the first edge is received
+	RMT.conf_ch[bus->rx].conf1.rx_en = 1;
+	RMT.conf_ch[bus->tx].conf1.tx_start = 1;
+
+	return NULL;
+}
+
+static driver_error_t *owire_rmt_wait(void *arg, uint8_t dev, uint8_t *rx) {
+	owire_rmt_t *bus = &rmt_bus[dev];
+	volatile rmt_item32_t *mem;
+	uint32_t i, lows, duration, level;
+
+	if (!xSemaphoreTake(bus->done, OWIRE_TIMEOUT)) {
+		rmt_channel_intr_disable(RMT_INTR_TX_END(bus->tx) | RMT_INTR_RX_END(bus->rx));
+		RMT.conf_ch[bus->rx].conf1.rx_en = 0;
+		bus->pending = 0;
+		xSemaphoreGive(bus->done);
+
+		return driver_operation_error(OWIRE_DRIVER, OWIRE_ERR_TIMEOUT, NULL);
+	}
+
+	xSemaphoreGive(bus->done);
+
+	// Decode the low levels received, there is one for each slot. After a
+	// reset, a low level after the reset pulse is the presence pulse.
+	mem = RMTMEM.chan[bus->rx].data32;
+
+	memset(rx, 0, bus->slots?((bus->slots + 7) / 8):1);
+	lows = 0;
+
+	for(i = 0; i < 128; i++) {
+		if (i & 1) {
+			duration = mem[i >> 1].duration1;
+			level = mem[i >> 1].level1;
+		} else {
+			duration = mem[i >> 1].duration0;
+			level = mem[i >> 1].level0;
+		}
+
+		if (duration == 0) {
+			break;
+		}
+
+		if (level) {
+			continue;
+		}
+
+		if (bus->slots == 0) {
+			if (lows > 0) {
+				rx[0] = 1;
+			}
+		} else if (lows < bus->slots) {
+			if (duration < OWIRE_T_SAMPLE) {
+				rx[lows >> 3] |= (1 << (lows & 7));
+			}
+		}
+
+		lows++;
+	}
+
+	if ((bus->slots > 0) && (lows != bus->slots)) {
+		return driver_operation_error(OWIRE_DRIVER, OWIRE_ERR_BUS, NULL);
+	}
+
+	return NULL;
+}
+
+// Drive the bus high (push-pull), or release it (open drain). The RMT idle
+// level is high, so the bus is driven high when the output isn't open drain.
+static void owire_rmt_power(void *arg, uint8_t dev, int on) {
+	GPIO.pin[ow_devices[dev].device.pin].pad_driver = !on;
+}
+
+static const owire_engine_t owire_rmt_engine = {
+	.start = owire_rmt_start,
+	.wait = owire_rmt_wait,
+	.power = owire_rmt_power,
+	.arg = NULL,
+};
+
+// Setup the RMT channels of a bus
+static driver_error_t *owire_rmt_setup(uint8_t dev, uint8_t pin) {
+	owire_rmt_t *bus = &rmt_bus[dev];
+	int ch;
+
+	if (!bus->done) {
+		bus->done = xSemaphoreCreateBinary();
+		if (!bus->done) {
+			return driver_setup_error(OWIRE_DRIVER, OWIRE_ERR_CANT_INIT, "not enough memory");
+		}
+
+		xSemaphoreGive(bus->done);
+	}
+
+	if ((bus->tx = rmt_channel_alloc(1, owire_rmt_isr, bus)) < 0) {
+		return driver_setup_error(OWIRE_DRIVER, OWIRE_ERR_NO_MORE_CHANNELS, NULL);
+	}
+
+	if ((bus->rx = rmt_channel_alloc(1, owire_rmt_isr, bus)) < 0) {
+		rmt_channel_free(bus->tx);
+		return driver_setup_error(OWIRE_DRIVER, OWIRE_ERR_NO_MORE_CHANNELS, NULL);
+	}
+
+	// Transmitter, the bus is released when idle
+	ch = bus->tx;
+	RMT.conf_ch[ch].conf0.div_cnt = OWIRE_RMT_CLK_DIV;
+	RMT.conf_ch[ch].conf0.mem_size = 1;
+	RMT.conf_ch[ch].conf0.carrier_en = 0;
+	RMT.conf_ch[ch].conf0.mem_pd = 0;
+
+	RMT.conf_ch[ch].conf1.rx_en = 0;
+	RMT.conf_ch[ch].conf1.mem_owner = 0;
+	RMT.conf_ch[ch].conf1.tx_conti_mode = 0;
+	RMT.conf_ch[ch].conf1.ref_always_on = 1;
+	RMT.conf_ch[ch].conf1.idle_out_en = 1;
+	RMT.conf_ch[ch].conf1.idle_out_lv = 1;
+
+	// Receiver, ends when the bus is idle
+	ch = bus->rx;
+	RMT.conf_ch[ch].conf0.div_cnt = OWIRE_RMT_CLK_DIV;
+	RMT.conf_ch[ch].conf0.mem_size = 1;
+	RMT.conf_ch[ch].conf0.carrier_en = 0;
+	RMT.conf_ch[ch].conf0.mem_pd = 0;
+	RMT.conf_ch[ch].conf0.idle_thres = OWIRE_T_IDLE;
+
+	RMT.conf_ch[ch].conf1.rx_en = 0;
+	RMT.conf_ch[ch].conf1.mem_owner = 1;
+	RMT.conf_ch[ch].conf1.ref_always_on = 1;
+	RMT.conf_ch[ch].conf1.rx_filter_en = 1;
+	RMT.conf_ch[ch].conf1.rx_filter_thres = OWIRE_RMT_FILTER;
+
+	// Open drain GPIO, with pull up, used by both channels
+	gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+	gpio_set_direction(pin, GPIO_MODE_INPUT_OUTPUT_OD);
+	gpio_matrix_out(pin, RMT_SIG_OUT0_IDX + bus->tx, 0, 0);
+	gpio_matrix_in(pin, RMT_SIG_IN0_IDX + bus->rx, 0);
+
+	return NULL;
+}
 
 // Get the pins used by an ONE WIRE channel
 void owire_pins(int8_t owpin, uint8_t *pin) {
@@ -94,7 +344,14 @@ driver_error_t *owire_lock_resources(int8_t pin, void *resources) {
     	return driver_lock_error(OWIRE_DRIVER, lock_error);
     }
 
+    driver_error_t *error;
+
+    if ((error = owire_rmt_setup(owdev, pin))) {
+    	return error;
+    }
+
 	ow_devices[owdev].device.pin = pin;
+	ow_devices_init(owdev);
 
 	return NULL;
 }
@@ -117,393 +374,16 @@ driver_error_t *owire_setup_pin(int8_t pin) {
 		return error;
 	}
 
+    // Let the devices power up
+	vTaskDelay(10 / portTICK_RATE_MS);
+
     return NULL;
 }
 
 void owire_init() {
 	memset(ow_devices, 0, sizeof(TM_One_Wire_Devices_t) * MAX_ONEWIRE_PINS);
-}
 
-DRIVER_REGISTER(OWIRE,owire,owire_locks,owire_init,NULL);
-
-//******************
-// ONEWIRE FUNCTIONS
-//******************
-
-//--------------------------------
-void owdevice_input(uint8_t dev) {
-	gpio_set_pull_mode(ow_devices[dev].device.pin, GPIO_PULLUP_ONLY);
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_INPUT);
-}
-
-//-----------------------------------
-void owdevice_pinpower(uint8_t dev) {
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_OUTPUT);
-	gpio_set_level(ow_devices[dev].device.pin,1);
+	owire_set_engine(&owire_rmt_engine);
 }
 
-//-------------------------------------------
-unsigned char TM_OneWire_Reset(uint8_t dev) {
-	unsigned char bit = 1;
-	int i;
-	portDISABLE_INTERRUPTS();
-	// Set line low and wait ~500 us
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_OUTPUT);
-	gpio_set_level(ow_devices[dev].device.pin,0);
-	ets_delay_us(500);
-
-	// Release the line and wait 500 us for line value
-	gpio_set_level(ow_devices[dev].device.pin,1);
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_INPUT);
-	i = 500;
-	while (i > 0) {
-		ets_delay_us(10);
-		if (gpio_get_level(ow_devices[dev].device.pin) == 0){
-	    	bit = 0;
-	    	break;
-	    }
-	    i -= 10;
-	}
-	if ((i > 0) && (bit == 0)) {
-		// wait up to 500 us
-		ets_delay_us(i);
-	}
-	portENABLE_INTERRUPTS();
-    // Return value of presence pulse, 0 = OK, 1 = ERROR
-    return bit;
-}
-
-// ow WRITE slot
-//---------------------------------------------------------------
-static void TM_OneWire_WriteBit(uint8_t dev, unsigned char bit) {
-  portDISABLE_INTERRUPTS();
-  if (bit) {
-	// ** Bit high
-	// Set line low and wait 8 us
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_OUTPUT);
-	gpio_set_level(ow_devices[dev].device.pin,0);
-	ets_delay_us(8);
-
-	// Release the line and wait ~65 us
-	gpio_set_level(ow_devices[dev].device.pin,1);
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_INPUT);
-	ets_delay_us(65);
-  }
-  else {
-    // ** Bit low
-	// Set line low and wait ~65 us
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_OUTPUT);
-	gpio_set_level(ow_devices[dev].device.pin,0);
-	ets_delay_us(65);
-
-	// Release the line and wait 5 us
-	gpio_set_level(ow_devices[dev].device.pin,1);
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_INPUT);
-	ets_delay_us(5);
-  }
-  portENABLE_INTERRUPTS();
-}
-
-// ow READ slot
-//---------------------------------------------
-unsigned char TM_OneWire_ReadBit(uint8_t dev) {
-	unsigned char bit = 1;
-	int i;
-
-    portDISABLE_INTERRUPTS();
-	// Set line low and wait 3 us
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_OUTPUT);
-	gpio_set_level(ow_devices[dev].device.pin,0);
-	ets_delay_us(3);
-
-	// Release the line and wait ~65 us for line value
-	gpio_set_level(ow_devices[dev].device.pin,1);
-	gpio_set_direction(ow_devices[dev].device.pin, GPIO_MODE_INPUT);
-	i = 66;
-	while (i > 0) {
-		ets_delay_us(2);
-		if (gpio_get_level(ow_devices[dev].device.pin) == 0){
-	    	bit = 0;
-	    	break;
-	    }
-	    i -= 2;
-	}
-	if ((i > 0) && (bit == 0)) {
-		// wait up to 65 us
-		ets_delay_us(i);
-	}
-    portENABLE_INTERRUPTS();
-	// Return bit value
-	return bit;
-}
-
-//----------------------------------------------------------
-void TM_OneWire_WriteByte(uint8_t dev, unsigned char byte) {
-  unsigned char i = 8;
-  // Write 8 bits
-  while (i--) {
-    // LSB bit is first
-    TM_OneWire_WriteBit(dev, byte & 0x01);
-    byte >>= 1;
-  }
-}
-
-//----------------------------------------------
-unsigned char TM_OneWire_ReadByte(uint8_t dev) {
-  unsigned char i = 8, byte = 0;
-  while (i--) {
-    byte >>= 1;
-    byte |= (TM_OneWire_ReadBit(dev) << 7);
-  }
-  return byte;
-}
-
-//-----------------------------------------------
-static void TM_OneWire_ResetSearch(uint8_t dev) {
-  // Reset the search state
-  ow_devices[dev].device.LastDiscrepancy = 0;
-  ow_devices[dev].device.LastDeviceFlag = 0;
-  ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-}
-
-//-------------------------------------------------------------------
-unsigned char TM_OneWire_Search(uint8_t dev, unsigned char command) {
-  unsigned char id_bit_number;
-  unsigned char last_zero, rom_byte_number, search_result;
-  unsigned char id_bit, cmp_id_bit;
-  unsigned char rom_byte_mask, search_direction;
-
-  /* Initialize for search */
-  id_bit_number = 1;
-  last_zero = 0;
-  rom_byte_number = 0;
-  rom_byte_mask = 1;
-  search_result = 0;
-  // if the last call was not the last one
-  if (!ow_devices[dev].device.LastDeviceFlag) {
-    // 1-Wire reset
-    if (TM_OneWire_Reset(dev)) {
-      /* Reset the search */
-      ow_devices[dev].device.LastDiscrepancy = 0;
-      ow_devices[dev].device.LastDeviceFlag = 0;
-      ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-      return 0;
-    }
-    // issue the search command
-    TM_OneWire_WriteByte(dev, command);
-    // loop to do the search
-    do {
-      // read a bit and its complement
-      id_bit = TM_OneWire_ReadBit(dev);
-      cmp_id_bit = TM_OneWire_ReadBit(dev);
-      // check for no devices on 1-wire
-      if ((id_bit == 1) && (cmp_id_bit == 1)) {
-        break;
-      } else {
-        // all devices coupled have 0 or 1
-        if (id_bit != cmp_id_bit) {
-          search_direction = id_bit;  // bit write value for search
-        } else {
-          // if this discrepancy if before the Last Discrepancy
-          // on a previous next then pick the same as last time
-          if (id_bit_number < ow_devices[dev].device.LastDiscrepancy) {
-            search_direction = ((ow_devices[dev].device.ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
-          } else {
-            // if equal to last pick 1, if not then pick 0
-            search_direction = (id_bit_number == ow_devices[dev].device.LastDiscrepancy);
-          }
-          // if 0 was picked then record its position in LastZero
-          if (search_direction == 0) {
-            last_zero = id_bit_number;
-            // check for Last discrepancy in family
-            if (last_zero < 9) {
-              ow_devices[dev].device.LastFamilyDiscrepancy = last_zero;
-            }
-          }
-        }
-        // set or clear the bit in the ROM byte rom_byte_number
-        // with mask rom_byte_mask
-        if (search_direction == 1) {
-          ow_devices[dev].device.ROM_NO[rom_byte_number] |= rom_byte_mask;
-        } else {
-          ow_devices[dev].device.ROM_NO[rom_byte_number] &= ~rom_byte_mask;
-        }
-        // serial number search direction write bit
-        TM_OneWire_WriteBit(dev, search_direction);
-        // increment the byte counter id_bit_number
-        // and shift the mask rom_byte_mask
-        id_bit_number++;
-        rom_byte_mask <<= 1;
-        // if the mask is 0 then go to new SerialNum byte rom_byte_number and reset mask
-        if (rom_byte_mask == 0) {
-          //docrc8(ROM_NO[rom_byte_number]);  // accumulate the CRC
-          rom_byte_number++;
-          rom_byte_mask = 1;
-        }
-      }
-    } while (rom_byte_number < 8);  // loop until through all ROM bytes 0-7
-
-    // if the search was successful then
-    if (!(id_bit_number < 65)) {
-      // search successful so set LastDiscrepancy,LastDeviceFlag,search_result
-      ow_devices[dev].device.LastDiscrepancy = last_zero;
-      // check for last device
-      if (ow_devices[dev].device.LastDiscrepancy == 0) {
-        ow_devices[dev].device.LastDeviceFlag = 1;
-      }
-      search_result = 1;
-    }
-  }
-
-  // if no device found then reset counters so next 'search' will be like a first
-  if (!search_result || !ow_devices[dev].device.ROM_NO[0]) {
-    ow_devices[dev].device.LastDiscrepancy = 0;
-    ow_devices[dev].device.LastDeviceFlag = 0;
-    ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-    search_result = 0;
-  }
-
-  return search_result;
-}
-
-//-------------------------------------------
-unsigned char TM_OneWire_First(uint8_t dev) {
-  // Reset search values
-  TM_OneWire_ResetSearch(dev);
-  // Start with searching
-  return TM_OneWire_Search(dev, ONEWIRE_CMD_SEARCHROM);
-}
-
-//------------------------------------------
-unsigned char TM_OneWire_Next(uint8_t dev) {
-  // Leave the search state alone
-  return TM_OneWire_Search(dev, ONEWIRE_CMD_SEARCHROM);
-}
-
-/*
-//------------------------------
-static int TM_OneWire_Verify() {
-  unsigned char rom_backup[8];
-  int i,rslt,ld_backup,ldf_backup,lfd_backup;
-  // keep a backup copy of the current state
-  for (i = 0; i < 8; i++)
-    rom_backup[i] = ow_devices[dev].device.ROM_NO[i];
-  ld_backup = ow_devices[dev].device.LastDiscrepancy;
-  ldf_backup = ow_devices[dev].device.LastDeviceFlag;
-  lfd_backup = ow_devices[dev].device.LastFamilyDiscrepancy;
-  // set search to find the same device
-  ow_devices[dev].device.LastDiscrepancy = 64;
-  ow_devices[dev].device.LastDeviceFlag = 0;
-  if (TM_OneWire_Search(ONEWIRE_CMD_SEARCHROM)) {
-    // check if same device found
-    rslt = 1;
-    for (i = 0; i < 8; i++) {
-      if (rom_backup[i] != ow_devices[dev].device.ROM_NO[i]) {
-        rslt = 1;
-        break;
-      }
-    }
-  } else {
-    rslt = 0;
-  }
-  // restore the search state
-  for (i = 0; i < 8; i++) {
-    ow_devices[dev].device.ROM_NO[i] = rom_backup[i];
-  }
-  ow_devices[dev].device.LastDiscrepancy = ld_backup;
-  ow_devices[dev].device.LastDeviceFlag = ldf_backup;
-  ow_devices[dev].device.LastFamilyDiscrepancy = lfd_backup;
-  // return the result of the verify
-  return rslt;
-}
-//-------------------------------------------------------
-static void TM_OneWire_TargetSetup(unsigned char family_code) {
-  unsigned char i;
-  // set the search state to find SearchFamily type devices
-  ow_devices[dev].device.ROM_NO[0] = family_code;
-  for (i = 1; i < 8; i++) {
-    ow_devices[dev].device.ROM_NO[i] = 0;
-  }
-  ow_devices[dev].device.LastDiscrepancy = 64;
-  ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-  ow_devices[dev].device.LastDeviceFlag = 0;
-}
-//----------------------------------------
-static void TM_OneWire_FamilySkipSetup() {
-  // set the Last discrepancy to last family discrepancy
-  ow_devices[dev].device.LastDiscrepancy = ow_devices[dev].device.LastFamilyDiscrepancy;
-  ow_devices[dev].device.LastFamilyDiscrepancy = 0;
-  // check for end of list
-  if (ow_devices[dev].device.LastDiscrepancy == 0) {
-    ow_devices[dev].device.LastDeviceFlag = 1;
-  }
-}
-//-----------------------------------------------
-static unsigned char TM_OneWire_GetROM(unsigned char index) {
-  return ow_devices[dev].device.ROM_NO[index];
-}
-//--------------------------------------------
-static void TM_OneWire_Select(unsigned char* addr) {
-  unsigned char i;
-  TM_OneWire_WriteByte(ONEWIRE_CMD_MATCHROM);
-  for (i = 0; i < 8; i++) {
-    TM_OneWire_WriteByte(*(addr + i));
-  }
-}
-*/
-
-//------------------------------------------------------------------
-void TM_OneWire_SelectWithPointer(uint8_t dev, unsigned char *ROM) {
-  unsigned char i;
-  TM_OneWire_WriteByte(dev, ONEWIRE_CMD_MATCHROM);
-  for (i = 0; i < 8; i++) {
-    TM_OneWire_WriteByte(dev, *(ROM + i));
-  }
-}
-
-//------------------------------------------------------------------
-void TM_OneWire_GetFullROM(uint8_t dev, unsigned char *firstIndex) {
-  unsigned char i;
-  for (i = 0; i < 8; i++) {
-    *(firstIndex + i) = ow_devices[dev].device.ROM_NO[i];
-  }
-}
-
-//---------------------------------------------------------------------
-unsigned char TM_OneWire_CRC8(unsigned char *addr, unsigned char len) {
-  unsigned char crc = 0, inbyte, i, mix;
-
-  while (len--) {
-    inbyte = *addr++;
-    for (i = 8; i; i--) {
-      mix = (crc ^ inbyte) & 0x01;
-      crc >>= 1;
-      if (mix) {
-        crc ^= 0x8C;
-      }
-      inbyte >>= 1;
-    }
-  }
-  /* Return calculated CRC */
-  return crc;
-}
-
-//----------------------------------------
-uint8_t TM_OneWire_Dosearch(uint8_t dev) {
-	// Search for devices on owire bus
-	uint8_t count = 0;
-	uint8_t owdev = 0;
-	owdev = TM_OneWire_First(dev);
-	while (owdev) {
-		count++;  // Increase device counter
-		// Get full ROM value, 8 bytes, give location of first byte where to save
-		TM_OneWire_GetFullROM(dev, ow_devices[dev].roms[count - 1]);
-		// Get next device
-		owdev = TM_OneWire_Next(dev);
-		if (count >= MAX_ONEWIRE_SENSORS) break;
-	}
-
-	ow_devices[dev].numdev = count;
-
-	return count;
-}
+DRIVER_REGISTER(OWIRE,owire,owire_locks,owire_init,NULL);
@@ -25,6 +25,9 @@ typedef struct {
 // ONE WIRE driver errors
 #define OWIRE_ERR_CANT_INIT                (DRIVER_EXCEPTION_BASE(OWIRE_DRIVER_ID) |  0)
 #define OWIRE_ERR_INVALID_CHANNEL          (DRIVER_EXCEPTION_BASE(OWIRE_DRIVER_ID) |  1)
+#define OWIRE_ERR_NO_MORE_CHANNELS         (DRIVER_EXCEPTION_BASE(OWIRE_DRIVER_ID) |  2)
+#define OWIRE_ERR_TIMEOUT                  (DRIVER_EXCEPTION_BASE(OWIRE_DRIVER_ID) |  3)
+#define OWIRE_ERR_BUS                      (DRIVER_EXCEPTION_BASE(OWIRE_DRIVER_ID) |  4)
 
 /* OneWire commands */
 #define ONEWIRE_CMD_RSCRATCHPAD		0xBE
@@ -40,6 +43,30 @@ typedef struct {
 #define MAX_ONEWIRE_PINS 4			// Maximum number of buses (pins) to be used for owire
 #define MAX_ONEWIRE_SENSORS 8		// Maximum number of devices on one owire bus (gpio)
 
+#define OWIRE_MAX_SLOTS 56			// Maximum number of slots in a transaction (7 bytes)
+
+/*
+ * Slot engine
+ *
+ * The engine generates the time slots on a bus. A transaction is a sequence of
+ * up to OWIRE_MAX_SLOTS slots: for each slot a bit is written (a 1 bit is also a
+ * read slot, and the bit sampled on the bus is the bit read). A transaction
+ * with no slots is a reset pulse.
+ *
+ * start doesn't wait for the transaction, so transactions on different buses
+ * run at the same time, and wait gets the sampled bits (LSB first). After a
+ * reset, bit 0 is 1 if a device sent a presence pulse.
+ *
+ * power drives the bus high, for devices that are parasite powered, or
+ * releases the bus.
+ */
+typedef struct {
+	driver_error_t *(*start)(void *arg, uint8_t dev, const uint8_t *tx, uint32_t slots);
+	driver_error_t *(*wait)(void *arg, uint8_t dev, uint8_t *rx);
+	void (*power)(void *arg, uint8_t dev, int on);
+	void *arg;
+} owire_engine_t;
+
 typedef struct {
 	int 		  pin;          			// GPIO Pin to be used for I/O functions
 	unsigned char LastDiscrepancy;       	// Search private
@@ -51,10 +78,11 @@ typedef struct {
 typedef struct {
 	TM_One_Wire_t	device;
 	uint8_t			numdev;
+	uint8_t			cached;					// roms are the result of a complete search
 	uint8_t			roms[MAX_ONEWIRE_SENSORS][8];
 } TM_One_Wire_Devices_t;
 
-TM_One_Wire_Devices_t ow_devices[MAX_ONEWIRE_PINS];
+extern TM_One_Wire_Devices_t ow_devices[MAX_ONEWIRE_PINS];
 
 unsigned char TM_OneWire_ReadBit(uint8_t dev);
 void TM_OneWire_GetFullROM(uint8_t dev, unsigned char *firstIndex);
@@ -75,4 +103,13 @@ void ow_devices_init(uint8_t dev);
 uint8_t TM_OneWire_Dosearch(uint8_t dev);
 int8_t owire_addess_to_dev(uint8_t sensor, uint64_t address);
 
+const owire_engine_t *owire_set_engine(const owire_engine_t *engine);
+driver_error_t *owire_reset(uint8_t dev, uint8_t *presence);
+driver_error_t *owire_slots(uint8_t dev, const uint8_t *tx, uint8_t *rx, uint32_t slots);
+driver_error_t *owire_write(uint8_t dev, const uint8_t *data, uint32_t len);
+driver_error_t *owire_read(uint8_t dev, uint8_t *data, uint32_t len);
+driver_error_t *owire_select(uint8_t dev, const uint8_t *rom, uint8_t command);
+driver_error_t *owire_search(uint32_t mask);
+void owire_invalidate(uint8_t dev);
+
 #endif /* _OWIRE_H_ */
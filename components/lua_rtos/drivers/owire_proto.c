@@ -0,0 +1,516 @@
+/**
+ * ONE WIRE protocol for Lua-RTOS-ESP32
+ * author: LoBo (loboris@gmail.com)
+ * based on TM_ONEWIRE (author  Tilen Majerle)
+ *
+ * Reset, byte transfers and ROM search, over the slot engine of the bus
+ * (see owire_engine_t). Nothing here depends on the hardware, so the
+ * protocol can be tested with a simulated bus.
+ *
+ * The ROM search runs on several buses at the same time: each step of the
+ * search is started on all the buses, and then the results are collected,
+ * so enumerating n buses takes the time of the slowest one.
+ */
+
+#include "luartos.h"
+
+#include <string.h>
+
+#include <sys/driver.h>
+
+#include <drivers/owire.h>
+
+TM_One_Wire_Devices_t ow_devices[MAX_ONEWIRE_PINS];
+
+// Current engine
+static const owire_engine_t *engine = NULL;
+
+void ow_devices_init(uint8_t dev) {
+	ow_devices[dev].cached = 0;
+	ow_devices[dev].device.LastDeviceFlag = 0;
+	ow_devices[dev].device.LastDiscrepancy = 0;
+	ow_devices[dev].device.LastFamilyDiscrepancy = 0;
+	memset(ow_devices[dev].device.ROM_NO, 0, sizeof(ow_devices[dev].device.ROM_NO));
+	ow_devices[dev].numdev = 0;
+	memset(ow_devices[dev].roms, 0, sizeof(ow_devices[dev].roms));
+}
+
+// Set the slot engine used by all buses, and return the previous one
+const owire_engine_t *owire_set_engine(const owire_engine_t *new_engine) {
+	const owire_engine_t *old = engine;
+
+	engine = new_engine;
+
+	return old;
+}
+
+//*************
+// TRANSACTIONS
+//*************
+
+// Reset the bus, presence is set to 1 if there are devices on the bus
+driver_error_t *owire_reset(uint8_t dev, uint8_t *presence) {
+	driver_error_t *error;
+	uint8_t rx = 0;
+
+	if ((error = engine->start(engine->arg, dev, NULL, 0))) {
+		return error;
+	}
+
+	if ((error = engine->wait(engine->arg, dev, &rx))) {
+		return error;
+	}
+
+	*presence = rx & 1;
+
+	return NULL;
+}
+
+/*
+ * Run slots on the bus, writing the bits of tx, and storing the sampled bits
+ * in rx, if it's not NULL. Bits are LSB first. Long sequences are split in
+ * transactions of OWIRE_MAX_SLOTS slots.
+ */
+driver_error_t *owire_slots(uint8_t dev, const uint8_t *tx, uint8_t *rx, uint32_t slots) {
+	driver_error_t *error;
+	uint8_t dummy[OWIRE_MAX_SLOTS / 8];
+	uint32_t n;
+
+	while (slots > 0) {
+		n = (slots > OWIRE_MAX_SLOTS)?OWIRE_MAX_SLOTS:slots;
+
+		if ((error = engine->start(engine->arg, dev, tx, n))) {
+			return error;
+		}
+
+		if ((error = engine->wait(engine->arg, dev, rx?rx:dummy))) {
+			return error;
+		}
+
+		tx += OWIRE_MAX_SLOTS / 8;
+		if (rx) {
+			rx += OWIRE_MAX_SLOTS / 8;
+		}
+
+		slots -= n;
+	}
+
+	return NULL;
+}
+
+driver_error_t *owire_write(uint8_t dev, const uint8_t *data, uint32_t len) {
+	return owire_slots(dev, data, NULL, len * 8);
+}
+
+// Read len bytes, writing 1 bits (read slots)
+driver_error_t *owire_read(uint8_t dev, uint8_t *data, uint32_t len) {
+	memset(data, 0xff, len);
+
+	return owire_slots(dev, data, data, len * 8);
+}
+
+// Select the device with a Match ROM command, and send a function command to it
+driver_error_t *owire_select(uint8_t dev, const uint8_t *rom, uint8_t command) {
+	uint8_t buffer[10];
+
+	buffer[0] = ONEWIRE_CMD_MATCHROM;
+	memcpy(&buffer[1], rom, 8);
+	buffer[9] = command;
+
+	return owire_write(dev, buffer, sizeof(buffer));
+}
+
+//-------------------------------------------
+void owdevice_input(uint8_t dev) {
+	engine->power(engine->arg, dev, 0);
+}
+
+//-------------------------------------------
+void owdevice_pinpower(uint8_t dev) {
+	engine->power(engine->arg, dev, 1);
+}
+
+//-------------------------------------------
+unsigned char TM_OneWire_Reset(uint8_t dev) {
+	driver_error_t *error;
+	uint8_t presence;
+
+	if ((error = owire_reset(dev, &presence))) {
+		free(error);
+		return 1;
+	}
+
+	// Return value of presence pulse, 0 = OK, 1 = ERROR
+	return !presence;
+}
+
+// ow WRITE slot
+//---------------------------------------------------------------
+static void TM_OneWire_WriteBit(uint8_t dev, unsigned char bit) {
+	driver_error_t *error;
+
+	bit &= 1;
+	if ((error = owire_slots(dev, &bit, NULL, 1))) {
+		free(error);
+	}
+}
+
+// ow READ slot
+//---------------------------------------------
+unsigned char TM_OneWire_ReadBit(uint8_t dev) {
+	driver_error_t *error;
+	uint8_t bit = 1;
+
+	if ((error = owire_slots(dev, &bit, &bit, 1))) {
+		free(error);
+		return 1;
+	}
+
+	return bit & 1;
+}
+
+//----------------------------------------------------------
+void TM_OneWire_WriteByte(uint8_t dev, unsigned char byte) {
+	driver_error_t *error;
+
+	if ((error = owire_write(dev, &byte, 1))) {
+		free(error);
+	}
+}
+
+//----------------------------------------------
+unsigned char TM_OneWire_ReadByte(uint8_t dev) {
+	driver_error_t *error;
+	uint8_t byte;
+
+	if ((error = owire_read(dev, &byte, 1))) {
+		free(error);
+		return 0xff;
+	}
+
+	return byte;
+}
+
+//***********
+// ROM SEARCH
+//***********
+
+//-----------------------------------------------
+static void TM_OneWire_ResetSearch(uint8_t dev) {
+  // Reset the search state
+  ow_devices[dev].device.LastDiscrepancy = 0;
+  ow_devices[dev].device.LastDeviceFlag = 0;
+  ow_devices[dev].device.LastFamilyDiscrepancy = 0;
+}
+
+/*
+ * Find the next device on each bus in mask, from the search state of each bus
+ * (see TM_One_Wire_t). Buses where a device is found are set in found, and its
+ * ROM is in the ROM_NO of the bus.
+ *
+ * For each ROM bit, the write slot of the search direction for the previous
+ * bit, and the two read slots of the bit and its complement, are sent in the
+ * same transaction.
+ */
+static driver_error_t *owire_search_step(uint32_t mask, unsigned char command, uint32_t *found) {
+	driver_error_t *error = NULL;
+	TM_One_Wire_t *device;
+	unsigned char last_zero[MAX_ONEWIRE_PINS];
+	unsigned char direction[MAX_ONEWIRE_PINS];
+	unsigned char id_bit, cmp_id_bit;
+	uint8_t tx, rx, n;
+	uint32_t active;
+	int dev, bit;
+
+	*found = 0;
+	active = 0;
+
+	// Reset the buses, except the ones where the last device was found
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if ((mask & (1 << dev)) && !ow_devices[dev].device.LastDeviceFlag) {
+			if ((error = engine->start(engine->arg, dev, NULL, 0))) {
+				goto exit;
+			}
+
+			active |= (1 << dev);
+		}
+	}
+
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (active & (1 << dev)) {
+			rx = 0;
+			if ((error = engine->wait(engine->arg, dev, &rx))) {
+				goto exit;
+			}
+
+			// No devices
+			if (!(rx & 1)) {
+				active &= ~(1 << dev);
+			}
+		}
+	}
+
+	// Issue the search command
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (active & (1 << dev)) {
+			if ((error = engine->start(engine->arg, dev, &command, 8))) {
+				goto exit;
+			}
+		}
+	}
+
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (active & (1 << dev)) {
+			if ((error = engine->wait(engine->arg, dev, &rx))) {
+				goto exit;
+			}
+
+			last_zero[dev] = 0;
+		}
+	}
+
+	// Loop to do the search, bit is the id bit number - 1
+	for(bit = 0; (bit <= 64) && active; bit++) {
+		for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+			if (active & (1 << dev)) {
+				// Direction for the previous bit, then read a bit and its complement
+				tx = 0;
+				n = 0;
+
+				if (bit > 0) {
+					tx = direction[dev];
+					n++;
+				}
+
+				if (bit < 64) {
+					tx |= (3 << n);
+					n += 2;
+				}
+
+				if ((error = engine->start(engine->arg, dev, &tx, n))) {
+					goto exit;
+				}
+			}
+		}
+
+		for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+			if (!(active & (1 << dev))) {
+				continue;
+			}
+
+			if ((error = engine->wait(engine->arg, dev, &rx))) {
+				goto exit;
+			}
+
+			if (bit == 64) {
+				continue;
+			}
+
+			device = &ow_devices[dev].device;
+
+			id_bit = (rx >> (n - 2)) & 1;
+			cmp_id_bit = (rx >> (n - 1)) & 1;
+
+			// check for no devices on 1-wire
+			if ((id_bit == 1) && (cmp_id_bit == 1)) {
+				active &= ~(1 << dev);
+				continue;
+			}
+
+			// all devices coupled have 0 or 1
+			if (id_bit != cmp_id_bit) {
+				direction[dev] = id_bit;  // bit write value for search
+			} else {
+				// if this discrepancy if before the Last Discrepancy
+				// on a previous next then pick the same as last time
+				if (bit + 1 < device->LastDiscrepancy) {
+					direction[dev] = ((device->ROM_NO[bit >> 3] & (1 << (bit & 7))) > 0);
+				} else {
+					// if equal to last pick 1, if not then pick 0
+					direction[dev] = (bit + 1 == device->LastDiscrepancy);
+				}
+
+				// if 0 was picked then record its position in LastZero
+				if (direction[dev] == 0) {
+					last_zero[dev] = bit + 1;
+
+					// check for Last discrepancy in family
+					if (last_zero[dev] < 9) {
+						device->LastFamilyDiscrepancy = last_zero[dev];
+					}
+				}
+			}
+
+			// set or clear the bit in the ROM
+			if (direction[dev] == 1) {
+				device->ROM_NO[bit >> 3] |= (1 << (bit & 7));
+			} else {
+				device->ROM_NO[bit >> 3] &= ~(1 << (bit & 7));
+			}
+		}
+	}
+
+	// The search was successful on the buses that are still active, and the
+	// ROM is valid
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (active & (1 << dev)) {
+			device = &ow_devices[dev].device;
+
+			if (device->ROM_NO[0] && (TM_OneWire_CRC8(device->ROM_NO, 7) == device->ROM_NO[7])) {
+				device->LastDiscrepancy = last_zero[dev];
+
+				// check for last device
+				if (device->LastDiscrepancy == 0) {
+					device->LastDeviceFlag = 1;
+				}
+
+				*found |= (1 << dev);
+			}
+		}
+	}
+
+exit:
+	// if no device found then reset counters so next 'search' will be like a first
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if ((mask & (1 << dev)) && !(*found & (1 << dev))) {
+			TM_OneWire_ResetSearch(dev);
+		}
+	}
+
+	return error;
+}
+
+//-------------------------------------------------------------------
+unsigned char TM_OneWire_Search(uint8_t dev, unsigned char command) {
+	driver_error_t *error;
+	uint32_t found;
+
+	if ((error = owire_search_step(1 << dev, command, &found))) {
+		free(error);
+		return 0;
+	}
+
+	return (found != 0);
+}
+
+//-------------------------------------------
+unsigned char TM_OneWire_First(uint8_t dev) {
+  // Reset search values
+  TM_OneWire_ResetSearch(dev);
+  // Start with searching
+  return TM_OneWire_Search(dev, ONEWIRE_CMD_SEARCHROM);
+}
+
+//------------------------------------------
+unsigned char TM_OneWire_Next(uint8_t dev) {
+  // Leave the search state alone
+  return TM_OneWire_Search(dev, ONEWIRE_CMD_SEARCHROM);
+}
+
+/*
+ * Enumerate the devices of all the buses in mask, at the same time. The ROMs
+ * found are stored in the bus, and are used until the bus is searched again.
+ */
+driver_error_t *owire_search(uint32_t mask) {
+	driver_error_t *error;
+	uint32_t pending, found;
+	int dev;
+
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (mask & (1 << dev)) {
+			TM_OneWire_ResetSearch(dev);
+			ow_devices[dev].numdev = 0;
+			ow_devices[dev].cached = 0;
+			memset(ow_devices[dev].roms, 0, sizeof(ow_devices[dev].roms));
+		}
+	}
+
+	pending = mask;
+	while (pending) {
+		if ((error = owire_search_step(pending, ONEWIRE_CMD_SEARCHROM, &found))) {
+			return error;
+		}
+
+		for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+			if (!(pending & (1 << dev))) {
+				continue;
+			}
+
+			if (found & (1 << dev)) {
+				TM_OneWire_GetFullROM(dev, ow_devices[dev].roms[ow_devices[dev].numdev++]);
+			}
+
+			// Done when there are no more devices, or there is no more room
+			if (!(found & (1 << dev)) || ow_devices[dev].device.LastDeviceFlag || (ow_devices[dev].numdev >= MAX_ONEWIRE_SENSORS)) {
+				pending &= ~(1 << dev);
+			}
+		}
+	}
+
+	for(dev = 0; dev < MAX_ONEWIRE_PINS; dev++) {
+		if (mask & (1 << dev)) {
+			ow_devices[dev].cached = 1;
+		}
+	}
+
+	return NULL;
+}
+
+// Forget the ROMs of the bus, so next TM_OneWire_Dosearch searches again
+void owire_invalidate(uint8_t dev) {
+	ow_devices[dev].cached = 0;
+}
+
+//------------------------------------------------------------------
+void TM_OneWire_SelectWithPointer(uint8_t dev, unsigned char *ROM) {
+	driver_error_t *error;
+	uint8_t buffer[9];
+
+	buffer[0] = ONEWIRE_CMD_MATCHROM;
+	memcpy(&buffer[1], ROM, 8);
+
+	if ((error = owire_write(dev, buffer, sizeof(buffer)))) {
+		free(error);
+	}
+}
+
+//------------------------------------------------------------------
+void TM_OneWire_GetFullROM(uint8_t dev, unsigned char *firstIndex) {
+  unsigned char i;
+  for (i = 0; i < 8; i++) {
+    *(firstIndex + i) = ow_devices[dev].device.ROM_NO[i];
+  }
+}
+
+//---------------------------------------------------------------------
+unsigned char TM_OneWire_CRC8(unsigned char *addr, unsigned char len) {
+  unsigned char crc = 0, inbyte, i, mix;
+
+  while (len--) {
+    inbyte = *addr++;
+    for (i = 8; i; i--) {
+      mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      inbyte >>= 1;
+    }
+  }
+  /* Return calculated CRC */
+  return crc;
+}
+
+// Search for devices on owire bus, if they aren't known yet
+//----------------------------------------
+uint8_t TM_OneWire_Dosearch(uint8_t dev) {
+	driver_error_t *error;
+
+	if (!ow_devices[dev].cached) {
+		if ((error = owire_search(1 << dev))) {
+			free(error);
+		}
+	}
+
+	return ow_devices[dev].numdev;
+}
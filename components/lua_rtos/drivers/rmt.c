@@ -0,0 +1,151 @@
+/*
+ * Lua RTOS, RMT channels
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "rmt.h"
+
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+#include "soc/soc.h"
+#include "soc/rmt_struct.h"
+#include "driver/periph_ctrl.h"
+
+typedef struct {
+	uint8_t used;         // 1 if the channel's memory is in use
+	rmt_channel_isr_t isr;  // NULL if the channel isn't allocated, or its memory is used by other channel
+	void *arg;
+} rmt_channel_entry_t;
+
+static DRAM_ATTR rmt_channel_entry_t channels[RMT_CHANNELS];
+
+static intr_handle_t rmt_intr = NULL;
+static portMUX_TYPE rmt_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR rmt_isr(void *arg) {
+	BaseType_t woken = pdFALSE;
+	uint32_t status;
+	int ch;
+
+	status = RMT.int_st.val;
+	RMT.int_clr.val = status;
+
+	for(ch = 0; ch < RMT_CHANNELS; ch++) {
+		if (channels[ch].isr && (status & RMT_INTR_ALL(ch))) {
+			channels[ch].isr(channels[ch].arg, ch, status, &woken);
+		}
+	}
+
+	if (woken == pdTRUE) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+/*
+ * Allocate a channel that uses blocks memory blocks, and set its interrupt
+ * handler. Returns the channel, or -1 if there are no free channels.
+ */
+int rmt_channel_alloc(uint8_t blocks, rmt_channel_isr_t isr, void *arg) {
+	int ch, i;
+
+	portENTER_CRITICAL(&rmt_spinlock);
+
+	for(ch = 0; ch + blocks <= RMT_CHANNELS; ch++) {
+		for(i = 0; i < blocks; i++) {
+			if (channels[ch + i].used) {
+				break;
+			}
+		}
+
+		if (i == blocks) {
+			for(i = 0; i < blocks; i++) {
+				channels[ch + i].used = blocks - i;
+			}
+
+			channels[ch].arg = arg;
+			channels[ch].isr = isr;
+			break;
+		}
+	}
+
+	portEXIT_CRITICAL(&rmt_spinlock);
+
+	if (ch + blocks > RMT_CHANNELS) {
+		return -1;
+	}
+
+	if (!rmt_intr) {
+		periph_module_enable(PERIPH_RMT_MODULE);
+
+		RMT.apb_conf.fifo_mask = 1;
+
+		esp_intr_alloc(ETS_RMT_INTR_SOURCE, ESP_INTR_FLAG_IRAM, rmt_isr, NULL, &rmt_intr);
+	}
+
+	return ch;
+}
+
+// Free a channel, and the channels used for its memory
+void rmt_channel_free(uint8_t channel) {
+	int i, blocks;
+
+	rmt_channel_intr_disable(RMT_INTR_ALL(channel));
+
+	portENTER_CRITICAL(&rmt_spinlock);
+
+	blocks = channels[channel].used;
+	for(i = 0; i < blocks; i++) {
+		channels[channel + i].used = 0;
+	}
+
+	channels[channel].isr = NULL;
+	channels[channel].arg = NULL;
+
+	portEXIT_CRITICAL(&rmt_spinlock);
+}
+
+// Clear and enable interrupts, mask is built with the RMT_INTR_xxx macros
+void rmt_channel_intr_enable(uint32_t mask) {
+	portENTER_CRITICAL(&rmt_spinlock);
+	RMT.int_clr.val = mask;
+	RMT.int_ena.val |= mask;
+	portEXIT_CRITICAL(&rmt_spinlock);
+}
+
+// Disable interrupts, mask is built with the RMT_INTR_xxx macros
+void rmt_channel_intr_disable(uint32_t mask) {
+	portENTER_CRITICAL(&rmt_spinlock);
+	RMT.int_ena.val &= ~mask;
+	portEXIT_CRITICAL(&rmt_spinlock);
+}
+
+void IRAM_ATTR rmt_channel_intr_disable_from_isr(uint32_t mask) {
+	portENTER_CRITICAL_ISR(&rmt_spinlock);
+	RMT.int_ena.val &= ~mask;
+	portEXIT_CRITICAL_ISR(&rmt_spinlock);
+}
@@ -0,0 +1,68 @@
+/*
+ * Lua RTOS, RMT channels
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ *
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ *
+ * All rights reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * RMT channels are shared by the drivers that use the RMT peripheral (NZR,
+ * ONE WIRE). A driver allocates a channel with the number of RMT memory
+ * blocks that it needs, and the channel's interrupts are dispatched to the
+ * driver's handler from a single RMT interrupt.
+ *
+ * A channel that uses n memory blocks also uses the memory of the next n - 1
+ * channels, so these channels are allocated too.
+ */
+
+#ifndef RMT_H_
+#define RMT_H_
+
+#include "freertos/FreeRTOS.h"
+
+#include <stdint.h>
+
+#define RMT_CHANNELS        8
+
+// RMT interrupts for a channel
+#define RMT_INTR_TX_END(ch) (1 << ((ch) * 3))
+#define RMT_INTR_RX_END(ch) (1 << ((ch) * 3 + 1))
+#define RMT_INTR_ERR(ch)    (1 << ((ch) * 3 + 2))
+#define RMT_INTR_TX_THR(ch) (1 << (24 + (ch)))
+
+#define RMT_INTR_ALL(ch)    (RMT_INTR_TX_END(ch) | RMT_INTR_RX_END(ch) | RMT_INTR_ERR(ch) | RMT_INTR_TX_THR(ch))
+
+// Channel interrupt handler. It's called from the RMT interrupt, with the
+// interrupt status of all channels, so it must be in IRAM. woken is set to
+// pdTRUE if the handler wakes a higher priority task.
+typedef void (*rmt_channel_isr_t)(void *arg, uint8_t channel, uint32_t status, BaseType_t *woken);
+
+int rmt_channel_alloc(uint8_t blocks, rmt_channel_isr_t isr, void *arg);
+void rmt_channel_free(uint8_t channel);
+void rmt_channel_intr_enable(uint32_t mask);
+void rmt_channel_intr_disable(uint32_t mask);
+void rmt_channel_intr_disable_from_isr(uint32_t mask);
+
+#endif /* RMT_H_ */
@@ -33,7 +33,11 @@
 
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include <sys/list.h>
+#include <sys/mutex.h>
 #include <sys/driver.h>
 #include <sys/syslog.h>
 
@@ -57,13 +61,33 @@ DRIVER_REGISTER_ERROR(SENSOR, sensor, SetUndefined, "set function is not defined
 DRIVER_REGISTER_ERROR(SENSOR, sensor, NotFound, "not found", SENSOR_ERR_NOT_FOUND);
 DRIVER_REGISTER_ERROR(SENSOR, sensor, InterfaceNotSupported, "interface not supported", SENSOR_ERR_INTERFACE_NOT_SUPPORTED);
 DRIVER_REGISTER_ERROR(SENSOR, sensor, NotSetup, "sensor is not setup", SENSOR_ERR_NOT_SETUP);
+DRIVER_REGISTER_ERROR(SENSOR, sensor, NoSample, "no sample available", SENSOR_ERR_NO_SAMPLE);
 
 // List of instantiated sensors
 struct list sensor_list;
 
+// Protects the sensor list and the sampling schedule
+static struct mtx sensor_mtx;
+
+// Serialize acquisitions, as the sampling service and Lua threads can share buses.
+// Each 1-Wire bus has its own mutex, as DS1820 conversions are long, and the other
+// interfaces share the last one. Lock order is bus, then sensor_mtx.
+static struct mtx sensor_bus_mtx[MAX_ONEWIRE_PINS + 1];
+
+// Sampling service task
+static TaskHandle_t sensor_task = NULL;
+
 /*
  * Helper functions
  */
+static struct mtx *sensor_bus(sensor_instance_t *unit) {
+	if (unit->sensor->interface == OWIRE_INTERFACE) {
+		return &sensor_bus_mtx[unit->setup.owire.owdevice];
+	}
+
+	return &sensor_bus_mtx[MAX_ONEWIRE_PINS];
+}
+
 static driver_error_t *sensor_adc_setup(sensor_instance_t *unit) {
 	driver_unit_lock_error_t *lock_error = NULL;
 	driver_error_t *error;
@@ -106,23 +130,17 @@ static driver_error_t *sensor_owire_setup(sensor_instance_t *unit) {
 		if ((error = owire_setup_pin(unit->setup.owire.gpio))) {
 		  	return error;
 		}
-		int dev = owire_checkpin(unit->setup.owire.gpio);
+		dev = owire_checkpin(unit->setup.owire.gpio);
 		if (dev < 0) {
 			return driver_setup_error(SENSOR_DRIVER, SENSOR_ERR_CANT_INIT, NULL);
 		}
-		vTaskDelay(10 / portTICK_RATE_MS);
-		owdevice_input(dev);
-		ow_devices_init(dev);
-		unit->setup.owire.owdevice = dev;
-
-		// Search for devices on owire bus
-		TM_OneWire_Dosearch(dev);
-	}
-	else {
-		unit->setup.owire.owdevice = dev;
-		TM_OneWire_Dosearch(dev);
 	}
 
+	unit->setup.owire.owdevice = dev;
+
+	// Search for devices on owire bus, unless they are already known
+	TM_OneWire_Dosearch(dev);
+
 	// check if owire bus is setup
 	if (ow_devices[unit->setup.owire.owdevice].device.pin == 0) {
 		return driver_setup_error(SENSOR_DRIVER, SENSOR_ERR_CANT_INIT, NULL);
@@ -140,12 +158,223 @@ static driver_error_t *sensor_i2c_setup(sensor_instance_t *unit) {
 	return NULL;
 }
 
+// Acquire data from sensor using the acquire function fn. The unit's bus must be locked.
+static driver_error_t *sensor_acquire_unit(sensor_instance_t *unit, sensor_acquire_f_t fn) {
+	driver_error_t *error = NULL;
+	sensor_value_t *value = NULL;
+	int i = 0;
+
+	#if CONFIG_LUA_RTOS_USE_POWER_BUS
+	pwbus_on();
+	#endif
+
+	// Allocate space for sensor data
+	if (!(value = calloc(1, sizeof(sensor_value_t) * SENSOR_MAX_DATA))) {
+		return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	// Call to specific acquire function
+	if ((error = fn(unit, value))) {
+		free(value);
+		return error;
+	}
+
+	// Copy sensor values into instance
+	// Note that we only copy raw values as value types are set in sensor_setup from sensor
+	// definition
+	for(i=0;i < SENSOR_MAX_DATA;i++) {
+		unit->data[i].raw = value[i].raw;
+	}
+
+	free(value);
+
+	return NULL;
+}
+
+// Publish current unit data as the last sample. Readers never wait for the
+// writer: the sample is written into the buffer that is not published, and
+// then published. A reader retries its copy if a sample was published while
+// it was copying, as the next sample is written into the buffer it copies.
+static void sensor_publish_sample(sensor_instance_t *unit, driver_error_t *error) {
+	uint8_t next = unit->current ^ 1;
+
+	memcpy(unit->sample[next].data, unit->data, sizeof(unit->data));
+	unit->sample[next].time = xTaskGetTickCount();
+	unit->sample[next].failed = (error != NULL);
+	if (error) {
+		unit->sample[next].error = *error;
+		unit->sample[next].error.lock_error = NULL;
+	}
+
+	__sync_synchronize();
+	unit->current = next;
+
+	__sync_synchronize();
+	unit->seq++;
+}
+
+// Get the next due unit after index (-1 for the first one), with its bus locked.
+// A unit can't be removed while its bus is locked. Returns NULL if there are no
+// more due units.
+static sensor_instance_t *sensor_lock_due(int *index) {
+	sensor_instance_t *unit, *check;
+	struct mtx *bus;
+	int due;
+
+	for(;;) {
+		mtx_lock(&sensor_mtx);
+
+		*index = (*index < 0)?list_first(&sensor_list):list_next(&sensor_list, *index);
+		while (*index >= 0) {
+			if (!list_get(&sensor_list, *index, (void **)&unit) && unit->due) {
+				break;
+			}
+
+			*index = list_next(&sensor_list, *index);
+		}
+
+		if (*index < 0) {
+			mtx_unlock(&sensor_mtx);
+			return NULL;
+		}
+
+		bus = sensor_bus(unit);
+
+		mtx_unlock(&sensor_mtx);
+
+		mtx_lock(bus);
+
+		// Unit can be removed before its bus is locked
+		mtx_lock(&sensor_mtx);
+		due = (!list_get(&sensor_list, *index, (void **)&check) && (check == unit) && unit->due);
+		mtx_unlock(&sensor_mtx);
+
+		if (due) {
+			return unit;
+		}
+
+		mtx_unlock(bus);
+	}
+}
+
+// Sampling service: acquires all the sampled units that are due, and sleeps until
+// next sample is due, or until a new unit is sampled. sensor_mtx is only held to
+// walk the schedule, and each acquisition only locks its bus, so a conversion
+// doesn't block acquisitions on other buses.
+static void sensor_sample_task(void *arg) {
+	driver_error_t *error;
+	sensor_instance_t *unit;
+	uint32_t now, started, wait;
+	int index;
+
+	for(;;) {
+		wait = portMAX_DELAY;
+
+		// Mark due units
+		mtx_lock(&sensor_mtx);
+
+		now = xTaskGetTickCount();
+
+		index = list_first(&sensor_list);
+		while (index >= 0) {
+			if (!list_get(&sensor_list, index, (void **)&unit)) {
+				unit->due = (unit->period && ((int32_t)(now - unit->next) >= 0));
+			}
+
+			index = list_next(&sensor_list, index);
+		}
+
+		mtx_unlock(&sensor_mtx);
+
+		// Start shared acquisitions once per bus
+		started = 0;
+
+		index = -1;
+		while ((unit = sensor_lock_due(&index))) {
+			if (unit->sensor->startall && unit->sensor->collect && (unit->sensor->interface == OWIRE_INTERFACE)) {
+				if (!(started & (1 << unit->setup.owire.owdevice))) {
+					if ((error = unit->sensor->startall(unit))) {
+						free(error);
+					}
+
+					started |= (1 << unit->setup.owire.owdevice);
+				}
+			}
+
+			mtx_unlock(sensor_bus(unit));
+		}
+
+		// Acquire due units
+		index = -1;
+		while ((unit = sensor_lock_due(&index))) {
+			if (unit->sensor->collect && (unit->sensor->interface == OWIRE_INTERFACE) && (started & (1 << unit->setup.owire.owdevice))) {
+				error = sensor_acquire_unit(unit, unit->sensor->collect);
+			} else {
+				error = sensor_acquire_unit(unit, unit->sensor->acquire);
+			}
+
+			sensor_publish_sample(unit, error);
+
+			if (error) {
+				free(error);
+			}
+
+			// Schedule next sample without drift, unless we are late
+			mtx_lock(&sensor_mtx);
+
+			unit->next += unit->period;
+			now = xTaskGetTickCount();
+			if ((int32_t)(now - unit->next) >= 0) {
+				unit->next = now + unit->period;
+			}
+
+			unit->due = 0;
+
+			mtx_unlock(&sensor_mtx);
+
+			mtx_unlock(sensor_bus(unit));
+		}
+
+		// Time to next sample
+		mtx_lock(&sensor_mtx);
+
+		now = xTaskGetTickCount();
+
+		index = list_first(&sensor_list);
+		while (index >= 0) {
+			if (!list_get(&sensor_list, index, (void **)&unit) && unit->period) {
+				if ((int32_t)(unit->next - now) <= 0) {
+					wait = 0;
+				} else if ((unit->next - now) < wait) {
+					wait = unit->next - now;
+				}
+			}
+
+			index = list_next(&sensor_list, index);
+		}
+
+		mtx_unlock(&sensor_mtx);
+
+		if (wait) {
+			ulTaskNotifyTake(pdTRUE, wait);
+		}
+	}
+}
+
 /*
  * Operation functions
  */
 void sensor_init() {
+	int i;
+
 	// Init sensor list
     list_init(&sensor_list, 0);
+
+    mtx_init(&sensor_mtx, NULL, NULL, 0);
+
+    for(i = 0;i < MAX_ONEWIRE_PINS + 1;i++) {
+    	mtx_init(&sensor_bus_mtx[i], NULL, NULL, 0);
+    }
 }
 
 const sensor_t *get_sensor(const char *id) {
@@ -248,35 +477,13 @@ driver_error_t *sensor_setup(const sensor_t *sensor, sensor_setup_t *setup, sens
 }
 
 driver_error_t *sensor_acquire(sensor_instance_t *unit) {
-	driver_error_t *error = NULL;
-	sensor_value_t *value = NULL;
-	int i = 0;
-
-	#if CONFIG_LUA_RTOS_USE_POWER_BUS
-	pwbus_on();
-	#endif
-
-	// Allocate space for sensor data
-	if (!(value = calloc(1, sizeof(sensor_value_t) * SENSOR_MAX_DATA))) {
-		return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_ENOUGH_MEMORY, NULL);
-	}
-
-	// Call to specific acquire function, if any
-	if ((error = unit->sensor->acquire(unit, value))) {
-		free(value);
-		return error;
-	}
-
-	// Copy sensor values into instance
-	// Note that we only copy raw values as value types are set in sensor_setup from sensor
-	// definition
-	for(i=0;i < SENSOR_MAX_DATA;i++) {
-		unit->data[i].raw = value[i].raw;
-	}
+	driver_error_t *error;
 
-	free(value);
+	mtx_lock(sensor_bus(unit));
+	error = sensor_acquire_unit(unit, unit->sensor->acquire);
+	mtx_unlock(sensor_bus(unit));
 
-	return NULL;
+	return error;
 }
 
 driver_error_t *sensor_read(sensor_instance_t *unit, const char *id, sensor_value_t **value) {
@@ -341,6 +548,93 @@ driver_error_t *sensor_get(sensor_instance_t *unit, const char *id, sensor_value
 	return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_FOUND, NULL);
 }
 
+driver_error_t *sensor_sample(sensor_instance_t *unit, uint32_t period) {
+	// Start sampling service, if needed
+	if (period && !sensor_task) {
+		if (xTaskCreatePinnedToCore(sensor_sample_task, "sensor", CONFIG_LUA_RTOS_LUA_THREAD_STACK_SIZE, NULL, CONFIG_LUA_RTOS_LUA_TASK_PRIORITY, &sensor_task, xPortGetCoreID()) != pdPASS) {
+			sensor_task = NULL;
+
+			return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_ENOUGH_MEMORY, NULL);
+		}
+	}
+
+	mtx_lock(&sensor_mtx);
+
+	unit->period = period / portTICK_PERIOD_MS;
+	if (period && !unit->period) {
+		unit->period = 1;
+	}
+
+	// First sample is taken now
+	unit->next = xTaskGetTickCount();
+
+	mtx_unlock(&sensor_mtx);
+
+	if (sensor_task) {
+		xTaskNotifyGive(sensor_task);
+	}
+
+	return NULL;
+}
+
+driver_error_t *sensor_get_sample(sensor_instance_t *unit, sensor_value_t *values, uint32_t *age) {
+	driver_error_t *error;
+	driver_error_t sample_error;
+	uint8_t failed;
+	uint32_t seq;
+	uint8_t current;
+
+	if (!unit->period) {
+		return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_SETUP, "not sampled");
+	}
+
+	do {
+		seq = unit->seq;
+
+		__sync_synchronize();
+
+		current = unit->current;
+		memcpy(values, unit->sample[current].data, sizeof(unit->sample[current].data));
+		*age = (xTaskGetTickCount() - unit->sample[current].time) * portTICK_PERIOD_MS;
+		failed = unit->sample[current].failed;
+		sample_error = unit->sample[current].error;
+
+		__sync_synchronize();
+	} while (seq != unit->seq);
+
+	if (seq == 0) {
+		// Nothing published yet
+		return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NO_SAMPLE, NULL);
+	}
+
+	if (failed) {
+		// The error of the acquisition, as it was raised by its driver
+		error = (driver_error_t *)malloc(sizeof(driver_error_t));
+		if (!error) {
+			return driver_operation_error(SENSOR_DRIVER, SENSOR_ERR_NOT_ENOUGH_MEMORY, NULL);
+		}
+
+		*error = sample_error;
+
+		return error;
+	}
+
+	return NULL;
+}
+
+void sensor_unsetup(sensor_instance_t *unit) {
+	struct mtx *bus = sensor_bus(unit);
+
+	// Stop sampling and remove instance, service can't be using it while
+	// its bus is locked
+	mtx_lock(bus);
+	mtx_lock(&sensor_mtx);
+	unit->period = 0;
+	list_remove(&sensor_list, unit->unit, 1);
+	mtx_unlock(&sensor_mtx);
+	mtx_unlock(bus);
+}
+
 DRIVER_REGISTER(SENSOR,sensor,NULL,sensor_init,NULL);
 
 #endif
@@ -47,6 +47,7 @@ typedef driver_error_t *(*sensor_setup_f_t)(struct sensor_instance *);
 typedef driver_error_t *(*sensor_acquire_f_t)(struct sensor_instance *, struct sensor_value *);
 typedef driver_error_t *(*sensor_set_f_t)(struct sensor_instance *, const char *, struct sensor_value *);
 typedef driver_error_t *(*sensor_get_f_t)(struct sensor_instance *, const char *, struct sensor_value *);
+typedef driver_error_t *(*sensor_startall_f_t)(struct sensor_instance *);
 
 #define SENSOR_MAX_DATA       6
 #define SENSOR_MAX_PROPERTIES 4
@@ -91,6 +92,13 @@ typedef struct {
 	const sensor_acquire_f_t acquire;
 	const sensor_set_f_t set;
 	const sensor_get_f_t get;
+
+	// Optional, used by the sampling service for overlap the acquisition of
+	// all the sensors that share a bus: startall starts the acquisition on all
+	// the devices attached to the unit's bus, and collect gets the values of
+	// the unit once they are available.
+	const sensor_startall_f_t startall;
+	const sensor_acquire_f_t collect;
 } sensor_t;
 
 typedef struct sensor_value {
@@ -149,6 +157,14 @@ typedef struct {
 	};
 } sensor_setup_t;
 
+// Sample taken by the sampling service
+typedef struct {
+	sensor_value_t data[SENSOR_MAX_DATA];
+	uint32_t time;			// tick count when sample was acquired
+	uint8_t failed;			// the acquisition raised an error
+	driver_error_t error;	// error raised by the acquisition
+} sensor_sample_t;
+
 // Sensor instance
 typedef struct sensor_instance {
 	int unit;
@@ -156,6 +172,14 @@ typedef struct sensor_instance {
 	sensor_value_t properties[SENSOR_MAX_PROPERTIES];
 	const sensor_t *sensor;
 	sensor_setup_t setup;
+
+	// Sampling service
+	uint32_t period;				// sampling period in ticks, 0 = not sampled
+	uint32_t next;					// tick count of next sample
+	uint8_t due;					// sample is due in current service cycle
+	sensor_sample_t sample[2];		// double buffered samples
+	volatile uint8_t current;		// sample buffer published to readers
+	volatile uint32_t seq;			// number of published samples
 } sensor_instance_t;
 
 const sensor_t *get_sensor(const char *id);
@@ -165,6 +189,9 @@ driver_error_t *sensor_acquire(sensor_instance_t *unit);
 driver_error_t *sensor_read(sensor_instance_t *unit, const char *id, sensor_value_t **value);
 driver_error_t *sensor_set(sensor_instance_t *unit, const char *id, sensor_value_t *value);
 driver_error_t *sensor_get(sensor_instance_t *unit, const char *id, sensor_value_t **value);
+driver_error_t *sensor_sample(sensor_instance_t *unit, uint32_t period);
+driver_error_t *sensor_get_sample(sensor_instance_t *unit, sensor_value_t *values, uint32_t *age);
+void sensor_unsetup(sensor_instance_t *unit);
 
 // SENSOR errors
 #define SENSOR_ERR_CANT_INIT                (DRIVER_EXCEPTION_BASE(SENSOR_DRIVER_ID) |  0)
@@ -176,6 +203,7 @@ driver_error_t *sensor_get(sensor_instance_t *unit, const char *id, sensor_value
 #define SENSOR_ERR_NOT_FOUND				(DRIVER_EXCEPTION_BASE(SENSOR_DRIVER_ID) |  6)
 #define SENSOR_ERR_INTERFACE_NOT_SUPPORTED	(DRIVER_EXCEPTION_BASE(SENSOR_DRIVER_ID) |  7)
 #define SENSOR_ERR_NOT_SETUP				(DRIVER_EXCEPTION_BASE(SENSOR_DRIVER_ID) |  8)
+#define SENSOR_ERR_NO_SAMPLE				(DRIVER_EXCEPTION_BASE(SENSOR_DRIVER_ID) |  9)
 
 #endif
 
@@ -590,12 +590,18 @@ void IRAM_ATTR spi_ll_bulk_read(int deviceid, uint32_t nbytes, uint8_t *data) {
 }
 
 int IRAM_ATTR spi_ll_bulk_rw(int deviceid, uint32_t nbytes, uint8_t *data) {
-	uint8_t *read = (uint8_t *)malloc(nbytes);
+	uint8_t buffer[SPI_LL_RW_BUFFER_SIZE];
+
+	// Short transfers, as ADC conversions, don't need to allocate memory
+	uint8_t *read = (nbytes <= sizeof(buffer))?buffer:(uint8_t *)malloc(nbytes);
 	if (read) {
 	    spi_master_op(deviceid, 1, nbytes, data, read);
 
 	    memcpy(data, read, nbytes);
-		free(read);
+
+	    if (read != buffer) {
+	    	free(read);
+	    }
 	} else {
 		return -1;
 	}
@@ -35,6 +35,9 @@
 // Number of SPI devices per bus
 #define SPI_BUS_DEVICES 3
 
+// Transfers up to this size are done in spi_ll_bulk_rw without allocating memory
+#define SPI_LL_RW_BUFFER_SIZE 16
+
 // SPI errors
 #define SPI_ERR_INVALID_MODE             (DRIVER_EXCEPTION_BASE(SPI_DRIVER_ID) |  0)
 #define SPI_ERR_INVALID_UNIT             (DRIVER_EXCEPTION_BASE(SPI_DRIVER_ID) |  1)
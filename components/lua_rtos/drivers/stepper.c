@@ -37,9 +37,9 @@ x * Lua RTOS, stepper driver
 
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 
-#include <sys/delay.h>
 #include <sys/list.h>
 #include <sys/driver.h>
 #include <sys/syslog.h>
@@ -55,6 +55,8 @@ DRIVER_REGISTER_ERROR(STEPPER, stepper, NoMoreUnits, "no more units available",
 DRIVER_REGISTER_ERROR(STEPPER, stepper, UnitNotSetup, "unit is not setup", STEPPER_ERR_UNIT_NOT_SETUP);
 DRIVER_REGISTER_ERROR(STEPPER, stepper, InvalidPin, "invalid pin", STEPPER_ERR_INVALID_PIN);
 DRIVER_REGISTER_ERROR(STEPPER, stepper, InvalidDirection, "invalid direction", STEPPER_ERR_INVALID_DIRECTION);
+DRIVER_REGISTER_ERROR(STEPPER, stepper, InvalidProfile, "invalid profile", STEPPER_ERR_INVALID_PROFILE);
+DRIVER_REGISTER_ERROR(STEPPER, stepper, InvalidMaster, "invalid master", STEPPER_ERR_INVALID_MASTER);
 
 // Stepper units
 static stepper_t stepper[NSTEP];
@@ -63,45 +65,86 @@ static struct mtx stepper_mutex;
 timg_dev_t *stepper_timerg;        // Timer group
 int stepper_timeri;                // Timer unit into timer group
 static uint32_t start;             // Start stepper mask (1 = started, 0 = not started)
+static uint32_t pulse;             // Clock pins set in the last tick, cleared in the next one
+static stepper_stats_t stats;      // Interrupt handler measures
 
 /*
  * Helper functions
  */
 static void stepper_init() {
+	int unit;
+
     mtx_init(&stepper_mutex, NULL, NULL, 0);
 	memset(stepper,0,sizeof(stepper_t) * NSTEP);
+	memset(&stats,0,sizeof(stats));
+	stats.latency_min = 0xffffffff;
+	stats.step_min = 0xffffffff;
+
+	for(unit = 0; unit < NSTEP; unit++) {
+		stepper[unit].master = -1;
+	}
+}
+
+// Forget the programmed movement of a unit
+static void stepper_release(int unit) {
+	int i;
+
+	if (stepper[unit].profile) {
+		free(stepper[unit].profile);
+		stepper[unit].profile = NULL;
+	}
+
+	// Detach from master
+	if (stepper[unit].master >= 0) {
+		stepper[stepper[unit].master].followers &= ~(1 << unit);
+		stepper[unit].master = -1;
+	}
+
+	// Detach followers
+	for(i = 0; i < NSTEP; i++) {
+		if (stepper[unit].followers & (1 << i)) {
+			stepper[i].master = -1;
+			stepper[i].steps = 0;
+		}
+	}
+
+	stepper[unit].followers = 0;
+	stepper[unit].steps = 0;
 }
 
-static inline void stepper_update_frequency(int unit, double freq) {
-    // Compute theoretical ticks, real ticks, and lost ticks per tick
-
-    /*
-     * We have 1 tick every (1 / STEPPER_HZ) seconds.
-     *
-     * We need (1 / freq) / (1 / STEPPER_HZ) ticks for generate a clock
-     * pulse at freq Hz.
-     *
-     */
-    double tticks = (((double)1 / freq) / ((double)1 / (double)STEPPER_HZ));
-
-    /*
-     * tticks must be round to the nearest integer less than tticks, because
-     * we can't get exactly tticks.
-     */
-    double rticks = floor(tticks);
-
-    /*
-     * tticks - lticks is the number of ticks that we lost by every tick. This
-     * value is accumulated in every tick interrupt, and when reaches a value
-     * >= 1 we need to decrement ticks by 1 for compensate.
-     */
-    double lticks = tticks - rticks;
-
-    /*
-     * Store rticks / lticks, for later use.
-     */
-    stepper[unit].ticks = rticks;
-    stepper[unit].lticks = lticks;
+/*
+ * Get the clock period for freq, in ticks, in fixed point.
+ *
+ * We have 1 tick every (1 / STEPPER_HZ) seconds, so we need
+ * (1 / freq) / (1 / STEPPER_HZ) ticks for generate a clock pulse at
+ * freq Hz. The fraction part is the number of ticks that we lost by
+ * every clock pulse, which is accumulated in the interrupt handler.
+ */
+static uint32_t stepper_period(double freq) {
+	double period;
+
+	if (freq < STEPPER_MIN_FREQ) {
+		freq = STEPPER_MIN_FREQ;
+	}
+
+	if (freq > STEPPER_MAX_FREQ) {
+		freq = STEPPER_MAX_FREQ;
+	}
+
+	period = ((double)STEPPER_HZ / freq) * (double)(1 << STEPPER_FRAC_BITS);
+	if (period > (double)0xffffffff) {
+		return 0xffffffff;
+	}
+
+	return (uint32_t)period;
+}
+
+// Load the clock period for the current profile entry
+static inline void IRAM_ATTR stepper_next_period(stepper_t *pstepper) {
+	uint32_t period = pstepper->lost + pstepper->profile[pstepper->profile_i];
+
+	pstepper->ticks = period >> STEPPER_FRAC_BITS;
+	pstepper->lost = period & ((1 << STEPPER_FRAC_BITS) - 1);
 }
 
 static void IRAM_ATTR stepper_isr(void *arg) {
@@ -109,68 +152,96 @@ static void IRAM_ATTR stepper_isr(void *arg) {
     uint32_t intr_status = stepper_timerg->int_st_timers.val;
 
     if((intr_status & BIT(timer_idx)) && timer_idx == stepper_timeri) {
+    	uint32_t ccount = xthal_get_ccount();
+    	uint32_t latency;
+
     	uint32_t clock_mask = 0;  // Clock mask
-        uint32_t dirs_mask  = 0;  // Direction (set) mask
-        uint32_t dirc_mask  = 0;  // Direction (clear) mask
         uint32_t stop_mask  = 0;  // Stop mask
+        uint32_t followers;       // Pending followers
 
         uint8_t unit = 0;              // Current unit
         stepper_t *pstepper = stepper; // Current stepper (= stepper[unit])
+        stepper_t *pfollower;          // Current follower
 
         uint32_t started = start;      // Pending steppers
 
-        while (started) {
-            if (started & 0b00000001) {
-            	// Increment ticks
-                pstepper->cticks++;
+        // Counter is reloaded on alarm, so its value is the interrupt latency
+        stepper_timerg->hw_timer[timer_idx].update = 1;
+        latency = stepper_timerg->hw_timer[timer_idx].cnt_low;
 
-                if (pstepper->cticks == pstepper->ticks) {
-                	// Update lost ticks
-                    pstepper->lost = pstepper->lost + pstepper->lticks;
+        // End the clock pulses started in the previous tick
+        if (pulse) {
+    		GPIO.out_w1tc = pulse;
+    		pulse = 0;
+        }
 
+        while (started) {
+            if ((started & 0b00000001) && (pstepper->master < 0)) {
+            	// Increment ticks
+                if (++pstepper->cticks >= pstepper->ticks) {
                     pstepper->cticks = 0;
-                    while (pstepper->lost >= 1.0) {
-                    	// 1 ticks is lost
-
-                    	// Increment ticks for compensate
-                        pstepper->cticks++;
-
-                        // Update lost
-                        pstepper->lost = pstepper->lost - 1.0;
-                    }
 
                     // Update clock mask
                     clock_mask |= (1 << pstepper->clock_pin);
 
-                    // Update direction mask
-                    if (pstepper->dir) {
-                        dirs_mask |= (1 << pstepper->dir_pin);
-                    } else {
-                        dirc_mask |= (1 << pstepper->dir_pin);
+                    // Shortest step period achieved
+                    if (pstepper->stepped && (ccount - pstepper->step_ccount < stats.step_min)) {
+                    	stats.step_min = ccount - pstepper->step_ccount;
                     }
 
-                    // Stop condition
-                    if (pstepper->steps == 1) {
-                        start &= ~(1 << unit);
-
-                        stop_mask |= (1 << unit);
-
-                        continue;
+                    pstepper->stepped = 1;
+                    pstepper->step_ccount = ccount;
+
+                    // Followers step when the error overflows
+                    followers = pstepper->followers;
+                    pfollower = stepper;
+                    while (followers) {
+                    	if ((followers & 0b00000001) && pfollower->steps) {
+                    		pfollower->dda_err += pfollower->dda_inc;
+                    		if (pfollower->dda_err >= pfollower->dda_steps) {
+                    			pfollower->dda_err -= pfollower->dda_steps;
+                    			pfollower->steps--;
+
+                    			clock_mask |= (1 << pfollower->clock_pin);
+                    		}
+                    	}
+
+                    	pfollower++;
+                    	followers = followers >> 1;
                     }
 
-                    // Ramp UP
-                    if (pstepper->steps >= pstepper->steps_up) {
-                        pstepper->current_freq += pstepper->freq_inc;
-                        stepper_update_frequency(unit, pstepper->current_freq);
+                    if (pstepper->steps == 1) {
+                        // Stop condition
+                        stop_mask |= (1 << unit) | pstepper->followers;
                     } else {
-                        // Ramp DOWN
-                        if (pstepper->steps <= pstepper->steps_down) {
-                            pstepper->current_freq -= pstepper->freq_inc;
-                            stepper_update_frequency(unit, pstepper->current_freq);
-                        }
+						if (pstepper->steps >= pstepper->steps_up) {
+							// Ramp UP
+							if (pstepper->ramp_i < pstepper->ramp) {
+								pstepper->ramp_i++;
+
+								if (++pstepper->ramp_rem == pstepper->ramp_div) {
+									pstepper->ramp_rem = 0;
+									pstepper->profile_i++;
+								}
+							}
+						} else if (pstepper->steps <= pstepper->steps_down) {
+							// Ramp DOWN
+							if (pstepper->ramp_i > 0) {
+								pstepper->ramp_i--;
+
+								if (pstepper->ramp_rem == 0) {
+									pstepper->ramp_rem = pstepper->ramp_div;
+									pstepper->profile_i--;
+								}
+
+								pstepper->ramp_rem--;
+							}
+						}
+
+						stepper_next_period(pstepper);
+
+						pstepper->steps--;
                     }
-
-                    pstepper->steps--;
                 }
             }
 
@@ -180,24 +251,41 @@ static void IRAM_ATTR stepper_isr(void *arg) {
         }
 
         if (clock_mask) {
-            // Update direction
-    		GPIO.out_w1ts = dirs_mask;
-    		GPIO.out_w1tc = dirc_mask;
-
-            // Generate clock pulse
+            // Generate clock pulse, it ends in the next tick
     		GPIO.out_w1ts = clock_mask;
-    		udelay(STEPPER_CLOCK_PULSE);
-    		GPIO.out_w1tc = clock_mask;
+    		pulse = clock_mask;
         }
 
         if (stop_mask) {
-        	// STOP
-        	mtx_unlock(&stepper_mutex);
+        	start &= ~stop_mask;
+
+        	if (!start) {
+            	// STOP
+            	mtx_unlock(&stepper_mutex);
+        	}
         }
 
     	stepper_timerg->hw_timer[timer_idx].update = 1;
     	stepper_timerg->int_clr_timers.t1 = 1;
     	stepper_timerg->hw_timer[timer_idx].config.alarm_en = 1;
+
+    	// Measures
+    	ccount = xthal_get_ccount() - ccount;
+
+    	stats.isr++;
+    	stats.isr_total += ccount;
+
+    	if (ccount > stats.isr_max) {
+    		stats.isr_max = ccount;
+    	}
+
+    	if (latency < stats.latency_min) {
+    		stats.latency_min = latency;
+    	}
+
+    	if (latency > stats.latency_max) {
+    		stats.latency_max = latency;
+    	}
     }
 }
 
@@ -263,7 +351,7 @@ driver_error_t *stepper_setup(uint8_t step_pin, uint8_t dir_pin, uint8_t *unit)
 		}
 	}
 
-	if (i > NSTEP) {
+	if (i >= NSTEP) {
 		// No free unit
 		mtx_unlock(&stepper_mutex);
 		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_NO_MORE_UNITS, NULL);
@@ -314,15 +402,23 @@ driver_error_t *stepper_setup(uint8_t step_pin, uint8_t dir_pin, uint8_t *unit)
     return NULL;
 }
 
-driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t ramp, double ifreq, double efreq) {
+driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t ramp, double ifreq, double efreq, uint8_t profile) {
+	uint32_t *table;
+	uint32_t div, size;
+	double t;
+	uint32_t i;
+
 	// Sanity checks
 	if (dir > 1) {
 		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_DIRECTION, NULL);
 	}
-	if (unit > NSTEP) {
+	if (unit >= NSTEP) {
 		// Invalid unit
 		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_UNIT, NULL);
 	}
+	if (profile > STEPPER_PROFILE_SCURVE) {
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_PROFILE, NULL);
+	}
 
 	mtx_lock(&stepper_mutex);
 
@@ -332,25 +428,97 @@ driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t
 		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_UNIT_NOT_SETUP, NULL);
 	}
 
+	if (ramp > steps) {
+		ramp = steps;
+	}
+
+	// Compute the clock period of the ramp steps, so the interrupt handler
+	// doesn't need to do floating point. Long ramps are subsampled, each
+	// entry is used by div ramp steps, and the last one is the end frequency.
+	div = ramp / (STEPPER_PROFILE_SIZE - 1) + ((ramp % (STEPPER_PROFILE_SIZE - 1))?1:0);
+	if (div == 0) {
+		div = 1;
+	}
+
+	size = ramp / div + 1;
+
+	table = (uint32_t *)malloc(sizeof(uint32_t) * size);
+	if (!table) {
+		mtx_unlock(&stepper_mutex);
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	for(i = 0; i < size; i++) {
+		t = ((i < size - 1)?(double)(i * div) / (double)ramp:1.0);
+
+		if (profile == STEPPER_PROFILE_SCURVE) {
+			// Smoothstep, acceleration starts and ends at 0
+			t = t * t * (3.0 - 2.0 * t);
+		}
+
+		table[i] = stepper_period(ifreq + (efreq - ifreq) * t);
+	}
+
+	stepper_release(unit);
+
+	stepper[unit].profile = table;
+	stepper[unit].ramp = ramp;
+	stepper[unit].ramp_i = 0;
+	stepper[unit].ramp_div = div;
+	stepper[unit].ramp_rem = 0;
+	stepper[unit].profile_i = 0;
+	stepper[unit].stepped = 0;
+
 	stepper[unit].steps = steps;
 
     stepper[unit].steps_up = steps - ramp + 1;
     stepper[unit].steps_down = ramp;
 
-    stepper[unit].target_freq  = efreq;
-    stepper[unit].current_freq = (ramp > 0?ifreq:efreq);
-
-    if (ramp > 0) {
-        stepper[unit].freq_inc = (stepper[unit].target_freq - ifreq) / ramp;
-    } else {
-        stepper[unit].freq_inc = 0;
-    }
-
     stepper[unit].dir = dir;
     stepper[unit].lost = 0;
     stepper[unit].cticks = 0;
 
-    stepper_update_frequency(unit, stepper[unit].current_freq);
+    stepper_next_period(&stepper[unit]);
+
+	mtx_unlock(&stepper_mutex);
+
+	return NULL;
+}
+
+driver_error_t *stepper_follow(uint8_t unit, uint8_t master, uint8_t dir, uint32_t steps) {
+	// Sanity checks
+	if (dir > 1) {
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_DIRECTION, NULL);
+	}
+	if ((unit >= NSTEP) || (master >= NSTEP)) {
+		// Invalid unit
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_UNIT, NULL);
+	}
+
+	mtx_lock(&stepper_mutex);
+
+	if (!stepper[unit].setup || !stepper[master].setup) {
+		// Unit not setup
+		mtx_unlock(&stepper_mutex);
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_UNIT_NOT_SETUP, NULL);
+	}
+
+	// Master must be programmed with stepper_move, and can't do less steps
+	if ((unit == master) || !stepper[master].profile || (stepper[master].master >= 0) || (steps > stepper[master].steps)) {
+		mtx_unlock(&stepper_mutex);
+		return driver_operation_error(STEPPER_DRIVER, STEPPER_ERR_INVALID_MASTER, NULL);
+	}
+
+	stepper_release(unit);
+
+	stepper[unit].master = master;
+	stepper[unit].steps = steps;
+	stepper[unit].dda_inc = steps;
+	stepper[unit].dda_steps = stepper[master].steps;
+	stepper[unit].dda_err = stepper[master].steps / 2;
+	stepper[unit].dir = dir;
+
+	stepper[master].followers |= (1 << unit);
 
 	mtx_unlock(&stepper_mutex);
 
@@ -358,8 +526,42 @@ driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t
 }
 
 void stepper_start(int mask) {
+	int unit;
+
 	mtx_lock(&stepper_mutex);
 
+	// Start the followers with their master, and don't start units without
+	// a programmed movement
+	for(unit = 0; unit < NSTEP; unit++) {
+		if (mask & (1 << unit)) {
+			if (stepper[unit].master < 0) {
+				if (stepper[unit].profile && stepper[unit].steps) {
+					mask |= stepper[unit].followers;
+				} else {
+					mask &= ~(1 << unit);
+				}
+			} else if (!(mask & (1 << stepper[unit].master))) {
+				mask &= ~(1 << unit);
+			}
+		}
+	}
+
+	if (!mask) {
+		mtx_unlock(&stepper_mutex);
+		return;
+	}
+
+	// Set direction before the first clock pulse
+	for(unit = 0; unit < NSTEP; unit++) {
+		if (mask & (1 << unit)) {
+			if (stepper[unit].dir) {
+				gpio_ll_pin_set(stepper[unit].dir_pin);
+			} else {
+				gpio_ll_pin_clr(stepper[unit].dir_pin);
+			}
+		}
+	}
+
 	portDISABLE_INTERRUPTS();
     start |= mask;
     portENABLE_INTERRUPTS();
@@ -368,9 +570,30 @@ void stepper_start(int mask) {
     // Loc is released in the ISR when movement is done
 	mtx_lock(&stepper_mutex);
 
+	// Movement is done, so units must be programmed again
+	for(unit = 0; unit < NSTEP; unit++) {
+		if (mask & (1 << unit)) {
+			stepper_release(unit);
+		}
+	}
+
 	mtx_unlock(&stepper_mutex);
 }
 
+void stepper_stats(stepper_stats_t *pstats, int reset) {
+	portDISABLE_INTERRUPTS();
+
+	memcpy(pstats, &stats, sizeof(stepper_stats_t));
+
+	if (reset) {
+		memset(&stats,0,sizeof(stats));
+		stats.latency_min = 0xffffffff;
+	stats.step_min = 0xffffffff;
+	}
+
+    portENABLE_INTERRUPTS();
+}
+
 DRIVER_REGISTER(STEPPER,stepper,NULL,stepper_init,NULL);
 
 #endif
@@ -59,6 +59,18 @@
  The error is compensated in the interrupt handler. In the previous example every 6 ticks the
  interrupt handler increments 1 tick for compensate.
 
+ The motion profile (acceleration ramp, cruise, deceleration ramp) is computed when the movement
+ is programmed, as a table with the clock period of each ramp step, in ticks, in fixed point with
+ STEPPER_FRAC_BITS bits of fraction. The fraction is the lost part of the tick, so the interrupt
+ handler only does integer additions and compares.
+
+ The clock pulse is 1 tick wide: pins are set in a tick, and cleared in the next one, so the
+ maximum step rate is STEPPER_HZ / 2.
+
+ In a coordinated move, one unit (the master, that has the most steps) is driven by the profile,
+ and the other units (followers) step when the master steps, using Bresenham's algorithm, so all
+ units start and end at the same time.
+
  */
 
 #ifndef _STEPPER_H_
@@ -72,31 +84,70 @@
 // Stepper base timer frequency
 #define STEPPER_HZ 100000
 
-// Stepper clock pulse in microseconds
-#define STEPPER_CLOCK_PULSE 10
+// Stepper clock pulse in microseconds (1 tick)
+#define STEPPER_CLOCK_PULSE (1000000 / STEPPER_HZ)
 
 #define STEPPER_TIMER_ADJ 5
 
+// Stepper timer counter frequency
+#define STEPPER_TIMER_HZ (TIMER_BASE_CLK / 2)
+
+// Fraction bits of the profile's clock periods
+#define STEPPER_FRAC_BITS 8
+
+// Max number of entries of a profile, in longer ramps each entry is used by
+// many ramp steps
+#define STEPPER_PROFILE_SIZE 256
+
+// Min and max step rate
+#define STEPPER_MIN_FREQ 1
+#define STEPPER_MAX_FREQ (STEPPER_HZ / 2)
+
+// Motion profiles
+#define STEPPER_PROFILE_TRAPEZOIDAL 0
+#define STEPPER_PROFILE_SCURVE      1
+
 typedef struct {
 	uint8_t  setup;         // Is this unit setup?
     uint8_t  clock_pin;     // Clock pin number
     uint8_t  dir_pin;       // Direction pin number
+    uint8_t  dir;           // Direction. 0 = ccw, 1 = cw
 
     uint32_t steps;         // Number of steps to do
     uint32_t steps_up;      // Number of ramp-up steps to do
     uint32_t steps_down;    // Number of ramp-down steps to do
 
-    double target_freq;     // Target stepper clock frequency
-    double current_freq;    // Current stepper clock frequency
-    double freq_inc;        // Increment of current clock frequency
-
-    uint32_t     ticks;     // Number of ticks to do for each clock pulse
-    uint32_t     cticks;    // Number of ticks since last clock pulse
-    double       lticks;    // Number of lost ticks per tick
-    double       lost;      // Current lost ticks
-    uint8_t      dir;       // Direction. 0 = ccw, 1 = cw
+    uint32_t *profile;      // Clock period of the ramp steps, in ticks (fixed point)
+    uint32_t ramp;          // Number of ramp steps
+    uint32_t ramp_i;        // Current ramp step
+    uint32_t ramp_div;      // Number of ramp steps of each profile entry
+    uint32_t ramp_rem;      // Ramp steps done in the current profile entry
+    uint32_t profile_i;     // Current profile entry (ramp_i / ramp_div)
+
+    uint32_t ticks;         // Number of ticks to do for current clock pulse
+    uint32_t cticks;        // Number of ticks since last clock pulse
+    uint32_t lost;          // Current lost ticks (fixed point)
+
+    int8_t   master;        // Unit that drives this unit, -1 if none
+    uint32_t followers;     // Mask of units driven by this unit
+    uint32_t dda_inc;       // Bresenham increment (steps to do in the move)
+    uint32_t dda_steps;     // Bresenham threshold (master steps to do in the move)
+    uint32_t dda_err;       // Bresenham error
+
+    uint8_t  stepped;       // Has the unit done a step in the current move?
+    uint32_t step_ccount;   // CPU cycle count of the last step
 } stepper_t;
 
+// Interrupt handler measures
+typedef struct {
+	uint32_t isr;           // Number of interrupts
+	uint32_t isr_max;       // Max time in interrupt, in CPU cycles
+	uint64_t isr_total;     // Total time in interrupt, in CPU cycles
+	uint32_t latency_min;   // Min interrupt latency, in timer counts
+	uint32_t latency_max;   // Max interrupt latency, in timer counts
+	uint32_t step_min;      // Min time between two steps of a unit, in CPU cycles
+} stepper_stats_t;
+
 // Stepper errors
 #define STEPPER_ERR_NOT_ENOUGH_MEMORY        (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  0)
 #define STEPPER_ERR_INVALID_UNIT             (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  1)
@@ -104,9 +155,13 @@ typedef struct {
 #define STEPPER_ERR_UNIT_NOT_SETUP           (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  3)
 #define STEPPER_ERR_INVALID_PIN              (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  4)
 #define STEPPER_ERR_INVALID_DIRECTION        (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  5)
+#define STEPPER_ERR_INVALID_PROFILE          (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  6)
+#define STEPPER_ERR_INVALID_MASTER           (DRIVER_EXCEPTION_BASE(STEPPER_DRIVER_ID) |  7)
 
 driver_error_t *stepper_setup(uint8_t step_pin, uint8_t dir_pin, uint8_t *unit);
-driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t ramp, double ifreq, double efreq);
+driver_error_t *stepper_move(uint8_t unit, uint8_t dir, uint32_t steps, uint32_t ramp, double ifreq, double efreq, uint8_t profile);
+driver_error_t *stepper_follow(uint8_t unit, uint8_t master, uint8_t dir, uint32_t steps);
 void stepper_start(int mask);
+void stepper_stats(stepper_stats_t *stats, int reset);
 
 #endif /* _STEPPER_H_ */
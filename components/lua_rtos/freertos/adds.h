@@ -11,6 +11,7 @@ typedef struct {
 	int32_t    threadid;
  	uint32_t   signaled;	
   	lua_State *L;
+	struct pthread_key_specific *specific;
 } lua_rtos_tcb_t;
 
 // This macro is not present in all FreeRTOS ports. In Lua RTOS is used in some places
@@ -40,6 +40,8 @@
  *
  * lwip fd 0 it's (vfs_id | lwip fd) in newlib
  *
+ * The translation is done by vfs/net.c, without opening a file.
+ *
  */
 
 #include "luartos.h"
@@ -51,16 +53,15 @@
 #include <errno.h>
 
 #if USE_NET_VFS
-#if 0
-int _curl_socket = 0;
-#endif
-#define fd_to_socket(fd) (fd & ((1 << CONFIG_MAX_FD_BITS) - 1))
+#include "vfs/vfs.h"
+
+#define fd_to_socket(fd) vfs_net_socket(fd)
+#define socket_to_fd(s) vfs_net_fd(s)
 #else
 #define fd_to_socket(fd) fd
+#define socket_to_fd(s) s
 #endif
 
-#define socket_to_fd(vfs, fd) (vfs | fd)
-
 extern int __real_lwip_accept_r(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern int __real_lwip_bind_r(int s, const struct sockaddr *name, socklen_t namelen);
 extern int __real_lwip_shutdown_r(int s, int how);
@@ -85,23 +86,7 @@ extern int __real_lwip_fcntl_r(int s, int cmd, int val);
 extern int __real_lwip_close_r(int s);
 
 int __wrap_lwip_accept_r(int fd, struct sockaddr *addr, socklen_t *addrlen) {
-	int s = __real_lwip_accept_r(fd_to_socket(fd), addr, addrlen);
-
-#if USE_NET_VFS
-	if (s != -1) {
-		char device[15];
-
-		snprintf(device, sizeof(device), "/dev/socket/%d", s);
-		FILE *stream = fopen(device,"a+");
-		if (stream) {
-			return stream->_file;
-		} else {
-			return -1;
-		}
-	}
-#endif
-
-	return s;
+	return socket_to_fd(__real_lwip_accept_r(fd_to_socket(fd), addr, addrlen));
 }
 
 int __wrap_lwip_bind_r(int fd, const struct sockaddr *name, socklen_t namelen) {
@@ -169,67 +154,67 @@ int __wrap_lwip_writev_r(int fd, const struct iovec *iov, int iovcnt) {
 
 int __wrap_lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout) {
 #if USE_NET_VFS
-	int vfs = maxfdp1 & (((1 << (16 - CONFIG_MAX_FD_BITS - 1)) - 1) << CONFIG_MAX_FD_BITS);
-	int maxfdp = ((1 << CONFIG_MAX_FD_BITS) - 1);
-	int i, s;
-
-    // Convert input fd sets to internal lwip sets
-    for(i=0;i<maxfdp1;i++) {
-    	if (readset) {
-    		if (FD_ISSET(i, readset)) {
-    			FD_SET(fd_to_socket(i), readset);
-    		} else {
-    			FD_CLR(fd_to_socket(i), readset);
-    		}
-    	}
-
-    	if (writeset) {
-    		if (FD_ISSET(i, writeset)) {
-    			FD_SET(fd_to_socket(i), writeset);
-    		} else {
-    			FD_CLR(fd_to_socket(i), writeset);
-    		}
-    	}
-
-    	if (exceptset) {
-    		if (FD_ISSET(i, exceptset)) {
-    			FD_SET(fd_to_socket(i), exceptset);
-    		} else {
-    			FD_CLR(fd_to_socket(i), exceptset);
-    		}
-    	}
-    }
-
-    s = __real_lwip_select(maxfdp, readset, writeset, exceptset, timeout);
+	fd_set *sets[3] = {readset, writeset, exceptset};
+	fd_set lwip_sets[3];
+	int maxs = 0;
+	int fd, s, i;
+	int res;
+
+	// The caller's sets can't hold a file descriptor above FD_SETSIZE
+	if ((maxfdp1 < 0) || (maxfdp1 > FD_SETSIZE)) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	// We need to convert lwip sets to newlib sets
-	for(i=0;i<maxfdp;i++) {
-		if (readset) {
-			if (FD_ISSET(i, readset)) {
-				FD_SET(socket_to_fd(vfs, i), readset);
-			} else {
-				FD_CLR(socket_to_fd(vfs, i), readset);
-			}
+	// Convert input fd sets to internal lwip sets. Only sockets can be
+	// waited for here.
+	for(i = 0; i < 3; i++) {
+		if (sets[i]) {
+			FD_ZERO(&lwip_sets[i]);
 		}
+	}
 
-		if (writeset) {
-			if (FD_ISSET(i, writeset)) {
-				FD_SET(vfs | socket_to_fd(vfs,i), writeset);
-			} else {
-				FD_CLR(socket_to_fd(vfs, i), writeset);
+	for(fd = 0; fd < maxfdp1; fd++) {
+		for(i = 0; i < 3; i++) {
+			if (sets[i] && FD_ISSET(fd, sets[i])) {
+				if ((s = fd_to_socket(fd)) < 0) {
+					errno = EBADF;
+					return -1;
+				}
+
+				FD_SET(s, &lwip_sets[i]);
+				if (s >= maxs) {
+					maxs = s + 1;
+				}
 			}
 		}
+	}
+
+	res = __real_lwip_select(maxs,
+		readset ? &lwip_sets[0] : NULL,
+		writeset ? &lwip_sets[1] : NULL,
+		exceptset ? &lwip_sets[2] : NULL,
+		timeout
+	);
+
+	if (res < 0) {
+		return res;
+	}
 
-		if (exceptset) {
-			if (FD_ISSET(i, exceptset)) {
-				FD_SET(socket_to_fd(vfs, i), exceptset);
-			} else {
-				FD_CLR(socket_to_fd(vfs, i), exceptset);
+	// We need to convert lwip sets to newlib sets
+	for(i = 0; i < 3; i++) {
+		if (sets[i]) {
+			FD_ZERO(sets[i]);
+
+			for(s = 0; s < maxs; s++) {
+				if (FD_ISSET(s, &lwip_sets[i])) {
+					FD_SET(socket_to_fd(s), sets[i]);
+				}
 			}
 		}
 	}
 
-    return s;
+	return res;
 #else
     return __real_lwip_select(maxfdp1, readset, writeset, exceptset, timeout);
 #endif
@@ -244,27 +229,7 @@ int __wrap_lwip_fcntl_r(int fd, int cmd, int val) {
 }
 
 int __wrap_lwip_socket(int domain, int type, int protocol) {
-	int s = __real_lwip_socket(domain, type, protocol);
-
-#if USE_NET_VFS
-#if 0
-	if ((s != -1) && (!_curl_socket)) {
-#else
-	if (s != -1) {
-#endif
-		char device[15];
-
-		snprintf(device, sizeof(device), "/dev/socket/%d", s);
-		FILE *stream = fopen(device,"a+");
-		if (stream) {
-			return stream->_file;
-		} else {
-			return -1;
-		}
-	}
-#endif
-
-	return s;
+	return socket_to_fd(__real_lwip_socket(domain, type, protocol));
 }
 
 int __wrap_lwip_close_r(int fd) {
@@ -27,177 +27,200 @@
  * this software.
  */
 
+/*
+ * A condition keeps a FIFO queue of the waiting threads. Each waiting thread
+ * is queued before unlocking the mutex, so a signal can't be lost, and waits
+ * for its own task notification. Signal wakes up the first waiting thread,
+ * and broadcast all of them.
+ */
+
 #include <errno.h>
-#include <sys/mutex.h>
 #include <pthread/pthread.h>
 
-extern struct mtx cond_mtx;
+// Protects the queues of all the conditions
+static portMUX_TYPE cond_lock = portMUX_INITIALIZER_UNLOCKED;
 
-#if MTX_USE_EVENTS
-extern eventg_t eventg[MTX_EVENT_GROUPS];
-#endif
+// Remove waiter from the queue of cond, if it's still in the queue
+static void _cond_remove(pthread_cond_t *cond, struct pthread_cond_waiter *waiter) {
+	struct pthread_cond_waiter *prev = NULL;
+	struct pthread_cond_waiter *cur = cond->head;
 
-int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
-	// Atrr values in this implementation are not allowed
-	if (attr) {
-		return EINVAL;
+	while (cur && (cur != waiter)) {
+		prev = cur;
+		cur = cur->next;
 	}
 
-	mtx_lock(&cond_mtx);
+	if (!cur) {
+		return;
+	}
 
-	if (cond->referenced > 0) {
-		mtx_unlock(&cond_mtx);
-		return EBUSY;
+	if (prev) {
+		prev->next = cur->next;
+	} else {
+		cond->head = cur->next;
 	}
 
-	#if !MTX_USE_EVENTS
-    if (!cond->mutex.sem) {
-        mtx_init(&cond->mutex, NULL, NULL, 0);
-        if (!cond->mutex.sem) {
-        	mtx_unlock(&cond_mtx);
-        	return ENOMEM;
-        }
-    } else {
-    	mtx_unlock(&cond_mtx);
-    	return EBUSY;
-    }
-	#else
-    if (cond->mutex.mtxid < 0) {
-        mtx_init(&cond->mutex, NULL, NULL, 0);
-        if (cond->mutex.mtxid < 0) {
-        	mtx_unlock(&cond_mtx);
-        	return ENOMEM;
-        }
-    } else {
-    	mtx_unlock(&cond_mtx);
-    	return EBUSY;
-    }
-	#endif
-    
-    cond->referenced = 0;
-
-    mtx_unlock(&cond_mtx);
+	if (cond->tail == cur) {
+		cond->tail = prev;
+	}
+}
 
-	return 0;
+// Wake up a waiter, that was removed from the queue. Must be called with
+// cond_lock taken, so the waiter can't return before it's notified.
+static void _cond_wake(struct pthread_cond_waiter *waiter) {
+	waiter->signaled = 1;
+	xTaskNotify(waiter->task, PTHREAD_COND_NOTIFY, eSetBits);
 }
 
-int pthread_cond_destroy(pthread_cond_t *cond) {
-	mtx_lock(&cond_mtx);
+// Ticks until abstime, 0 if abstime has been reached. Must be called
+// without cond_lock taken, as it gets the time.
+static TickType_t _cond_ticks(const struct timespec *abstime) {
+	struct timeval now;
+	int64_t usecs;
+
+	gettimeofday(&now, NULL);
 
-	if (cond->referenced > 0) {
-		mtx_unlock(&cond_mtx);
-		return EBUSY;
+	usecs = ((int64_t)abstime->tv_sec - now.tv_sec) * 1000000 + (abstime->tv_nsec / 1000 - now.tv_usec);
+	if (usecs <= 0) {
+		return 0;
 	}
 
-	#if !MTX_USE_EVENTS
-    if (cond->mutex.sem) {
-        mtx_destroy(&cond->mutex);
-    } else {
-    	mtx_unlock(&cond_mtx);
-    	return EINVAL;
-    }
-	#else
-    if (cond->mutex.mtxid >= 0) {
-        mtx_destroy(&cond->mutex);
-    } else {
-    	mtx_unlock(&cond_mtx);
-    	return EINVAL;
-    }
-	#endif
-
-    mtx_unlock(&cond_mtx);
-	
-	return 0; 
+	return (TickType_t)((usecs + (portTICK_PERIOD_MS * 1000) - 1) / (portTICK_PERIOD_MS * 1000));
 }
 
-int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
-	#if !MTX_USE_EVENTS
-	if (!cond->mutex.sem) {
-		return EINVAL;
+static int _cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime) {
+	struct pthread_cond_waiter waiter;
+	TickType_t ticks = portMAX_DELAY;
+	int res = 0;
+	int signaled;
+
+	waiter.next = NULL;
+	waiter.task = xTaskGetCurrentTaskHandle();
+	waiter.signaled = 0;
+
+	// Queue
+	portENTER_CRITICAL(&cond_lock);
+	if (cond->tail) {
+		cond->tail->next = &waiter;
+	} else {
+		cond->head = &waiter;
+	}
+	cond->tail = &waiter;
+	portEXIT_CRITICAL(&cond_lock);
+
+	res = pthread_mutex_unlock(mutex);
+	if (res) {
+		portENTER_CRITICAL(&cond_lock);
+		_cond_remove(cond, &waiter);
+		portEXIT_CRITICAL(&cond_lock);
+
+		return res;
+	}
+
+	// Wait to be signaled. Notifications sent to the thread for other
+	// purposes, or left by a previous wait, only cause another check.
+	for(;;) {
+		if (abstime) {
+			ticks = _cond_ticks(abstime);
+		}
+
+		portENTER_CRITICAL(&cond_lock);
+		signaled = waiter.signaled;
+		if (!signaled && !ticks) {
+			_cond_remove(cond, &waiter);
+		}
+		portEXIT_CRITICAL(&cond_lock);
+
+		if (signaled) {
+			break;
+		}
+
+		if (!ticks) {
+			res = ETIMEDOUT;
+			break;
+		}
+
+		xTaskNotifyWait(0, PTHREAD_COND_NOTIFY, NULL, ticks);
 	}
-	#else
-	if (cond->mutex.mtxid < 0) {
+
+	pthread_mutex_lock(mutex);
+
+	return res;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+	// Atrr values in this implementation are not allowed
+	if (attr) {
 		return EINVAL;
 	}
-	#endif
 
-	// At this point cond is protected by mutex, so is not necessary to use
-	// cond_mtx
-	cond->referenced++;
+	cond->head = NULL;
+	cond->tail = NULL;
 
-    // Wait for condition
-    mtx_lock(&cond->mutex);
+	return 0;
+}
 
-    // If current thread is the first that calls to pthread_cond_wait, lock
-    // again for block thread
-    if (cond->referenced == 1) {
-        mtx_lock(&cond->mutex);
+int pthread_cond_destroy(pthread_cond_t *cond) {
+	int res = 0;
 
-    }
+	portENTER_CRITICAL(&cond_lock);
+	if (cond->head) {
+		res = EBUSY;
+	}
+	portEXIT_CRITICAL(&cond_lock);
 
-    pthread_mutex_unlock(mutex);
+	return res;
+}
 
-    return 0;
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+	return _cond_wait(cond, mutex, NULL);
 }
   
 int pthread_cond_timedwait(pthread_cond_t *cond, 
     pthread_mutex_t *mutex, const struct timespec *abstime) { 
-    
-	#if !MTX_USE_EVENTS
-	if (!cond->mutex.sem) {
-		return EINVAL;
-	}
-	#else
-	if (cond->mutex.mtxid < 0) {
+
+	if (!abstime || (abstime->tv_nsec < 0) || (abstime->tv_nsec >= 1000000000)) {
 		return EINVAL;
 	}
-	#endif
-
-	// At this point cond is protected by mutex, so is not necessary to use
-	// cond_mtx
-	cond->referenced++;
-
-    // If current thread is the first that calls to pthread_cond_wait, lock
-    // again for block thread
-    if (cond->referenced == 1) {
-        mtx_lock(&cond->mutex);
-    }
-
-    // Wait for condition
-	#if !MTX_USE_EVENTS
-    if (xSemaphoreTake(cond->mutex.sem, (1000 * abstime->tv_sec) / portTICK_PERIOD_MS ) != pdTRUE) {
-        return ETIMEDOUT;
-    }
-	#else
-  	EventBits_t uxBits = xEventGroupWaitBits(MTX_EVENTG(cond->mutex.mtxid).eg, MTX_EVENTG_BIT(cond->mutex.mtxid), pdTRUE, pdTRUE, (1000 * abstime->tv_sec) / portTICK_PERIOD_MS );
-  	if (!(uxBits & MTX_EVENTG_BIT(cond->mutex.mtxid))) {
-        return ETIMEDOUT;
-  	}
-	#endif
-    
-    pthread_mutex_unlock(mutex);
-    
-    return 0;
+
+	return _cond_wait(cond, mutex, abstime);
 }
 
 int pthread_cond_signal(pthread_cond_t *cond) {
-	#if !MTX_USE_EVENTS
-	if (!cond->mutex.sem) {
-		return EINVAL;
-	}
-	#else
-	if (cond->mutex.mtxid < 0) {
-		return EINVAL;
+	struct pthread_cond_waiter *waiter;
+
+	portENTER_CRITICAL(&cond_lock);
+
+	waiter = cond->head;
+	if (waiter) {
+		cond->head = waiter->next;
+		if (!cond->head) {
+			cond->tail = NULL;
+		}
+
+		_cond_wake(waiter);
 	}
-	#endif
 
-	// At this point cond is protected by mutex, prior to calling pthread_cond_wait or
-	// pthread_cond_timedwait. pthread_cond_init / pthread_cond_destroy fails due to
-	// cond->referenced > 0, so is not necessary to use cond_mtx
-	cond->referenced--;
+	portEXIT_CRITICAL(&cond_lock);
+
+	return 0;
+}
 
-	// Release cond
-	mtx_unlock(&cond->mutex);
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+	struct pthread_cond_waiter *waiter;
 
-    return 0;
+	portENTER_CRITICAL(&cond_lock);
+
+	waiter = cond->head;
+	cond->head = NULL;
+	cond->tail = NULL;
+
+	while (waiter) {
+		_cond_wake(waiter);
+		waiter = waiter->next;
+	}
+
+	portEXIT_CRITICAL(&cond_lock);
+
+	return 0;
 }
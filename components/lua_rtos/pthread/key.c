@@ -27,105 +27,192 @@
  * this software.
  */
 
+/*
+ * Keys are slots in a fixed table, and the values of a thread are in an array
+ * indexed by slot, that is referenced from the Lua RTOS specific TCB parts of
+ * the thread. So, getting and setting a value don't need any lookup, lock or
+ * allocation (the array is only allocated the first time that the thread sets
+ * a value).
+ *
+ * Each slot has a generation, that is incremented when a key is created in
+ * the slot, and each value keeps the generation of the key that set it. When
+ * a key is deleted its values aren't freed, but they are ignored because
+ * their generation doesn't match the generation of the slot anymore.
+ */
+
+#include "esp_attr.h"
+
 #include <errno.h>
 #include <stdlib.h>
 #include <pthread/pthread.h>
+#include "freertos/adds.h"
+
+static struct pthread_key keys[PTHREAD_KEYS_MAX];
+static portMUX_TYPE key_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Get the Lua RTOS specific TCB parts of the current thread
+static inline lua_rtos_tcb_t *_key_tcb() {
+    return (lua_rtos_tcb_t *)pvTaskGetThreadLocalStoragePointer(NULL, THREAD_LOCAL_STORAGE_POINTER_ID);
+}
+
+// Test if k is a key in use
+static inline int _key_valid(pthread_key_t k) {
+    int slot = PTHREAD_KEY_SLOT(k);
 
-extern struct list key_list;
+    return (k > 0) && (slot < PTHREAD_KEYS_MAX) && keys[slot].used && (keys[slot].generation == PTHREAD_KEY_GEN(k));
+}
 
 int pthread_key_create(pthread_key_t *k, void (*destructor)(void*)) {
-    struct pthread_key *key;
-    int res;
-    
-    // Allocate space for the key
-    key = (struct pthread_key *)malloc(sizeof(struct pthread_key));
-    if (!key) {
-        errno = ENOMEM;
-        return ENOMEM;
+    int slot;
+
+    portENTER_CRITICAL(&key_lock);
+
+    // Get a free slot
+    for(slot = 0; slot < PTHREAD_KEYS_MAX; slot++) {
+        if (!keys[slot].used) {
+            break;
+        }
+    }
+
+    if (slot == PTHREAD_KEYS_MAX) {
+        portEXIT_CRITICAL(&key_lock);
+
+        errno = EAGAIN;
+        return EAGAIN;
     }
-    
-    // Init key
-    key->destructor = destructor;
-    
-    list_init(&key->specific,1);
-    
-    // Add key to key list
-    res = list_add(&key_list, key, k);
-    if (res) {
-        free(key);
-        errno = res;
-        return res;
+
+    // Next generation, that is never 0
+    keys[slot].generation = (keys[slot].generation + 1) & PTHREAD_KEY_GEN_MASK;
+    if (!keys[slot].generation) {
+        keys[slot].generation = 1;
     }
-    
+
+    keys[slot].destructor = destructor;
+    keys[slot].used = 1;
+
+    *k = (pthread_key_t)((keys[slot].generation << PTHREAD_KEY_SLOT_BITS) | slot);
+
+    portEXIT_CRITICAL(&key_lock);
+
     return 0;
 }
 
-int pthread_setspecific(pthread_key_t k, const void *value) {
+int IRAM_ATTR pthread_setspecific(pthread_key_t k, const void *value) {
     struct pthread_key_specific *specific;
-    struct pthread_key *key;    
-    int res;
-    
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
-        return res;
+    lua_rtos_tcb_t *tcb;
+
+    if (!_key_valid(k)) {
+        errno = EINVAL;
+        return EINVAL;
+    }
+
+    tcb = _key_tcb();
+    if (!tcb) {
+        errno = EINVAL;
+        return EINVAL;
     }
 
-    // Allocate space for specific
-    specific = (struct pthread_key_specific *)malloc(sizeof(struct pthread_key_specific));
-    if (!specific) {
-        errno = ENOMEM;
-        return ENOMEM;
+    if (!tcb->specific) {
+        tcb->specific = (struct pthread_key_specific *)calloc(PTHREAD_KEYS_MAX, sizeof(struct pthread_key_specific));
+        if (!tcb->specific) {
+            errno = ENOMEM;
+            return ENOMEM;
+        }
     }
-    
-    specific->thread = pthread_self();
+
+    specific = &tcb->specific[PTHREAD_KEY_SLOT(k)];
+
     specific->value = value;
-    
+    specific->generation = PTHREAD_KEY_GEN(k);
+
     return 0;
 }
 
-void *pthread_getspecific(pthread_key_t k) {
+void * IRAM_ATTR pthread_getspecific(pthread_key_t k) {
     struct pthread_key_specific *specific;
-    struct pthread_key *key;
-    pthread_t thread;
-    int res;
-    int index;
-    
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
+    lua_rtos_tcb_t *tcb;
+
+    if (!_key_valid(k)) {
         return NULL;
     }
-    
-    // Get specific value
-    thread = pthread_self();
-
-    index = list_first(&key->specific);
-    while (index >= 0) {
-        list_get(&key->specific, index, (void **)&specific);
-                
-        if (specific->thread == thread) {
-            return (void *)specific->value;
-        }
-        
-        index = list_next(&key->specific, index);
+
+    tcb = _key_tcb();
+    if (!tcb || !tcb->specific) {
+        return NULL;
+    }
+
+    specific = &tcb->specific[PTHREAD_KEY_SLOT(k)];
+    if (specific->generation != PTHREAD_KEY_GEN(k)) {
+        return NULL;
     }
-    
-    return NULL;
+
+    return (void *)specific->value;
 }
 
 int pthread_key_delete(pthread_key_t k) {
-    struct pthread_key *key;
-    int res;
-
-    // Get key
-    res = list_get(&key_list, k, (void **)&key);
-    if (res) {
-        errno = res;
-        return res;
+    portENTER_CRITICAL(&key_lock);
+
+    if (!_key_valid(k)) {
+        portEXIT_CRITICAL(&key_lock);
+
+        errno = EINVAL;
+        return EINVAL;
     }
-    
-    list_remove(&key_list, k, 1);
+
+    keys[PTHREAD_KEY_SLOT(k)].used = 0;
+    keys[PTHREAD_KEY_SLOT(k)].destructor = NULL;
+
+    portEXIT_CRITICAL(&key_lock);
 
     return 0;
 }
+
+// Call the destructors of the values of the current thread, and free them.
+// Called when the thread ends.
+void _pthread_key_free() {
+    struct pthread_key_specific *specific;
+    void (*destructor)(void*);
+    lua_rtos_tcb_t *tcb;
+    const void *value;
+    int iteration, slot, called;
+
+    tcb = _key_tcb();
+    if (!tcb || !tcb->specific) {
+        return;
+    }
+
+    // A destructor can set values again
+    for(iteration = 0; iteration < PTHREAD_DESTRUCTOR_ITERATIONS; iteration++) {
+        called = 0;
+
+        for(slot = 0; slot < PTHREAD_KEYS_MAX; slot++) {
+            specific = &tcb->specific[slot];
+            if (!specific->value) {
+                continue;
+            }
+
+            portENTER_CRITICAL(&key_lock);
+            if (keys[slot].used && (keys[slot].generation == specific->generation)) {
+                destructor = keys[slot].destructor;
+            } else {
+                destructor = NULL;
+            }
+            portEXIT_CRITICAL(&key_lock);
+
+            value = specific->value;
+            specific->value = NULL;
+
+            if (destructor) {
+                destructor((void *)value);
+                called = 1;
+            }
+        }
+
+        if (!called) {
+            break;
+        }
+    }
+
+    free(tcb->specific);
+    tcb->specific = NULL;
+}
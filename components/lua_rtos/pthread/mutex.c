@@ -27,6 +27,30 @@
  * this software.
  */
 
+/*
+ * A mutex is locked by setting its owner word, with an atomic compare and
+ * swap, so an uncontended lock / unlock doesn't need any semaphore.
+ *
+ * When the mutex is locked, the thread tries again up to PTHREAD_MTX_SPIN
+ * times, and then waits in the wait queue of the mutex, that is created the
+ * first time that it is needed:
+ *
+ *  - The first waiting thread holds the queue semaphore, and the other ones
+ *    wait for it, with priority inheritance. The first waiting thread sets
+ *    PTHREAD_MUTEX_WAITERS in the owner word, raises the priority of the
+ *    owner if it's lower than its own one, and waits for the wake semaphore.
+ *
+ *  - On unlock, if PTHREAD_MUTEX_WAITERS is set, the owner word is set to the
+ *    first waiting thread, that is waken up, and the owner goes back to its
+ *    priority. The new owner keeps the queue semaphore until it unlocks the
+ *    mutex, so the next waiting threads inherit its priority.
+ *
+ * The priority is raised and restored with the FreeRTOS primitives used by
+ * its own mutexes, that only change the current priority of the owner, and
+ * not its base one. So the owner goes back to its base priority, once it
+ * doesn't hold any FreeRTOS mutex, as FreeRTOS does.
+ */
+
 #include "esp_attr.h"
 
 #include <errno.h>
@@ -46,59 +70,190 @@ static int _check_attr(const pthread_mutexattr_t *attr) {
    return 0;
 }
 
-int pthread_mutex_init(pthread_mutex_t *mut, const pthread_mutexattr_t *attr) {
+static inline int _cas(volatile uintptr_t *word, uintptr_t expected, uintptr_t desired) {
+    return __atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static int _mutex_create(pthread_mutex_t *mut, int type) {
     struct pthread_mutex *mutex;
     int res;
 
-    if (!attr) {
-        errno = EINVAL;
-        return EINVAL;
+    // Create mutex structure
+    mutex = (struct pthread_mutex *)calloc(1, sizeof(struct pthread_mutex));
+    if (!mutex) {
+        return ENOMEM;
     }
-    
-    // Check attr
-    res = _check_attr(attr);
+
+    mutex->type = type;
+
+    // Add mutex to the list
+    res = list_add(&mutex_list, mutex, &mutex->index);
     if (res) {
-        errno = res;
+        free(mutex);
         return res;
     }
 
-    // Test if it's init yet
-    res = list_get(&mutex_list, *mut, (void **)&mutex);
-    if (!res) {
-        errno = EBUSY;
-        return EBUSY;
+    // A mutex initialized with PTHREAD_MUTEX_INITIALIZER is created on its
+    // first use, maybe by more than one thread at the same time
+    if (!__atomic_compare_exchange_n(mut, &(pthread_mutex_t){PTHREAD_MUTEX_INITIALIZER}, mutex, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        list_remove(&mutex_list, mutex->index, 1);
     }
 
-    // Create mutex structure
-    mutex = (struct pthread_mutex *)malloc(sizeof(struct pthread_mutex));
-    if (!mutex) {
-        errno = EINVAL;
-        return EINVAL;
+    return 0;
+}
+
+static struct pthread_mutex_wait *_mutex_wait(struct pthread_mutex *mutex) {
+    struct pthread_mutex_wait *wait;
+
+    if (mutex->wait) {
+        return mutex->wait;
     }
 
-    mutex->type = attr->type;
+    wait = (struct pthread_mutex_wait *)calloc(1, sizeof(struct pthread_mutex_wait));
+    if (!wait) {
+        return NULL;
+    }
 
-    // Create semaphore
-    if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-        mutex->sem = xSemaphoreCreateRecursiveMutex();    
-    } else {
-        mutex->sem = xSemaphoreCreateMutex();
+    wait->queue = xSemaphoreCreateMutex();
+    wait->wake = xSemaphoreCreateBinary();
+    if (!wait->queue || !wait->wake) {
+        goto fail;
     }
-    if(!mutex->sem){
-        *mut = 0;
-        free(mutex->sem);
-        errno = ENOMEM;
+
+    vPortCPUInitializeMutex(&wait->lock);
+
+    // Other thread can create it at the same time
+    if (!__atomic_compare_exchange_n(&mutex->wait, &(struct pthread_mutex_wait *){NULL}, wait, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        goto fail;
+    }
+
+    return wait;
+
+fail:
+    if (wait->queue) vSemaphoreDelete(wait->queue);
+    if (wait->wake) vSemaphoreDelete(wait->wake);
+    free(wait);
+
+    return mutex->wait;
+}
+
+static int _mutex_lock_wait(struct pthread_mutex *mutex, uintptr_t self) {
+    struct pthread_mutex_wait *wait;
+    uintptr_t owner;
+
+    wait = _mutex_wait(mutex);
+    if (!wait) {
         return ENOMEM;
     }
-    
-    mutex->owner = pthread_self();
-    
-    // Add mutext to the list
-    res = list_add(&mutex_list, mutex, (int *)mut);
+
+    // Wait to be the first waiting thread
+    if (xSemaphoreTake(wait->queue, PTHREAD_MTX_LOCK_TIMEOUT) != pdPASS) {
+        PTHREAD_MTX_DEBUG_LOCK();
+        return EINVAL;
+    }
+
+    wait->head = (TaskHandle_t)self;
+
+    for(;;) {
+        portENTER_CRITICAL(&wait->lock);
+
+        owner = mutex->owner;
+        if (owner == self) {
+            // Handed over by the owner
+            portEXIT_CRITICAL(&wait->lock);
+            break;
+        }
+
+        if (owner == 0) {
+            if (_cas(&mutex->owner, 0, self)) {
+                portEXIT_CRITICAL(&wait->lock);
+                break;
+            }
+
+            portEXIT_CRITICAL(&wait->lock);
+            continue;
+        }
+
+        if (!(owner & PTHREAD_MUTEX_WAITERS) && !_cas(&mutex->owner, owner, owner | PTHREAD_MUTEX_WAITERS)) {
+            portEXIT_CRITICAL(&wait->lock);
+            continue;
+        }
+
+        // From here the owner can't unlock without taking the lock, so it is
+        // alive while its priority is raised
+        if (uxTaskPriorityGet((TaskHandle_t)owner) < uxTaskPriorityGet(NULL)) {
+            vTaskPriorityInherit((TaskHandle_t)owner);
+            wait->inherited = 1;
+        }
+
+        portEXIT_CRITICAL(&wait->lock);
+
+        xSemaphoreTake(wait->wake, portMAX_DELAY);
+    }
+
+    wait->held = 1;
+
+    return 0;
+}
+
+static void IRAM_ATTR _mutex_release(struct pthread_mutex *mutex, uintptr_t self) {
+    struct pthread_mutex_wait *wait = mutex->wait;
+    int inherited;
+    int held = 0;
+
+    mutex->count = 0;
+
+    if (wait && wait->held) {
+        wait->held = 0;
+        held = 1;
+    }
+
+    if (!__atomic_compare_exchange_n(&mutex->owner, &self, 0, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        // There is a waiting thread, hand over the mutex. The wait queue can
+        // have been created after the first read, by this waiting thread.
+        wait = mutex->wait;
+
+        portENTER_CRITICAL(&wait->lock);
+
+        inherited = wait->inherited;
+        wait->inherited = 0;
+
+        __atomic_store_n(&mutex->owner, (uintptr_t)wait->head, __ATOMIC_RELEASE);
+
+        portEXIT_CRITICAL(&wait->lock);
+
+        xSemaphoreGive(wait->wake);
+
+        if (inherited) {
+            // Disinherit as a FreeRTOS mutex, that is counted as held first
+            pvTaskIncrementMutexHeldCount();
+            if (xTaskPriorityDisinherit(xTaskGetCurrentTaskHandle())) {
+                taskYIELD();
+            }
+        }
+    }
+
+    if (held) {
+        xSemaphoreGive(wait->queue);
+    }
+}
+
+int pthread_mutex_init(pthread_mutex_t *mut, const pthread_mutexattr_t *attr) {
+    int res;
+
+    // Check attr
+    if (attr) {
+        res = _check_attr(attr);
+        if (res) {
+            errno = res;
+            return res;
+        }
+    }
+
+    *mut = PTHREAD_MUTEX_INITIALIZER;
+
+    res = _mutex_create(mut, attr?attr->type:PTHREAD_MUTEX_NORMAL);
     if (res) {
-        free(mutex->sem);
-        vSemaphoreDelete(mutex->sem);
-        
         errno = res;
         return res;
     }
@@ -107,100 +262,134 @@ int pthread_mutex_init(pthread_mutex_t *mut, const pthread_mutexattr_t *attr) {
 }
 
 int IRAM_ATTR pthread_mutex_lock(pthread_mutex_t *mut) {
+    uintptr_t self = (uintptr_t)xTaskGetCurrentTaskHandle();
     struct pthread_mutex *mutex;
-    int res;
+    int res, spin;
 
-    // Get mutex
-    res = list_get(&mutex_list, *mut, (void **)&mutex);
-    if (res) {
-        errno = res;
-        return res;
+    // Create mutex, if it was initialized with PTHREAD_MUTEX_INITIALIZER
+    if (!*mut) {
+        res = _mutex_create(mut, PTHREAD_MUTEX_DEFAULT);
+        if (res) {
+            errno = res;
+            return res;
+        }
     }
-    
+
+    mutex = *mut;
+
     // Lock
-    if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-        if (xSemaphoreTakeRecursive(mutex->sem, PTHREAD_MTX_LOCK_TIMEOUT) != pdPASS) {
-            PTHREAD_MTX_DEBUG_LOCK();
-            errno = EINVAL;
-            return EINVAL;
+    if (_cas(&mutex->owner, 0, self)) {
+        mutex->count = 1;
+        return 0;
+    }
+
+    // Locked by the current thread
+    if ((mutex->owner & ~PTHREAD_MUTEX_WAITERS) == self) {
+        if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
+            mutex->count++;
+            return 0;
         }
-    } else {
-        if (xSemaphoreTake(mutex->sem, PTHREAD_MTX_LOCK_TIMEOUT) != pdPASS) {
-            PTHREAD_MTX_DEBUG_LOCK();
-            errno = EINVAL;
-            return EINVAL;
-        }        
+
+        errno = EDEADLK;
+        return EDEADLK;
     }
-    
-    return 0;
-}
 
-int IRAM_ATTR pthread_mutex_unlock(pthread_mutex_t *mut) {
-    struct pthread_mutex *mutex;
-    int res;
+    // Try again before waiting
+    for(spin = 0; spin < PTHREAD_MTX_SPIN; spin++) {
+        if ((mutex->owner == 0) && _cas(&mutex->owner, 0, self)) {
+            mutex->count = 1;
+            return 0;
+        }
+    }
 
-    // Get mutex
-    res = list_get(&mutex_list, *mut, (void **)&mutex);
+    res = _mutex_lock_wait(mutex, self);
     if (res) {
         errno = res;
         return res;
     }
-    
-    // Unlock
-    if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-        xSemaphoreGiveRecursive(mutex->sem);        
-    } else {
-        xSemaphoreGive(mutex->sem);        
+
+    mutex->count = 1;
+
+    return 0;
+}
+
+int IRAM_ATTR pthread_mutex_unlock(pthread_mutex_t *mut) {
+    uintptr_t self = (uintptr_t)xTaskGetCurrentTaskHandle();
+    struct pthread_mutex *mutex = *mut;
+
+    if (!mutex) {
+        errno = EINVAL;
+        return EINVAL;
     }
-    
+
+    // Only the owner can unlock
+    if ((mutex->owner & ~PTHREAD_MUTEX_WAITERS) != self) {
+        errno = EPERM;
+        return EPERM;
+    }
+
+    if (--mutex->count > 0) {
+        return 0;
+    }
+
+    _mutex_release(mutex, self);
+
     return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *mut) {
+    uintptr_t self = (uintptr_t)xTaskGetCurrentTaskHandle();
     struct pthread_mutex *mutex;
     int res;
-    
-    // Get mutex
-    res = list_get(&mutex_list, *mut, (void **)&mutex);
-    if (res) {
-        errno = res;
-        return res;
+
+    if (!*mut) {
+        res = _mutex_create(mut, PTHREAD_MUTEX_DEFAULT);
+        if (res) {
+            errno = res;
+            return res;
+        }
     }
-    
+
+    mutex = *mut;
+
     // Try lock
-    if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-        if (xSemaphoreTakeRecursive(mutex->sem,0 ) != pdTRUE) {
-            errno = EBUSY;
-            return EBUSY;
-        }
-    } else {
-        if (xSemaphoreTake(mutex->sem,0 ) != pdTRUE) {
-            errno = EBUSY;
-            return EBUSY;
-        }
+    if (_cas(&mutex->owner, 0, self)) {
+        mutex->count = 1;
+        return 0;
     }
-    
-    return 0;
+
+    if ((mutex->type == PTHREAD_MUTEX_RECURSIVE) && ((mutex->owner & ~PTHREAD_MUTEX_WAITERS) == self)) {
+        mutex->count++;
+        return 0;
+    }
+
+    errno = EBUSY;
+    return EBUSY;
 }
 
 int pthread_mutex_destroy(pthread_mutex_t *mut) {
-    struct pthread_mutex *mutex;
-    int res;
-    
-    // Get mutex
-    res = list_get(&mutex_list, *mut, (void **)&mutex);
-    if (res) {
-        errno = res;
-        return res;
+    struct pthread_mutex *mutex = *mut;
+
+    if (!mutex) {
+        errno = EINVAL;
+        return EINVAL;
     }
 
-    if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-        xSemaphoreGiveRecursive(mutex->sem);  
-    } else {
-        xSemaphoreGive(mutex->sem);                
+    // Waiting threads would wait forever
+    if (mutex->owner & PTHREAD_MUTEX_WAITERS) {
+        errno = EBUSY;
+        return EBUSY;
+    }
+
+    if (mutex->wait) {
+        vSemaphoreDelete(mutex->wait->queue);
+        vSemaphoreDelete(mutex->wait->wake);
+        free(mutex->wait);
     }
-    
-    vSemaphoreDelete(mutex->sem);
+
+    *mut = PTHREAD_MUTEX_INITIALIZER;
+
+    list_remove(&mutex_list, mutex->index, 1);
 
     return 0;
 }
@@ -234,19 +423,19 @@ int pthread_mutexattr_init(pthread_mutexattr_t *attr) {
     return 0;
 }
 
+// Unlock the mutexes locked by the current thread
 void _pthread_mutex_free() {
+    uintptr_t self = (uintptr_t)xTaskGetCurrentTaskHandle();
     struct pthread_mutex *mutex;
     int index;
     
     index = list_first(&mutex_list);
     while (index >= 0) {
         list_get(&mutex_list, index, (void **)&mutex);
-         
-        if (mutex->type == PTHREAD_MUTEX_RECURSIVE) {
-            while (xSemaphoreGiveRecursive(mutex->sem) == pdTRUE);  
-        } else {
-            xSemaphoreGive(mutex->sem);                
-        }            
+
+        if ((mutex->owner & ~PTHREAD_MUTEX_WAITERS) == self) {
+            _mutex_release(mutex, self);
+        }
         
         index = list_next(&mutex_list, index);
     }    
@@ -46,12 +46,10 @@
 
 #include "lauxlib.h"
 
-struct list key_list;
 struct list mutex_list;
 struct list thread_list;
 
 struct mtx once_mtx;
-struct mtx cond_mtx;
 
 struct pthreadTaskArg {
     void *(*pthread_function) (void *);
@@ -66,12 +64,10 @@ void pthreadTask(void *task_arguments);
 void _pthread_init() {
     // Create mutexes
     mtx_init(&once_mtx, NULL, NULL, 0);
-    mtx_init(&cond_mtx, NULL, NULL, 0);
     
     // Init lists
     list_init(&thread_list, 1);
     list_init(&mutex_list, 1);
-    list_init(&key_list, 1);
 }
 
 int _pthread_create(pthread_t *id, int priority, int stacksize, int cpu, int initial_state,
@@ -409,6 +405,7 @@ int _pthread_resume(pthread_t id) {
 // This is the callback function for free Lua RTOS specific TCB parts
 static void pthreadLocaleStoragePointerCallback(int index, void* data) {
 	if (index == THREAD_LOCAL_STORAGE_POINTER_ID) {
+		free(((lua_rtos_tcb_t *)data)->specific);
 		free(data);
 	}
 }
@@ -499,6 +496,9 @@ void pthreadTask(void *taskArgs) {
         
         index = list_next(&thread->clean_list, index);
     }
+
+    // Call destructors of thread-specific values
+    _pthread_key_free();
     
     // Free thread structures
     _pthread_free(args->id);
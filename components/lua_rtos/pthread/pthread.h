@@ -61,6 +61,14 @@
 #define PTHREAD_MTX_DEBUG_LOCK() 
 #endif
 
+// Number of times a thread tries to get a locked mutex before waiting for it
+#define PTHREAD_MTX_SPIN 100
+
+// Max number of keys at the same time, and max number of times that the
+// destructors of the keys are called at thread exit
+#define PTHREAD_KEYS_MAX              64
+#define PTHREAD_DESTRUCTOR_ITERATIONS 4
+
 // Minimal stack size per thread
 #define PTHREAD_STACK_MIN (1024 * 2)
 
@@ -78,14 +86,11 @@
 
 // Initializers
 #define PTHREAD_MUTEX_INITIALIZER     0
-
-#if !MTX_USE_EVENTS
 #define PTHREAD_ONCE_INIT             {NULL}
-#define PTHREAD_COND_INITIALIZER      {.mutex.sem = NULL, .referenced = 0}
-#else
-#define PTHREAD_ONCE_INIT             {NULL}
-#define PTHREAD_COND_INITIALIZER      {.mutex.mtxid = -1, .referenced = 0}
-#endif
+#define PTHREAD_COND_INITIALIZER      {.head = NULL, .tail = NULL}
+
+// Task notification bit used to wake up a thread waiting for a condition
+#define PTHREAD_COND_NOTIFY           (1U << 31)
 
 // Required structures and types
 struct pthread_mutex_attr {
@@ -94,20 +99,42 @@ struct pthread_mutex_attr {
 
 typedef struct pthread_mutex_attr pthread_mutexattr_t;
 
+// Owner bit set when a thread waits for the owner to unlock the mutex
+#define PTHREAD_MUTEX_WAITERS 1
+
+// Wait queue of a mutex, only created when the mutex is contended
+struct pthread_mutex_wait {
+    SemaphoreHandle_t queue;    // waiting threads, with priority inheritance
+    SemaphoreHandle_t wake;     // wakes up the first waiting thread on unlock
+    TaskHandle_t head;          // first waiting thread
+    int inherited;              // the owner's priority is raised
+    int held;                   // the owner holds queue
+    portMUX_TYPE lock;
+};
+
 struct pthread_mutex {
-    SemaphoreHandle_t sem;
-    int owner;
+    volatile uintptr_t owner;   // owner task | PTHREAD_MUTEX_WAITERS, 0 if unlocked
+    int count;                  // lock count of the owner
     int type;
+    int index;                  // index in the mutex list
+    struct pthread_mutex_wait *volatile wait;
 };
 
-typedef unsigned int pthread_mutex_t;
+typedef struct pthread_mutex *pthread_mutex_t;
 typedef unsigned int pthread_condattr_t;
 typedef int pthread_t;
 typedef int pthread_key_t;
 
+// A thread waiting for a condition, allocated in its stack
+struct pthread_cond_waiter {
+    struct pthread_cond_waiter *next;
+    TaskHandle_t task;
+    int signaled;
+};
+
 struct pthread_cond {
-    struct mtx mutex;
-    int referenced;
+    struct pthread_cond_waiter *head;   // waiting threads, in FIFO order
+    struct pthread_cond_waiter *tail;
 };
 
 typedef struct pthread_cond pthread_cond_t;
@@ -118,14 +145,25 @@ struct pthread_once {
 
 typedef struct pthread_once pthread_once_t;
 
+// A key is a slot in the key table, and the generation of the slot when the
+// key was created, so a deleted key can't access the values of a new key in
+// the same slot
+#define PTHREAD_KEY_SLOT_BITS  8
+#define PTHREAD_KEY_SLOT(k)    ((k) & ((1 << PTHREAD_KEY_SLOT_BITS) - 1))
+#define PTHREAD_KEY_GEN(k)     ((uint32_t)(k) >> PTHREAD_KEY_SLOT_BITS)
+#define PTHREAD_KEY_GEN_MASK   (0xffffffff >> (PTHREAD_KEY_SLOT_BITS + 1))
+
+// Value of a key in a thread, in an array indexed by slot, that is allocated
+// the first time the thread sets a value
 struct pthread_key_specific {
-    pthread_t thread;
     const void *value;
+    uint32_t generation;
 };
 
 struct pthread_key {
-    struct list specific;
     void (*destructor)(void*);
+    uint32_t generation;
+    int used;
 };
 
 struct pthread_join {
@@ -174,6 +212,7 @@ int   _pthread_stop(pthread_t id);
 int   _pthread_suspend(pthread_t id);
 int   _pthread_resume(pthread_t id);
 void  _pthread_mutex_free();
+void  _pthread_key_free();
 int   _pthread_core(pthread_t id);
 sig_t _pthread_signal(int s, sig_t h);
 int   _pthread_get_prio();
@@ -204,7 +243,8 @@ int  pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
 int  pthread_cond_destroy(pthread_cond_t *cond);
 int  pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 int  pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
-int pthread_cond_signal(pthread_cond_t *cond);
+int  pthread_cond_signal(pthread_cond_t *cond);
+int  pthread_cond_broadcast(pthread_cond_t *cond);
 
 int  pthread_once(pthread_once_t *once_control, void (*init_routine)(void));
 void pthread_cleanup_push(void (*routine)(void *), void *arg);
@@ -212,6 +252,7 @@ int  pthread_setcancelstate(int state, int *oldstate);
 int  pthread_key_create(pthread_key_t *k, void (*destructor)(void*));
 int  pthread_setspecific(pthread_key_t k, const void *value);
 void *pthread_getspecific(pthread_key_t k);
+int  pthread_key_delete(pthread_key_t k);
 int  pthread_join(pthread_t thread, void **value_ptr);
 int pthread_cancel(pthread_t thread);
 
@@ -18,6 +18,11 @@
 #include <sys/driver.h>
 
 static int ds_parasite_pwr = 0;
+
+// Tick count when a conversion was started on all the devices of a bus
+static uint32_t ds_start_tick[MAX_ONEWIRE_PINS];
+static uint8_t ds_started[MAX_ONEWIRE_PINS] = {0};
+
 extern TM_One_Wire_Devices_t ow_devices[MAX_ONEWIRE_PINS];
 
 #ifdef DS18B20ALARMFUNC
@@ -41,6 +46,8 @@ const sensor_t __attribute__((used,unused,section(".sensors"))) ds1820_sensor =
 	.acquire = ds1820_acquire,
 	.set = ds1820_set,
 	.get = ds1820_get,
+	.startall = ds1820_startall,
+	.collect = ds1820_collect,
 };
 
 
@@ -95,6 +102,8 @@ static int getPowerMode(uint8_t dev) {
 
 //------------------------------------------------------------------
 static owState_t TM_DS18B20_Start(uint8_t dev, unsigned char *ROM) {
+  driver_error_t *error;
+
   // Check if device is DS18B20
   if (!TM_DS18B20_Is(ROM)) {
     return owError_Not18b20;
@@ -104,10 +113,11 @@ static owState_t TM_DS18B20_Start(uint8_t dev, unsigned char *ROM) {
   // Reset line
   if (TM_OneWire_Reset(dev) != 0) return owError_NoDevice;
 
-  // Select ROM number
-  TM_OneWire_SelectWithPointer(dev, ROM);
-  // Start temperature conversion
-  TM_OneWire_WriteByte(dev, DS18B20_CMD_CONVERTTEMP);
+  // Select ROM number, and start temperature conversion
+  if ((error = owire_select(dev, ROM, DS18B20_CMD_CONVERTTEMP))) {
+    free(error);
+    return owError_NoDevice;
+  }
 
   if (ds_parasite_pwr) owdevice_pinpower(dev);
 
@@ -115,7 +125,6 @@ static owState_t TM_DS18B20_Start(uint8_t dev, unsigned char *ROM) {
 }
 
 //-------------------------------------------------
-#if 0
 static owState_t TM_DS18B20_StartAll(uint8_t dev) {
   if (getPowerMode(dev)) return owError_NoDevice;
 
@@ -130,7 +139,6 @@ static owState_t TM_DS18B20_StartAll(uint8_t dev) {
 
   return ow_OK;
 }
-#endif
 
 //--------------------------------------------------------------------------------------
 static owState_t TM_DS18B20_Read(uint8_t dev, unsigned char *ROM, double *destination) {
@@ -138,9 +146,9 @@ static owState_t TM_DS18B20_Read(uint8_t dev, unsigned char *ROM, double *destin
   unsigned char resolution;
   char digit, minus = 0;
   double decimal;
-  unsigned char i = 0;
   unsigned char data[9];
   unsigned char crc;
+  driver_error_t *error;
 
   /* Check if device is DS18B20 */
   if (!TM_DS18B20_Is(ROM)) {
@@ -155,15 +163,16 @@ static owState_t TM_DS18B20_Read(uint8_t dev, unsigned char *ROM, double *destin
   if (TM_OneWire_Reset(dev) != 0) {
     return owError_NoDevice;
   }
-  /* Select ROM number */
-  TM_OneWire_SelectWithPointer(dev, ROM);
-  /* Read scratchpad command by onewire protocol */
-  TM_OneWire_WriteByte(dev, ONEWIRE_CMD_RSCRATCHPAD);
+  /* Select ROM number, and send read scratchpad command */
+  if ((error = owire_select(dev, ROM, ONEWIRE_CMD_RSCRATCHPAD))) {
+    free(error);
+    return owError_NoDevice;
+  }
 
   /* Get data */
-  for (i = 0; i < 9; i++) {
-    /* Read byte by byte */
-    data[i] = TM_OneWire_ReadByte(dev);
+  if ((error = owire_read(dev, data, 9))) {
+    free(error);
+    return owError_NoDevice;
   }
   /* Calculate CRC */
   crc = TM_OneWire_CRC8(data, 8);
@@ -672,41 +681,33 @@ driver_error_t *ds1820_set(sensor_instance_t *unit, const char *id, sensor_value
 	return NULL;
 }
 
-//-------------------------------------------------------------------------------
-driver_error_t *ds1820_acquire(sensor_instance_t *unit, sensor_value_t *values) {
-	unsigned char sens = unit->setup.owire.owsensor - 1;
-	uint8_t dev = unit->setup.owire.owdevice;
-
-	sens = owire_addess_to_dev(dev, sens);
-
-	owState_t stat;
-	double temper;
-	uint16_t measure_time = 900;
-
-	// set measure time, it depends on resolution
+// Measure time in msecs, it depends on resolution
+//-------------------------------------------------------
+static uint16_t ds1820_measure_time(sensor_instance_t *unit) {
 	switch (unit->properties[0].integerd.value) {
 	case 9:
-		measure_time = 150;
-		break;
+		return 150;
 	case 10:
-		measure_time = 250;
-		break;
+		return 250;
 	case 11:
-		measure_time = 450;
-		break;
+		return 450;
 	case 12:
-		measure_time = 850;
-		break;
+		return 850;
 	}
 
-	/* Start temperature conversion on all devices on one bus
-	TM_DS18B20_StartAll(dev);
-	*/
-	// Start temperature conversion on device
-	if (TM_DS18B20_Start(dev, (unsigned char *)&ow_devices[dev].roms[sens]) != ow_OK) {
-		values[0].floatd.value = -9997.0;
-		return NULL;
-	}
+	return 900;
+}
+
+// Wait until measurement finished, and read temperature from device
+//-----------------------------------------------------------------------------------------------
+static void ds1820_read(sensor_instance_t *unit, sensor_value_t *values, uint16_t measure_time) {
+	unsigned char sens = unit->setup.owire.owsensor - 1;
+	uint8_t dev = unit->setup.owire.owdevice;
+
+	sens = owire_addess_to_dev(dev, sens);
+
+	owState_t stat;
+	double temper;
 
 	// Wait until measurement finished
 	if (ds_parasite_pwr) {
@@ -716,15 +717,17 @@ driver_error_t *ds1820_acquire(sensor_instance_t *unit, sensor_value_t *values)
 	}
 	else {
 		for (int mtime = 0; mtime < measure_time; mtime += 10) {
-			vTaskDelay(10 / portTICK_RATE_MS);
 			if (TM_OneWire_ReadBit(dev)) break;
+			vTaskDelay(10 / portTICK_RATE_MS);
 		}
 	}
-	vTaskDelay(10 / portTICK_RATE_MS);
+	if (!TM_OneWire_ReadBit(dev)) {
+		vTaskDelay(10 / portTICK_RATE_MS);
+	}
 	if (!TM_OneWire_ReadBit(dev)) {
 		/* Timeout */
 		values[0].floatd.value = -9998.0;
-		return NULL;
+		return;
 	}
 
 	// Read temperature from selected device
@@ -737,6 +740,62 @@ driver_error_t *ds1820_acquire(sensor_instance_t *unit, sensor_value_t *values)
 		// Reading error
 		values[0].floatd.value = -9999.0;
 	}
+}
+
+//-------------------------------------------------------------------------------
+driver_error_t *ds1820_acquire(sensor_instance_t *unit, sensor_value_t *values) {
+	unsigned char sens = unit->setup.owire.owsensor - 1;
+	uint8_t dev = unit->setup.owire.owdevice;
+
+	sens = owire_addess_to_dev(dev, sens);
+
+	// Start temperature conversion on device
+	if (TM_DS18B20_Start(dev, (unsigned char *)&ow_devices[dev].roms[sens]) != ow_OK) {
+		values[0].floatd.value = -9997.0;
+		return NULL;
+	}
+
+	ds1820_read(unit, values, ds1820_measure_time(unit));
+
+	return NULL;
+}
+
+// Start temperature conversion on all devices of the unit's bus, with a single Skip ROM
+// command, so that all the sensors of the bus are converting at the same time
+//-------------------------------------------------------------
+driver_error_t *ds1820_startall(sensor_instance_t *unit) {
+	uint8_t dev = unit->setup.owire.owdevice;
+
+	ds_started[dev] = (TM_DS18B20_StartAll(dev) == ow_OK);
+	ds_start_tick[dev] = xTaskGetTickCount();
+
+	return NULL;
+}
+
+// Read temperature converted by a previous ds1820_startall, only waiting for the remaining
+// measure time
+//-------------------------------------------------------------------------------
+driver_error_t *ds1820_collect(sensor_instance_t *unit, sensor_value_t *values) {
+	uint8_t dev = unit->setup.owire.owdevice;
+	uint32_t elapsed;
+	uint16_t measure_time;
+
+	if (!ds_started[dev]) {
+		values[0].floatd.value = -9997.0;
+		return NULL;
+	}
+
+	// In parasite power mode bus is powered until the slowest device has finished
+	measure_time = (ds_parasite_pwr?900:ds1820_measure_time(unit));
+
+	elapsed = (xTaskGetTickCount() - ds_start_tick[dev]) * portTICK_RATE_MS;
+	if (elapsed < measure_time) {
+		measure_time -= elapsed;
+	} else {
+		measure_time = 0;
+	}
+
+	ds1820_read(unit, values, measure_time);
 
 	return NULL;
 }
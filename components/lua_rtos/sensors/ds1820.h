@@ -70,6 +70,8 @@ typedef enum {
 
 driver_error_t *ds1820_setup(sensor_instance_t *unit);
 driver_error_t *ds1820_acquire(sensor_instance_t *unit, sensor_value_t *values);
+driver_error_t *ds1820_startall(sensor_instance_t *unit);
+driver_error_t *ds1820_collect(sensor_instance_t *unit, sensor_value_t *values);
 driver_error_t *ds1820_set(sensor_instance_t *unit, const char *id, sensor_value_t *property);
 driver_error_t *ds1820_get(sensor_instance_t *unit, const char *id, sensor_value_t *property);
 
@@ -60,6 +60,8 @@
 #define EVENT_DRIVER_ID    20
 #define SPI_ETH_DRIVER_ID  21
 #define CAN_DRIVER_ID      22
+#define DATALOG_DRIVER_ID  23
+#define TMR_DRIVER_ID      24
 
 #define GPIO_DRIVER driver_get_by_name("gpio")
 #define UART_DRIVER driver_get_by_name("uart")
@@ -77,6 +79,8 @@
 #define EVENT_DRIVER driver_get_by_name("event")
 #define SPI_ETH_DRIVER driver_get_by_name("spi_eth")
 #define CAN_DRIVER driver_get_by_name("can")
+#define DATALOG_DRIVER driver_get_by_name("datalog")
+#define TMR_DRIVER driver_get_by_name("tmr")
 
 #define DRIVER_EXCEPTION_BASE(n) (n << 24)
 
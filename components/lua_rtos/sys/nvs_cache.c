@@ -0,0 +1,586 @@
+/*
+ * Lua RTOS, NVS cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+#include "esp_err.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/nvs_cache.h>
+
+// The index grows by this number of keys
+#define NVS_CACHE_INDEX_GROW 8
+
+static uint32_t key_hash(const char *key) {
+	uint32_t hash = 2166136261U;
+
+	while (*key) {
+		hash = (hash ^ (uint8_t)*key++) * 16777619U;
+	}
+
+	return hash % NVS_CACHE_BUCKETS;
+}
+
+static int key_check(const char *key) {
+	size_t len = strlen(key);
+
+	return ((len > 0) && (len < NVS_CACHE_KEY_SIZE) && strcmp(key, NVS_CACHE_INDEX_KEY));
+}
+
+void nvs_cache_value_free(nvs_cache_value_t *value) {
+	if (value->type == NvsCacheString) {
+		free(value->string.data);
+	}
+
+	value->type = NvsCacheNone;
+}
+
+static int value_copy(nvs_cache_value_t *dst, const nvs_cache_value_t *src) {
+	*dst = *src;
+
+	if (src->type == NvsCacheString) {
+		// One more byte, so the data can also be used as a C string
+		dst->string.data = malloc(src->string.len + 1);
+		if (!dst->string.data) {
+			dst->type = NvsCacheNone;
+			return ESP_ERR_NO_MEM;
+		}
+
+		memcpy(dst->string.data, src->string.data, src->string.len);
+		dst->string.data[src->string.len] = 0;
+	}
+
+	return ESP_OK;
+}
+
+/*
+ * Index of keys
+ */
+
+static int index_find(nvs_cache_t *cache, const char *key) {
+	uint32_t i;
+
+	for(i = 0; i < cache->nkeys; i++) {
+		if (strcmp(cache->keys[i], key) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int index_add(nvs_cache_t *cache, const char *key) {
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+
+	if ((cache->nkeys % NVS_CACHE_INDEX_GROW) == 0) {
+		keys = realloc(cache->keys, (cache->nkeys + NVS_CACHE_INDEX_GROW) * NVS_CACHE_KEY_SIZE);
+		if (!keys) {
+			return ESP_ERR_NO_MEM;
+		}
+
+		cache->keys = keys;
+	}
+
+	strcpy(cache->keys[cache->nkeys++], key);
+	cache->index_dirty = 1;
+
+	return ESP_OK;
+}
+
+static void index_remove(nvs_cache_t *cache, int pos) {
+	cache->nkeys--;
+	memmove(cache->keys[pos], cache->keys[pos + 1], (cache->nkeys - pos) * NVS_CACHE_KEY_SIZE);
+	cache->index_dirty = 1;
+}
+
+// The index is stored as a string with the keys, each one ended by a 0
+static int index_load(nvs_cache_t *cache) {
+	nvs_cache_value_t value;
+	char *key;
+	int res;
+
+	res = cache->backend->get(cache->handle, NVS_CACHE_INDEX_KEY, &value, &cache->index_stored);
+	if (res != ESP_OK) {
+		return res;
+	}
+
+	cache->stats.reads++;
+
+	if (value.type != NvsCacheString) {
+		nvs_cache_value_free(&value);
+		return ESP_OK;
+	}
+
+	for(key = value.string.data; key < value.string.data + value.string.len; key += strlen(key) + 1) {
+		if (key_check(key) && (index_find(cache, key) < 0)) {
+			if ((res = index_add(cache, key))) {
+				break;
+			}
+		}
+	}
+
+	cache->index_dirty = 0;
+
+	nvs_cache_value_free(&value);
+
+	return res;
+}
+
+static int index_write(nvs_cache_t *cache) {
+	nvs_cache_value_t value;
+	uint32_t i;
+	char *c;
+	int res;
+
+	if (!cache->index_dirty) {
+		return ESP_OK;
+	}
+
+	if (cache->nkeys == 0) {
+		value.type = NvsCacheNone;
+	} else {
+		value.type = NvsCacheString;
+		value.string.len = 0;
+		value.string.data = malloc(cache->nkeys * NVS_CACHE_KEY_SIZE);
+		if (!value.string.data) {
+			return ESP_ERR_NO_MEM;
+		}
+
+		for(i = 0, c = value.string.data; i < cache->nkeys; i++) {
+			strcpy(c, cache->keys[i]);
+			c += strlen(c) + 1;
+		}
+
+		value.string.len = c - value.string.data;
+	}
+
+	res = cache->backend->set(cache->handle, NVS_CACHE_INDEX_KEY, &value, &cache->index_stored);
+	if (res == ESP_OK) {
+		cache->stats.writes++;
+		cache->index_dirty = 0;
+	}
+
+	nvs_cache_value_free(&value);
+
+	return res;
+}
+
+/*
+ * Entries
+ */
+
+static nvs_cache_entry_t *entry_find(nvs_cache_t *cache, const char *key) {
+	nvs_cache_entry_t *entry;
+
+	for(entry = cache->bucket[key_hash(key)]; entry; entry = entry->next) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+// Get the entry of a key, reading it from the storage if it's not cached
+static int entry_load(nvs_cache_t *cache, const char *key, nvs_cache_entry_t **entry) {
+	nvs_cache_entry_t *new_entry;
+	uint32_t hash;
+	int res;
+
+	if ((*entry = entry_find(cache, key))) {
+		return ESP_OK;
+	}
+
+	new_entry = calloc(1, sizeof(nvs_cache_entry_t));
+	if (!new_entry) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	res = cache->backend->get(cache->handle, key, &new_entry->value, &new_entry->stored);
+	if (res != ESP_OK) {
+		free(new_entry);
+		return res;
+	}
+
+	cache->stats.reads++;
+
+	strcpy(new_entry->key, key);
+
+	hash = key_hash(key);
+	new_entry->next = cache->bucket[hash];
+	cache->bucket[hash] = new_entry;
+
+	*entry = new_entry;
+
+	return ESP_OK;
+}
+
+static int entry_write(nvs_cache_t *cache, nvs_cache_entry_t *entry) {
+	int res;
+
+	res = cache->backend->set(cache->handle, entry->key, &entry->value, &entry->stored);
+	if (res == ESP_OK) {
+		cache->stats.writes++;
+		entry->dirty = 0;
+	}
+
+	return res;
+}
+
+// Write the dirty entries and the index, and commit
+static int cache_flush(nvs_cache_t *cache) {
+	nvs_cache_entry_t *entry;
+	int res, i;
+
+	for(i = 0; i < NVS_CACHE_BUCKETS; i++) {
+		for(entry = cache->bucket[i]; entry; entry = entry->next) {
+			if (entry->dirty && (res = entry_write(cache, entry))) {
+				return res;
+			}
+		}
+	}
+
+	if ((res = index_write(cache))) {
+		return res;
+	}
+
+	if ((res = cache->backend->commit(cache->handle))) {
+		return res;
+	}
+
+	cache->stats.commits++;
+
+	return ESP_OK;
+}
+
+static void cache_clear(nvs_cache_t *cache) {
+	nvs_cache_entry_t *entry, *next;
+	int i;
+
+	for(i = 0; i < NVS_CACHE_BUCKETS; i++) {
+		for(entry = cache->bucket[i]; entry; entry = next) {
+			next = entry->next;
+
+			nvs_cache_value_free(&entry->value);
+			free(entry);
+		}
+
+		cache->bucket[i] = NULL;
+	}
+
+	free(cache->keys);
+	cache->keys = NULL;
+	cache->nkeys = 0;
+	cache->index_dirty = 0;
+}
+
+// Discard the cached values and the index, so they are read again from the
+// storage
+static void cache_invalidate(nvs_cache_t *cache) {
+	cache_clear(cache);
+	index_load(cache);
+}
+
+// Set the value of a key in the cache, to be written by cache_flush. The
+// value is moved to the cache.
+static int cache_update(nvs_cache_t *cache, const char *key, nvs_cache_value_t *value) {
+	nvs_cache_entry_t *entry;
+	int res, pos;
+
+	// The entry is loaded, so the backend knows how the current value is
+	// stored
+	if ((res = entry_load(cache, key, &entry))) {
+		return res;
+	}
+
+	pos = index_find(cache, key);
+	if ((value->type != NvsCacheNone) && (pos < 0)) {
+		if ((res = index_add(cache, key))) {
+			return res;
+		}
+	} else if ((value->type == NvsCacheNone) && (pos >= 0)) {
+		index_remove(cache, pos);
+	}
+
+	nvs_cache_value_free(&entry->value);
+	entry->value = *value;
+	entry->dirty = 1;
+
+	value->type = NvsCacheNone;
+
+	return ESP_OK;
+}
+
+/*
+ * API
+ */
+
+int nvs_cache_open(const nvs_cache_backend_t *backend, const char *nspace, nvs_cache_t **cache) {
+	nvs_cache_t *new_cache;
+	int res;
+
+	if (!key_check(nspace)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	new_cache = calloc(1, sizeof(nvs_cache_t));
+	if (!new_cache) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	new_cache->backend = backend;
+	strcpy(new_cache->nspace, nspace);
+
+	if ((res = backend->open(nspace, &new_cache->handle))) {
+		free(new_cache);
+		return res;
+	}
+
+	if ((res = index_load(new_cache))) {
+		cache_clear(new_cache);
+		backend->close(new_cache->handle);
+		free(new_cache);
+		return res;
+	}
+
+	pthread_mutex_init(&new_cache->mtx, NULL);
+
+	*cache = new_cache;
+
+	return ESP_OK;
+}
+
+void nvs_cache_close(nvs_cache_t *cache) {
+	cache_clear(cache);
+	cache->backend->close(cache->handle);
+
+	pthread_mutex_destroy(&cache->mtx);
+	free(cache);
+}
+
+int nvs_cache_get(nvs_cache_t *cache, const char *key, nvs_cache_value_t *value) {
+	nvs_cache_entry_t *entry;
+	int res;
+
+	if (!key_check(key)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	pthread_mutex_lock(&cache->mtx);
+
+	if ((entry = entry_find(cache, key))) {
+		cache->stats.hits++;
+		res = ESP_OK;
+	} else {
+		res = entry_load(cache, key, &entry);
+	}
+
+	if (res == ESP_OK) {
+		res = value_copy(value, &entry->value);
+	}
+
+	pthread_mutex_unlock(&cache->mtx);
+
+	return res;
+}
+
+int nvs_cache_set(nvs_cache_t *cache, const char *key, const nvs_cache_value_t *value) {
+	nvs_cache_value_t copy;
+	int res;
+
+	if (!key_check(key)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if ((res = value_copy(&copy, value))) {
+		return res;
+	}
+
+	pthread_mutex_lock(&cache->mtx);
+
+	if ((res = cache_update(cache, key, &copy)) == ESP_OK) {
+		res = cache_flush(cache);
+	}
+
+	if (res != ESP_OK) {
+		// The cache doesn't match the storage anymore
+		cache_invalidate(cache);
+	}
+
+	pthread_mutex_unlock(&cache->mtx);
+
+	nvs_cache_value_free(&copy);
+
+	return res;
+}
+
+/*
+ * Batches
+ */
+
+static nvs_cache_entry_t *batch_find(nvs_cache_batch_t *batch, const char *key) {
+	nvs_cache_entry_t *entry;
+
+	for(entry = batch->entries; entry; entry = entry->next) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void batch_free(nvs_cache_batch_t *batch) {
+	nvs_cache_entry_t *entry, *next;
+
+	for(entry = batch->entries; entry; entry = next) {
+		next = entry->next;
+
+		nvs_cache_value_free(&entry->value);
+		free(entry);
+	}
+
+	free(batch);
+}
+
+int nvs_cache_begin(nvs_cache_t *cache, nvs_cache_batch_t **batch) {
+	*batch = calloc(1, sizeof(nvs_cache_batch_t));
+	if (!*batch) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	(*batch)->cache = cache;
+
+	return ESP_OK;
+}
+
+int nvs_cache_batch_get(nvs_cache_batch_t *batch, const char *key, nvs_cache_value_t *value) {
+	nvs_cache_entry_t *entry;
+
+	if (!key_check(key)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if ((entry = batch_find(batch, key))) {
+		return value_copy(value, &entry->value);
+	}
+
+	return nvs_cache_get(batch->cache, key, value);
+}
+
+int nvs_cache_batch_set(nvs_cache_batch_t *batch, const char *key, const nvs_cache_value_t *value) {
+	nvs_cache_entry_t *entry;
+	nvs_cache_value_t copy;
+	int res;
+
+	if (!key_check(key)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if ((res = value_copy(&copy, value))) {
+		return res;
+	}
+
+	if (!(entry = batch_find(batch, key))) {
+		entry = calloc(1, sizeof(nvs_cache_entry_t));
+		if (!entry) {
+			nvs_cache_value_free(&copy);
+			return ESP_ERR_NO_MEM;
+		}
+
+		strcpy(entry->key, key);
+		entry->next = batch->entries;
+		batch->entries = entry;
+	}
+
+	nvs_cache_value_free(&entry->value);
+	entry->value = copy;
+
+	return ESP_OK;
+}
+
+int nvs_cache_commit(nvs_cache_batch_t *batch) {
+	nvs_cache_t *cache = batch->cache;
+	nvs_cache_entry_t *entry;
+	int res = ESP_OK;
+
+	pthread_mutex_lock(&cache->mtx);
+
+	// Outside a commit there are no dirty entries, so only the writes of the
+	// batch are written
+	for(entry = batch->entries; entry && (res == ESP_OK); entry = entry->next) {
+		res = cache_update(cache, entry->key, &entry->value);
+	}
+
+	if (res == ESP_OK) {
+		res = cache_flush(cache);
+	}
+
+	if (res != ESP_OK) {
+		cache_invalidate(cache);
+	}
+
+	pthread_mutex_unlock(&cache->mtx);
+
+	batch_free(batch);
+
+	return res;
+}
+
+void nvs_cache_rollback(nvs_cache_batch_t *batch) {
+	batch_free(batch);
+}
+
+int nvs_cache_keys(nvs_cache_t *cache, char (**keys)[NVS_CACHE_KEY_SIZE], uint32_t *nkeys) {
+	pthread_mutex_lock(&cache->mtx);
+
+	*keys = NULL;
+	*nkeys = cache->nkeys;
+
+	if (cache->nkeys > 0) {
+		*keys = malloc(cache->nkeys * NVS_CACHE_KEY_SIZE);
+		if (!*keys) {
+			pthread_mutex_unlock(&cache->mtx);
+			return ESP_ERR_NO_MEM;
+		}
+
+		memcpy(*keys, cache->keys, cache->nkeys * NVS_CACHE_KEY_SIZE);
+	}
+
+	pthread_mutex_unlock(&cache->mtx);
+
+	return ESP_OK;
+}
+
+void nvs_cache_stats(nvs_cache_t *cache, nvs_cache_stats_t *stats) {
+	pthread_mutex_lock(&cache->mtx);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->mtx);
+}
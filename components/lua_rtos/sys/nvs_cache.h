@@ -0,0 +1,177 @@
+/*
+ * Lua RTOS, NVS cache
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Cached, batched access to a NVS namespace.
+ *
+ * A cache keeps its namespace open, and keeps the values that are read or
+ * written, so a value is read from flash once. Values are typed: integers,
+ * numbers, booleans and strings, and the backend stores each type in its
+ * native form.
+ *
+ * nvs_cache_set writes and commits at once. A batch, started with
+ * nvs_cache_begin, keeps its writes apart from the cache, and
+ * nvs_cache_commit writes them with a single commit, so a key that is
+ * written many times is written to flash once. Each batch belongs to the
+ * caller that started it, and many batches can be open on a cache: the
+ * writes of a batch are only seen through the batch until it's committed,
+ * and writes outside the batch are written at once. NVS can't commit many
+ * keys atomically, so if a commit fails, some of the keys of the batch can
+ * be written. nvs_cache_rollback discards the writes of the batch.
+ *
+ * NVS can't list the keys of a namespace, so the cache keeps the names of
+ * the keys that are written through a cache in an index, stored in the same
+ * namespace under NVS_CACHE_INDEX_KEY.
+ *
+ * The storage is accessed through a backend, so the cache can be used with
+ * other storage than the ESP-IDF NVS.
+ */
+
+#ifndef _NVS_CACHE_H
+#define	_NVS_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread/pthread.h>
+
+// Includes the terminating 0, as in NVS
+#define NVS_CACHE_KEY_SIZE  16
+
+#define NVS_CACHE_INDEX_KEY "\x01keys"
+
+#define NVS_CACHE_BUCKETS   16
+
+typedef enum {
+	NvsCacheNone = 0,   // the key doesn't exist
+	NvsCacheInteger,
+	NvsCacheNumber,
+	NvsCacheBoolean,
+	NvsCacheString,
+} nvs_cache_type_t;
+
+typedef struct {
+	nvs_cache_type_t type;
+	union {
+		int64_t integer;
+		double number;
+		int boolean;
+		struct {
+			char *data;         // allocated, can have zeros
+			size_t len;
+		} string;
+	};
+} nvs_cache_value_t;
+
+typedef struct {
+	// Open a namespace
+	int (*open)(const char *nspace, void **handle);
+
+	void (*close)(void *handle);
+
+	// Read a key. If it doesn't exist, value->type is NvsCacheNone. stored
+	// is set to how the value is stored, in a backend specific way.
+	int (*get)(void *handle, const char *key, nvs_cache_value_t *value, uint8_t *stored);
+
+	// Write a key, or erase it if value->type is NvsCacheNone. stored is how
+	// the current value is stored, and it's updated.
+	int (*set)(void *handle, const char *key, const nvs_cache_value_t *value, uint8_t *stored);
+
+	int (*commit)(void *handle);
+} nvs_cache_backend_t;
+
+typedef struct nvs_cache_entry {
+	struct nvs_cache_entry *next;
+	char key[NVS_CACHE_KEY_SIZE];
+	nvs_cache_value_t value;
+	uint8_t stored;             // how the value is stored, for the backend
+	uint8_t dirty;              // written in the cache, not in the storage
+} nvs_cache_entry_t;
+
+typedef struct {
+	uint32_t reads;             // reads from the storage
+	uint32_t hits;              // reads from the cache
+	uint32_t writes;            // writes to the storage
+	uint32_t commits;
+} nvs_cache_stats_t;
+
+typedef struct {
+	const nvs_cache_backend_t *backend;
+	void *handle;
+	pthread_mutex_t mtx;
+	char nspace[NVS_CACHE_KEY_SIZE];
+	nvs_cache_entry_t *bucket[NVS_CACHE_BUCKETS];
+	uint8_t index_dirty;        // the index must be written
+	uint8_t index_stored;       // how the index is stored, for the backend
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+	uint32_t nkeys;
+	nvs_cache_stats_t stats;
+} nvs_cache_t;
+
+typedef struct {
+	nvs_cache_t *cache;
+	nvs_cache_entry_t *entries; // the writes of the batch, in any order
+} nvs_cache_batch_t;
+
+// Functions return ESP_OK, or an esp_err_t error code
+
+int nvs_cache_open(const nvs_cache_backend_t *backend, const char *nspace, nvs_cache_t **cache);
+
+// Close a cache, its batches must be ended before
+void nvs_cache_close(nvs_cache_t *cache);
+
+// Get a value, that is owned by the caller (see nvs_cache_value_free)
+int nvs_cache_get(nvs_cache_t *cache, const char *key, nvs_cache_value_t *value);
+
+// Set a value, or erase the key if value->type is NvsCacheNone. The value
+// is copied.
+int nvs_cache_set(nvs_cache_t *cache, const char *key, const nvs_cache_value_t *value);
+
+// Start a batch, that is ended, and freed, by nvs_cache_commit or
+// nvs_cache_rollback
+int nvs_cache_begin(nvs_cache_t *cache, nvs_cache_batch_t **batch);
+
+// As nvs_cache_get / nvs_cache_set, with the writes of the batch
+int nvs_cache_batch_get(nvs_cache_batch_t *batch, const char *key, nvs_cache_value_t *value);
+int nvs_cache_batch_set(nvs_cache_batch_t *batch, const char *key, const nvs_cache_value_t *value);
+
+// Write the batch with a single commit. The batch is ended, also if the
+// commit fails.
+int nvs_cache_commit(nvs_cache_batch_t *batch);
+void nvs_cache_rollback(nvs_cache_batch_t *batch);
+
+// Get a copy of the keys of the namespace, that is freed by the caller
+int nvs_cache_keys(nvs_cache_t *cache, char (**keys)[NVS_CACHE_KEY_SIZE], uint32_t *nkeys);
+
+void nvs_cache_stats(nvs_cache_t *cache, nvs_cache_stats_t *stats);
+
+void nvs_cache_value_free(nvs_cache_value_t *value);
+
+#endif	/* _NVS_CACHE_H */
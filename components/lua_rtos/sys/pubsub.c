@@ -0,0 +1,443 @@
+/*
+ * Lua RTOS, publish / subscribe bus
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/pubsub.h>
+
+#include <pthread/pthread.h>
+
+// Subscribers of a publish that are collected in the stack
+#define PUBSUB_LOCAL_SUBS 16
+
+// Protects the subscriber lists
+static pthread_mutex_t bus_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// Subscribers with an exact filter, by hash of the filter
+static pubsub_sub_t *buckets[PUBSUB_BUCKETS];
+
+// Subscribers with a wildcard filter
+static pubsub_sub_t *wildcards = NULL;
+
+static pubsub_stats_t bus_stats;
+
+static uint32_t topic_hash(const char *topic) {
+	uint32_t hash = 2166136261U;
+
+	while (*topic) {
+		hash = (hash ^ (uint8_t)*topic++) * 16777619U;
+	}
+
+	return hash % PUBSUB_BUCKETS;
+}
+
+/*
+ * Check a topic, or a filter if wildcards are allowed. A + must be a whole
+ * level, and a # must be the whole last level.
+ */
+static int topic_check(const char *topic, int wildcards) {
+	const char *c;
+	size_t len = strlen(topic);
+
+	if ((len == 0) || (len >= PUBSUB_MAX_TOPIC)) {
+		return 0;
+	}
+
+	for(c = topic; *c; c++) {
+		if ((*c != '+') && (*c != '#')) {
+			continue;
+		}
+
+		if (!wildcards) {
+			return 0;
+		}
+
+		if ((c != topic) && (*(c - 1) != '/')) {
+			return 0;
+		}
+
+		if ((*c == '+') && *(c + 1) && (*(c + 1) != '/')) {
+			return 0;
+		}
+
+		if ((*c == '#') && *(c + 1)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int is_wildcard(const char *filter) {
+	return (strchr(filter, '+') || strchr(filter, '#'));
+}
+
+int pubsub_topic_match(const char *filter, const char *topic) {
+	while (*filter) {
+		if (*filter == '#') {
+			return 1;
+		}
+
+		if (*filter == '+') {
+			while (*topic && (*topic != '/')) {
+				topic++;
+			}
+
+			filter++;
+			continue;
+		}
+
+		if (*filter != *topic) {
+			// a/# also matches a
+			return (!*topic && (*filter == '/') && (*(filter + 1) == '#'));
+		}
+
+		filter++;
+		topic++;
+	}
+
+	return !*topic;
+}
+
+/*
+ * Collect the subscribers of a topic, taking a reference of each one. If
+ * subs is NULL, only count them. Called with the bus locked.
+ */
+static uint32_t collect(const char *topic, pubsub_sub_t **subs) {
+	pubsub_sub_t *sub;
+	uint32_t n = 0;
+
+	for(sub = buckets[topic_hash(topic)]; sub; sub = sub->next) {
+		if (strcmp(sub->filter, topic) == 0) {
+			if (subs) {
+				__atomic_add_fetch(&sub->refs, 1, __ATOMIC_RELAXED);
+				subs[n] = sub;
+			}
+			n++;
+		}
+	}
+
+	for(sub = wildcards; sub; sub = sub->next) {
+		if (pubsub_topic_match(sub->filter, topic)) {
+			if (subs) {
+				__atomic_add_fetch(&sub->refs, 1, __ATOMIC_RELAXED);
+				subs[n] = sub;
+			}
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static void unlink_sub(pubsub_sub_t **list, pubsub_sub_t *sub) {
+	while (*list) {
+		if (*list == sub) {
+			*list = sub->next;
+			return;
+		}
+
+		list = &(*list)->next;
+	}
+}
+
+/*
+ * Put a message in the queue of a subscriber, applying its overflow
+ * policy. Returns 1 if the message was queued.
+ */
+static int sub_put(pubsub_sub_t *sub, pubsub_msg_t *msg) {
+	pubsub_msg_t *old;
+
+	__atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+
+	for(;;) {
+		portENTER_CRITICAL(&sub->lock);
+
+		if (sub->closed) {
+			portEXIT_CRITICAL(&sub->lock);
+
+			// Unsubscribe wakes one blocked publisher, that wakes the next one
+			if (sub->overflow == PubSubBlock) {
+				xSemaphoreGive(sub->space);
+			}
+			break;
+		}
+
+		if (sub->count < sub->size) {
+			sub->queue[(sub->head + sub->count) % sub->size] = msg;
+			sub->count++;
+			sub->delivered++;
+			portEXIT_CRITICAL(&sub->lock);
+
+			xSemaphoreGive(sub->items);
+			__atomic_add_fetch(&bus_stats.delivered, 1, __ATOMIC_RELAXED);
+
+			return 1;
+		}
+
+		if (sub->overflow == PubSubDropNewest) {
+			sub->dropped++;
+			portEXIT_CRITICAL(&sub->lock);
+
+			__atomic_add_fetch(&bus_stats.dropped, 1, __ATOMIC_RELAXED);
+			break;
+		}
+
+		if (sub->overflow == PubSubDropOldest) {
+			// The new message takes the place of the oldest one, so the
+			// number of messages in the queue doesn't change
+			old = sub->queue[sub->head];
+			sub->queue[sub->head] = msg;
+			sub->head = (sub->head + 1) % sub->size;
+			sub->delivered++;
+			sub->dropped++;
+			portEXIT_CRITICAL(&sub->lock);
+
+			pubsub_msg_release(old);
+			__atomic_add_fetch(&bus_stats.delivered, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&bus_stats.dropped, 1, __ATOMIC_RELAXED);
+
+			return 1;
+		}
+
+		// Block until the subscriber takes a message
+		portEXIT_CRITICAL(&sub->lock);
+		xSemaphoreTake(sub->space, portMAX_DELAY);
+	}
+
+	pubsub_msg_release(msg);
+
+	return 0;
+}
+
+int pubsub_subscribe(const char *filter, uint32_t size, pubsub_overflow_t overflow, pubsub_sub_t **sub) {
+	pubsub_sub_t *nsub;
+	pubsub_sub_t **list;
+
+	if (!topic_check(filter, 1) || (size < 1) || (size > PUBSUB_MAX_QUEUE) || (overflow > PubSubBlock)) {
+		return EINVAL;
+	}
+
+	nsub = calloc(1, sizeof(pubsub_sub_t));
+	if (!nsub) {
+		return ENOMEM;
+	}
+
+	nsub->filter = strdup(filter);
+	nsub->queue = calloc(size, sizeof(pubsub_msg_t *));
+	nsub->items = xSemaphoreCreateCounting(size + 1, 0);
+	nsub->space = xSemaphoreCreateCounting(size, 0);
+
+	if (!nsub->filter || !nsub->queue || !nsub->items || !nsub->space) {
+		if (nsub->items) vSemaphoreDelete(nsub->items);
+		if (nsub->space) vSemaphoreDelete(nsub->space);
+		free(nsub->queue);
+		free(nsub->filter);
+		free(nsub);
+
+		return ENOMEM;
+	}
+
+	vPortCPUInitializeMutex(&nsub->lock);
+
+	nsub->size = size;
+	nsub->overflow = overflow;
+	nsub->wildcard = is_wildcard(filter);
+
+	// One reference for the caller, and one for the bus
+	nsub->refs = 2;
+
+	pthread_mutex_lock(&bus_mtx);
+
+	list = nsub->wildcard?&wildcards:&buckets[topic_hash(filter)];
+	nsub->next = *list;
+	*list = nsub;
+
+	bus_stats.subscribers++;
+
+	pthread_mutex_unlock(&bus_mtx);
+
+	*sub = nsub;
+
+	return 0;
+}
+
+void pubsub_unsubscribe(pubsub_sub_t *sub) {
+	pthread_mutex_lock(&bus_mtx);
+
+	if (sub->closed) {
+		pthread_mutex_unlock(&bus_mtx);
+		return;
+	}
+
+	unlink_sub(sub->wildcard?&wildcards:&buckets[topic_hash(sub->filter)], sub);
+	bus_stats.subscribers--;
+
+	portENTER_CRITICAL(&sub->lock);
+	sub->closed = 1;
+	portEXIT_CRITICAL(&sub->lock);
+
+	pthread_mutex_unlock(&bus_mtx);
+
+	// Wake the receiver, and the blocked publishers
+	xSemaphoreGive(sub->items);
+	xSemaphoreGive(sub->space);
+
+	pubsub_sub_release(sub);
+}
+
+void pubsub_sub_release(pubsub_sub_t *sub) {
+	if (__atomic_sub_fetch(&sub->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	while (sub->count > 0) {
+		pubsub_msg_release(sub->queue[sub->head]);
+		sub->head = (sub->head + 1) % sub->size;
+		sub->count--;
+	}
+
+	vSemaphoreDelete(sub->items);
+	vSemaphoreDelete(sub->space);
+	free(sub->queue);
+	free(sub->filter);
+	free(sub);
+}
+
+int pubsub_publish(const char *topic, const void *data, size_t len, uint32_t *delivered) {
+	pubsub_sub_t *local[PUBSUB_LOCAL_SUBS];
+	pubsub_sub_t **subs = local;
+	pubsub_msg_t *msg;
+	uint32_t count = 0;
+	uint32_t n, i;
+	size_t tlen;
+
+	if (!topic_check(topic, 0)) {
+		return EINVAL;
+	}
+
+	tlen = strlen(topic);
+
+	msg = malloc(sizeof(pubsub_msg_t) + len + tlen + 1);
+	if (!msg) {
+		return ENOMEM;
+	}
+
+	msg->refs = 1;
+	msg->len = len;
+	if (len > 0) {
+		memcpy(msg->data, data, len);
+	}
+	memcpy(&msg->data[len], topic, tlen + 1);
+	msg->topic = (const char *)&msg->data[len];
+
+	pthread_mutex_lock(&bus_mtx);
+
+	n = collect(topic, NULL);
+	if (n > PUBSUB_LOCAL_SUBS) {
+		subs = malloc(n * sizeof(pubsub_sub_t *));
+		if (!subs) {
+			pthread_mutex_unlock(&bus_mtx);
+			free(msg);
+
+			return ENOMEM;
+		}
+	}
+
+	collect(topic, subs);
+
+	pthread_mutex_unlock(&bus_mtx);
+
+	__atomic_add_fetch(&bus_stats.published, 1, __ATOMIC_RELAXED);
+
+	// Deliver out of the bus lock, as a publisher can block
+	for(i = 0; i < n; i++) {
+		count += sub_put(subs[i], msg);
+		pubsub_sub_release(subs[i]);
+	}
+
+	if (subs != local) {
+		free(subs);
+	}
+
+	pubsub_msg_release(msg);
+
+	if (delivered) {
+		*delivered = count;
+	}
+
+	return 0;
+}
+
+pubsub_msg_t *pubsub_receive(pubsub_sub_t *sub, TickType_t ticks) {
+	pubsub_msg_t *msg = NULL;
+
+	if (xSemaphoreTake(sub->items, ticks) != pdTRUE) {
+		return NULL;
+	}
+
+	portENTER_CRITICAL(&sub->lock);
+	if (sub->count > 0) {
+		msg = sub->queue[sub->head];
+		sub->head = (sub->head + 1) % sub->size;
+		sub->count--;
+	}
+	portEXIT_CRITICAL(&sub->lock);
+
+	if (msg && (sub->overflow == PubSubBlock)) {
+		xSemaphoreGive(sub->space);
+	}
+
+	return msg;
+}
+
+void pubsub_msg_release(pubsub_msg_t *msg) {
+	if (__atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(msg);
+	}
+}
+
+void pubsub_sub_stats(pubsub_sub_t *sub, uint32_t *queued, uint32_t *delivered, uint32_t *dropped) {
+	portENTER_CRITICAL(&sub->lock);
+	if (queued) *queued = sub->count;
+	if (delivered) *delivered = sub->delivered;
+	if (dropped) *dropped = sub->dropped;
+	portEXIT_CRITICAL(&sub->lock);
+}
+
+void pubsub_stats(pubsub_stats_t *stats) {
+	pthread_mutex_lock(&bus_mtx);
+	*stats = bus_stats;
+	pthread_mutex_unlock(&bus_mtx);
+}
@@ -0,0 +1,107 @@
+/*
+ * Lua RTOS, publish / subscribe bus
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+/*
+ * In-process publish / subscribe bus.
+ *
+ * Messages are published to a topic, a string of levels separated by /,
+ * such as "sensor/temp/1". A subscriber uses a filter, that is a topic
+ * that can have wildcards: + matches one level, and # at the end matches
+ * any number of levels (MQTT style).
+ *
+ * Each subscriber has its own bounded queue, and an overflow policy that
+ * tells what happens when a message is published to a full queue. A
+ * message is published once, and shared by all the queues it is delivered
+ * to, so the payload is copied only once.
+ */
+
+#ifndef _PUBSUB_H
+#define	_PUBSUB_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PUBSUB_MAX_TOPIC 128
+#define PUBSUB_MAX_QUEUE 1024
+
+// Exact filters are hashed into this number of buckets
+#define PUBSUB_BUCKETS   32
+
+typedef enum {
+	PubSubDropOldest = 0, // the oldest message in the queue is dropped
+	PubSubDropNewest = 1, // the published message is dropped
+	PubSubBlock      = 2, // the publisher waits for space in the queue
+} pubsub_overflow_t;
+
+typedef struct pubsub_msg {
+	volatile uint32_t refs;
+	const char *topic;
+	size_t len;
+	uint8_t data[];       // payload, then topic
+} pubsub_msg_t;
+
+typedef struct pubsub_sub {
+	struct pubsub_sub *next;     // next subscriber in the bucket, or in the wildcard list
+	volatile uint32_t refs;
+	char *filter;
+	uint8_t wildcard;
+	uint8_t closed;
+	pubsub_overflow_t overflow;
+	portMUX_TYPE lock;           // protects the queue
+	pubsub_msg_t **queue;
+	uint32_t size;
+	uint32_t head;
+	uint32_t count;
+	SemaphoreHandle_t items;     // messages in the queue
+	SemaphoreHandle_t space;     // wakes blocked publishers
+	uint32_t delivered;
+	uint32_t dropped;
+} pubsub_sub_t;
+
+typedef struct {
+	uint32_t published;
+	uint32_t delivered;
+	uint32_t dropped;
+	uint32_t subscribers;
+} pubsub_stats_t;
+
+int pubsub_subscribe(const char *filter, uint32_t size, pubsub_overflow_t overflow, pubsub_sub_t **sub);
+void pubsub_unsubscribe(pubsub_sub_t *sub);
+void pubsub_sub_release(pubsub_sub_t *sub);
+int pubsub_publish(const char *topic, const void *data, size_t len, uint32_t *delivered);
+pubsub_msg_t *pubsub_receive(pubsub_sub_t *sub, TickType_t ticks);
+void pubsub_msg_release(pubsub_msg_t *msg);
+void pubsub_sub_stats(pubsub_sub_t *sub, uint32_t *queued, uint32_t *delivered, uint32_t *dropped);
+void pubsub_stats(pubsub_stats_t *stats);
+int pubsub_topic_match(const char *filter, const char *topic);
+
+#endif	/* _PUBSUB_H */
@@ -0,0 +1,381 @@
+/*
+ * Lua RTOS, software timer service
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <sys/swtimer.h>
+
+#include <pthread/pthread.h>
+
+#define SWTIMER_TICK_US (portTICK_PERIOD_MS * 1000ULL)
+
+// Initial capacity of the heap, that grows as needed
+#define SWTIMER_HEAP_SIZE 16
+
+// Protects the heap, and serializes the callbacks with swtimer_stop
+static pthread_mutex_t svc_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// Wakes up the service task when the earliest deadline changes
+static SemaphoreHandle_t wake = NULL;
+static TaskHandle_t task = NULL;
+
+// 1-based binary min-heap, heap[1] is the next timer to expire
+static swtimer_t **heap = NULL;
+static uint32_t heap_size = 0;
+static uint32_t heap_count = 0;
+
+static uint32_t seq = 0;
+
+// Monotonic clock, see swtimer_now
+static portMUX_TYPE clock_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t clock_now = 0;
+static uint64_t clock_tv = 0;
+static TickType_t clock_ticks = 0;
+
+/*
+ * The system time has microsecond resolution, but it can be set (for
+ * example by SNTP), and the tick count can't be set, but it has the
+ * resolution of the tick. The clock advances as the system time, unless
+ * it differs from the tick count by more than 2 ticks, that means that the
+ * system time was set, and then it advances as the tick count.
+ */
+uint64_t swtimer_now(void) {
+	struct timeval tv;
+	TickType_t ticks;
+	int64_t elapsed, elapsed_ticks;
+	uint64_t now, us;
+
+	gettimeofday(&tv, NULL);
+	ticks = xTaskGetTickCount();
+
+	us = (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+
+	portENTER_CRITICAL(&clock_lock);
+
+	elapsed = (int64_t)(us - clock_tv);
+	elapsed_ticks = (int64_t)(TickType_t)(ticks - clock_ticks) * SWTIMER_TICK_US;
+
+	if ((elapsed < elapsed_ticks - 2 * (int64_t)SWTIMER_TICK_US) || (elapsed > elapsed_ticks + 2 * (int64_t)SWTIMER_TICK_US)) {
+		elapsed = elapsed_ticks;
+	}
+
+	// Another CPU can have read a later time, and updated the clock first
+	if (elapsed > 0) {
+		clock_now += elapsed;
+		clock_tv = us;
+		clock_ticks = ticks;
+	}
+
+	now = clock_now;
+
+	portEXIT_CRITICAL(&clock_lock);
+
+	return now;
+}
+
+/*
+ * Heap
+ */
+
+static inline int heap_before(swtimer_t *a, swtimer_t *b) {
+	if (a->deadline != b->deadline) {
+		return (a->deadline < b->deadline);
+	}
+
+	// Same deadline, first started first
+	return ((int32_t)(a->seq - b->seq) < 0);
+}
+
+static inline void heap_set(uint32_t index, swtimer_t *timer) {
+	heap[index] = timer;
+	timer->index = index;
+}
+
+static void heap_up(uint32_t index) {
+	swtimer_t *timer = heap[index];
+
+	while ((index > 1) && heap_before(timer, heap[index >> 1])) {
+		heap_set(index, heap[index >> 1]);
+		index >>= 1;
+	}
+
+	heap_set(index, timer);
+}
+
+static void heap_down(uint32_t index) {
+	swtimer_t *timer = heap[index];
+	uint32_t child;
+
+	while ((child = index << 1) <= heap_count) {
+		if ((child < heap_count) && heap_before(heap[child + 1], heap[child])) {
+			child++;
+		}
+
+		if (!heap_before(heap[child], timer)) {
+			break;
+		}
+
+		heap_set(index, heap[child]);
+		index = child;
+	}
+
+	heap_set(index, timer);
+}
+
+static int heap_insert(swtimer_t *timer) {
+	swtimer_t **tmp;
+	uint32_t size;
+
+	if (heap_count + 1 >= heap_size) {
+		size = heap_size ? (heap_size << 1) : SWTIMER_HEAP_SIZE;
+
+		tmp = realloc(heap, size * sizeof(swtimer_t *));
+		if (!tmp) {
+			return ENOMEM;
+		}
+
+		heap = tmp;
+		heap_size = size;
+	}
+
+	heap_count++;
+	heap_set(heap_count, timer);
+	heap_up(heap_count);
+
+	return 0;
+}
+
+static void heap_remove(swtimer_t *timer) {
+	uint32_t index = timer->index;
+	swtimer_t *last;
+
+	timer->index = 0;
+
+	last = heap[heap_count--];
+	if (last == timer) {
+		return;
+	}
+
+	// Move the last timer to the hole, then up or down
+	heap_set(index, last);
+	if ((index > 1) && heap_before(last, heap[index >> 1])) {
+		heap_up(index);
+	} else {
+		heap_down(index);
+	}
+}
+
+/*
+ * Service
+ */
+
+static void timer_expire(swtimer_t *timer, uint64_t now) {
+	uint64_t late;
+
+	timer->fired++;
+
+	if (timer->flags & SWTIMER_ONESHOT) {
+		heap_remove(timer);
+	} else {
+		// From the previous deadline, so the error doesn't accumulate
+		timer->deadline += timer->period;
+		if (timer->deadline <= now) {
+			late = (now - timer->deadline) / timer->period + 1;
+
+			timer->missed += late;
+			timer->deadline += late * timer->period;
+		}
+
+		heap_down(timer->index);
+	}
+
+	timer->callback(timer->arg);
+}
+
+static void swtimer_task(void *args) {
+	swtimer_t *timer;
+	TickType_t ticks;
+	uint64_t now, wait, until;
+	int spin, spun = 0;
+
+	for(;;) {
+		ticks = portMAX_DELAY;
+		spin = 0;
+		until = 0;
+
+		pthread_mutex_lock(&svc_mtx);
+
+		while (heap_count > 0) {
+			timer = heap[1];
+			now = swtimer_now();
+
+			if (timer->deadline <= now) {
+				timer_expire(timer, now);
+				continue;
+			}
+
+			wait = timer->deadline - now;
+			if (timer->flags & SWTIMER_HIRES) {
+				// Sleep until the last tick, then busy wait. The task blocks
+				// between two busy waits, so it never spins for more than a
+				// tick without letting the lower priority tasks run.
+				ticks = wait / SWTIMER_TICK_US;
+				if (ticks == 0) {
+					if (spun) {
+						ticks = 1;
+					} else {
+						spin = 1;
+					}
+				}
+				until = timer->deadline;
+			} else {
+				// A tick wait can end before a tick period, so it can end
+				// before the deadline, but never after
+				ticks = (wait + SWTIMER_TICK_US - 1) / SWTIMER_TICK_US;
+			}
+
+			break;
+		}
+
+		pthread_mutex_unlock(&svc_mtx);
+
+		if (spin) {
+			// The timer can be stopped meanwhile, so it is checked again with
+			// the lock taken
+			while (swtimer_now() < until) {
+				if (uxSemaphoreGetCount(wake)) {
+					break;
+				}
+			}
+
+			spun = 1;
+			continue;
+		}
+
+		xSemaphoreTake(wake, ticks);
+		spun = 0;
+	}
+}
+
+static int service_start(void) {
+	if (task) {
+		return 0;
+	}
+
+	if (!wake) {
+		wake = xSemaphoreCreateBinary();
+		if (!wake) {
+			return ENOMEM;
+		}
+	}
+
+	if (xTaskCreatePinnedToCore(swtimer_task, "swtimer", configTIMER_TASK_STACK_DEPTH, NULL, configTIMER_TASK_PRIORITY, &task, xPortGetCoreID()) != pdPASS) {
+		task = NULL;
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * API
+ */
+
+int swtimer_start(swtimer_t *timer, uint64_t period, uint32_t flags, swtimer_callback_t callback, void *arg) {
+	int res;
+
+	if ((period == 0) || !callback) {
+		return EINVAL;
+	}
+
+	if ((flags & SWTIMER_HIRES) && (period < SWTIMER_TICK_US)) {
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&svc_mtx);
+
+	if (timer->index) {
+		pthread_mutex_unlock(&svc_mtx);
+		return EINVAL;
+	}
+
+	if ((res = service_start())) {
+		pthread_mutex_unlock(&svc_mtx);
+		return res;
+	}
+
+	timer->period = period;
+	timer->deadline = swtimer_now() + period;
+	timer->seq = seq++;
+	timer->flags = flags;
+	timer->fired = 0;
+	timer->missed = 0;
+	timer->callback = callback;
+	timer->arg = arg;
+
+	if ((res = heap_insert(timer))) {
+		pthread_mutex_unlock(&svc_mtx);
+		return res;
+	}
+
+	// The service task sleeps until the previous earliest deadline
+	if (timer->index == 1) {
+		xSemaphoreGive(wake);
+	}
+
+	pthread_mutex_unlock(&svc_mtx);
+
+	return 0;
+}
+
+void swtimer_stop(swtimer_t *timer) {
+	pthread_mutex_lock(&svc_mtx);
+
+	if (timer->index) {
+		heap_remove(timer);
+	}
+
+	pthread_mutex_unlock(&svc_mtx);
+}
+
+void swtimer_stats(swtimer_t *timer, uint32_t *fired, uint32_t *missed) {
+	pthread_mutex_lock(&svc_mtx);
+
+	if (fired) *fired = timer->fired;
+	if (missed) *missed = timer->missed;
+
+	pthread_mutex_unlock(&svc_mtx);
+}
@@ -0,0 +1,99 @@
+/*
+ * Lua RTOS, software timer service
+ *
+ * Copyright (C) 2015 - 2017
+ * IBEROXARXA SERVICIOS INTEGRALES, S.L. & CSS IBÉRICA, S.L.
+ * 
+ * Author: Jaume Olivé (jolive@iberoxarxa.com / jolive@whitecatboard.org)
+ * 
+ * All rights reserved.  
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+
+/*
+ * Software timer service.
+ *
+ * All the timers are served by a single task, that keeps them in a binary
+ * min-heap ordered by deadline, and sleeps until the earliest deadline, so
+ * the cost of a timer doesn't depend on the number of timers.
+ *
+ * Deadlines are in microseconds. A periodic timer is rescheduled from its
+ * previous deadline, not from the time it was served, so it doesn't drift.
+ * If the service is late by more than a period, the missed expirations are
+ * counted, and the timer expires only once.
+ *
+ * Normal timers are served with the resolution of the system tick. A high
+ * resolution timer (SWTIMER_HIRES) makes the service task busy wait for the
+ * last tick before its deadline, so its period can't be less than a tick.
+ *
+ * Callbacks are called from the service task, with the service locked, so
+ * they must be short, must not block, and must not call swtimer functions.
+ * They are typically used for queueing work to another task.
+ */
+
+#ifndef _SWTIMER_H
+#define	_SWTIMER_H
+
+#include <stdint.h>
+
+// Flags
+#define SWTIMER_ONESHOT (1 << 0) // expires once, otherwise periodic
+#define SWTIMER_HIRES   (1 << 1) // microsecond resolution
+
+typedef void (*swtimer_callback_t)(void *arg);
+
+typedef struct swtimer {
+	uint64_t deadline;           // next expiration, in microseconds
+	uint64_t period;             // in microseconds
+	uint32_t index;              // position in the heap, 0 if not started
+	uint32_t seq;                // start order, for timers with the same deadline
+	uint32_t flags;
+	uint32_t fired;              // number of expirations
+	uint32_t missed;             // number of expirations skipped by a late service
+	swtimer_callback_t callback;
+	void *arg;
+} swtimer_t;
+
+/*
+ * Start a timer that expires after period microseconds, and then every
+ * period microseconds if it is periodic. The timer structure is owned by
+ * the caller, and must not be freed until the timer is stopped.
+ *
+ * Returns 0 on success, EINVAL if period is 0, or less than a tick for a
+ * high resolution timer, or if the timer is already started, or ENOMEM.
+ */
+int swtimer_start(swtimer_t *timer, uint64_t period, uint32_t flags, swtimer_callback_t callback, void *arg);
+
+/*
+ * Stop a timer. When this function returns, the callback of the timer is
+ * not running, and will not be called. Stopping a timer that is not started,
+ * or a one shot timer that has expired, does nothing.
+ */
+void swtimer_stop(swtimer_t *timer);
+
+// Get the expirations and missed expirations of a timer
+void swtimer_stats(swtimer_t *timer, uint32_t *fired, uint32_t *missed);
+
+// Current time, in microseconds since boot. It is monotonic, setting the
+// system time doesn't change it.
+uint64_t swtimer_now(void);
+
+#endif	/* _SWTIMER_H */
@@ -7,8 +7,12 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include <fcntl.h>
+
 #include <sys/mount.h>
 
+#include "manifest.h"
+
 extern int __real__open_r(struct _reent *r, const char *path, int flags, int mode);
 
 int IRAM_ATTR __wrap__open_r(struct _reent *r, const char *path, int flags, int mode) {
@@ -27,6 +31,14 @@ int IRAM_ATTR __wrap__open_r(struct _reent *r, const char *path, int flags, int
 		if (ppath) {
 			res = __real__open_r(r, ppath, flags, mode);
 			free(ppath);
+
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+			// The file can be changed, so its bytecode is not used anymore
+			if ((res >= 0) && (((flags & O_ACCMODE) != O_RDONLY) || (flags & O_TRUNC))) {
+				manifest_invalidate(path);
+			}
+#endif
+
 			return res;
 		} else {
 			return -1;
@@ -9,6 +9,8 @@
 
 #include <sys/mount.h>
 
+#include "manifest.h"
+
 extern int __real__rename_r(struct _reent *r, const char *src, const char *dst);
 
 int IRAM_ATTR __wrap__rename_r(struct _reent *r, const char *src, const char *dst) {
@@ -43,5 +45,12 @@ int IRAM_ATTR __wrap__rename_r(struct _reent *r, const char *src, const char *ds
 	free(ppath_src);
 	free(ppath_dst);
 
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+	if (res == 0) {
+		manifest_invalidate(src);
+		manifest_invalidate(dst);
+	}
+#endif
+
 	return res;
 }
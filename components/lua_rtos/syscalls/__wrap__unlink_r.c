@@ -9,6 +9,8 @@
 
 #include <sys/mount.h>
 
+#include "manifest.h"
+
 extern int __real__unlink_r(struct _reent *r, const char *path);
 
 int IRAM_ATTR __wrap__unlink_r(struct _reent *r, const char *path) {
@@ -26,6 +28,12 @@ int IRAM_ATTR __wrap__unlink_r(struct _reent *r, const char *path) {
 
 		free(ppath);
 
+#if CONFIG_LUA_RTOS_LUA_USE_MANIFEST
+		if (res == 0) {
+			manifest_invalidate(path);
+		}
+#endif
+
 		return res;
 	} else {
 		return -1;
@@ -31,6 +31,15 @@
 
 #if USE_NET_VFS
 
+/*
+ * A socket has a file descriptor in the vfs, that is formed by the vfs
+ * index of /dev/socket in the upper bits, and the lwip socket number in the
+ * lower CONFIG_MAX_FD_BITS bits. The file descriptor of the socket 0 is
+ * got once, when the vfs is registered, so a socket is translated to, and
+ * from, its file descriptor with a mask, without opening /dev/socket/n
+ * (and allocating a stream) for each new socket.
+ */
+
 #include "freertos/FreeRTOS.h"
 #include "lwip/sockets.h"
 
@@ -38,36 +47,80 @@
 #include "esp_attr.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "vfs.h"
+
+#define VFS_NET_SOCKET_MASK ((1 << CONFIG_MAX_FD_BITS) - 1)
+
+#if CONFIG_LWIP_MAX_SOCKETS > (1 << CONFIG_MAX_FD_BITS)
+#error "CONFIG_LWIP_MAX_SOCKETS doesn't fit in CONFIG_MAX_FD_BITS"
+#endif
+
+// File descriptor of the socket 0
+static int vfs_net_fd_base = 0;
+
+extern int __real_lwip_send_r(int s, const void *dataptr, size_t size, int flags);
+extern int __real_lwip_recv_r(int s, void *mem, size_t len, int flags);
+extern int __real_lwip_close_r(int s);
+
 static int IRAM_ATTR vfs_net_open(const char *path, int flags, int mode);
 static size_t IRAM_ATTR vfs_net_write(int fd, const void *data, size_t size);
 static ssize_t IRAM_ATTR vfs_net_read(int fd, void * dst, size_t size);
 static int IRAM_ATTR vfs_net_close(int fd);
 
 static int IRAM_ATTR vfs_net_open(const char *path, int flags, int mode) {
-	int s;
+	char *end;
+	long s;
 
 	// Get socket number
-	sscanf(path,"/%d", &s);
+	s = strtol(path + 1, &end, 10);
+	if ((end == path + 1) || *end || (s < 0) || (s > VFS_NET_SOCKET_MASK)) {
+		errno = ENOENT;
+		return -1;
+	}
 
     return s;
 }
 
+// The vfs gives the socket number, not its file descriptor, so the lwip
+// functions are called without the translation of lwip/socket.c
 static size_t IRAM_ATTR vfs_net_write(int fd, const void *data, size_t size) {
-	return (ssize_t)lwip_send(fd, data, size, 0);
+	return (ssize_t)__real_lwip_send_r(fd, data, size, 0);
 }
 
 static ssize_t IRAM_ATTR vfs_net_read(int fd, void * dst, size_t size) {
-    return (ssize_t)lwip_recv(fd, dst, size, 0);
+    return (ssize_t)__real_lwip_recv_r(fd, dst, size, 0);
 }
 
 static int IRAM_ATTR vfs_net_close(int fd) {
-	return closesocket(fd);
+	return __real_lwip_close_r(fd);
+}
+
+int IRAM_ATTR vfs_net_fd(int s) {
+	if (s < 0) {
+		return s;
+	}
+
+	return vfs_net_fd_base | s;
+}
+
+int IRAM_ATTR vfs_net_socket(int fd) {
+	// File descriptors of other vfs, as the ones of the console, are not
+	// sockets
+	if ((fd < 0) || ((fd & ~VFS_NET_SOCKET_MASK) != vfs_net_fd_base)) {
+		return -1;
+	}
+
+	return fd & VFS_NET_SOCKET_MASK;
 }
 
 void vfs_net_register() {
+	int fd;
+
     esp_vfs_t vfs = {
         .fd_offset = 0,
         .flags = ESP_VFS_FLAG_DEFAULT,
@@ -84,6 +137,15 @@ void vfs_net_register() {
     };
 
     ESP_ERROR_CHECK(esp_vfs_register("/dev/socket", &vfs, NULL));
+
+    // The vfs doesn't allocate anything on open, so there is nothing to
+    // close
+    fd = open("/dev/socket/0", O_RDWR);
+    if (fd < 0) {
+    	ESP_ERROR_CHECK(ESP_FAIL);
+    }
+
+    vfs_net_fd_base = fd & ~VFS_NET_SOCKET_MASK;
 }
 
 #endif
@@ -29,6 +29,8 @@
 
 void vfs_fat_register();
 void vfs_net_register();
+int vfs_net_fd(int s);
+int vfs_net_socket(int fd);
 void vfs_spiffs_register();
 void vfs_tty_register();
 void vfs_spiffs_format();
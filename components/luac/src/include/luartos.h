@@ -0,0 +1,12 @@
+/*
+ * Lua RTOS, luartos.h for the host build of luac
+ *
+ * luac only needs the Lua core, that doesn't depend on the target
+ * configuration, so nothing is defined here. This header shadows the
+ * target's luartos.h, that depends on FreeRTOS and sdkconfig.
+ */
+
+#ifndef LUA_RTOS_LUARTOS_H_
+#define LUA_RTOS_LUARTOS_H_
+
+#endif
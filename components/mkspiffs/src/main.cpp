@@ -9,6 +9,9 @@
 
 #include <iostream>
 #include "spiffs/spiffs.h"
+extern "C" {
+#include "spiffs/spiffs_nucleus.h"
+}
 #include <vector>
 #include <dirent.h>
 #include <sys/types.h>
@@ -18,9 +21,22 @@
 #include <string>
 #include <memory>
 #include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include "tclap/CmdLine.h"
 #include "tclap/UnlabeledValueArg.h"
 
+// WHITECAT BEGIN
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "lundump.h"
+}
+// WHITECAT END
+
 static std::vector<uint8_t> s_flashmem;
 
 static std::string s_dirName;
@@ -32,6 +48,35 @@ static int s_blockSize;
 enum Action { ACTION_NONE, ACTION_PACK, ACTION_UNPACK, ACTION_LIST, ACTION_VISUALIZE };
 static Action s_action = ACTION_NONE;
 
+// WHITECAT BEGIN
+static bool s_compile = false;
+static bool s_minify = false;
+static bool s_arrange = false;
+static int s_jobs = 0;
+
+// Manifest of the precompiled files, read by Lua RTOS (see Lua/common/manifest.h)
+#define MANIFEST_FILE "/.manifest"
+
+struct ManifestEntry {
+    std::string path;
+    size_t size;
+};
+
+static std::vector<ManifestEntry> s_manifest;
+
+// File to pack. Files are read, and prepared, by the pack jobs, and then
+// written to the image.
+struct PackFile {
+    std::string name;      // name in image
+    std::string path;      // source path
+    std::string data;      // content
+    std::string bytecode;  // precompiled content, if compiled
+    bool compiled;
+};
+
+static std::vector<PackFile> s_packFiles;
+// WHITECAT END
+
 static spiffs s_fs;
 
 static std::vector<uint8_t> s_spiffsWorkBuf;
@@ -77,7 +122,13 @@ int spiffsTryMount(){
     const int maxOpenFiles = 4;
     s_spiffsWorkBuf.resize(s_pageSize * 2);
     s_spiffsFds.resize(32 * maxOpenFiles);
-    s_spiffsCache.resize((32 + s_pageSize) * maxOpenFiles);
+
+    // WHITECAT BEGIN
+    // Biggest cache supported by SPIFFS (32 pages), so writes of whole
+    // blocks are done in the cache
+    const int cachePages = 32;
+    s_spiffsCache.resize(sizeof(spiffs_cache) + (sizeof(spiffs_cache_page) + s_pageSize) * cachePages);
+    // WHITECAT END
 
     return SPIFFS_mount(&s_fs, &cfg,
         &s_spiffsWorkBuf[0],
@@ -133,37 +184,208 @@ int addDir(const char* name) {
 
     return 0;
 }
-// WHITECAT END
 
-int addFile(char* name, const char* path) {
-    FILE* src = fopen(path, "rb");
-    if (!src) {
-        std::cerr << "error: failed to open " << path << " for reading" << std::endl;
-        return 1;
+// Bytecode header of the Lua RTOS target (ESP32, LUA_32BITS, little endian):
+// int, size_t, Instruction, lua_Integer and lua_Number are 4 bytes, followed
+// by LUAC_INT and LUAC_NUM (370.5f)
+static const char s_luacSizes[] = {4, 4, 4, 4, 4};
+static const char s_luacInt[] = {0x78, 0x56, 0x00, 0x00};
+static const char s_luacNum[] = {0x00, 0x40, (char)0xb9, 0x43};
+
+static std::string luacHeader() {
+    std::string header = LUA_SIGNATURE;
+
+    header += (char)LUAC_VERSION;
+    header += (char)LUAC_FORMAT;
+    header += LUAC_DATA;
+    header.append(s_luacSizes, sizeof(s_luacSizes));
+    header.append(s_luacInt, sizeof(s_luacInt));
+    header.append(s_luacNum, sizeof(s_luacNum));
+
+    return header;
+}
+
+static int luaWriter(lua_State *L, const void *p, size_t size, void *ud) {
+    ((std::string *)ud)->append((const char *)p, size);
+    return 0;
+}
+
+// Compile a Lua source to stripped bytecode. The bytecode must have the
+// target's header, and must load back.
+static bool compileLua(lua_State *L, const std::string& source, const char* name, std::string& bytecode) {
+    std::string chunk = source;
+    std::string chunkName = "@";
+    chunkName += name;
+
+    // Skip first line if it's a comment (Unix exec. file), as loadfile does
+    if (!chunk.empty() && chunk[0] == '#') {
+        size_t eol = chunk.find('\n');
+        chunk.replace(0, (eol == std::string::npos) ? chunk.size() : eol, "");
     }
 
-    spiffs_file dst = SPIFFS_open(&s_fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (luaL_loadbufferx(L, chunk.data(), chunk.size(), chunkName.c_str(), "t") != LUA_OK) {
+        std::cerr << "error: " << lua_tostring(L, -1) << std::endl;
+        lua_pop(L, 1);
+        return false;
+    }
 
-    // read file size
-    fseek(src, 0, SEEK_END);
-    size_t size = ftell(src);
-    fseek(src, 0, SEEK_SET);
+    bytecode.clear();
+    lua_dump(L, luaWriter, &bytecode, 1);
+    lua_pop(L, 1);
 
-    if (g_debugLevel > 0) {
-        std::cout << "file size: " << size << std::endl;
+    std::string header = luacHeader();
+    if (bytecode.compare(0, header.size(), header) != 0) {
+        std::cerr << "error: " << name << ": bytecode is not compatible with Lua RTOS "
+                  << "(mkspiffs must be built with LUA_32BITS on a little endian host)" << std::endl;
+        return false;
     }
 
-    size_t left = size;
-    uint8_t data_byte;
-    while (left > 0){
-        if (1 != fread(&data_byte, 1, 1, src)) {
-            std::cerr << "fread error!" << std::endl;
+    if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunkName.c_str(), "b") != LUA_OK) {
+        std::cerr << "error: " << name << ": bytecode doesn't load: " << lua_tostring(L, -1) << std::endl;
+        lua_pop(L, 1);
+        return false;
+    }
 
-            fclose(src);
-            SPIFFS_close(&s_fs, dst);
-            return 1;
+    lua_pop(L, 1);
+
+    return true;
+}
+
+static bool isWordChar(char c) {
+    return isalnum((unsigned char)c) || (c == '_');
+}
+
+static bool isOpChar(char c) {
+    return (c != 0) && (strchr("-+*/%^#&~|<>=.:[]", c) != NULL);
+}
+
+// If there is an opening long bracket at pos, returns its level + 1,
+// otherwise 0
+static size_t longBracket(const std::string& src, size_t pos) {
+    size_t i = pos + 1;
+
+    if ((pos >= src.size()) || (src[pos] != '[')) {
+        return 0;
+    }
+
+    while ((i < src.size()) && (src[i] == '=')) {
+        i++;
+    }
+
+    return ((i < src.size()) && (src[i] == '[')) ? (i - pos) : 0;
+}
+
+// Returns the position after the closing long bracket of a long string or
+// comment that starts at pos, or the end of the source if it's unfinished
+static size_t longBracketEnd(const std::string& src, size_t pos, size_t level) {
+    std::string close = "]" + std::string(level - 1, '=') + "]";
+    size_t end = src.find(close, pos + level + 1);
+
+    return (end == std::string::npos) ? src.size() : end + close.size();
+}
+
+// Minify a Lua source. Comments, indentation and spaces that don't separate
+// tokens are removed. Line breaks are kept, so line numbers are the same.
+static std::string minifyLua(const std::string& src) {
+    std::string dst;
+    bool space = false;
+    size_t i = 0, end, level;
+
+    // Keep first line if it's a comment (Unix exec. file)
+    if (!src.empty() && src[0] == '#') {
+        i = src.find('\n');
+        if (i == std::string::npos) {
+            return src;
+        }
+        dst = src.substr(0, i);
+    }
+
+    while (i < src.size()) {
+        char c = src[i];
+
+        if (c == '\n') {
+            dst += c;
+            space = false;
+            i++;
+            continue;
+        }
+
+        if (isspace((unsigned char)c)) {
+            space = true;
+            i++;
+            continue;
+        }
+
+        // Comments
+        if ((c == '-') && (i + 1 < src.size()) && (src[i + 1] == '-')) {
+            if ((level = longBracket(src, i + 2))) {
+                end = longBracketEnd(src, i + 2, level);
+                dst.append(std::count(src.begin() + i, src.begin() + end, '\n'), '\n');
+            } else {
+                end = src.find('\n', i);
+                if (end == std::string::npos) {
+                    end = src.size();
+                }
+            }
+
+            space = true;
+            i = end;
+            continue;
+        }
+
+        // Keep a space where tokens would be merged without it
+        if (space && !dst.empty()) {
+            char last = dst[dst.size() - 1];
+
+            if ((isWordChar(last) && (isWordChar(c) || c == '.')) || (isOpChar(last) && isOpChar(c))) {
+                dst += ' ';
+            }
         }
-        int res = SPIFFS_write(&s_fs, dst, &data_byte, 1);
+
+        space = false;
+
+        if ((c == '"') || (c == '\'')) {
+            // Short string
+            end = i + 1;
+            while ((end < src.size()) && (src[end] != c) && (src[end] != '\n')) {
+                if ((src[end] == '\\') && (end + 1 < src.size()) && (src[end + 1] == 'z')) {
+                    // \z skips the following spaces, including line breaks
+                    end += 2;
+                    while ((end < src.size()) && isspace((unsigned char)src[end])) {
+                        end++;
+                    }
+                } else {
+                    end += (src[end] == '\\') ? 2 : 1;
+                }
+            }
+            end = std::min(end + 1, src.size());
+        } else if ((level = longBracket(src, i))) {
+            // Long string
+            end = longBracketEnd(src, i, level);
+        } else {
+            end = i + 1;
+        }
+
+        dst.append(src, i, end - i);
+        i = end;
+    }
+
+    return dst;
+}
+
+// Write a file to the image, in block sized writes
+int writeFile(const char* name, const std::string& data) {
+    spiffs_file dst = SPIFFS_open(&s_fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (dst < 0) {
+        std::cerr << "SPIFFS_open error(" << s_fs.err_code << ")" << std::endl;
+        return 1;
+    }
+
+    size_t left = data.size();
+    const uint8_t *buffer = (const uint8_t *)data.data();
+    while (left > 0){
+        size_t size = std::min(left, (size_t)s_blockSize);
+        int res = SPIFFS_write(&s_fs, dst, (void *)buffer, size);
         if (res < 0) {
             std::cerr << "SPIFFS_write error(" << s_fs.err_code << "): ";
 
@@ -178,16 +400,182 @@ int addFile(char* name, const char* path) {
                 std::cout << "data left: " << left << std::endl;
             }
 
-            fclose(src);
             SPIFFS_close(&s_fs, dst);
             return 1;
         }
-        left -= 1;
+        buffer += size;
+        left -= size;
     }
 
     SPIFFS_close(&s_fs, dst);
+
+    return 0;
+}
+
+// Prepare a Lua source to pack, minified and / or with its bytecode
+int prepareLuaFile(lua_State *L, PackFile& file) {
+    const char *name = file.name.c_str();
+
+    if (s_minify) {
+        std::string minified = minifyLua(file.data);
+        std::string check;
+
+        // Minified source must compile to the same code
+        if (!compileLua(L, file.data, name, file.bytecode) || !compileLua(L, minified, name, check)) {
+            if (s_compile) {
+                return 1;
+            }
+            std::cerr << "warning: " << name << " not minified" << std::endl;
+        } else if (file.bytecode != check) {
+            std::cerr << "error: " << name << ": minified source doesn't compile to the same code" << std::endl;
+            return 1;
+        } else {
+            file.data = minified;
+        }
+    } else if (s_compile) {
+        if (!compileLua(L, file.data, name, file.bytecode)) {
+            return 1;
+        }
+    }
+
+    file.compiled = s_compile;
+
+    return 0;
+}
+
+int addManifest() {
+    char line[64];
+    std::string manifest;
+
+    snprintf(line, sizeof(line), "luac %x %d %d %d %d %d %d le\n", LUAC_VERSION, LUAC_FORMAT,
+        s_luacSizes[0], s_luacSizes[1], s_luacSizes[2], s_luacSizes[3], s_luacSizes[4]);
+    manifest += line;
+
+    // The path is the last field, up to the end of the line
+    for (size_t i = 0; i < s_manifest.size(); i++) {
+        snprintf(line, sizeof(line), "%u ", (unsigned int)s_manifest[i].size);
+        manifest += line;
+        manifest += s_manifest[i].path;
+        manifest += "\n";
+    }
+
+    std::cout << MANIFEST_FILE << std::endl;
+
+    return writeFile(MANIFEST_FILE, manifest);
+}
+// WHITECAT END
+
+// Read a file to pack, and prepare it if it's a Lua source
+int readFile(lua_State *L, PackFile& file) {
+    FILE* src = fopen(file.path.c_str(), "rb");
+    if (!src) {
+        std::cerr << "error: failed to open " << file.path << " for reading" << std::endl;
+        return 1;
+    }
+
+    // read file size
+    fseek(src, 0, SEEK_END);
+    size_t size = ftell(src);
+    fseek(src, 0, SEEK_SET);
+
+    if (g_debugLevel > 0) {
+        std::cout << "file size: " << size << std::endl;
+    }
+
+    file.data.resize(size);
+    if ((size > 0) && (1 != fread(&file.data[0], size, 1, src))) {
+        std::cerr << "fread error!" << std::endl;
+
+        fclose(src);
+        return 1;
+    }
+
     fclose(src);
 
+    const std::string& name = file.name;
+    if (L && (name.size() > 4) && (name.compare(name.size() - 4, 4, ".lua") == 0)) {
+        return prepareLuaFile(L, file);
+    }
+
+    return 0;
+}
+
+// Pack job, reads and prepares files until there are no more files
+static void packJob(std::atomic<size_t>* next, std::atomic<int>* errors) {
+    lua_State *L = (s_compile || s_minify) ? luaL_newstate() : NULL;
+    size_t i;
+
+    while ((i = (*next)++) < s_packFiles.size()) {
+        if (readFile(L, s_packFiles[i]) != 0) {
+            std::cerr << "error adding " << s_packFiles[i].name << "!" << std::endl;
+            (*errors)++;
+        }
+    }
+
+    if (L) {
+        lua_close(L);
+    }
+}
+
+// Read and prepare all the files with s_jobs jobs, and write them to the
+// image. When arranged, bigger files are written first, so they are in
+// contiguous pages, and small files fill the rest of the blocks.
+int packFiles() {
+    std::atomic<size_t> next(0);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> jobs;
+    int count = s_jobs;
+
+    if (count <= 0) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    count = std::min((size_t)count, std::max((size_t)1, s_packFiles.size()));
+
+    for (int i = 1; i < count; i++) {
+        jobs.push_back(std::thread(packJob, &next, &errors));
+    }
+    packJob(&next, &errors);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].join();
+    }
+
+    if (errors > 0) {
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, const std::string*> > writes;
+    for (size_t i = 0; i < s_packFiles.size(); i++) {
+        PackFile& file = s_packFiles[i];
+
+        writes.push_back(std::make_pair(file.name, &file.data));
+        if (file.compiled) {
+            writes.push_back(std::make_pair(file.name + "c", &file.bytecode));
+
+            // A path with a line break can't be in the manifest, so its
+            // bytecode is not used
+            if (file.name.find('\n') == std::string::npos) {
+                ManifestEntry entry = {file.name, file.data.size()};
+                s_manifest.push_back(entry);
+            }
+        }
+    }
+
+    if (s_arrange) {
+        std::stable_sort(writes.begin(), writes.end(),
+            [](const std::pair<std::string, const std::string*>& a, const std::pair<std::string, const std::string*>& b) {
+                return a.second->size() > b.second->size();
+            });
+    }
+
+    for (size_t i = 0; i < writes.size(); i++) {
+        std::cout << writes[i].first << std::endl;
+
+        if (writeFile(writes[i].first.c_str(), *writes[i].second) != 0) {
+            std::cerr << "error adding file!" << std::endl;
+            return 1;
+        }
+    }
+
     return 0;
 }
 
@@ -228,6 +616,10 @@ int addFiles(const char* dirname, const char* subPath) {
                     if (addFiles(dirname, newSubPath.c_str()) != 0)
                     {
                         std::cerr << "Error for adding content from " << ent->d_name << "!" << std::endl;
+                        // WHITECAT BEGIN
+                        error = true;
+                        break;
+                        // WHITECAT END
                     }
 
                     continue;
@@ -242,17 +634,12 @@ int addFiles(const char* dirname, const char* subPath) {
             // Filepath with dirname as root folder.
             std::string filepath = subPath;
             filepath += ent->d_name;
-            std::cout << filepath << std::endl;
-
-            // Add File to image.
-            if (addFile((char*)filepath.c_str(), fullpath.c_str()) != 0) {
-                std::cerr << "error adding file!" << std::endl;
-                error = true;
-                if (g_debugLevel > 0) {
-                    std::cout << std::endl;
-                }
-                break;
-            }
+
+            // WHITECAT BEGIN
+            // Add File to the pack list, it's written by packFiles
+            PackFile file = {filepath, fullpath, "", "", false};
+            s_packFiles.push_back(file);
+            // WHITECAT END
         } // end while
         closedir (dir);
     } else {
@@ -454,7 +841,37 @@ int actionPack() {
 	addDir("");
 	// WHITECAT END
 	
+    // WHITECAT BEGIN
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // WHITECAT END
+
     int result = addFiles(s_dirName.c_str(), "/");
+
+    // WHITECAT BEGIN
+    if (result == 0) {
+        result = packFiles();
+    }
+
+    if ((result == 0) && s_compile) {
+        result = addManifest();
+    }
+
+    if (result == 0) {
+        uint32_t total, used;
+        size_t bytes = 0;
+
+        for (size_t i = 0; i < s_packFiles.size(); i++) {
+            bytes += s_packFiles[i].data.size() + s_packFiles[i].bytecode.size();
+        }
+
+        SPIFFS_info(&s_fs, &total, &used);
+        std::cout << "packed " << s_packFiles.size() << " files, " << bytes << " bytes, "
+                  << used << " of " << total << " bytes used, in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+    // WHITECAT END
+
     spiffsUnmount();
 
     fwrite(&s_flashmem[0], 4, s_flashmem.size()/4, fdres);
@@ -551,11 +968,19 @@ void processArgs(int argc, const char** argv) {
     TCLAP::ValueArg<int> pageSizeArg( "p", "page", "fs page size, in bytes", false, 256, "number" );
     TCLAP::ValueArg<int> blockSizeArg( "b", "block", "fs block size, in bytes", false, 4096, "number" );
     TCLAP::ValueArg<int> debugArg( "d", "debug", "Debug level. 0 means no debug output.", false, 0, "0-5" );
+    TCLAP::SwitchArg compileArg( "x", "compile", "precompile .lua files to .luac, and write a manifest", false);
+    TCLAP::SwitchArg minifyArg( "m", "minify", "minify .lua files", false);
+    TCLAP::SwitchArg arrangeArg( "a", "arrange", "write bigger files first", false);
+    TCLAP::ValueArg<int> jobsArg( "j", "jobs", "jobs for reading and compiling files, 0 means one per CPU", false, 0, "number" );
 
     cmd.add( imageSizeArg );
     cmd.add( pageSizeArg );
     cmd.add( blockSizeArg );
     cmd.add(debugArg);
+    cmd.add(compileArg);
+    cmd.add(minifyArg);
+    cmd.add(arrangeArg);
+    cmd.add(jobsArg);
     std::vector<TCLAP::Arg*> args = {&packArg, &unpackArg, &listArg, &visualizeArg};
     cmd.xorAdd( args );
     cmd.add( outNameArg );
@@ -582,6 +1007,10 @@ void processArgs(int argc, const char** argv) {
     s_imageSize = imageSizeArg.getValue();
     s_pageSize  = pageSizeArg.getValue();
     s_blockSize = blockSizeArg.getValue();
+    s_compile   = compileArg.getValue();
+    s_minify    = minifyArg.getValue();
+    s_arrange   = arrangeArg.getValue();
+    s_jobs      = jobsArg.getValue();
 }
 
 int main(int argc, const char * argv[]) {
@@ -0,0 +1,99 @@
+-- Lua RTOS: cached NVS handles of the nvs module
+--
+-- Checks typed values, batches, rollback and the key index.
+
+print "testing nvs"
+
+local h = nvs.open("test")
+
+-- typed values
+h:write("int", 1234)
+h:write("big", 1 << 40)
+h:write("num", 2.5)
+h:write("bool", true)
+h:write("str", "hello")
+h:write("bin", "a\0b")
+
+assert(h:read("int") == 1234 and math.type(h:read("int")) == "integer")
+assert(h:read("big") == 1 << 40)
+assert(h:read("num") == 2.5 and math.type(h:read("num")) == "float")
+assert(h:read("bool") == true)
+assert(h:read("str") == "hello")
+assert(h:read("bin") == "a\0b")
+
+-- the type of a key can change
+h:write("int", "now a string")
+assert(h:read("int") == "now a string")
+
+-- values written with a handle can be read with nvs.read, and the other way
+assert(nvs.read("test", "str") == "hello")
+nvs.write("test", "old", 7)
+assert(h:read("old") == 7)
+
+-- erase
+h:write("old", nil)
+assert(h:read("old", "default") == "default")
+assert(not pcall(h.read, h, "old"))
+
+-- reads are cached
+local reads = h:stats()
+for i = 1, 100 do
+  assert(h:read("num") == 2.5)
+end
+assert(h:stats() == reads)
+
+-- a batch is written with a single commit
+local _, _, _, commits = h:stats()
+h:begin()
+for i = 1, 100 do
+  h:write("counter", i)
+end
+assert(h:read("counter") == 100)
+h:commit()
+assert(select(4, h:stats()) == commits + 1)
+assert(nvs.read("test", "counter") == 100)
+
+-- rollback
+h:begin()
+h:write("counter", 0)
+h:write("new", 1)
+h:rollback()
+assert(h:read("counter") == 100)
+assert(h:read("new", nil) == nil)
+
+-- each handle has its own batch, and writes outside a batch are written at once
+local h2 = nvs.open("test")
+h:begin()
+h2:begin()
+h:write("counter", 1)
+h2:write("new", 2)
+nvs.write("test", "old", 3)
+assert(h:read("counter") == 1 and h2:read("counter") == 100)
+assert(h:read("new", nil) == nil and h2:read("new") == 2)
+h2:rollback()
+h:commit()
+assert(nvs.read("test", "counter") == 1 and nvs.read("test", "old") == 3)
+assert(h:read("new", nil) == nil)
+h2:close()
+h:write("counter", 100)
+h:write("old", nil)
+assert(not pcall(h.commit, h))
+
+-- keys
+local keys = {}
+for _, k in ipairs(h:keys()) do keys[k] = true end
+assert(keys.int and keys.big and keys.num and keys.bool and keys.str and keys.bin and keys.counter)
+assert(not keys.old and not keys.new)
+
+-- cleanup
+h:begin()
+for _, k in ipairs(h:keys()) do
+  h:write(k, nil)
+end
+h:commit()
+assert(#h:keys() == 0)
+
+h:close()
+assert(not pcall(h.read, h, "int"))
+
+print "OK"
@@ -0,0 +1,229 @@
+-- Lua RTOS: binary codec of the pack module
+--
+-- Round trips of random values through pack.encode / pack.decode, compared
+-- with string.pack, and a throughput comparison with the hex codec of
+-- pack.pack / pack.unpack.
+
+print "testing pack"
+
+math.randomseed(1234)
+
+local maxi, mini = math.maxinteger, math.mininteger
+local intbits = string.packsize("j") * 8
+
+-- a random integer, with all the bits random
+local function rand()
+  local v = 0
+  for i = 1, intbits // 16 do v = (v << 16) | math.random(0, 0xffff) end
+  return v
+end
+
+-- a random integer that fits in a signed / unsigned integer of n bytes
+local function randint(n, signed)
+  local bits = math.min(n * 8, intbits)
+  local v = rand()
+
+  if bits < intbits then
+    v = v & ((1 << bits) - 1)
+    if signed and v >= (1 << (bits - 1)) then
+      v = v - (1 << bits)
+    end
+  elseif not signed and n * 8 == intbits then
+    -- any value is valid
+  elseif not signed then
+    v = v & maxi
+  end
+
+  return v
+end
+
+local function randstr(n)
+  local t = {}
+  for i = 1, n do t[i] = string.char(math.random(0, 255)) end
+  return table.concat(t)
+end
+
+-- fixed size options, compatible with string.pack
+local ints = {
+  {"b", 1, true}, {"B", 1, false}, {"h", 2, true}, {"H", 2, false},
+  {"i3", 3, true}, {"I3", 3, false}, {"i", 4, true}, {"I", 4, false},
+  {"j", intbits // 8, true}, {"J", intbits // 8, false},
+}
+
+for _, e in ipairs({"<", ">", "="}) do
+  for _, o in ipairs(ints) do
+    for i = 1, 200 do
+      local fmt = e .. o[1]
+      local v = randint(o[2], o[3])
+      local s = pack.encode(fmt, v)
+      assert(s == string.pack(fmt, v))
+      local r, pos = pack.decode(fmt, s)
+      assert(r == v and pos == #s + 1)
+    end
+  end
+end
+
+-- limits
+for _, o in ipairs(ints) do
+  local n = o[2] * 8
+  if o[3] then
+    local lim = (n < intbits) and (1 << (n - 1)) or mini
+    assert(pack.decode(o[1], pack.encode(o[1], -lim)) == -lim)
+    assert(pack.decode(o[1], pack.encode(o[1], lim - 1)) == lim - 1)
+    if n < intbits then
+      assert(not pcall(pack.encode, o[1], lim))
+      assert(not pcall(pack.encode, o[1], -lim - 1))
+    end
+  elseif n < intbits then
+    assert(pack.decode(o[1], pack.encode(o[1], (1 << n) - 1)) == (1 << n) - 1)
+    assert(not pcall(pack.encode, o[1], 1 << n))
+    assert(not pcall(pack.encode, o[1], -1))
+  end
+end
+
+-- 64-bit integers are sign extended when integers are smaller
+assert(pack.decode("<l", pack.encode("<l", -2)) == -2)
+assert(pack.encode("<l", -2) == "\xfe\xff\xff\xff\xff\xff\xff\xff")
+assert(pack.encode(">L", 258) == "\0\0\0\0\0\0\1\2")
+
+-- floats
+for i = 1, 200 do
+  local v = (math.random() - 0.5) * 2 ^ math.random(-20, 20)
+  for _, fmt in ipairs({"<f", ">f", "<d", ">d", "<n", ">n"}) do
+    local s = pack.encode(fmt, v)
+    assert(s == string.pack(fmt, v))
+    assert(pack.decode(fmt, s) == string.unpack(fmt, s))
+  end
+  assert(pack.decode("n", pack.encode("n", v)) == v)
+end
+
+-- strings
+for i = 1, 200 do
+  local v = randstr(math.random(0, 300))
+  for _, fmt in ipairs({"<s4", ">s2", "s1", "s8"}) do
+    if fmt ~= "s1" or #v < 256 then
+      local s = pack.encode(fmt, v)
+      assert(s == string.pack(fmt, v))
+      assert(pack.decode(fmt, s) == v)
+    end
+  end
+  local z = v:gsub("%z", "")
+  assert(pack.decode("z", pack.encode("z", z)) == z)
+end
+
+assert(not pcall(pack.encode, "s1", string.rep("x", 256)))
+assert(not pcall(pack.encode, "z", "a\0b"))
+
+-- variable-length integers
+assert(pack.encode("V", 0) == "\0")
+assert(pack.encode("V", 127) == "\127")
+assert(pack.encode("V", 128) == "\128\1")
+assert(pack.encode("V", 300) == "\172\2")
+assert(pack.encode("v", 0) == "\0")
+assert(pack.encode("v", -1) == "\1")
+assert(pack.encode("v", 1) == "\2")
+assert(pack.encode("v", -64) == "\127")
+assert(pack.encode("v", 64) == "\128\1")
+assert(not pcall(pack.encode, "V", -1))
+
+for _, v in ipairs({maxi, mini, 0, -1, 1}) do
+  assert(pack.decode("v", pack.encode("v", v)) == v)
+end
+assert(pack.decode("V", pack.encode("V", maxi)) == maxi)
+
+for i = 1, 1000 do
+  local v = rand() >> math.random(1, intbits - 1)
+  assert(pack.decode("V", pack.encode("V", v)) == v)
+  v = v * (math.random(0, 1) * 2 - 1)
+  assert(pack.decode("v", pack.encode("v", v)) == v)
+end
+
+-- too long, or truncated
+assert(not pcall(pack.decode, "V", string.rep("\255", intbits // 7 + 1) .. "\1"))
+assert(not pcall(pack.decode, "V", "\128"))
+
+-- random formats, with many values
+local opts = {"b", "B", "h", "H", "i", "I", "i3", "I7", "j", "J", "f", "d", "n",
+              "s", "s2", "z", "v", "V", "x", "<", ">", "=", " "}
+
+for i = 1, 500 do
+  local fmt, vals = {}, {}
+  for j = 1, math.random(1, 20) do
+    local o = opts[math.random(#opts)]
+    local v
+    fmt[#fmt + 1] = o
+    if o:match("^[bBhHiIjJ]") then
+      local n = tonumber(o:sub(2)) or ({b=1, B=1, h=2, H=2, i=4, I=4, j=intbits//8, J=intbits//8})[o:sub(1, 1)]
+      v = randint(n, o:match("^[bhij]") ~= nil)
+    elseif o == "f" then
+      v = string.unpack("f", string.pack("f", math.random()))
+    elseif o == "d" or o == "n" then
+      v = math.random() * 1000
+    elseif o == "z" then
+      v = randstr(math.random(0, 20)):gsub("%z", "")
+    elseif o:sub(1, 1) == "s" then
+      v = randstr(math.random(0, 20))
+    elseif o == "v" or o == "V" then
+      v = randint(intbits // 8, o == "v")
+      if o == "V" and v < 0 then v = -(v + 1) end
+    end
+    if v then vals[#vals + 1] = v end
+  end
+
+  fmt = table.concat(fmt)
+  local s = pack.encode(fmt, table.unpack(vals))
+  local r = table.pack(pack.decode(fmt, s))
+  assert(r.n == #vals + 1 and r[r.n] == #s + 1)
+  for j = 1, #vals do assert(r[j] == vals[j]) end
+
+  -- decode from a position
+  local r2 = table.pack(pack.decode(fmt, "pre" .. s, 4))
+  assert(r2[r2.n] == #s + 4)
+end
+
+-- errors
+assert(not pcall(pack.encode, "i9", 1))
+assert(not pcall(pack.encode, "i0", 1))
+assert(not pcall(pack.encode, "y", 1))
+assert(not pcall(pack.encode, "i", "x"))
+assert(not pcall(pack.encode, "i", 1, 2))
+assert(not pcall(pack.encode, "ii", 1))
+assert(not pcall(pack.decode, "i", "abc"))
+assert(not pcall(pack.decode, "s", "\10\0\0\0abc"))
+assert(not pcall(pack.decode, "z", "abc"))
+assert(not pcall(pack.decode, "b", "a", 3))
+
+-- hex codec round trip
+for i = 1, 200 do
+  local i1, n1, s1 = randint(intbits // 8, true), math.random() * 100, randstr(math.random(0, 20)):gsub("%z", "")
+  local ri, rn, rb, rs = pack.unpack(pack.pack(i1, n1, true, s1))
+  assert(ri == i1 and rn == n1 and rb == true and rs == s1)
+end
+
+-- a hex string without its "00" terminator ends at the end of the packet
+assert(pack.unpack(pack.pack("ab"):sub(1, -3)) == "ab")
+
+-- throughput
+local n = 2000
+local str = string.rep("payload ", 4)
+
+local t0 = os.clock()
+for i = 1, n do
+  pack.unpack(pack.pack(i, i + 0.5, true, str))
+end
+local thex = os.clock() - t0
+
+local t0 = os.clock()
+for i = 1, n do
+  pack.decode("<j n B s2", pack.encode("<j n B s2", i, i + 0.5, 1, str))
+end
+local tbin = os.clock() - t0
+
+print(string.format("hex %d bytes, %.2f ms, binary %d bytes, %.2f ms, for %d round trips",
+  #pack.pack(1, 1.5, true, str), thex * 1000,
+  #pack.encode("<j n B s2", 1, 1.5, 1, str), tbin * 1000, n))
+
+assert(#pack.encode("<j n B s2", 1, 1.5, 1, str) < #pack.pack(1, 1.5, true, str))
+assert(tbin < thex)
+
+print "OK"
@@ -0,0 +1,83 @@
+-- Lua RTOS: publish / subscribe bus of the event module
+--
+-- Checks topic filters, payloads, overflow policies and counters, and
+-- measures publishing to a number of subscribers.
+
+print "testing pubsub"
+
+-- payloads are copied
+local s = event.subscribe("home/+/temp")
+local t = {1, "x", {y = 2.5}}
+assert(event.publish("home/kitchen/temp", 21, t) == 1)
+local topic, v, r = s:receive(0)
+assert(topic == "home/kitchen/temp" and v == 21 and r ~= t)
+assert(r[1] == 1 and r[2] == "x" and r[3].y == 2.5)
+
+-- no payload
+assert(event.publish("home/hall/temp") == 1)
+topic, v = s:receive(0)
+assert(topic == "home/hall/temp" and v == nil)
+
+-- filters
+assert(event.publish("home/temp") == 0)
+assert(event.publish("home/a/b/temp") == 0)
+assert(s:receive(0) == nil)
+
+local all = event.subscribe("home/#")
+assert(event.publish("home") == 1)
+assert(event.publish("home/kitchen/temp") == 2)
+assert(all:count() == 2 and s:count() == 1)
+all:unsubscribe()
+assert(event.publish("home/kitchen/temp") == 1)
+
+-- errors
+assert(not pcall(event.subscribe, "home/+x"))
+assert(not pcall(event.subscribe, "a", 0))
+assert(not pcall(event.subscribe, "a", 4, 7))
+assert(not pcall(event.publish, "a/+"))
+assert(not pcall(event.publish, "a", print))
+
+-- overflow
+local oldest = event.subscribe("o", 4, event.DROP_OLDEST)
+local newest = event.subscribe("o", 4, event.DROP_NEWEST)
+for i = 1, 10 do event.publish("o", i) end
+assert(select(2, oldest:receive(0)) == 7)
+assert(select(2, newest:receive(0)) == 1)
+local delivered, dropped = oldest:stats()
+assert(delivered == 10 and dropped == 6)
+delivered, dropped = newest:stats()
+assert(delivered == 4 and dropped == 6)
+
+-- block: the publisher waits for the subscriber
+local blocked = event.subscribe("b", 2, event.BLOCK)
+local got = {}
+local th = thread.start(function ()
+  for i = 1, 10 do got[i] = select(2, blocked:receive()) end
+end)
+for i = 1, 10 do event.publish("b", i) end
+thread.sleepms(100)
+for i = 1, 10 do assert(got[i] == i) end
+
+-- fan-out benchmark
+local N, M = 100, 100
+local subs = {}
+for i = 1, N do subs[i] = event.subscribe("bench/" .. (i % 2 == 0 and "+" or "x")) end
+
+collectgarbage()
+local t0 = os.clock()
+for i = 1, M do assert(event.publish("bench/x", i) == N) end
+local t1 = os.clock()
+for i = 1, N do
+  for j = 1, 16 do
+    assert(select(2, subs[i]:receive(0)) == (M - 16 + j))
+  end
+end
+print(string.format("  publish to %d subscribers %8.3f ms", N, (t1 - t0) * 1000 / M))
+
+local published, delivered = event.stats()
+assert(published > 0 and delivered > 0)
+
+subs = nil
+collectgarbage()
+
+print "OK"
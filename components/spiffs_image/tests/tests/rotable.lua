@@ -0,0 +1,85 @@
+-- Lua RTOS: read-only tables (rotables)
+--
+-- Checks rotable indexing semantics through the VM paths that have an
+-- inline cache (constant keys in OP_GETTABLE / OP_GETTABUP / OP_SELF),
+-- and measures them against the same accesses on an ordinary table.
+
+print "testing rotables"
+
+assert(type(math) == "rotable")
+assert(type(string) == "rotable")
+
+-- constant keys
+assert(math.pi > 3.14 and math.pi < 3.15)
+assert(math.floor(3.7) == 3)
+assert(math.nokey == nil)
+assert(string.len("abc") == 3)
+
+-- constant keys, same instruction over different rotables
+local function field (t) return t.len end
+assert(field(string) == string.len)
+assert(field(math) == nil)
+assert(field(string) == string.len)
+assert(field({len = 1}) == 1)
+
+-- keys in registers
+local k = "floor"
+assert(math[k] == math.floor)
+k = "nokey"
+assert(math[k] == nil)
+assert(math[1.5] == nil and math[true] == nil)
+
+-- methods on strings go through the string rotable
+assert(("abc"):upper() == "ABC")
+
+-- iteration
+local n = 0
+for key, val in pairs(math) do
+  assert(math[key] == val)
+  n = n + 1
+end
+assert(n > 0)
+
+-- rotables are read only for the raw table functions
+assert(not pcall(rawset, math, "x", 1))
+
+-- microbenchmark
+local N = 20000
+
+local function bench (name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  f()
+  local t = os.clock() - t0
+  print(string.format("  %-24s %8.3f us/op", name, t * 1e6 / N))
+end
+
+local ram = {}
+for key, val in pairs(math) do ram[key] = val end
+
+bench("table field", function ()
+  local t = ram
+  for i = 1, N do local _ = t.floor end
+end)
+
+bench("rotable field", function ()
+  local t = math
+  for i = 1, N do local _ = t.floor end
+end)
+
+-- key in a register, so it isn't cached
+bench("rotable field (no cache)", function ()
+  local t, key = math, "floor"
+  for i = 1, N do local _ = t[key] end
+end)
+
+bench("rotable call", function ()
+  for i = 1, N do math.abs(i) end
+end)
+
+bench("rotable method", function ()
+  local s = "x"
+  for i = 1, N do s:len() end
+end)
+
+print "OK"
@@ -28,6 +28,13 @@ table.insert(tests, function() dofile('sort.lua', true) end)
 table.insert(tests, function() dofile('bitwise.lua') end)
 --table.insert(tests, function() assert(dofile('verybig.lua', true) == 10) end)
 --table.insert(tests, function() dofile('files.lua') end)
+table.insert(tests, function() dofile('rotable.lua') end)
+table.insert(tests, function() dofile('xip.lua') end)
+table.insert(tests, function() dofile('thread_isolated.lua') end)
+table.insert(tests, function() dofile('pubsub.lua') end)
+table.insert(tests, function() dofile('tmr.lua') end)
+table.insert(tests, function() dofile('nvs.lua') end)
+table.insert(tests, function() dofile('pack.lua') end)
 table.insert(tests, function() dofile('bitwise.lua') end)
 
 if os.bootcount() == 1 then
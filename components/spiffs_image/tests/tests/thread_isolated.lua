@@ -0,0 +1,92 @@
+-- Lua RTOS: isolated threads and channels
+--
+-- Checks that values are deep copied through channels, and measures the
+-- time of a CPU-bound job split among isolated threads, that run in their
+-- own Lua state, so they don't contend for the heap or the collector of
+-- the main state, and can run on both cores.
+
+print "testing isolated threads"
+
+-- values are copied
+local ch = thread.channel(4)
+local v = {1, 2.5, "x", true, {a = {b = "deep"}}, [10] = -7}
+assert(ch:send(v))
+local r = ch:receive()
+assert(r ~= v and r[1] == 1 and math.type(r[1]) == "integer" and r[2] == 2.5)
+assert(r[3] == "x" and r[4] == true and r[5].a.b == "deep" and r[10] == -7)
+
+-- bounded capacity and timeouts
+assert(ch:receive(10) == nil)
+for i = 1, 4 do assert(ch:send(i)) end
+assert(ch:count() == 4)
+assert(ch:send(5, 10) == false)
+for i = 1, 4 do assert(ch:receive() == i) end
+
+-- values that can't be sent
+assert(not pcall(ch.send, ch, nil))
+assert(not pcall(ch.send, ch, print))
+local t = {} t.t = t
+assert(not pcall(ch.send, ch, t))
+
+-- code is a string or a function without upvalues, and gets its arguments
+local done = thread.channel()
+thread.spawn_isolated("local c, x = ... c:send(x * 2)", 0, done, 21)
+assert(done:receive(1000) == 42)
+
+thread.spawn_isolated(function (c, s) c:send(s:upper()) end, 1, done, "abc")
+assert(done:receive(1000) == "ABC")
+
+-- isolated threads don't see the globals of the main state
+isolated_global = 1
+thread.spawn_isolated(function (c) c:send(isolated_global == nil) end, 0, done)
+assert(done:receive(1000) == true)
+isolated_global = nil
+
+assert(not pcall(thread.spawn_isolated, "syntax error"))
+
+-- benchmark: the same job, split among 1, 2 and 4 workers
+local N = 40000
+
+local function worker (jobs, results)
+  while true do
+    local job = jobs:receive()
+    if not job then break end
+
+    local sum = 0
+    for i = job.from, job.to do
+      sum = sum + (i * i) % 7
+    end
+
+    results:send(sum)
+  end
+end
+
+local expected = 0
+for i = 1, N do expected = expected + (i * i) % 7 end
+
+for _, workers in ipairs({1, 2, 4}) do
+  local jobs, results = thread.channel(workers), thread.channel(workers)
+
+  for w = 1, workers do
+    thread.spawn_isolated(worker, (w - 1) % 2, jobs, results)
+  end
+
+  local t0 = os.clock()
+  local size = N // workers
+  for w = 1, workers do
+    jobs:send({from = (w - 1) * size + 1, to = (w == workers) and N or w * size})
+  end
+
+  local sum = 0
+  for w = 1, workers do sum = sum + results:receive() end
+  local t = os.clock() - t0
+
+  assert(sum == expected)
+
+  -- workers end when they receive false
+  for w = 1, workers do jobs:send(false) end
+
+  print(string.format("  %d isolated workers %8.3f s", workers, t))
+end
+
+print "OK"
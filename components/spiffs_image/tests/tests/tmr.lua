@@ -0,0 +1,59 @@
+-- Lua RTOS: timer callbacks of the tmr module
+--
+-- Checks periodic and one shot timers, the order of the callbacks, and
+-- detach.
+
+print "testing tmr"
+
+-- periodic
+local n = 0
+local t = tmr.attach(10, function() n = n + 1 end)
+tmr.sleepms(505)
+t:detach()
+local fired, missed = t:stats()
+assert(fired + missed == 50)
+
+-- an expiration queued before the detach is discarded
+assert(n == fired or n == fired - 1)
+fired = n
+
+-- detached timers don't expire
+tmr.sleepms(50)
+assert(n == fired)
+
+-- one shot, in deadline order
+local order = {}
+tmr.attach(30, function() order[#order + 1] = 3 end, true)
+tmr.attach(10, function() order[#order + 1] = 1 end, true)
+tmr.attach(20, function() order[#order + 1] = 2 end, true)
+tmr.sleepms(100)
+assert(#order == 3 and order[1] == 1 and order[2] == 2 and order[3] == 3)
+
+-- an attached timer keeps running without its handle
+n = 0
+tmr.attach(10, function() n = n + 1 end)
+collectgarbage()
+tmr.sleepms(55)
+assert(n >= 4)
+
+-- high resolution
+local us = 0
+t = tmr.attachus(1500, function() us = us + 1 end)
+tmr.sleepms(150)
+t:detach()
+fired, missed = t:stats()
+assert(fired + missed >= 99 and us <= fired)
+
+-- a timer can detach itself
+n = 0
+t = tmr.attach(10, function() n = n + 1; if n == 3 then t:detach() end end)
+tmr.sleepms(100)
+assert(n == 3)
+
+-- errors
+assert(not pcall(tmr.attach, 0, print))
+assert(not pcall(tmr.attach, 10))
+assert(not pcall(tmr.attachus, 10, print))
+assert(not pcall(tmr.attachus, 500, print))
+
+print "OK"
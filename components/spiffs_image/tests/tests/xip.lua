@@ -0,0 +1,67 @@
+-- Lua RTOS: modules executed in place from a bytecode image
+--
+-- Build and flash the image with the test suite, and the test suite in
+-- SPIFFS, with:
+--
+--   make SPIFFS_IMAGE=tests flashfs flashxip
+--
+-- For each test file, compares the time needed to load it, and the heap
+-- retained by the loaded function, when it's loaded from the image
+-- (precompiled, code in flash) and from the file system (parsed to RAM).
+-- The numbers are only printed; no baseline has been recorded for them.
+
+print "testing bytecode image"
+
+-- chunks can't be used in place from user buffers
+assert(not pcall(load, string.dump(function () end), nil, "bx"))
+assert(not pcall(loadfile, "xip.lua", "bx"))
+
+-- the xip searcher goes right after the preload searcher
+local xip = package.searchers[2]
+
+if select(2, xip("tests.gc")) ~= "xip:tests.gc" then
+  print "no bytecode image, skipped"
+  return
+end
+
+local files = {
+  "gc", "calls", "strings", "literals", "tpack", "locals", "constructs",
+  "pm", "utf8", "events", "vararg", "closure", "coroutine", "goto",
+  "math", "sort", "bitwise", "rotable",
+}
+
+local function measure (load)
+  collectgarbage()
+  collectgarbage()
+  local mem0 = collectgarbage("count")
+  local t0 = os.clock()
+  local f = load()
+  local t = os.clock() - t0
+  collectgarbage()
+  collectgarbage()
+  local mem = collectgarbage("count") - mem0
+  assert(type(f) == "function")
+  return t, mem, f
+end
+
+local tx, mx, tf, mf = 0, 0, 0, 0
+
+print(string.format("  %-12s %10s %10s %10s %10s", "file",
+                    "xip ms", "xip KB", "fs ms", "fs KB"))
+
+for _, name in ipairs(files) do
+  local t1, m1 = measure(function () return (xip("tests." .. name)) end)
+  local t2, m2 = measure(function () return assert(loadfile(name .. ".lua")) end)
+  print(string.format("  %-12s %10.1f %10.1f %10.1f %10.1f", name,
+                      t1 * 1000, m1, t2 * 1000, m2))
+  tx, mx, tf, mf = tx + t1, mx + m1, tf + t2, mf + m2
+end
+
+print(string.format("  %-12s %10.1f %10.1f %10.1f %10.1f", "total",
+                    tx * 1000, mx, tf * 1000, mf))
+
+-- a module from the image behaves as the one in the file system
+local f = xip("tests.bitwise")
+assert(pcall(f))
+
+print "OK"
@@ -0,0 +1,256 @@
+#include "unity.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "captivedns.h"
+
+#define NUM_QUERIES 10000
+
+#define TYPE_A    1
+#define TYPE_AAAA 28
+#define TYPE_ANY  255
+
+static const uint8_t ap[4] = {192, 168, 4, 1};
+static const uint8_t a1[4] = {10, 0, 0, 1};
+static const uint8_t a2[4] = {10, 0, 0, 2};
+static const uint8_t a3[4] = {10, 0, 0, 3};
+static const uint8_t v6[16] = {0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+static uint8_t query[CAPTIVEDNS_MSG_SIZE];
+static uint8_t reply[CAPTIVEDNS_MSG_SIZE];
+
+// Build a query, with a question for each name, and return its length
+static int build_query(uint16_t id, int count, const char **names, const uint16_t *types) {
+	const char *name, *dot;
+	int pos = 12;
+	int i, len;
+
+	memset(query, 0, 12);
+	query[0] = id >> 8;
+	query[1] = id & 0xff;
+	query[2] = 0x01; // RD
+	query[5] = count;
+
+	for(i = 0; i < count; i++) {
+		for(name = names[i]; *name; name += len + (dot != NULL)) {
+			dot = strchr(name, '.');
+			len = dot ? (int)(dot - name) : (int)strlen(name);
+
+			query[pos++] = len;
+			memcpy(query + pos, name, len);
+			pos += len;
+		}
+
+		query[pos++] = 0;
+		query[pos++] = types[i] >> 8;
+		query[pos++] = types[i] & 0xff;
+		query[pos++] = 0;
+		query[pos++] = 1;
+	}
+
+	return pos;
+}
+
+static int resolve(const char *name, uint16_t type) {
+	return captivedns_reply(query, build_query(0x1234, 1, &name, &type), reply, sizeof(reply));
+}
+
+#define REPLY_RCODE   (reply[3] & 0x0f)
+#define REPLY_ANSWERS ((reply[6] << 8) | reply[7])
+
+TEST_CASE("captivedns zone", "[captivedns]") {
+	const char *names[3];
+	uint16_t types[3];
+	int len, res;
+
+	captivedns_zone_clear();
+	captivedns_zone_default(ap);
+
+	// Empty zone, any name is resolved to the access point
+	len = resolve("connectivitycheck.gstatic.com", TYPE_A);
+	TEST_ASSERT(len == 12 + 35 + 16);
+	TEST_ASSERT((reply[0] == 0x12) && (reply[1] == 0x34));
+	TEST_ASSERT(reply[2] == (0x80 | 0x04 | 0x01));
+	TEST_ASSERT((REPLY_RCODE == 0) && (REPLY_ANSWERS == 1));
+	TEST_ASSERT((reply[47] == 0xc0) && (reply[48] == 12));
+	TEST_ASSERT(memcmp(reply + len - 4, ap, 4) == 0);
+
+	// Exact names, and wildcards
+	TEST_ASSERT(captivedns_zone_add("Example.COM.", CAPTIVEDNS_HAS_A | CAPTIVEDNS_HAS_AAAA, a1, v6, 60) == 0);
+	TEST_ASSERT(captivedns_zone_add("*.example.com", CAPTIVEDNS_HAS_A, a2, NULL, 60) == 0);
+	TEST_ASSERT(captivedns_zone_add("*", CAPTIVEDNS_HAS_A, a3, NULL, 60) == 0);
+
+	len = resolve("example.com", TYPE_A);
+	TEST_ASSERT(memcmp(reply + len - 4, a1, 4) == 0);
+
+	len = resolve("www.EXAMPLE.com", TYPE_A);
+	TEST_ASSERT(memcmp(reply + len - 4, a2, 4) == 0);
+
+	len = resolve("a.b.example.com", TYPE_A);
+	TEST_ASSERT(memcmp(reply + len - 4, a2, 4) == 0);
+
+	len = resolve("example.org", TYPE_A);
+	TEST_ASSERT(memcmp(reply + len - 4, a3, 4) == 0);
+
+	// AAAA, ANY, and a type without address
+	len = resolve("example.com", TYPE_AAAA);
+	TEST_ASSERT(REPLY_ANSWERS == 1);
+	TEST_ASSERT(memcmp(reply + len - 16, v6, 16) == 0);
+
+	resolve("example.com", TYPE_ANY);
+	TEST_ASSERT(REPLY_ANSWERS == 2);
+
+	resolve("www.example.com", TYPE_AAAA);
+	TEST_ASSERT((REPLY_RCODE == 0) && (REPLY_ANSWERS == 0));
+
+	// NXDOMAIN
+	TEST_ASSERT(captivedns_zone_remove("*") == 0);
+	TEST_ASSERT(captivedns_zone_remove("*") == ENOENT);
+
+	len = resolve("example.org", TYPE_A);
+	TEST_ASSERT((REPLY_RCODE == 3) && (REPLY_ANSWERS == 0));
+	TEST_ASSERT(len == 12 + 17);
+
+	// Many questions, each one answered
+	names[0] = "example.com";     types[0] = TYPE_AAAA;
+	names[1] = "www.example.com"; types[1] = TYPE_A;
+	names[2] = "example.org";     types[2] = TYPE_A;
+
+	len = build_query(1, 3, names, types);
+	res = captivedns_reply(query, len, reply, sizeof(reply));
+	TEST_ASSERT((REPLY_RCODE == 0) && (REPLY_ANSWERS == 2));
+	TEST_ASSERT(res == len + 28 + 16);
+	TEST_ASSERT(memcmp(reply + len + 12, v6, 16) == 0);
+	TEST_ASSERT(memcmp(reply + res - 4, a2, 4) == 0);
+
+	// Answers that don't fit are truncated
+	res = captivedns_reply(query, len, reply, len + 30);
+	TEST_ASSERT((reply[2] & 0x02) && (REPLY_ANSWERS == 1));
+	TEST_ASSERT(res == len + 28);
+
+	// Invalid names
+	TEST_ASSERT(captivedns_zone_add("a..b", CAPTIVEDNS_HAS_A, a1, NULL, 60) == EINVAL);
+	TEST_ASSERT(captivedns_zone_add("a.*.b", CAPTIVEDNS_HAS_A, a1, NULL, 60) == EINVAL);
+	TEST_ASSERT(captivedns_zone_add("a.b", 0, a1, NULL, 60) == EINVAL);
+
+	captivedns_zone_clear();
+}
+
+TEST_CASE("captivedns errors", "[captivedns]") {
+	int len, i, j;
+
+	captivedns_zone_clear();
+	captivedns_zone_default(ap);
+
+	len = resolve("example.com", TYPE_A);
+	TEST_ASSERT(len > 0);
+	len -= 16;
+
+	// Responses and short messages are ignored
+	query[2] |= 0x80;
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == 0);
+	query[2] &= ~0x80;
+	TEST_ASSERT(captivedns_reply(query, 11, reply, sizeof(reply)) == 0);
+
+	// Not a standard query
+	query[2] |= 2 << 3;
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == 12);
+	TEST_ASSERT(REPLY_RCODE == 4);
+	query[2] &= ~(2 << 3);
+
+	// No questions, or a question out of the message
+	query[5] = 0;
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == 12);
+	TEST_ASSERT(REPLY_RCODE == 1);
+	query[5] = 1;
+
+	TEST_ASSERT(captivedns_reply(query, len - 1, reply, sizeof(reply)) == 12);
+	TEST_ASSERT(REPLY_RCODE == 1);
+
+	// Compressed name
+	query[12] = 0xc0;
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == 12);
+	TEST_ASSERT(REPLY_RCODE == 1);
+
+	// Random messages are replied, or ignored, never out of the buffers
+	srand(1);
+	for(i = 0; i < 10000; i++) {
+		len = 1 + rand() % 64;
+		for(j = 0; j < len; j++) {
+			query[j] = rand();
+		}
+
+		if (i & 1) {
+			memset(query + 4, 0, 6);
+			query[5] = rand() % 3;
+		}
+
+		len = captivedns_reply(query, len, reply, 12 + rand() % 64);
+		TEST_ASSERT(len >= 0);
+	}
+}
+
+TEST_CASE("captivedns cache", "[captivedns]") {
+	const char *name = "www.example.com";
+	uint16_t type = TYPE_A;
+	captivedns_stats_t before, after;
+	TickType_t start, cached, uncached;
+	uint8_t first[CAPTIVEDNS_MSG_SIZE];
+	int len, res, i;
+
+	captivedns_zone_clear();
+	TEST_ASSERT(captivedns_zone_add("*.example.com", CAPTIVEDNS_HAS_A, a2, NULL, 60) == 0);
+
+	len = build_query(1, 1, &name, &type);
+	res = captivedns_reply(query, len, first, sizeof(first));
+
+	// The same query, with another id, is replied from the cache
+	captivedns_stats(&before);
+
+	query[1] = 2;
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == res);
+	TEST_ASSERT(reply[1] == 2);
+	TEST_ASSERT(memcmp(reply + 2, first + 2, res - 2) == 0);
+
+	captivedns_stats(&after);
+	TEST_ASSERT(after.cached == before.cached + 1);
+	TEST_ASSERT(after.answered == before.answered + 1);
+
+	// The cache is flushed when the zone changes
+	TEST_ASSERT(captivedns_zone_add("*.example.com", CAPTIVEDNS_HAS_A, a3, NULL, 60) == 0);
+	TEST_ASSERT(captivedns_reply(query, len, reply, sizeof(reply)) == res);
+	TEST_ASSERT(memcmp(reply + res - 4, a3, 4) == 0);
+
+	// Queries per second, with and without the cache
+	start = xTaskGetTickCount();
+	for(i = 0; i < NUM_QUERIES; i++) {
+		query[1] = i;
+		captivedns_reply(query, len, reply, sizeof(reply));
+	}
+	cached = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	start = xTaskGetTickCount();
+	for(i = 0; i < NUM_QUERIES; i++) {
+		// Flushes the cache
+		captivedns_zone_default(ap);
+
+		query[1] = i;
+		captivedns_reply(query, len, reply, sizeof(reply));
+	}
+	uncached = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	printf("%d replies in %u msecs from the cache, %u msecs without cache\n",
+		NUM_QUERIES, cached, uncached);
+
+	if (cached > 0) {
+		printf("%u queries/sec from the cache\n", (NUM_QUERIES * 1000) / cached);
+	}
+
+	captivedns_zone_clear();
+}
@@ -0,0 +1,107 @@
+#include "unity.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <sys/driver.h>
+
+#include <drivers/i2c.h>
+
+// Bus utilisation benchmark, reading the 24 byte calibration block of a
+// BME280 at 400 Khz:
+//
+// * one transaction per byte, as the i2c module did before block reads
+// * a transaction with a block read
+// * i2c_read_reg
+//
+// Utilisation is the time needed for the bits on the bus, relative to the
+// elapsed time.
+#define BENCH_SPEED    400
+#define BENCH_ADDRESS  0x76
+#define BENCH_REG      0x88
+#define BENCH_LEN      24
+#define BENCH_LOOPS    100
+
+static void i2c_bench_report(const char *name, struct timeval *start, int transactions, int len) {
+	struct timeval end;
+	uint32_t usecs, bus_usecs;
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+
+	// address (write), register, address (read) and data are 9 bits each,
+	// plus start, repeated start and stop
+	bus_usecs = (transactions * (9 * (3 + len) + 3) * 1000) / BENCH_SPEED;
+
+	printf("%-24s %8u us, %3u%% bus utilisation\n", name, usecs, (bus_usecs * 100) / usecs);
+}
+
+static void i2c_bench_block(char *data) {
+	driver_error_t *error;
+	int transaction = I2C_TRANSACTION_INITIALIZER;
+	char reg = BENCH_REG;
+
+	error = i2c_start(0, &transaction);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_write_address(0, &transaction, BENCH_ADDRESS, 0);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_write(0, &transaction, &reg, sizeof(reg));
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_start(0, &transaction);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_write_address(0, &transaction, BENCH_ADDRESS, 1);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_read(0, &transaction, data, BENCH_LEN);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	error = i2c_stop(0, &transaction);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+	TEST_ASSERT(transaction == I2C_TRANSACTION_INITIALIZER);
+}
+
+TEST_CASE("i2c-benchmark", "[i2c master]") {
+	driver_error_t *error;
+	struct timeval start;
+	char block[BENCH_LEN];
+	char reg[BENCH_LEN];
+	char byte[BENCH_LEN];
+	int i, j;
+
+	error = i2c_setup(0, I2C_MASTER, BENCH_SPEED, 16, 4, 0, 0);
+	TEST_ASSERT(error == NULL);
+
+	// One transaction per byte
+	gettimeofday(&start, NULL);
+	for(i = 0;i < BENCH_LOOPS;i++) {
+		for(j = 0;j < BENCH_LEN;j++) {
+			error = i2c_read_reg(0, BENCH_ADDRESS, BENCH_REG + j, &byte[j], 1);
+			TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+		}
+	}
+	i2c_bench_report("byte transactions", &start, BENCH_LOOPS * BENCH_LEN, 1);
+
+	// Block read in a transaction
+	gettimeofday(&start, NULL);
+	for(i = 0;i < BENCH_LOOPS;i++) {
+		i2c_bench_block(block);
+	}
+	i2c_bench_report("block transaction", &start, BENCH_LOOPS, BENCH_LEN);
+
+	// Register read
+	gettimeofday(&start, NULL);
+	for(i = 0;i < BENCH_LOOPS;i++) {
+		error = i2c_read_reg(0, BENCH_ADDRESS, BENCH_REG, reg, BENCH_LEN);
+		TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+	}
+	i2c_bench_report("i2c_read_reg", &start, BENCH_LOOPS, BENCH_LEN);
+
+	TEST_ASSERT(memcmp(block, reg, BENCH_LEN) == 0);
+	TEST_ASSERT(memcmp(byte, reg, BENCH_LEN) == 0);
+}
@@ -0,0 +1,370 @@
+#include "unity.h"
+
+#include "esp_err.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/nvs_cache.h>
+
+/*
+ * In-memory backend, that stands in for the NVS, and counts the accesses
+ */
+
+#define MEM_ITEMS 64
+
+struct mem_item {
+	char nspace[NVS_CACHE_KEY_SIZE];
+	char key[NVS_CACHE_KEY_SIZE];
+	nvs_cache_value_t value;
+};
+
+static struct mem_item items[MEM_ITEMS];
+static int reads, writes, commits, fail;
+
+static struct mem_item *mem_find(const char *nspace, const char *key) {
+	int i;
+
+	for(i = 0; i < MEM_ITEMS; i++) {
+		if ((items[i].value.type != NvsCacheNone) && !strcmp(items[i].nspace, nspace) && !strcmp(items[i].key, key)) {
+			return &items[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int mem_copy(nvs_cache_value_t *dst, const nvs_cache_value_t *src) {
+	*dst = *src;
+
+	if (src->type == NvsCacheString) {
+		dst->string.data = malloc(src->string.len + 1);
+		memcpy(dst->string.data, src->string.data, src->string.len);
+		dst->string.data[src->string.len] = 0;
+	}
+
+	return ESP_OK;
+}
+
+static int mem_open(const char *nspace, void **handle) {
+	*handle = strdup(nspace);
+
+	return ESP_OK;
+}
+
+static void mem_close(void *handle) {
+	free(handle);
+}
+
+static int mem_get(void *handle, const char *key, nvs_cache_value_t *value, uint8_t *stored) {
+	struct mem_item *item = mem_find(handle, key);
+
+	reads++;
+
+	*stored = (item != NULL);
+	if (!item) {
+		value->type = NvsCacheNone;
+		return ESP_OK;
+	}
+
+	return mem_copy(value, &item->value);
+}
+
+static int mem_set(void *handle, const char *key, const nvs_cache_value_t *value, uint8_t *stored) {
+	struct mem_item *item = mem_find(handle, key);
+	int i;
+
+	if (fail) {
+		return ESP_FAIL;
+	}
+
+	writes++;
+
+	if (!item) {
+		for(i = 0; items[i].value.type != NvsCacheNone; i++);
+
+		item = &items[i];
+		strcpy(item->nspace, handle);
+		strcpy(item->key, key);
+	}
+
+	nvs_cache_value_free(&item->value);
+	mem_copy(&item->value, value);
+
+	*stored = (value->type != NvsCacheNone);
+
+	return ESP_OK;
+}
+
+static int mem_commit(void *handle) {
+	commits++;
+
+	return ESP_OK;
+}
+
+static const nvs_cache_backend_t mem_backend = {
+	.open = mem_open,
+	.close = mem_close,
+	.get = mem_get,
+	.set = mem_set,
+	.commit = mem_commit,
+};
+
+static void mem_reset(void) {
+	int i;
+
+	for(i = 0; i < MEM_ITEMS; i++) {
+		nvs_cache_value_free(&items[i].value);
+	}
+
+	reads = writes = commits = fail = 0;
+}
+
+static void set_integer(nvs_cache_t *cache, const char *key, int64_t i) {
+	nvs_cache_value_t value = {.type = NvsCacheInteger, .integer = i};
+
+	TEST_ASSERT(nvs_cache_set(cache, key, &value) == ESP_OK);
+}
+
+static int64_t get_integer(nvs_cache_t *cache, const char *key) {
+	nvs_cache_value_t value;
+
+	TEST_ASSERT(nvs_cache_get(cache, key, &value) == ESP_OK);
+	TEST_ASSERT(value.type == NvsCacheInteger);
+
+	return value.integer;
+}
+
+TEST_CASE("nvs cache reads", "[nvs]") {
+	nvs_cache_value_t value;
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+	nvs_cache_stats_t stats;
+	nvs_cache_t *cache;
+	uint32_t nkeys;
+	int i;
+
+	mem_reset();
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+
+	// Typed values, each write is committed
+	set_integer(cache, "int", 1234567890123LL);
+
+	value.type = NvsCacheNumber;
+	value.number = 3.5;
+	TEST_ASSERT(nvs_cache_set(cache, "number", &value) == ESP_OK);
+
+	value.type = NvsCacheString;
+	value.string.data = "a\0b";
+	value.string.len = 3;
+	TEST_ASSERT(nvs_cache_set(cache, "string", &value) == ESP_OK);
+
+	TEST_ASSERT(commits == 3);
+
+	nvs_cache_close(cache);
+
+	// Values are read from the storage once
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+	reads = 0;
+
+	for(i = 0; i < 10; i++) {
+		TEST_ASSERT(get_integer(cache, "int") == 1234567890123LL);
+
+		TEST_ASSERT(nvs_cache_get(cache, "number", &value) == ESP_OK);
+		TEST_ASSERT((value.type == NvsCacheNumber) && (value.number == 3.5));
+
+		TEST_ASSERT(nvs_cache_get(cache, "string", &value) == ESP_OK);
+		TEST_ASSERT((value.type == NvsCacheString) && (value.string.len == 3) && !memcmp(value.string.data, "a\0b", 3));
+		nvs_cache_value_free(&value);
+
+		// Also when the key doesn't exist
+		TEST_ASSERT(nvs_cache_get(cache, "missing", &value) == ESP_OK);
+		TEST_ASSERT(value.type == NvsCacheNone);
+	}
+
+	TEST_ASSERT(reads == 4);
+
+	nvs_cache_stats(cache, &stats);
+	TEST_ASSERT(stats.hits == 36);
+
+	// Keys are kept in the index
+	TEST_ASSERT(nvs_cache_keys(cache, &keys, &nkeys) == ESP_OK);
+	TEST_ASSERT(nkeys == 3);
+	TEST_ASSERT(!strcmp(keys[0], "int") && !strcmp(keys[1], "number") && !strcmp(keys[2], "string"));
+	free(keys);
+
+	// Other namespaces don't share keys
+	nvs_cache_t *other;
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "other", &other) == ESP_OK);
+	TEST_ASSERT(nvs_cache_keys(other, &keys, &nkeys) == ESP_OK);
+	TEST_ASSERT(nkeys == 0);
+	nvs_cache_close(other);
+
+	nvs_cache_close(cache);
+}
+
+static void batch_set_integer(nvs_cache_batch_t *batch, const char *key, int64_t i) {
+	nvs_cache_value_t value = {.type = NvsCacheInteger, .integer = i};
+
+	TEST_ASSERT(nvs_cache_batch_set(batch, key, &value) == ESP_OK);
+}
+
+static int64_t batch_get_integer(nvs_cache_batch_t *batch, const char *key) {
+	nvs_cache_value_t value;
+
+	TEST_ASSERT(nvs_cache_batch_get(batch, key, &value) == ESP_OK);
+	TEST_ASSERT(value.type == NvsCacheInteger);
+
+	return value.integer;
+}
+
+TEST_CASE("nvs cache batch", "[nvs]") {
+	char key[NVS_CACHE_KEY_SIZE];
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+	nvs_cache_value_t value;
+	nvs_cache_batch_t *batch;
+	nvs_cache_stats_t stats;
+	nvs_cache_t *cache;
+	uint32_t nkeys;
+	int i;
+
+	mem_reset();
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+
+	// Many writes, of a few keys, in a batch
+	TEST_ASSERT(nvs_cache_begin(cache, &batch) == ESP_OK);
+
+	for(i = 0; i < 100; i++) {
+		sprintf(key, "key%d", i % 10);
+		batch_set_integer(batch, key, i);
+	}
+
+	// Nothing is written until the commit, the batch has the values, and
+	// the cache doesn't
+	TEST_ASSERT((writes == 0) && (commits == 0));
+	TEST_ASSERT(batch_get_integer(batch, "key3") == 93);
+	TEST_ASSERT(nvs_cache_get(cache, "key3", &value) == ESP_OK);
+	TEST_ASSERT(value.type == NvsCacheNone);
+
+	TEST_ASSERT(nvs_cache_commit(batch) == ESP_OK);
+	TEST_ASSERT(get_integer(cache, "key3") == 93);
+
+	// Each key is written once, and the index, with one commit
+	TEST_ASSERT(writes == 11);
+	TEST_ASSERT(commits == 1);
+
+	nvs_cache_stats(cache, &stats);
+	TEST_ASSERT((stats.writes == 11) && (stats.commits == 1));
+
+	nvs_cache_close(cache);
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+	for(i = 0; i < 10; i++) {
+		sprintf(key, "key%d", i);
+		TEST_ASSERT(get_integer(cache, key) == 90 + i);
+	}
+
+	TEST_ASSERT(nvs_cache_keys(cache, &keys, &nkeys) == ESP_OK);
+	TEST_ASSERT(nkeys == 10);
+	free(keys);
+
+	nvs_cache_close(cache);
+}
+
+TEST_CASE("nvs cache batches", "[nvs]") {
+	nvs_cache_batch_t *a, *b;
+	nvs_cache_t *cache;
+
+	mem_reset();
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+
+	// Each batch has its own writes
+	TEST_ASSERT(nvs_cache_begin(cache, &a) == ESP_OK);
+	TEST_ASSERT(nvs_cache_begin(cache, &b) == ESP_OK);
+
+	batch_set_integer(a, "a", 1);
+	batch_set_integer(b, "b", 2);
+	TEST_ASSERT(batch_get_integer(a, "a") == 1);
+	TEST_ASSERT(batch_get_integer(b, "b") == 2);
+
+	// A write outside the batches is written at once, and doesn't commit
+	// the writes of the batches
+	set_integer(cache, "c", 3);
+	TEST_ASSERT(commits == 1);
+	TEST_ASSERT(mem_find("config", "c") != NULL);
+	TEST_ASSERT((mem_find("config", "a") == NULL) && (mem_find("config", "b") == NULL));
+
+	// A rollback doesn't discard the writes of other batches
+	nvs_cache_rollback(a);
+	TEST_ASSERT(batch_get_integer(b, "b") == 2);
+
+	// A commit doesn't commit the writes of other batches
+	TEST_ASSERT(nvs_cache_begin(cache, &a) == ESP_OK);
+	batch_set_integer(a, "a", 4);
+	TEST_ASSERT(nvs_cache_commit(b) == ESP_OK);
+	TEST_ASSERT(commits == 2);
+	TEST_ASSERT((mem_find("config", "a") == NULL) && (mem_find("config", "b") != NULL));
+
+	TEST_ASSERT(nvs_cache_commit(a) == ESP_OK);
+	TEST_ASSERT(get_integer(cache, "a") == 4);
+	TEST_ASSERT(get_integer(cache, "b") == 2);
+	TEST_ASSERT(get_integer(cache, "c") == 3);
+
+	nvs_cache_close(cache);
+	mem_reset();
+}
+
+TEST_CASE("nvs cache rollback", "[nvs]") {
+	char (*keys)[NVS_CACHE_KEY_SIZE];
+	nvs_cache_batch_t *batch;
+	nvs_cache_value_t value;
+	nvs_cache_t *cache;
+	uint32_t nkeys;
+
+	mem_reset();
+
+	TEST_ASSERT(nvs_cache_open(&mem_backend, "config", &cache) == ESP_OK);
+	set_integer(cache, "a", 1);
+
+	// Discarded writes
+	TEST_ASSERT(nvs_cache_begin(cache, &batch) == ESP_OK);
+	batch_set_integer(batch, "a", 2);
+	batch_set_integer(batch, "b", 2);
+	nvs_cache_rollback(batch);
+
+	TEST_ASSERT(get_integer(cache, "a") == 1);
+	TEST_ASSERT(nvs_cache_get(cache, "b", &value) == ESP_OK);
+	TEST_ASSERT(value.type == NvsCacheNone);
+
+	TEST_ASSERT(nvs_cache_keys(cache, &keys, &nkeys) == ESP_OK);
+	TEST_ASSERT(nkeys == 1);
+	free(keys);
+
+	// Erase
+	value.type = NvsCacheNone;
+	TEST_ASSERT(nvs_cache_set(cache, "a", &value) == ESP_OK);
+	TEST_ASSERT(mem_find("config", "a") == NULL);
+	TEST_ASSERT(nvs_cache_keys(cache, &keys, &nkeys) == ESP_OK);
+	TEST_ASSERT(nkeys == 0);
+
+	// A failed write doesn't change the cache
+	set_integer(cache, "a", 3);
+	fail = 1;
+	value.type = NvsCacheInteger;
+	value.integer = 4;
+	TEST_ASSERT(nvs_cache_set(cache, "a", &value) == ESP_FAIL);
+	fail = 0;
+	TEST_ASSERT(get_integer(cache, "a") == 3);
+
+	// Invalid keys
+	TEST_ASSERT(nvs_cache_set(cache, "", &value) == ESP_ERR_INVALID_ARG);
+	TEST_ASSERT(nvs_cache_set(cache, "0123456789abcdef", &value) == ESP_ERR_INVALID_ARG);
+	TEST_ASSERT(nvs_cache_set(cache, NVS_CACHE_INDEX_KEY, &value) == ESP_ERR_INVALID_ARG);
+
+	nvs_cache_close(cache);
+	mem_reset();
+}
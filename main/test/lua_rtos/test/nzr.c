@@ -0,0 +1,246 @@
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/list.h>
+
+#include <drivers/nzr.h>
+#include <drivers/neopixel.h>
+
+extern struct list neopixel_list;
+
+// This is a device test. It checks the encoded RMT items, and needs no
+// strip, but the refill of the RMT memory halves is not covered.
+
+// RMT item fields
+#define ITEM_LEVEL0(item)    (((item) >> 15) & 1)
+#define ITEM_DURATION0(item) ((item) & 0x7fff)
+#define ITEM_LEVEL1(item)    (((item) >> 31) & 1)
+#define ITEM_DURATION1(item) (((item) >> 16) & 0x7fff)
+
+// Convert CPU cycles and RMT ticks to nanoseconds
+#define CYCLES_NS(cycles)    (((double)(cycles) * 1000000000.0) / (double)CPU_HZ)
+#define TICKS_NS(ticks)      (((double)(ticks) * 1000000000.0) / (double)NZR_RMT_HZ)
+
+// Max error of a generated level, in nanoseconds (half a RMT tick, plus
+// half a CPU cycle lost when the timing was converted to cycles)
+#define MAX_ERROR_NS         (TICKS_NS(1) / 2.0 + CYCLES_NS(1) / 2.0)
+
+static void check_level(uint32_t level, uint32_t expected_level, uint32_t ticks, uint32_t cycles) {
+	double error = TICKS_NS(ticks) - CYCLES_NS(cycles);
+
+	TEST_ASSERT(level == expected_level);
+	TEST_ASSERT(error <= MAX_ERROR_NS);
+	TEST_ASSERT(error >= -MAX_ERROR_NS);
+}
+
+TEST_CASE("nzr encoder timing", "[nzr]") {
+	const uint8_t data[] = {0xa5, 0x3c, 0xff, 0x00, 0x81, 0x7e};
+	const uint32_t bits = sizeof(data) * 8;
+	uint32_t items[sizeof(data) * 8];
+	uint32_t split[sizeof(data) * 8];
+	const nzr_timing_t *timing;
+	nzr_items_t encoder;
+	uint32_t bit, n, i;
+	int controller;
+
+	for(controller = 0; (timing = neopixel_chipset(controller)); controller++) {
+		nzr_timing_items(timing, &encoder);
+
+		// 0 bit: high during T0H, then low during T0L
+		check_level(ITEM_LEVEL0(encoder.bit0), 1, ITEM_DURATION0(encoder.bit0), timing->t0h);
+		check_level(ITEM_LEVEL1(encoder.bit0), 0, ITEM_DURATION1(encoder.bit0), timing->t0l);
+
+		// 1 bit: high during T1H, then low during T1L
+		check_level(ITEM_LEVEL0(encoder.bit1), 1, ITEM_DURATION0(encoder.bit1), timing->t1h);
+		check_level(ITEM_LEVEL1(encoder.bit1), 0, ITEM_DURATION1(encoder.bit1), timing->t1l);
+
+		// Reset: low during RES, and no zero durations (a zero duration is the end item)
+		TEST_ASSERT(ITEM_LEVEL0(encoder.res) == 0);
+		TEST_ASSERT(ITEM_LEVEL1(encoder.res) == 0);
+		TEST_ASSERT(ITEM_DURATION0(encoder.res) > 0);
+		TEST_ASSERT(ITEM_DURATION1(encoder.res) > 0);
+		check_level(0, 0, ITEM_DURATION0(encoder.res) + ITEM_DURATION1(encoder.res), timing->res);
+
+		// One item per bit, MSB first
+		bit = 0;
+		n = nzr_encode(&encoder, data, &bit, bits, items, bits);
+		TEST_ASSERT(n == bits);
+		TEST_ASSERT(bit == bits);
+
+		for(i = 0; i < bits; i++) {
+			if (data[i >> 3] & (0x80 >> (i & 7))) {
+				TEST_ASSERT(items[i] == encoder.bit1);
+			} else {
+				TEST_ASSERT(items[i] == encoder.bit0);
+			}
+		}
+
+		// Encoding in chunks, as the RMT interrupt does when it fills each
+		// half of the RMT memory, gives the same items
+		bit = 0;
+		n = 0;
+		while (bit < bits) {
+			n += nzr_encode(&encoder, data, &bit, bits, &split[n], 7);
+		}
+
+		TEST_ASSERT(n == bits);
+		TEST_ASSERT(memcmp(items, split, sizeof(items)) == 0);
+
+		// Nothing to encode past the last bit
+		TEST_ASSERT(nzr_encode(&encoder, data, &bit, bits, split, 7) == 0);
+	}
+}
+
+// Pixels are checked in the instance buffer, so the strip doesn't need to be
+// connected to the GPIO
+#define STRIP_GPIO     27
+#define STRIP_PIXELS   300
+#define BENCH_FRAMES   100
+
+static neopixel_pixel_t *strip_pixels(uint32_t unit) {
+	neopixel_instance_t *instance;
+
+	TEST_ASSERT(list_get(&neopixel_list, (int)unit, (void **)&instance) == 0);
+
+	return instance->pixels;
+}
+
+static void check_pixel(neopixel_pixel_t *pixel, uint8_t r, uint8_t g, uint8_t b) {
+	TEST_ASSERT(pixel->r == r);
+	TEST_ASSERT(pixel->g == g);
+	TEST_ASSERT(pixel->b == b);
+}
+
+TEST_CASE("neopixel primitives", "[neopixel]") {
+	const uint8_t rgb[] = {1, 2, 3, 4, 5, 6};
+	const uint8_t black[] = {0, 0, 0};
+	const uint8_t white[] = {255, 255, 255};
+	driver_error_t *error;
+	neopixel_pixel_t *pixels;
+	uint32_t unit, frames, skipped;
+
+	error = neopixel_setup(NeopixelWS2812B, STRIP_GPIO, 10, &unit);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	pixels = strip_pixels(unit);
+
+	// Packed pixels, and ranges out of the strip
+	TEST_ASSERT(neopixel_set_pixels(unit, 8, rgb, 2) == NULL);
+	check_pixel(&pixels[8], 1, 2, 3);
+	check_pixel(&pixels[9], 4, 5, 6);
+	TEST_ASSERT(neopixel_set_pixels(unit, 9, rgb, 2) != NULL);
+	TEST_ASSERT(neopixel_fill(unit, 11, 0, 1, 1, 1) != NULL);
+
+	// Gradient includes both ends
+	TEST_ASSERT(neopixel_gradient(unit, 0, 10, black, white) == NULL);
+	check_pixel(&pixels[0], 0, 0, 0);
+	check_pixel(&pixels[3], 85, 85, 85);
+	check_pixel(&pixels[9], 255, 255, 255);
+
+	// Rotate, both ways
+	TEST_ASSERT(neopixel_shift(unit, 3, 1) == NULL);
+	check_pixel(&pixels[0], 198, 198, 198);
+	check_pixel(&pixels[3], 0, 0, 0);
+	TEST_ASSERT(neopixel_shift(unit, -13, 1) == NULL);
+	check_pixel(&pixels[0], 0, 0, 0);
+	check_pixel(&pixels[9], 255, 255, 255);
+
+	// Shift, pixels shifted in are off
+	TEST_ASSERT(neopixel_shift(unit, -1, 0) == NULL);
+	check_pixel(&pixels[0], 28, 28, 28);
+	check_pixel(&pixels[8], 255, 255, 255);
+	check_pixel(&pixels[9], 0, 0, 0);
+
+	// First update is always sent, and unchanged frames are not
+	TEST_ASSERT(neopixel_fill(unit, 0, 10, 10, 20, 30) == NULL);
+	TEST_ASSERT(neopixel_update(unit) == NULL);
+	TEST_ASSERT(neopixel_update(unit) == NULL);
+	TEST_ASSERT(neopixel_rgb(unit, 0, 10, 20, 30) == NULL);
+	TEST_ASSERT(neopixel_update(unit) == NULL);
+	TEST_ASSERT(neopixel_stats(unit, &frames, &skipped) == NULL);
+	TEST_ASSERT(frames == 1);
+	TEST_ASSERT(skipped == 2);
+
+	// Brightness changes the output, not the pixels
+	TEST_ASSERT(neopixel_brightness(unit, 128) == NULL);
+	TEST_ASSERT(neopixel_update(unit) == NULL);
+	TEST_ASSERT(neopixel_stats(unit, &frames, &skipped) == NULL);
+	TEST_ASSERT(frames == 2);
+	check_pixel(&pixels[0], 10, 20, 30);
+
+	TEST_ASSERT(neopixel_gamma(unit, 0.0f) != NULL);
+	TEST_ASSERT(neopixel_gamma(unit, 2.2f) == NULL);
+	TEST_ASSERT(neopixel_brightness(unit, 255) == NULL);
+	TEST_ASSERT(neopixel_gamma(unit, 1.0f) == NULL);
+
+	// Back to the output of the first frame, that is not the last one sent
+	TEST_ASSERT(neopixel_update(unit) == NULL);
+	TEST_ASSERT(neopixel_stats(unit, &frames, &skipped) == NULL);
+	TEST_ASSERT(frames == 3);
+}
+
+static void neopixel_bench_report(const char *name, struct timeval *start, uint32_t unit) {
+	struct timeval end;
+	uint32_t usecs, frames, skipped;
+
+	gettimeofday(&end, NULL);
+
+	usecs = (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+
+	TEST_ASSERT(neopixel_stats(unit, &frames, &skipped) == NULL);
+
+	printf("%-24s %6u frames/sec, %u sent, %u skipped\n", name, (BENCH_FRAMES * 1000000) / usecs, frames, skipped);
+}
+
+TEST_CASE("neopixel-benchmark", "[neopixel]") {
+	uint8_t frame[STRIP_PIXELS * 3];
+	const uint8_t from[] = {255, 0, 0};
+	const uint8_t to[] = {0, 0, 255};
+	driver_error_t *error;
+	struct timeval start;
+	uint32_t unit;
+	int i, j;
+
+	error = neopixel_setup(NeopixelWS2812B, STRIP_GPIO, STRIP_PIXELS, &unit);
+	TEST_ASSERT_MESSAGE(error == NULL, driver_get_err_msg(error));
+
+	// One call per pixel, as setPixel does
+	gettimeofday(&start, NULL);
+	for(i = 0; i < BENCH_FRAMES; i++) {
+		for(j = 0; j < STRIP_PIXELS; j++) {
+			TEST_ASSERT(neopixel_rgb(unit, j, i, j, 0) == NULL);
+		}
+		TEST_ASSERT(neopixel_update(unit) == NULL);
+	}
+	neopixel_bench_report("pixel by pixel", &start, unit);
+
+	// Packed frame
+	gettimeofday(&start, NULL);
+	for(i = 0; i < BENCH_FRAMES; i++) {
+		memset(frame, i, sizeof(frame));
+		TEST_ASSERT(neopixel_set_pixels(unit, 0, frame, STRIP_PIXELS) == NULL);
+		TEST_ASSERT(neopixel_update(unit) == NULL);
+	}
+	neopixel_bench_report("packed frame", &start, unit);
+
+	// Animation with primitives, gamma corrected
+	TEST_ASSERT(neopixel_gamma(unit, 2.2f) == NULL);
+	TEST_ASSERT(neopixel_gradient(unit, 0, STRIP_PIXELS, from, to) == NULL);
+
+	gettimeofday(&start, NULL);
+	for(i = 0; i < BENCH_FRAMES; i++) {
+		TEST_ASSERT(neopixel_shift(unit, 1, 1) == NULL);
+		TEST_ASSERT(neopixel_update(unit) == NULL);
+	}
+	neopixel_bench_report("rotate, gamma", &start, unit);
+
+	// Unchanged frames
+	gettimeofday(&start, NULL);
+	for(i = 0; i < BENCH_FRAMES; i++) {
+		TEST_ASSERT(neopixel_update(unit) == NULL);
+	}
+	neopixel_bench_report("unchanged", &start, unit);
+}
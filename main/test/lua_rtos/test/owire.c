@@ -0,0 +1,315 @@
+#include "unity.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/owire.h>
+
+/*
+ * Simulated bus
+ *
+ * Each bus has a set of devices that implement Search ROM, Match ROM and
+ * Read Scratchpad, slot by slot. The bus level of a slot is the bit written
+ * by the master, and'ed with the bits sent by the devices.
+ *
+ * The simulation keeps the time of the bus, in usecs: a transaction started
+ * when a bus is free starts at the current time, and waiting for it moves the
+ * current time to its end. So, transactions on different buses, that are
+ * started before waiting, run at the same time.
+ */
+#define SIM_BUSES        3
+#define SIM_DEVICES      8
+
+// Time of a slot, a reset, and the idle time that ends a transaction
+#define SIM_T_SLOT       70
+#define SIM_T_RESET      960
+#define SIM_T_IDLE       100
+
+typedef enum {
+	SimIdle,
+	SimCommand,       // receiving ROM command
+	SimSearch,        // Search ROM
+	SimMatch,         // Match ROM, receiving ROM
+	SimFunction,      // receiving function command
+	SimScratchpad,    // sending scratchpad
+} sim_state_t;
+
+typedef struct {
+	uint8_t rom[8];
+	uint8_t scratchpad[9];
+	sim_state_t state;
+	uint32_t bit;
+	uint8_t byte;
+} sim_device_t;
+
+typedef struct {
+	sim_device_t device[SIM_DEVICES];
+	int devices;
+
+	uint8_t rx[OWIRE_MAX_SLOTS / 8];
+	uint32_t slots;    // slots of the current transaction
+	uint32_t end;      // time when the current transaction ends
+} sim_bus_t;
+
+static sim_bus_t sim_bus[SIM_BUSES];
+static uint32_t sim_now;
+
+static int sim_device_out(sim_device_t *device) {
+	switch (device->state) {
+		case SimSearch:
+			// Bit, complement, then direction from the master
+			if ((device->bit % 3) == 2) {
+				return 1;
+			}
+
+			return ((device->rom[(device->bit / 3) >> 3] >> ((device->bit / 3) & 7)) & 1) ^ (device->bit % 3);
+
+		case SimScratchpad:
+			return (device->scratchpad[device->bit >> 3] >> (device->bit & 7)) & 1;
+
+		default:
+			return 1;
+	}
+}
+
+static void sim_device_in(sim_device_t *device, int level) {
+	switch (device->state) {
+		case SimIdle:
+			break;
+
+		case SimCommand:
+		case SimFunction:
+			device->byte |= (level << device->bit);
+			if (++device->bit < 8) {
+				break;
+			}
+
+			device->bit = 0;
+
+			if (device->state == SimFunction) {
+				device->state = (device->byte == ONEWIRE_CMD_RSCRATCHPAD)?SimScratchpad:SimIdle;
+			} else if (device->byte == ONEWIRE_CMD_SEARCHROM) {
+				device->state = SimSearch;
+			} else if (device->byte == ONEWIRE_CMD_MATCHROM) {
+				device->state = SimMatch;
+			} else if (device->byte == ONEWIRE_CMD_SKIPROM) {
+				device->state = SimFunction;
+			} else {
+				device->state = SimIdle;
+			}
+
+			device->byte = 0;
+			break;
+
+		case SimSearch:
+			// Devices that don't match the direction stop
+			if ((device->bit % 3) == 2) {
+				if (level != ((device->rom[(device->bit / 3) >> 3] >> ((device->bit / 3) & 7)) & 1)) {
+					device->state = SimIdle;
+				}
+			}
+
+			if (++device->bit == 64 * 3) {
+				device->state = SimIdle;
+			}
+			break;
+
+		case SimMatch:
+			if (level != ((device->rom[device->bit >> 3] >> (device->bit & 7)) & 1)) {
+				device->state = SimIdle;
+			} else if (++device->bit == 64) {
+				device->bit = 0;
+				device->state = SimFunction;
+			}
+			break;
+
+		case SimScratchpad:
+			if (++device->bit == 72) {
+				device->state = SimIdle;
+			}
+			break;
+	}
+}
+
+static driver_error_t *sim_start(void *arg, uint8_t dev, const uint8_t *tx, uint32_t slots) {
+	sim_bus_t *bus = &sim_bus[dev];
+	uint32_t i, start;
+	int level, d;
+
+	TEST_ASSERT(dev < SIM_BUSES);
+	TEST_ASSERT(slots <= OWIRE_MAX_SLOTS);
+
+	start = (bus->end > sim_now)?bus->end:sim_now;
+	memset(bus->rx, 0, sizeof(bus->rx));
+	bus->slots = slots;
+
+	if (slots == 0) {
+		for(d = 0; d < bus->devices; d++) {
+			bus->device[d].state = SimCommand;
+			bus->device[d].bit = 0;
+			bus->device[d].byte = 0;
+		}
+
+		bus->rx[0] = (bus->devices > 0);
+		bus->end = start + SIM_T_RESET;
+
+		return NULL;
+	}
+
+	for(i = 0; i < slots; i++) {
+		level = (tx[i >> 3] >> (i & 7)) & 1;
+
+		for(d = 0; d < bus->devices; d++) {
+			level &= sim_device_out(&bus->device[d]);
+		}
+
+		for(d = 0; d < bus->devices; d++) {
+			sim_device_in(&bus->device[d], level);
+		}
+
+		bus->rx[i >> 3] |= (level << (i & 7));
+	}
+
+	bus->end = start + slots * SIM_T_SLOT + SIM_T_IDLE;
+
+	return NULL;
+}
+
+static driver_error_t *sim_wait(void *arg, uint8_t dev, uint8_t *rx) {
+	sim_bus_t *bus = &sim_bus[dev];
+
+	if (bus->end > sim_now) {
+		sim_now = bus->end;
+	}
+
+	memcpy(rx, bus->rx, bus->slots?((bus->slots + 7) / 8):1);
+
+	return NULL;
+}
+
+static void sim_power(void *arg, uint8_t dev, int on) {
+}
+
+static const owire_engine_t sim_engine = {
+	.start = sim_start,
+	.wait = sim_wait,
+	.power = sim_power,
+	.arg = NULL,
+};
+
+// Add devices with random ROMs of a family, and a scratchpad with its ROM
+static void sim_add_devices(int dev, uint8_t family, int n) {
+	sim_bus_t *bus = &sim_bus[dev];
+	sim_device_t *device;
+	int i;
+
+	while (n--) {
+		device = &bus->device[bus->devices++];
+
+		device->rom[0] = family;
+		for(i = 1; i < 7; i++) {
+			device->rom[i] = rand();
+		}
+		device->rom[7] = TM_OneWire_CRC8(device->rom, 7);
+
+		memcpy(device->scratchpad, device->rom, 8);
+		device->scratchpad[8] = TM_OneWire_CRC8(device->scratchpad, 8);
+	}
+}
+
+static int sim_has_rom(int dev, uint8_t *rom) {
+	int i;
+
+	for(i = 0; i < sim_bus[dev].devices; i++) {
+		if (memcmp(sim_bus[dev].device[i].rom, rom, 8) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void sim_setup(const int *devices) {
+	int dev;
+
+	memset(sim_bus, 0, sizeof(sim_bus));
+	sim_now = 0;
+
+	srand(1);
+
+	for(dev = 0; dev < SIM_BUSES; dev++) {
+		sim_add_devices(dev, 0x28, devices[dev]);
+		ow_devices_init(dev);
+	}
+}
+
+TEST_CASE("owire search", "[owire]") {
+	const owire_engine_t *engine;
+	const int devices[SIM_BUSES] = {7, 7, 6};
+	uint32_t serial, parallel;
+	uint8_t data[9];
+	int dev, i, j;
+
+	engine = owire_set_engine(&sim_engine);
+
+	// Search each bus, one after the other
+	sim_setup(devices);
+	for(dev = 0; dev < SIM_BUSES; dev++) {
+		TEST_ASSERT(TM_OneWire_Dosearch(dev) == devices[dev]);
+	}
+	serial = sim_now;
+
+	// Search all buses at the same time
+	sim_setup(devices);
+	TEST_ASSERT(owire_search((1 << SIM_BUSES) - 1) == NULL);
+	parallel = sim_now;
+
+	printf("search of %d devices on %d buses: %u usecs serial, %u usecs parallel\n",
+		devices[0] + devices[1] + devices[2], SIM_BUSES, serial, parallel);
+
+	TEST_ASSERT(parallel < serial / 2);
+
+	// All devices found, once
+	for(dev = 0; dev < SIM_BUSES; dev++) {
+		TEST_ASSERT(ow_devices[dev].numdev == devices[dev]);
+		TEST_ASSERT(ow_devices[dev].cached);
+
+		for(i = 0; i < ow_devices[dev].numdev; i++) {
+			TEST_ASSERT(sim_has_rom(dev, ow_devices[dev].roms[i]));
+
+			for(j = 0; j < i; j++) {
+				TEST_ASSERT(memcmp(ow_devices[dev].roms[i], ow_devices[dev].roms[j], 8) != 0);
+			}
+		}
+	}
+
+	// ROMs are cached, there is no bus activity
+	parallel = sim_now;
+	for(dev = 0; dev < SIM_BUSES; dev++) {
+		TEST_ASSERT(TM_OneWire_Dosearch(dev) == devices[dev]);
+	}
+	TEST_ASSERT(sim_now == parallel);
+
+	// Until they are invalidated
+	owire_invalidate(0);
+	TEST_ASSERT(TM_OneWire_Dosearch(0) == devices[0]);
+	TEST_ASSERT(sim_now > parallel);
+
+	// Select a device, and read its scratchpad
+	for(i = 0; i < ow_devices[1].numdev; i++) {
+		TEST_ASSERT(TM_OneWire_Reset(1) == 0);
+		TEST_ASSERT(owire_select(1, ow_devices[1].roms[i], ONEWIRE_CMD_RSCRATCHPAD) == NULL);
+		TEST_ASSERT(owire_read(1, data, sizeof(data)) == NULL);
+		TEST_ASSERT(memcmp(data, ow_devices[1].roms[i], 8) == 0);
+		TEST_ASSERT(TM_OneWire_CRC8(data, 8) == data[8]);
+	}
+
+	// Empty bus
+	memset(sim_bus, 0, sizeof(sim_bus));
+	TEST_ASSERT(TM_OneWire_Reset(2) == 1);
+	TEST_ASSERT(owire_search(1 << 2) == NULL);
+	TEST_ASSERT(ow_devices[2].numdev == 0);
+
+	owire_set_engine(engine);
+}
@@ -1,8 +1,10 @@
 #include "unity.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include <pthread/pthread.h>
 
@@ -97,3 +99,234 @@ TEST_CASE("pthread conditions", "[pthread]") {
 	pthread_mutex_destroy(&count_mutex);
 	pthread_cond_destroy(&count_threshold_cv);
 }
+
+/*
+ * Stress test
+ *
+ * Producers and consumers share a bounded FIFO queue, and wait for it with
+ * pthread_cond_wait when it's full / empty. Each item carries its producer
+ * and a sequence number, so lost, duplicated or reordered items are detected.
+ */
+#define PRODUCERS    4
+#define CONSUMERS    4
+#define ITEMS        2000
+#define QUEUE_SIZE   8
+
+static pthread_mutex_t queue_mutex;
+static pthread_cond_t queue_not_empty;
+static pthread_cond_t queue_not_full;
+static int queue[QUEUE_SIZE];
+static int queue_head, queue_count;
+static int consumed;
+static int last_seq[PRODUCERS];
+static int errors;
+
+static void *producer(void *args) {
+	int id = (intptr_t)args;
+	int seq;
+
+	for(seq = 0; seq < ITEMS; seq++) {
+		pthread_mutex_lock(&queue_mutex);
+
+		while (queue_count == QUEUE_SIZE) {
+			pthread_cond_wait(&queue_not_full, &queue_mutex);
+		}
+
+		queue[(queue_head + queue_count) % QUEUE_SIZE] = (id << 16) | seq;
+		queue_count++;
+
+		pthread_cond_signal(&queue_not_empty);
+		pthread_mutex_unlock(&queue_mutex);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void *consumer(void *args) {
+	int item, id, seq;
+
+	pthread_mutex_lock(&queue_mutex);
+
+	for(;;) {
+		while ((queue_count == 0) && (consumed < PRODUCERS * ITEMS)) {
+			pthread_cond_wait(&queue_not_empty, &queue_mutex);
+		}
+
+		if (consumed == PRODUCERS * ITEMS) {
+			break;
+		}
+
+		item = queue[queue_head];
+		queue_head = (queue_head + 1) % QUEUE_SIZE;
+		queue_count--;
+		consumed++;
+
+		// Items of each producer are received in order
+		id = item >> 16;
+		seq = item & 0xffff;
+		if (seq != last_seq[id] + 1) {
+			errors++;
+		}
+		last_seq[id] = seq;
+
+		pthread_cond_signal(&queue_not_full);
+
+		// Wake up the other consumers after the last item
+		if (consumed == PRODUCERS * ITEMS) {
+			pthread_cond_broadcast(&queue_not_empty);
+		}
+	}
+
+	pthread_mutex_unlock(&queue_mutex);
+
+	pthread_exit(NULL);
+}
+
+TEST_CASE("pthread conditions stress", "[pthread]") {
+	pthread_t producers[PRODUCERS];
+	pthread_t consumers[CONSUMERS];
+	struct timeval start, end;
+	pthread_attr_t attr;
+	int i;
+
+	queue_head = queue_count = consumed = errors = 0;
+	for(i = 0; i < PRODUCERS; i++) {
+		last_seq[i] = -1;
+	}
+
+	TEST_ASSERT(pthread_mutex_init(&queue_mutex, NULL) == 0);
+	TEST_ASSERT(pthread_cond_init(&queue_not_empty, NULL) == 0);
+	TEST_ASSERT(pthread_cond_init(&queue_not_full, NULL) == 0);
+
+	pthread_attr_init(&attr);
+
+	gettimeofday(&start, NULL);
+
+	for(i = 0; i < CONSUMERS; i++) {
+		TEST_ASSERT(pthread_create(&consumers[i], &attr, consumer, NULL) == 0);
+	}
+
+	for(i = 0; i < PRODUCERS; i++) {
+		TEST_ASSERT(pthread_create(&producers[i], &attr, producer, (void *)(intptr_t)i) == 0);
+	}
+
+	for(i = 0; i < PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+
+	for(i = 0; i < CONSUMERS; i++) {
+		pthread_join(consumers[i], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	printf("%d items through a %d items queue, %d producers, %d consumers: %ld msecs\n",
+		PRODUCERS * ITEMS, QUEUE_SIZE, PRODUCERS, CONSUMERS,
+		(long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000));
+
+	TEST_ASSERT(consumed == PRODUCERS * ITEMS);
+	TEST_ASSERT(queue_count == 0);
+	TEST_ASSERT(errors == 0);
+
+	for(i = 0; i < PRODUCERS; i++) {
+		TEST_ASSERT(last_seq[i] == ITEMS - 1);
+	}
+
+	pthread_attr_destroy(&attr);
+
+	TEST_ASSERT(pthread_cond_destroy(&queue_not_empty) == 0);
+	TEST_ASSERT(pthread_cond_destroy(&queue_not_full) == 0);
+	TEST_ASSERT(pthread_mutex_destroy(&queue_mutex) == 0);
+}
+
+static pthread_mutex_t go_mutex;
+static pthread_cond_t go_cond;
+static int go, waiting, woken;
+
+static void *wait_go(void *args) {
+	pthread_mutex_lock(&go_mutex);
+
+	waiting++;
+	while (!go) {
+		pthread_cond_wait(&go_cond, &go_mutex);
+	}
+	woken++;
+
+	pthread_mutex_unlock(&go_mutex);
+
+	pthread_exit(NULL);
+}
+
+static void abstime_ms(struct timespec *abstime, int msecs) {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	abstime->tv_sec = now.tv_sec + msecs / 1000;
+	abstime->tv_nsec = now.tv_usec * 1000 + (msecs % 1000) * 1000000;
+	if (abstime->tv_nsec >= 1000000000) {
+		abstime->tv_sec++;
+		abstime->tv_nsec -= 1000000000;
+	}
+}
+
+TEST_CASE("pthread conditions broadcast and timed wait", "[pthread]") {
+	pthread_t threads[CONSUMERS];
+	struct timeval start, end;
+	struct timespec abstime;
+	pthread_attr_t attr;
+	int i, ready, msecs;
+
+	go = waiting = woken = 0;
+
+	TEST_ASSERT(pthread_mutex_init(&go_mutex, NULL) == 0);
+	TEST_ASSERT(pthread_cond_init(&go_cond, NULL) == 0);
+
+	pthread_attr_init(&attr);
+
+	for(i = 0; i < CONSUMERS; i++) {
+		TEST_ASSERT(pthread_create(&threads[i], &attr, wait_go, NULL) == 0);
+	}
+
+	// All threads waiting
+	do {
+		udelay(1000);
+
+		pthread_mutex_lock(&go_mutex);
+		ready = (waiting == CONSUMERS);
+		pthread_mutex_unlock(&go_mutex);
+	} while (!ready);
+
+	// Nobody is signaled, so the wait times out, and the mutex is locked
+	// again
+	pthread_mutex_lock(&go_mutex);
+
+	gettimeofday(&start, NULL);
+	abstime_ms(&abstime, 100);
+	TEST_ASSERT(pthread_cond_timedwait(&go_cond, &go_mutex, &abstime) == ETIMEDOUT);
+	gettimeofday(&end, NULL);
+
+	msecs = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	TEST_ASSERT(msecs >= 90);
+	TEST_ASSERT(woken == 0);
+
+	// Time in the past
+	abstime_ms(&abstime, -1000);
+	TEST_ASSERT(pthread_cond_timedwait(&go_cond, &go_mutex, &abstime) == ETIMEDOUT);
+
+	// Wake up all threads
+	go = 1;
+	pthread_cond_broadcast(&go_cond);
+	pthread_mutex_unlock(&go_mutex);
+
+	for(i = 0; i < CONSUMERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	TEST_ASSERT(woken == CONSUMERS);
+
+	pthread_attr_destroy(&attr);
+
+	TEST_ASSERT(pthread_cond_destroy(&go_cond) == 0);
+	TEST_ASSERT(pthread_mutex_destroy(&go_mutex) == 0);
+}
@@ -0,0 +1,116 @@
+#include "unity.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread/pthread.h>
+
+#include <sys/delay.h>
+
+#define NUM_KEYS       16
+#define NUM_THREADS    1000
+#define BATCH_THREADS  4
+#define RECYCLED_KEYS  2000
+
+static pthread_key_t keys[NUM_KEYS];
+static pthread_mutex_t destructor_mutex;
+static int destructor_calls;
+static int errors;
+
+static void destructor(void *value) {
+	pthread_mutex_lock(&destructor_mutex);
+	destructor_calls++;
+	pthread_mutex_unlock(&destructor_mutex);
+}
+
+static void *key_thread(void *args) {
+	int id = (intptr_t)args;
+	int i;
+
+	// No values yet
+	for(i = 0; i < NUM_KEYS; i++) {
+		if (pthread_getspecific(keys[i]) != NULL) {
+			errors++;
+		}
+	}
+
+	// A value per thread and key
+	for(i = 0; i < NUM_KEYS; i++) {
+		if (pthread_setspecific(keys[i], (void *)(intptr_t)(id * NUM_KEYS + i + 1)) != 0) {
+			errors++;
+		}
+	}
+
+	// Let other threads set their values
+	udelay(100);
+
+	for(i = 0; i < NUM_KEYS; i++) {
+		if (pthread_getspecific(keys[i]) != (void *)(intptr_t)(id * NUM_KEYS + i + 1)) {
+			errors++;
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+TEST_CASE("pthread keys", "[pthread]") {
+	pthread_t threads[BATCH_THREADS];
+	pthread_attr_t attr;
+	int i, j;
+
+	destructor_calls = errors = 0;
+
+	TEST_ASSERT(pthread_mutex_init(&destructor_mutex, NULL) == 0);
+
+	for(i = 0; i < NUM_KEYS; i++) {
+		TEST_ASSERT(pthread_key_create(&keys[i], destructor) == 0);
+	}
+
+	pthread_attr_init(&attr);
+
+	for(i = 0; i < NUM_THREADS; i += BATCH_THREADS) {
+		for(j = 0; j < BATCH_THREADS; j++) {
+			TEST_ASSERT(pthread_create(&threads[j], &attr, key_thread, (void *)(intptr_t)(i + j)) == 0);
+		}
+
+		for(j = 0; j < BATCH_THREADS; j++) {
+			pthread_join(threads[j], NULL);
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	TEST_ASSERT(errors == 0);
+
+	// Destructors are called at thread exit, before the thread is joined
+	TEST_ASSERT(destructor_calls == NUM_THREADS * NUM_KEYS);
+
+	for(i = 0; i < NUM_KEYS; i++) {
+		TEST_ASSERT(pthread_key_delete(keys[i]) == 0);
+	}
+
+	TEST_ASSERT(pthread_mutex_destroy(&destructor_mutex) == 0);
+}
+
+TEST_CASE("pthread keys recycling", "[pthread]") {
+	pthread_key_t key, old;
+	int i;
+
+	TEST_ASSERT(pthread_key_create(&old, NULL) == 0);
+	TEST_ASSERT(pthread_setspecific(old, (void *)1) == 0);
+	TEST_ASSERT(pthread_key_delete(old) == 0);
+
+	for(i = 0; i < RECYCLED_KEYS; i++) {
+		TEST_ASSERT(pthread_key_create(&key, NULL) == 0);
+
+		// The value of a deleted key is not a value of the new key
+		TEST_ASSERT(pthread_getspecific(key) == NULL);
+
+		TEST_ASSERT(pthread_setspecific(key, (void *)(intptr_t)(i + 2)) == 0);
+		TEST_ASSERT(pthread_getspecific(key) == (void *)(intptr_t)(i + 2));
+
+		TEST_ASSERT(pthread_key_delete(key) == 0);
+	}
+}
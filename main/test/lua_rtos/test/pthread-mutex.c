@@ -0,0 +1,268 @@
+#include "unity.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <pthread/pthread.h>
+
+#define NUM_THREADS  4
+#define BENCH_LOCKS  20000
+
+static pthread_mutex_t mutex;
+static int counter;
+
+static void *try_other(void *args) {
+	// Locked by other thread
+	TEST_ASSERT(pthread_mutex_trylock(&mutex) == EBUSY);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == EPERM);
+
+	pthread_exit(NULL);
+}
+
+TEST_CASE("pthread mutex types", "[pthread]") {
+	pthread_mutexattr_t attr;
+	pthread_attr_t tattr;
+	pthread_t thread;
+
+	pthread_attr_init(&tattr);
+
+	// Recursive
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	TEST_ASSERT(pthread_mutex_init(&mutex, &attr) == 0);
+
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_trylock(&mutex) == 0);
+
+	TEST_ASSERT(pthread_create(&thread, &tattr, try_other, NULL) == 0);
+	pthread_join(thread, NULL);
+
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == EPERM);
+	TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+
+	// Error check
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+	TEST_ASSERT(pthread_mutex_init(&mutex, &attr) == 0);
+
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == EDEADLK);
+	TEST_ASSERT(pthread_mutex_trylock(&mutex) == EBUSY);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+
+	// Static initializer, created on first use
+	mutex = PTHREAD_MUTEX_INITIALIZER;
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+	TEST_ASSERT(mutex != PTHREAD_MUTEX_INITIALIZER);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+
+	pthread_attr_destroy(&tattr);
+}
+
+/*
+ * Priority inheritance
+ */
+static SemaphoreHandle_t held;
+static UBaseType_t base;
+
+static void *low_thread(void *args) {
+	vTaskPrioritySet(NULL, base);
+
+	// Also holds a FreeRTOS mutex, as drivers do
+	TEST_ASSERT(xSemaphoreTake(held, portMAX_DELAY) == pdPASS);
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+
+	vTaskDelay(50 / portTICK_PERIOD_MS);
+
+	// Raised by the high priority thread
+	TEST_ASSERT(uxTaskPriorityGet(NULL) == base + 2);
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+
+	// Back to the base priority when no mutex is held
+	xSemaphoreGive(held);
+	TEST_ASSERT(uxTaskPriorityGet(NULL) == base);
+
+	pthread_exit(NULL);
+}
+
+static void *high_thread(void *args) {
+	vTaskPrioritySet(NULL, base + 2);
+	vTaskDelay(10 / portTICK_PERIOD_MS);
+
+	TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+	counter++;
+	TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+
+	pthread_exit(NULL);
+}
+
+static void *contend_thread(void *args) {
+	int i;
+
+	for(i = 0; i < 20; i++) {
+		TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+		counter++;
+		TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	}
+
+	pthread_exit(NULL);
+}
+
+TEST_CASE("pthread mutex contention", "[pthread]") {
+	pthread_t low, high, a, b;
+	pthread_attr_t tattr;
+	int i;
+
+	pthread_attr_init(&tattr);
+
+	held = xSemaphoreCreateMutex();
+	TEST_ASSERT(held != NULL);
+
+	base = uxTaskPriorityGet(NULL);
+	counter = 0;
+
+	TEST_ASSERT(pthread_mutex_init(&mutex, NULL) == 0);
+	TEST_ASSERT(pthread_create(&low, &tattr, low_thread, NULL) == 0);
+	TEST_ASSERT(pthread_create(&high, &tattr, high_thread, NULL) == 0);
+	pthread_join(low, NULL);
+	pthread_join(high, NULL);
+	TEST_ASSERT(counter == 1);
+	TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+
+	vSemaphoreDelete(held);
+
+	// First contention of new mutexes, the wait queue is created while
+	// the owner unlocks
+	for(i = 0; i < 200; i++) {
+		counter = 0;
+
+		TEST_ASSERT(pthread_mutex_init(&mutex, NULL) == 0);
+		TEST_ASSERT(pthread_create(&a, &tattr, contend_thread, NULL) == 0);
+		TEST_ASSERT(pthread_create(&b, &tattr, contend_thread, NULL) == 0);
+		pthread_join(a, NULL);
+		pthread_join(b, NULL);
+		TEST_ASSERT(counter == 40);
+		TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+	}
+
+	pthread_attr_destroy(&tattr);
+}
+
+/*
+ * Benchmark
+ *
+ * Compares the mutexes with the previous implementation, that looked up the
+ * mutex in a list, and then took its semaphore, on each lock and unlock.
+ * There is no host benchmark, the rates are measured on the device by this
+ * test.
+ */
+static struct list bench_list;
+static int bench_index;
+static int bench_yield;
+
+static void list_lock(void) {
+	SemaphoreHandle_t sem;
+
+	TEST_ASSERT(list_get(&bench_list, bench_index, (void **)&sem) == 0);
+	TEST_ASSERT(xSemaphoreTake(sem, portMAX_DELAY) == pdPASS);
+}
+
+static void list_unlock(void) {
+	SemaphoreHandle_t sem;
+
+	TEST_ASSERT(list_get(&bench_list, bench_index, (void **)&sem) == 0);
+	xSemaphoreGive(sem);
+}
+
+static void *bench_list_thread(void *args) {
+	int i;
+
+	for(i = 0; i < BENCH_LOCKS; i++) {
+		list_lock();
+		counter++;
+		if (bench_yield) taskYIELD();
+		list_unlock();
+	}
+
+	pthread_exit(NULL);
+}
+
+static void *bench_mutex_thread(void *args) {
+	int i;
+
+	for(i = 0; i < BENCH_LOCKS; i++) {
+		TEST_ASSERT(pthread_mutex_lock(&mutex) == 0);
+		counter++;
+		if (bench_yield) taskYIELD();
+		TEST_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+	}
+
+	pthread_exit(NULL);
+}
+
+static uint32_t bench_run(int threads, void *(*start)(void *)) {
+	pthread_t thread[NUM_THREADS];
+	pthread_attr_t attr;
+	struct timeval t0, t1;
+	uint32_t usecs;
+	int i;
+
+	pthread_attr_init(&attr);
+
+	counter = 0;
+
+	gettimeofday(&t0, NULL);
+	for(i = 0; i < threads; i++) {
+		TEST_ASSERT(pthread_create(&thread[i], &attr, start, NULL) == 0);
+	}
+
+	for(i = 0; i < threads; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	gettimeofday(&t1, NULL);
+
+	pthread_attr_destroy(&attr);
+
+	TEST_ASSERT(counter == threads * BENCH_LOCKS);
+
+	usecs = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_usec - t0.tv_usec);
+
+	// Lock / unlock per second
+	return (uint32_t)(((uint64_t)threads * BENCH_LOCKS * 1000000) / usecs);
+}
+
+TEST_CASE("pthread-mutex-benchmark", "[pthread]") {
+	uint32_t list_rate, mutex_rate;
+	SemaphoreHandle_t sem;
+	int threads;
+
+	list_init(&bench_list, 1);
+	sem = xSemaphoreCreateMutex();
+	TEST_ASSERT(sem != NULL);
+	TEST_ASSERT(list_add(&bench_list, sem, &bench_index) == 0);
+
+	TEST_ASSERT(pthread_mutex_init(&mutex, NULL) == 0);
+
+	for(bench_yield = 0; bench_yield < 2; bench_yield++) {
+		for(threads = 1; threads <= NUM_THREADS; threads <<= 1) {
+			list_rate = bench_run(threads, bench_list_thread);
+			mutex_rate = bench_run(threads, bench_mutex_thread);
+
+			printf("%d threads%s: %8u locks/sec list, %8u locks/sec atomic\n",
+				threads, bench_yield?", yield while locked":"", list_rate, mutex_rate);
+		}
+	}
+
+	TEST_ASSERT(pthread_mutex_destroy(&mutex) == 0);
+
+	list_remove(&bench_list, bench_index, 0);
+	list_destroy(&bench_list, 0);
+	vSemaphoreDelete(sem);
+}
@@ -0,0 +1,233 @@
+#include "unity.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/pubsub.h>
+
+#include <pthread/pthread.h>
+
+#define NUM_SUBSCRIBERS 100
+#define NUM_MESSAGES    10
+#define QUEUE_SIZE      4
+#define NUM_BLOCKED     3
+
+TEST_CASE("pubsub topics", "[pubsub]") {
+	pubsub_sub_t *sub;
+
+	TEST_ASSERT(pubsub_topic_match("a/b/c", "a/b/c"));
+	TEST_ASSERT(!pubsub_topic_match("a/b/c", "a/b"));
+	TEST_ASSERT(!pubsub_topic_match("a/b", "a/b/c"));
+
+	// Single level
+	TEST_ASSERT(pubsub_topic_match("a/+/c", "a/b/c"));
+	TEST_ASSERT(pubsub_topic_match("a/+/c", "a//c"));
+	TEST_ASSERT(!pubsub_topic_match("a/+/c", "a/b/d/c"));
+	TEST_ASSERT(pubsub_topic_match("+/+", "a/b"));
+	TEST_ASSERT(!pubsub_topic_match("+", "a/b"));
+
+	// Multi level
+	TEST_ASSERT(pubsub_topic_match("a/#", "a/b/c"));
+	TEST_ASSERT(pubsub_topic_match("a/#", "a"));
+	TEST_ASSERT(!pubsub_topic_match("a/#", "b/c"));
+	TEST_ASSERT(pubsub_topic_match("#", "a/b/c"));
+
+	// Invalid filters
+	TEST_ASSERT(pubsub_subscribe("", QUEUE_SIZE, PubSubDropNewest, &sub) == EINVAL);
+	TEST_ASSERT(pubsub_subscribe("a+", QUEUE_SIZE, PubSubDropNewest, &sub) == EINVAL);
+	TEST_ASSERT(pubsub_subscribe("a/+b", QUEUE_SIZE, PubSubDropNewest, &sub) == EINVAL);
+	TEST_ASSERT(pubsub_subscribe("a/#/b", QUEUE_SIZE, PubSubDropNewest, &sub) == EINVAL);
+	TEST_ASSERT(pubsub_subscribe("a", 0, PubSubDropNewest, &sub) == EINVAL);
+
+	// Wildcards are not allowed in topics
+	TEST_ASSERT(pubsub_publish("a/+", NULL, 0, NULL) == EINVAL);
+	TEST_ASSERT(pubsub_publish("#", NULL, 0, NULL) == EINVAL);
+}
+
+TEST_CASE("pubsub fan-out", "[pubsub]") {
+	const char *filters[] = {"sensor/temp", "sensor/+", "sensor/#", "#", "+/temp"};
+	pubsub_sub_t *subs[NUM_SUBSCRIBERS];
+	pubsub_sub_t *other;
+	pubsub_stats_t stats;
+	pubsub_msg_t *msg;
+	uint32_t delivered, dropped, queued;
+	int i, j;
+
+	for(i = 0; i < NUM_SUBSCRIBERS; i++) {
+		TEST_ASSERT(pubsub_subscribe(filters[i % 5], NUM_MESSAGES, PubSubDropNewest, &subs[i]) == 0);
+	}
+
+	// Doesn't match
+	TEST_ASSERT(pubsub_subscribe("sensor/hum", NUM_MESSAGES, PubSubDropNewest, &other) == 0);
+
+	pubsub_stats(&stats);
+	TEST_ASSERT(stats.subscribers == NUM_SUBSCRIBERS + 1);
+
+	// Each message is delivered to all subscribers
+	for(j = 0; j < NUM_MESSAGES; j++) {
+		TEST_ASSERT(pubsub_publish("sensor/temp", &j, sizeof(j), &delivered) == 0);
+		TEST_ASSERT(delivered == NUM_SUBSCRIBERS);
+	}
+
+	// In order
+	for(i = 0; i < NUM_SUBSCRIBERS; i++) {
+		for(j = 0; j < NUM_MESSAGES; j++) {
+			msg = pubsub_receive(subs[i], 0);
+			TEST_ASSERT(msg != NULL);
+			TEST_ASSERT(strcmp(msg->topic, "sensor/temp") == 0);
+			TEST_ASSERT(msg->len == sizeof(j));
+			TEST_ASSERT(memcmp(msg->data, &j, sizeof(j)) == 0);
+			pubsub_msg_release(msg);
+		}
+
+		TEST_ASSERT(pubsub_receive(subs[i], 0) == NULL);
+
+		pubsub_sub_stats(subs[i], &queued, &delivered, &dropped);
+		TEST_ASSERT(queued == 0);
+		TEST_ASSERT(delivered == NUM_MESSAGES);
+		TEST_ASSERT(dropped == 0);
+	}
+
+	TEST_ASSERT(pubsub_receive(other, 0) == NULL);
+
+	// Unsubscribed subscribers don't get messages
+	for(i = 0; i < NUM_SUBSCRIBERS; i += 2) {
+		pubsub_unsubscribe(subs[i]);
+	}
+
+	TEST_ASSERT(pubsub_publish("sensor/temp", NULL, 0, &delivered) == 0);
+	TEST_ASSERT(delivered == NUM_SUBSCRIBERS / 2);
+
+	for(i = 0; i < NUM_SUBSCRIBERS; i++) {
+		pubsub_unsubscribe(subs[i]);
+		pubsub_sub_release(subs[i]);
+	}
+
+	pubsub_unsubscribe(other);
+	pubsub_sub_release(other);
+
+	pubsub_stats(&stats);
+	TEST_ASSERT(stats.subscribers == 0);
+}
+
+static pubsub_sub_t *block_sub;
+
+static void *block_publisher(void *args) {
+	int i;
+
+	for(i = 0; i < NUM_MESSAGES; i++) {
+		TEST_ASSERT(pubsub_publish("block", &i, sizeof(i), NULL) == 0);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void *blocked_publisher(void *args) {
+	uint32_t delivered;
+
+	// Blocked until the subscriber is removed
+	TEST_ASSERT(pubsub_publish("block", NULL, 0, &delivered) == 0);
+	TEST_ASSERT(delivered == 0);
+
+	pthread_exit(NULL);
+}
+
+static int receive_int(pubsub_sub_t *sub) {
+	pubsub_msg_t *msg;
+	int value;
+
+	msg = pubsub_receive(sub, 1000 / portTICK_PERIOD_MS);
+	TEST_ASSERT(msg != NULL);
+	memcpy(&value, msg->data, sizeof(value));
+	pubsub_msg_release(msg);
+
+	return value;
+}
+
+TEST_CASE("pubsub overflow", "[pubsub]") {
+	uint32_t delivered, dropped, queued;
+	pthread_t blocked[NUM_BLOCKED];
+	pthread_attr_t attr;
+	pthread_t thread;
+	pubsub_sub_t *sub;
+	int i;
+
+	// Drop oldest: the last messages are kept
+	TEST_ASSERT(pubsub_subscribe("oldest", QUEUE_SIZE, PubSubDropOldest, &sub) == 0);
+	for(i = 0; i < NUM_MESSAGES; i++) {
+		TEST_ASSERT(pubsub_publish("oldest", &i, sizeof(i), &delivered) == 0);
+		TEST_ASSERT(delivered == 1);
+	}
+
+	pubsub_sub_stats(sub, &queued, &delivered, &dropped);
+	TEST_ASSERT(queued == QUEUE_SIZE);
+	TEST_ASSERT(delivered == NUM_MESSAGES);
+	TEST_ASSERT(dropped == NUM_MESSAGES - QUEUE_SIZE);
+
+	for(i = NUM_MESSAGES - QUEUE_SIZE; i < NUM_MESSAGES; i++) {
+		TEST_ASSERT(receive_int(sub) == i);
+	}
+	TEST_ASSERT(pubsub_receive(sub, 0) == NULL);
+
+	pubsub_unsubscribe(sub);
+	pubsub_sub_release(sub);
+
+	// Drop newest: the first messages are kept
+	TEST_ASSERT(pubsub_subscribe("newest", QUEUE_SIZE, PubSubDropNewest, &sub) == 0);
+	for(i = 0; i < NUM_MESSAGES; i++) {
+		TEST_ASSERT(pubsub_publish("newest", &i, sizeof(i), &delivered) == 0);
+		TEST_ASSERT(delivered == (i < QUEUE_SIZE));
+	}
+
+	pubsub_sub_stats(sub, &queued, &delivered, &dropped);
+	TEST_ASSERT(queued == QUEUE_SIZE);
+	TEST_ASSERT(delivered == QUEUE_SIZE);
+	TEST_ASSERT(dropped == NUM_MESSAGES - QUEUE_SIZE);
+
+	for(i = 0; i < QUEUE_SIZE; i++) {
+		TEST_ASSERT(receive_int(sub) == i);
+	}
+	TEST_ASSERT(pubsub_receive(sub, 0) == NULL);
+
+	pubsub_unsubscribe(sub);
+	pubsub_sub_release(sub);
+
+	// Block: the publisher waits, and nothing is lost
+	pthread_attr_init(&attr);
+
+	TEST_ASSERT(pubsub_subscribe("block", QUEUE_SIZE, PubSubBlock, &block_sub) == 0);
+	TEST_ASSERT(pthread_create(&thread, &attr, block_publisher, NULL) == 0);
+
+	for(i = 0; i < NUM_MESSAGES; i++) {
+		TEST_ASSERT(receive_int(block_sub) == i);
+	}
+
+	pthread_join(thread, NULL);
+
+	pubsub_sub_stats(block_sub, &queued, &delivered, &dropped);
+	TEST_ASSERT(delivered == NUM_MESSAGES);
+	TEST_ASSERT(dropped == 0);
+
+	// Publishers blocked on a full queue are released by unsubscribe
+	for(i = 0; i < QUEUE_SIZE; i++) {
+		TEST_ASSERT(pubsub_publish("block", &i, sizeof(i), NULL) == 0);
+	}
+
+	for(i = 0; i < NUM_BLOCKED; i++) {
+		TEST_ASSERT(pthread_create(&blocked[i], &attr, blocked_publisher, NULL) == 0);
+	}
+	vTaskDelay(100 / portTICK_PERIOD_MS);
+
+	pubsub_unsubscribe(block_sub);
+	for(i = 0; i < NUM_BLOCKED; i++) {
+		pthread_join(blocked[i], NULL);
+	}
+
+	// Queued messages can still be received
+	TEST_ASSERT(receive_int(block_sub) == 0);
+	pubsub_sub_release(block_sub);
+
+	pthread_attr_destroy(&attr);
+}
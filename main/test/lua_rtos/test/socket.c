@@ -0,0 +1,212 @@
+#include "unity.h"
+
+#include "luartos.h"
+
+#if USE_NET_VFS
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lwip/sockets.h"
+
+#include <drivers/net.h>
+#include <vfs/vfs.h>
+
+#define NUM_CONNECTIONS 200
+
+// Listen on a loopback port, and return the address to connect to
+static int loopback_server(struct sockaddr_in *address) {
+	socklen_t len = sizeof(*address);
+	int server;
+
+	memset(address, 0, sizeof(*address));
+	address->sin_family = AF_INET;
+	address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	server = socket(AF_INET, SOCK_STREAM, 0);
+	TEST_ASSERT(server >= 0);
+	TEST_ASSERT(bind(server, (struct sockaddr *)address, sizeof(*address)) == 0);
+	TEST_ASSERT(listen(server, 2) == 0);
+	TEST_ASSERT(getsockname(server, (struct sockaddr *)address, &len) == 0);
+
+	return server;
+}
+
+static int loopback_client(struct sockaddr_in *address) {
+	int client;
+
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	TEST_ASSERT(client >= 0);
+	TEST_ASSERT(connect(client, (struct sockaddr *)address, sizeof(*address)) == 0);
+
+	return client;
+}
+
+TEST_CASE("socket file descriptors", "[socket]") {
+	struct sockaddr_in address;
+	int server, client, conn;
+	char buf[4];
+	FILE *stream;
+	int s;
+
+	TEST_ASSERT(net_init() == NULL);
+
+	// Translation
+	for(s = 0; s < CONFIG_LWIP_MAX_SOCKETS; s++) {
+		TEST_ASSERT(vfs_net_socket(vfs_net_fd(s)) == s);
+	}
+
+	TEST_ASSERT(vfs_net_fd(-1) == -1);
+	TEST_ASSERT(vfs_net_socket(-1) == -1);
+
+	// The console is not a socket
+	TEST_ASSERT(vfs_net_socket(fileno(stdin)) == -1);
+	TEST_ASSERT(vfs_net_socket(fileno(stdout)) == -1);
+	TEST_ASSERT(vfs_net_socket(fileno(stderr)) == -1);
+
+	// Sockets can be waited for with select
+	TEST_ASSERT(vfs_net_fd(CONFIG_LWIP_MAX_SOCKETS - 1) < FD_SETSIZE);
+
+	server = loopback_server(&address);
+	client = loopback_client(&address);
+
+	conn = accept(server, NULL, NULL);
+	TEST_ASSERT(conn >= 0);
+	TEST_ASSERT(vfs_net_fd(vfs_net_socket(conn)) == conn);
+
+	// The file descriptors are from the vfs, and can be used with stdio
+	TEST_ASSERT(write(client, "abc", 3) == 3);
+	TEST_ASSERT(read(conn, buf, 3) == 3);
+	TEST_ASSERT(memcmp(buf, "abc", 3) == 0);
+
+	stream = fdopen(conn, "a+");
+	TEST_ASSERT(stream != NULL);
+	TEST_ASSERT(fprintf(stream, "xyz") == 3);
+	TEST_ASSERT(fflush(stream) == 0);
+	TEST_ASSERT(recv(client, buf, 3, 0) == 3);
+	TEST_ASSERT(memcmp(buf, "xyz", 3) == 0);
+	TEST_ASSERT(fclose(stream) == 0);
+
+	// A closed file descriptor
+	TEST_ASSERT(send(conn, "abc", 3, 0) == -1);
+
+	TEST_ASSERT(close(client) == 0);
+	TEST_ASSERT(close(server) == 0);
+}
+
+TEST_CASE("socket select", "[socket]") {
+	struct sockaddr_in address;
+	int server, client, conn;
+	struct timeval timeout;
+	fd_set rset, wset;
+	char buf[4];
+
+	TEST_ASSERT(net_init() == NULL);
+
+	server = loopback_server(&address);
+
+	// Nothing to accept
+	FD_ZERO(&rset);
+	FD_SET(server, &rset);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 10000;
+	TEST_ASSERT(select(server + 1, &rset, NULL, NULL, &timeout) == 0);
+	TEST_ASSERT(!FD_ISSET(server, &rset));
+
+	// A connection to accept, and a connected socket
+	client = loopback_client(&address);
+
+	FD_ZERO(&rset);
+	FD_SET(server, &rset);
+	FD_ZERO(&wset);
+	FD_SET(client, &wset);
+	TEST_ASSERT(select(((client > server) ? client : server) + 1, &rset, &wset, NULL, NULL) == 2);
+	TEST_ASSERT(FD_ISSET(server, &rset));
+	TEST_ASSERT(FD_ISSET(client, &wset));
+
+	conn = accept(server, NULL, NULL);
+	TEST_ASSERT(conn >= 0);
+
+	// Only the socket with data is readable
+	TEST_ASSERT(send(client, "abc", 3, 0) == 3);
+
+	FD_ZERO(&rset);
+	FD_SET(server, &rset);
+	FD_SET(client, &rset);
+	FD_SET(conn, &rset);
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
+	TEST_ASSERT(select(FD_SETSIZE, &rset, NULL, NULL, &timeout) == 1);
+	TEST_ASSERT(FD_ISSET(conn, &rset));
+	TEST_ASSERT(!FD_ISSET(server, &rset));
+	TEST_ASSERT(!FD_ISSET(client, &rset));
+
+	TEST_ASSERT(recv(conn, buf, sizeof(buf), 0) == 3);
+
+	// Only sockets can be waited for
+	FD_ZERO(&rset);
+	FD_SET(conn, &rset);
+	FD_SET(fileno(stdin), &rset);
+	TEST_ASSERT(select(FD_SETSIZE, &rset, NULL, NULL, &timeout) == -1);
+	TEST_ASSERT(errno == EBADF);
+
+	FD_ZERO(&rset);
+	TEST_ASSERT(select(FD_SETSIZE + 1, &rset, NULL, NULL, &timeout) == -1);
+	TEST_ASSERT(errno == EINVAL);
+
+	TEST_ASSERT(close(conn) == 0);
+	TEST_ASSERT(close(client) == 0);
+	TEST_ASSERT(close(server) == 0);
+}
+
+TEST_CASE("socket accept rate", "[socket]") {
+	struct sockaddr_in address;
+	int server, client, conn;
+	TickType_t start, elapsed;
+	uint32_t heap;
+	int i;
+
+	TEST_ASSERT(net_init() == NULL);
+
+	server = loopback_server(&address);
+
+	// Warm up, so lwip has its pools allocated
+	client = loopback_client(&address);
+	conn = accept(server, NULL, NULL);
+	TEST_ASSERT(conn >= 0);
+	close(conn);
+	close(client);
+
+	heap = xPortGetFreeHeapSize();
+
+	start = xTaskGetTickCount();
+	for(i = 0; i < NUM_CONNECTIONS; i++) {
+		client = loopback_client(&address);
+
+		conn = accept(server, NULL, NULL);
+		TEST_ASSERT(conn >= 0);
+		TEST_ASSERT(vfs_net_socket(conn) >= 0);
+
+		TEST_ASSERT(close(conn) == 0);
+		TEST_ASSERT(close(client) == 0);
+	}
+	elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	TEST_ASSERT(close(server) == 0);
+
+	printf("%d connections accepted in %u msecs, %u connections/sec, %d bytes of heap lost\n",
+		NUM_CONNECTIONS, elapsed, (elapsed > 0) ? (NUM_CONNECTIONS * 1000) / elapsed : 0,
+		(int)(heap - xPortGetFreeHeapSize()));
+
+	// No stream is allocated for each connection, but lwip can keep some
+	// connections in TIME_WAIT
+	TEST_ASSERT((int)(heap - xPortGetFreeHeapSize()) < NUM_CONNECTIONS * 64);
+}
+
+#endif
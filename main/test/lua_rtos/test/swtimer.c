@@ -0,0 +1,175 @@
+#include "unity.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <sys/swtimer.h>
+
+#define NUM_TIMERS    1000
+#define RUN_MS        1000
+#define HIRES_PERIOD  1500
+#define HIRES_FIRES   200
+
+struct test_timer {
+	swtimer_t timer;
+	uint64_t expected;  // expected time of the next expiration
+	uint32_t calls;
+};
+
+static struct test_timer timers[NUM_TIMERS];
+
+// Callbacks are serialized by the service, so no lock is needed
+static int order[NUM_TIMERS];
+static int ordered;
+static uint64_t max_late, sum_late;
+
+static void order_callback(void *arg) {
+	struct test_timer *t = (struct test_timer *)arg;
+
+	t->calls++;
+	order[ordered++] = t - timers;
+}
+
+static void jitter_callback(void *arg) {
+	struct test_timer *t = (struct test_timer *)arg;
+	uint64_t now = swtimer_now();
+	uint64_t late;
+
+	t->calls++;
+
+	late = now - t->expected;
+	if (late > max_late) max_late = late;
+	sum_late += late;
+
+	// The service has already scheduled the next expiration
+	t->expected = t->timer.deadline;
+}
+
+TEST_CASE("swtimer ordering", "[swtimer]") {
+	uint32_t fired;
+	int i;
+
+	memset(timers, 0, sizeof(timers));
+	ordered = 0;
+
+	// Deadlines from 1 to 200 msecs, not in start order
+	for(i = 0; i < NUM_TIMERS; i++) {
+		TEST_ASSERT(swtimer_start(&timers[i].timer, (1 + (i * 7919) % 200) * 1000, SWTIMER_ONESHOT, order_callback, &timers[i]) == 0);
+	}
+
+	vTaskDelay(400 / portTICK_PERIOD_MS);
+
+	// Each timer expires once, in deadline order
+	for(i = 0; i < NUM_TIMERS; i++) {
+		swtimer_stats(&timers[i].timer, &fired, NULL);
+		TEST_ASSERT(fired == 1);
+		TEST_ASSERT(timers[i].calls == 1);
+		TEST_ASSERT(timers[i].timer.index == 0);
+	}
+
+	TEST_ASSERT(ordered == NUM_TIMERS);
+
+	for(i = 1; i < NUM_TIMERS; i++) {
+		TEST_ASSERT(timers[order[i - 1]].timer.deadline <= timers[order[i]].timer.deadline);
+	}
+}
+
+TEST_CASE("swtimer periodic", "[swtimer]") {
+	uint32_t fired, missed, calls, expected;
+	uint64_t start, elapsed;
+	int i;
+
+	memset(timers, 0, sizeof(timers));
+	max_late = sum_late = 0;
+	calls = 0;
+
+	// 1000 concurrent timers, with periods from 10 to 55 msecs
+	start = swtimer_now();
+	for(i = 0; i < NUM_TIMERS; i++) {
+		// Set before the start, as the timer can expire before it returns
+		timers[i].expected = swtimer_now() + (10 + (i % 10) * 5) * 1000;
+		TEST_ASSERT(swtimer_start(&timers[i].timer, (10 + (i % 10) * 5) * 1000, 0, jitter_callback, &timers[i]) == 0);
+	}
+
+	vTaskDelay(RUN_MS / portTICK_PERIOD_MS);
+
+	for(i = 0; i < NUM_TIMERS; i++) {
+		swtimer_stop(&timers[i].timer);
+	}
+
+	elapsed = swtimer_now() - start;
+
+	// No drift: the number of expirations only depends on the period
+	for(i = 0; i < NUM_TIMERS; i++) {
+		swtimer_stats(&timers[i].timer, &fired, &missed);
+		TEST_ASSERT(fired == timers[i].calls);
+
+		expected = elapsed / timers[i].timer.period;
+		TEST_ASSERT(fired + missed + 1 >= expected);
+		TEST_ASSERT(fired + missed <= expected);
+
+		calls += fired;
+	}
+
+	printf("%u expirations, jitter %u usecs max, %u usecs mean\n",
+		calls, (uint32_t)max_late, (uint32_t)(sum_late / calls));
+
+	TEST_ASSERT(sum_late / calls < 2 * portTICK_PERIOD_MS * 1000);
+
+	// Stopped timers don't expire
+	vTaskDelay(100 / portTICK_PERIOD_MS);
+	swtimer_stats(&timers[0].timer, &fired, NULL);
+	TEST_ASSERT(fired == timers[0].calls);
+}
+
+TEST_CASE("swtimer high resolution", "[swtimer]") {
+	struct test_timer *t = &timers[0];
+	uint32_t fired, missed;
+
+	memset(t, 0, sizeof(*t));
+	max_late = sum_late = 0;
+
+	t->expected = swtimer_now() + HIRES_PERIOD;
+	TEST_ASSERT(swtimer_start(&t->timer, HIRES_PERIOD, SWTIMER_HIRES, jitter_callback, t) == 0);
+
+	vTaskDelay((HIRES_PERIOD * HIRES_FIRES / 1000) / portTICK_PERIOD_MS);
+
+	swtimer_stop(&t->timer);
+	swtimer_stats(&t->timer, &fired, &missed);
+
+	printf("%u expirations each %u usecs, %u missed, jitter %u usecs max, %u usecs mean\n",
+		fired, HIRES_PERIOD, missed, (uint32_t)max_late, (uint32_t)(sum_late / fired));
+
+	// Below the tick resolution
+	TEST_ASSERT(fired + missed + 2 >= HIRES_FIRES);
+	TEST_ASSERT(sum_late / fired < portTICK_PERIOD_MS * 1000);
+}
+
+TEST_CASE("swtimer errors", "[swtimer]") {
+	struct test_timer *t = &timers[0];
+
+	memset(t, 0, sizeof(*t));
+
+	TEST_ASSERT(swtimer_start(&t->timer, 0, 0, order_callback, t) == EINVAL);
+	TEST_ASSERT(swtimer_start(&t->timer, 1000, 0, NULL, t) == EINVAL);
+
+	// High resolution, less than a tick
+	TEST_ASSERT(swtimer_start(&t->timer, portTICK_PERIOD_MS * 1000 - 1, SWTIMER_HIRES, order_callback, t) == EINVAL);
+
+	// Already started
+	TEST_ASSERT(swtimer_start(&t->timer, 100000, 0, order_callback, t) == 0);
+	TEST_ASSERT(swtimer_start(&t->timer, 100000, 0, order_callback, t) == EINVAL);
+
+	// Stop is idempotent, and a stopped timer can be started again
+	swtimer_stop(&t->timer);
+	swtimer_stop(&t->timer);
+	TEST_ASSERT(swtimer_start(&t->timer, 100000, 0, order_callback, t) == 0);
+	swtimer_stop(&t->timer);
+
+	TEST_ASSERT(t->calls == 0);
+}